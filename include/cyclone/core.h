@@ -12,11 +12,13 @@
 
 
 #include <math.h>
+#include <cmath>
 
 #ifndef CYCLONE_CORE_H
 #define CYCLONE_CORE_H
 
 #include "precision.h"
+#include "simd.h"
 
 /**
  * The cyclone namespace includes all cyclone functions and
@@ -25,60 +27,110 @@
  */
 namespace cyclone {
 
+    /**
+     * Holds the value for energy under which a particle will be put to
+     * sleep. This is a global value for the whole solution. By
+     * default it is 0.3, which is fine for simulation when gravity is
+     * about 20 units per second squared, masses are about one, and
+     * other forces are around that of gravity. It may need tweaking
+     * if your simulation is drastically different to this.
+     */
+    extern real sleepEpsilon;
+
+    /**
+     * Sets the current sleep epsilon value: the kinetic energy under
+     * which a particle may be put to sleep. Particles are put to sleep
+     * if they appear to have a stable kinetic energy less than this
+     * value.
+     */
+    void setSleepEpsilon(real value);
+
+    /**
+     * Gets the current value of the sleep epsilon parameter.
+     *
+     * @see setSleepEpsilon
+     */
+    real getSleepEpsilon();
+
     /**
      * Holds a vector in 3 dimensions. Four data members are allocated
      * to ensure alignment in an array.
      *
+     * The scalar type is a template parameter, so vectors of floats
+     * and of doubles can be used side by side whatever precision the
+     * rest of the library is built in. Vector3 is the vector of the
+     * library's own real type, and is the one the engine uses. The
+     * particle classes are templates in the same way (see
+     * precision.h).
+     *
      * @note This class contains a lot of inline methods for basic
      * mathematics. The implementations are included in the header
-     * file.
+     * file. When the scalar type has SIMD kernels (see simd.h) the
+     * arithmetic operators work on all four members at once; the pad
+     * member is kept at zero so it never affects a result. The choice
+     * is made at compile time, so the other branch costs nothing.
      */
-    class Vector3
+    template <typename T>
+    class BasicVector3
     {
+        /** The kernels for this scalar type. */
+        typedef simd::Lanes<T> Lanes;
+
     public:
+        /** The type of the components. */
+        typedef T Scalar;
+
          /** Holds the value along the x axis. */
-        real x;
+        T x;
 
         /** Holds the value along the y axis. */
-        real y;
+        T y;
 
         /** Holds the value along the z axis. */
-        real z;
+        T z;
 
     private:
         /** Padding to ensure 4 word alignment. */
-        real pad;
+        T pad;
 
     public:
         /** The default constructor creates a zero vector. */
-        Vector3() : x(0), y(0), z(0) {}
+        BasicVector3() : x(0), y(0), z(0), pad(0) {}
 
         /**
          * The explicit constructor creates a vector with the given
          * components.
          */
-        Vector3(const real x, const real y, const real z)
-            : x(x), y(y), z(z) {}
-
-        const static Vector3 GRAVITY;
-        const static Vector3 HIGH_GRAVITY;
-        const static Vector3 UP;
-        const static Vector3 RIGHT;
-        const static Vector3 OUT_OF_SCREEN;
-        const static Vector3 X;
-        const static Vector3 Y;
-        const static Vector3 Z;
+        BasicVector3(const T x, const T y, const T z)
+            : x(x), y(y), z(z), pad(0) {}
+
+        /**
+         * Creates a vector from one of another precision. This is
+         * explicit so that the precision can't change unnoticed.
+         */
+        template <typename U>
+        explicit BasicVector3(const BasicVector3<U> &other)
+            : x((T)other.x), y((T)other.y), z((T)other.z), pad(0) {}
+
+        const static BasicVector3 GRAVITY;
+        const static BasicVector3 HIGH_GRAVITY;
+        const static BasicVector3 UP;
+        const static BasicVector3 RIGHT;
+        const static BasicVector3 OUT_OF_SCREEN;
+        const static BasicVector3 X;
+        const static BasicVector3 Y;
+        const static BasicVector3 Z;
 
         // ... Other Vector3 code as before ...
 
-        real operator[](unsigned i) const
+        T operator[](unsigned i) const
         {
             if (i == 0) return x;
             if (i == 1) return y;
             return z;
         }
 
-        real& operator[](unsigned i)
+        T& operator[](unsigned i)
         {
             if (i == 0) return x;
             if (i == 1) return y;
@@ -86,87 +138,160 @@ namespace cyclone {
         }
 
         /** Adds the given vector to this. */
-        void operator+=(const Vector3& v)
+        void operator+=(const BasicVector3& v)
         {
-            x += v.x;
-            y += v.y;
-            z += v.z;
+            if (Lanes::enabled)
+            {
+                Lanes::store(&x, Lanes::add(Lanes::load(&x), Lanes::load(&v.x)));
+            }
+            else
+            {
+                x += v.x;
+                y += v.y;
+                z += v.z;
+            }
         }
 
         /**
          * Returns the value of the given vector added to this.
          */
-        Vector3 operator+(const Vector3& v) const
+        BasicVector3 operator+(const BasicVector3& v) const
         {
-            return Vector3(x+v.x, y+v.y, z+v.z);
+            if (Lanes::enabled)
+            {
+                BasicVector3 result;
+                Lanes::store(&result.x, Lanes::add(Lanes::load(&x), Lanes::load(&v.x)));
+                return result;
+            }
+            else
+            {
+                return BasicVector3(x+v.x, y+v.y, z+v.z);
+            }
         }
 
         /** Subtracts the given vector from this. */
-        void operator-=(const Vector3& v)
+        void operator-=(const BasicVector3& v)
         {
-            x -= v.x;
-            y -= v.y;
-            z -= v.z;
+            if (Lanes::enabled)
+            {
+                Lanes::store(&x, Lanes::sub(Lanes::load(&x), Lanes::load(&v.x)));
+            }
+            else
+            {
+                x -= v.x;
+                y -= v.y;
+                z -= v.z;
+            }
         }
 
         /**
          * Returns the value of the given vector subtracted from this.
          */
-        Vector3 operator-(const Vector3& v) const
+        BasicVector3 operator-(const BasicVector3& v) const
         {
-            return Vector3(x-v.x, y-v.y, z-v.z);
+            if (Lanes::enabled)
+            {
+                BasicVector3 result;
+                Lanes::store(&result.x, Lanes::sub(Lanes::load(&x), Lanes::load(&v.x)));
+                return result;
+            }
+            else
+            {
+                return BasicVector3(x-v.x, y-v.y, z-v.z);
+            }
         }
 
         /** Multiplies this vector by the given scalar. */
-        void operator*=(const real value)
+        void operator*=(const T value)
         {
-            x *= value;
-            y *= value;
-            z *= value;
+            if (Lanes::enabled)
+            {
+                Lanes::store(&x, Lanes::mul(Lanes::load(&x), Lanes::splat(value)));
+            }
+            else
+            {
+                x *= value;
+                y *= value;
+                z *= value;
+            }
         }
 
         /** Returns a copy of this vector scaled the given value. */
-        Vector3 operator*(const real value) const
+        BasicVector3 operator*(const T value) const
         {
-            return Vector3(x*value, y*value, z*value);
+            if (Lanes::enabled)
+            {
+                BasicVector3 result;
+                Lanes::store(&result.x, Lanes::mul(Lanes::load(&x), Lanes::splat(value)));
+                return result;
+            }
+            else
+            {
+                return BasicVector3(x*value, y*value, z*value);
+            }
         }
 
         /**
          * Calculates and returns a component-wise product of this
          * vector with the given vector.
          */
-        Vector3 componentProduct(const Vector3 &vector) const
+        BasicVector3 componentProduct(const BasicVector3 &vector) const
         {
-            return Vector3(x * vector.x, y * vector.y, z * vector.z);
+            if (Lanes::enabled)
+            {
+                BasicVector3 result;
+                Lanes::store(&result.x, Lanes::mul(Lanes::load(&x), Lanes::load(&vector.x)));
+                return result;
+            }
+            else
+            {
+                return BasicVector3(x * vector.x, y * vector.y, z * vector.z);
+            }
         }
 
         /**
          * Performs a component-wise product with the given vector and
          * sets this vector to its result.
          */
-        void componentProductUpdate(const Vector3 &vector)
+        void componentProductUpdate(const BasicVector3 &vector)
         {
-            x *= vector.x;
-            y *= vector.y;
-            z *= vector.z;
+            if (Lanes::enabled)
+            {
+                Lanes::store(&x, Lanes::mul(Lanes::load(&x), Lanes::load(&vector.x)));
+            }
+            else
+            {
+                x *= vector.x;
+                y *= vector.y;
+                z *= vector.z;
+            }
         }
 
         /**
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 vectorProduct(const Vector3 &vector) const
+        BasicVector3 vectorProduct(const BasicVector3 &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
-                           z*vector.x-x*vector.z,
-                           x*vector.y-y*vector.x);
+            if (Lanes::cross)
+            {
+                BasicVector3 result;
+                Lanes::store(&result.x, Lanes::cross3(Lanes::load(&x), Lanes::load(&vector.x)));
+                return result;
+            }
+            else
+            {
+                return BasicVector3(y*vector.z-z*vector.y,
+                                    z*vector.x-x*vector.z,
+                                    x*vector.y-y*vector.x);
+            }
         }
 
         /**
          * Updates this vector to be the vector product of its current
          * value and the given vector.
          */
-        void operator %=(const Vector3 &vector)
+        void operator %=(const BasicVector3 &vector)
         {
             *this = vectorProduct(vector);
         }
@@ -175,55 +300,76 @@ namespace cyclone {
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 operator%(const Vector3 &vector) const
+        BasicVector3 operator%(const BasicVector3 &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
-                           z*vector.x-x*vector.z,
-                           x*vector.y-y*vector.x);
+            return vectorProduct(vector);
         }
 
         /**
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real scalarProduct(const Vector3 &vector) const
+        T scalarProduct(const BasicVector3 &vector) const
         {
-            return x*vector.x + y*vector.y + z*vector.z;
+            if (Lanes::enabled)
+            {
+                return Lanes::dot3(Lanes::load(&x), Lanes::load(&vector.x));
+            }
+            else
+            {
+                return x*vector.x + y*vector.y + z*vector.z;
+            }
         }
 
         /**
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real operator *(const Vector3 &vector) const
+        T operator *(const BasicVector3 &vector) const
         {
-            return x*vector.x + y*vector.y + z*vector.z;
+            return scalarProduct(vector);
         }
 
         /**
          * Adds the given vector to this, scaled by the given amount.
          */
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const BasicVector3& vector, T scale)
         {
-            x += vector.x * scale;
-            y += vector.y * scale;
-            z += vector.z * scale;
+            if (Lanes::enabled)
+            {
+                Lanes::store(&x, Lanes::madd(Lanes::load(&x),
+                    Lanes::load(&vector.x), Lanes::splat(scale)));
+            }
+            else
+            {
+                x += vector.x * scale;
+                y += vector.y * scale;
+                z += vector.z * scale;
+            }
         }
 
         /** Gets the magnitude of this vector. */
-        real magnitude() const
+        T magnitude() const
         {
-            return real_sqrt(x*x+y*y+z*z);
+            return std::sqrt(squareMagnitude());
         }
 
         /** Gets the squared magnitude of this vector. */
-        real squareMagnitude() const
+        T squareMagnitude() const
         {
-            return x*x+y*y+z*z;
+            if (Lanes::enabled)
+            {
+                typename Lanes::vec4 v = Lanes::load(&x);
+                return Lanes::dot3(v, v);
+            }
+            else
+            {
+                return x*x+y*y+z*z;
+            }
         }
 
         /** Limits the size of the vector to the given maximum. */
-        void trim(real size)
+        void trim(T size)
         {
             if (squareMagnitude() > size*size)
             {
@@ -237,23 +383,23 @@ namespace cyclone {
         /** Turns a non-zero vector into a vector of unit length. */
         void normalise()
         {
-            real l = magnitude();
+            T l = magnitude();
             if (l > 0)
             {
-                (*this) *= ((real)1)/l;
+                (*this) *= ((T)1)/l;
             }
         }
 
         /** Returns the normalised version of a vector. */
-        Vector3 unit() const
+        BasicVector3 unit() const
         {
-            Vector3 result = *this;
+            BasicVector3 result = *this;
             result.normalise();
             return result;
         }
 
         /** Checks if the two vectors have identical components. */
-        bool operator==(const Vector3& other) const
+        bool operator==(const BasicVector3& other) const
         {
             return  x == other.x &&
                     y == other.y &&
@@ -261,7 +407,7 @@ namespace cyclone {
         }
 
         /** Checks if the two vectors have non-identical components. */
-        bool operator!=(const Vector3& other) const
+        bool operator!=(const BasicVector3& other) const
         {
             return !(*this == other);
         }
@@ -273,7 +419,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator<(const Vector3& other) const
+        bool operator<(const BasicVector3& other) const
         {
             return x < other.x && y < other.y && z < other.z;
         }
@@ -285,7 +431,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator>(const Vector3& other) const
+        bool operator>(const BasicVector3& other) const
         {
             return x > other.x && y > other.y && z > other.z;
         }
@@ -297,7 +443,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator<=(const Vector3& other) const
+        bool operator<=(const BasicVector3& other) const
         {
             return x <= other.x && y <= other.y && z <= other.z;
         }
@@ -309,7 +455,7 @@ namespace cyclone {
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator>=(const Vector3& other) const
+        bool operator>=(const BasicVector3& other) const
         {
             return x >= other.x && y >= other.y && z >= other.z;
         }
@@ -328,6 +474,36 @@ namespace cyclone {
             z = -z;
         }
     };
+
+    // The constant vectors are defined in core.cpp for the float and
+    // double vectors; these declare that they exist.
+    template <> const BasicVector3<float> BasicVector3<float>::GRAVITY;
+    template <> const BasicVector3<float> BasicVector3<float>::HIGH_GRAVITY;
+    template <> const BasicVector3<float> BasicVector3<float>::UP;
+    template <> const BasicVector3<float> BasicVector3<float>::RIGHT;
+    template <> const BasicVector3<float> BasicVector3<float>::OUT_OF_SCREEN;
+    template <> const BasicVector3<float> BasicVector3<float>::X;
+    template <> const BasicVector3<float> BasicVector3<float>::Y;
+    template <> const BasicVector3<float> BasicVector3<float>::Z;
+
+    template <> const BasicVector3<double> BasicVector3<double>::GRAVITY;
+    template <> const BasicVector3<double> BasicVector3<double>::HIGH_GRAVITY;
+    template <> const BasicVector3<double> BasicVector3<double>::UP;
+    template <> const BasicVector3<double> BasicVector3<double>::RIGHT;
+    template <> const BasicVector3<double> BasicVector3<double>::OUT_OF_SCREEN;
+    template <> const BasicVector3<double> BasicVector3<double>::X;
+    template <> const BasicVector3<double> BasicVector3<double>::Y;
+    template <> const BasicVector3<double> BasicVector3<double>::Z;
+
+    /**
+     * The vector of the library's own real type. Particles, force
+     * generators and contacts all use this.
+     */
+    typedef BasicVector3<real> Vector3;
+
+    /** Vectors of a fixed precision. */
+    typedef BasicVector3<float> Vector3f;
+    typedef BasicVector3<double> Vector3d;
 }
 
 #endif // CYCLONE_CORE_H
@@ -12,12 +12,32 @@
 #include "precision.h"
 #include "core.h"
 #include "particle.h"
+#include "pstore.h"
+#include "jobs.h"
+#include "plinks.h"
+#include "pworld.h"
 #include "pfgen.h"
 #include "pcontacts.h"
+#include "pcollide.h"
+#include "pgravity.h"
+#include "pimplicit.h"
+#include "plinksolver.h"
+#include "pislands.h"
+#include "pcache.h"
+#include "pool.h"
+#include "profile.h"
+#include "psnapshot.h"
+#include "ptrajectory.h"
+#include "pworldthread.h"
+#include "pregion.h"
+#include "pemitter.h"
+#include "pmultirate.h"
+#include "pintegrator.h"
+#include "preorder.h"
+#include "pforcestack.h"
 
-// #include "random.h"
+#include "random.h"
 // #include "body.h"
-// #include "pworld.h"
 // #include "collide_fine.h"
 // #include "contacts.h"
 // #include "fgen.h"
@@ -0,0 +1,251 @@
+/*
+ * Interface file for the job system.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a small work-stealing task scheduler, used to
+ * split the engine's per-particle loops across several cores.
+ */
+#ifndef CYCLONE_JOBS_H
+#define CYCLONE_JOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cyclone {
+
+    /**
+     * The job system runs ranges of a loop on a pool of worker
+     * threads. Work is handed out as jobs, each covering part of the
+     * index range. Every thread has its own queue of jobs, and a
+     * thread that runs out of work steals from the others, so an
+     * uneven split still keeps every core busy.
+     *
+     * The thread that calls parallelFor takes part in the work and
+     * returns once every job it created has finished. A job system
+     * with one worker runs everything on the calling thread and
+     * starts no threads at all.
+     *
+     * Normally the jobs a loop is split into depend on the number of
+     * workers. A deterministic job system splits each loop into the
+     * same jobs whatever the number of workers, so a loop whose jobs
+     * each work out something for their own range (a partial sum, for
+     * example) gets the same answer from any job system.
+     */
+    class JobSystem
+    {
+    public:
+
+        /**
+         * The signature of a job. The function is called with the
+         * data pointer given to parallelFor and a half open range of
+         * indices to process.
+         */
+        typedef void (*JobFunction)(void* data, unsigned begin, unsigned end);
+
+    protected:
+
+        /**
+         * Holds one range of work waiting to be run.
+         */
+        struct Job
+        {
+            JobFunction function;
+            void* data;
+            unsigned begin;
+            unsigned end;
+            std::atomic<unsigned>* pending;
+        };
+
+        /**
+         * The number of jobs each queue can hold. If a queue is full
+         * the job is run straight away by the thread creating it.
+         */
+        static const unsigned queueCapacity = 1024;
+
+        /**
+         * Holds the jobs waiting for one thread. The owning thread
+         * takes jobs from the bottom; other threads steal from the
+         * top.
+         */
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            Job jobs[queueCapacity];
+            unsigned top;
+            unsigned bottom;
+
+            WorkQueue() : top(0), bottom(0) {}
+        };
+
+        /**
+         * Holds the number of threads that run jobs, including the
+         * thread calling parallelFor.
+         */
+        unsigned workerCount;
+
+        /**
+         * Holds one queue per worker. Queue zero belongs to the
+         * thread calling parallelFor.
+         */
+        std::vector<WorkQueue*> queues;
+
+        /**
+         * Holds the worker threads.
+         */
+        std::vector<std::thread> threads;
+
+        /**
+         * Holds the number of jobs sitting in any queue.
+         */
+        std::atomic<unsigned> queuedJobs;
+
+        /**
+         * Used to put idle workers to sleep until there is work.
+         */
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+
+        /**
+         * Set when the job system is being destroyed.
+         */
+        bool stopping;
+
+        /**
+         * True if loops are split into the same jobs whatever the
+         * number of workers.
+         */
+        bool deterministic;
+
+        /**
+         * Adds a job to the given queue, returning false if there was
+         * no room.
+         */
+        bool push(unsigned queue, const Job &job);
+
+        /**
+         * Takes a job from the bottom of the given queue.
+         */
+        bool pop(unsigned queue, Job *job);
+
+        /**
+         * Takes a job from the top of the given queue.
+         */
+        bool steal(unsigned queue, Job *job);
+
+        /**
+         * Finds a job for the given thread, looking first in its own
+         * queue and then in everyone else's.
+         */
+        bool findJob(unsigned queue, Job *job);
+
+        /**
+         * Runs a job and marks it as finished.
+         */
+        static void run(const Job &job);
+
+        /**
+         * The main loop of each worker thread.
+         */
+        void workerMain(unsigned queue);
+
+        /**
+         * Returns the queue belonging to the calling thread.
+         */
+        unsigned currentQueue() const;
+
+        /**
+         * Adapts a callable object to the job function signature.
+         */
+        template <class Body>
+        static void invokeBody(void* data, unsigned begin, unsigned end)
+        {
+            (*static_cast<Body*>(data))(begin, end);
+        }
+
+    public:
+
+        /**
+         * Creates a job system with the given number of workers,
+         * counting the calling thread. Zero uses one worker per
+         * hardware thread.
+         */
+        JobSystem(unsigned workerCount = 0);
+
+        /**
+         * Stops and joins the worker threads.
+         */
+        ~JobSystem();
+
+        /**
+         * Returns the number of threads that run jobs, including the
+         * calling thread.
+         */
+        unsigned getWorkerCount() const;
+
+        /**
+         * Returns the index of the worker running the calling code,
+         * from zero to getWorkerCount() - 1. Threads that are not
+         * part of this job system report zero. This can be used to
+         * give each worker its own scratch space.
+         */
+        unsigned getCurrentWorker() const;
+
+        /**
+         * Sets whether loops are split into the same jobs whatever
+         * the number of workers. Which worker runs each job still
+         * varies, so it only makes results reproducible if they don't
+         * depend on that. It is off by default.
+         */
+        void setDeterministic(bool deterministic);
+
+        /**
+         * Returns true if loops are split into the same jobs whatever
+         * the number of workers.
+         */
+        bool isDeterministic() const;
+
+        /**
+         * Calls the given function over the range [0, count), split
+         * into jobs of at most grainSize indices, and waits for them
+         * all to finish. A grain size of zero picks one that gives
+         * each worker a few jobs or, if the job system is
+         * deterministic, one that splits every loop into the same
+         * number of jobs.
+         *
+         * Jobs for different parts of the range can run at the same
+         * time, so the function must be safe to call concurrently on
+         * disjoint ranges.
+         */
+        void parallelFor(unsigned count, unsigned grainSize, JobFunction function, void* data);
+
+        /**
+         * Calls body(begin, end) over the range [0, count), as the
+         * function pointer version does.
+         */
+        template <class Body>
+        void parallelFor(unsigned count, unsigned grainSize, Body &body)
+        {
+            parallelFor(count, grainSize, &JobSystem::invokeBody<Body>, &body);
+        }
+
+    private:
+        JobSystem(const JobSystem&);
+        JobSystem& operator=(const JobSystem&);
+    };
+}
+
+#endif // CYCLONE_JOBS_H
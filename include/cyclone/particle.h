@@ -20,10 +20,94 @@
 #ifndef CYCLONE_PARTICLE_H
 #define CYCLONE_PARTICLE_H
 
+#include <assert.h>
+#include <limits>
 #include "core.h"
 
 namespace cyclone {
 
+    class JobSystem;
+
+    /**
+     * Remembers the drag factor, damping raised to the power of the
+     * step duration, for the last few damping values seen. Most
+     * scenes use only a handful of damping values and a fixed step,
+     * so the factor can almost always be looked up rather than
+     * calling real_pow for each particle on each step.
+     *
+     * A cache isn't safe to share between threads; give each thread
+     * (or each job) its own.
+     */
+    template <typename T>
+    class BasicDampingCache
+    {
+    public:
+        /**
+         * Holds the number of damping values remembered.
+         */
+        enum { CacheSize = 8 };
+
+    protected:
+        /**
+         * Holds the duration the cached factors were worked out for.
+         */
+        T duration;
+
+        /**
+         * Holds the cached damping values and their factors.
+         */
+        T damping[CacheSize];
+        T factor[CacheSize];
+
+        /**
+         * Holds the number of entries in use.
+         */
+        unsigned used;
+
+        /**
+         * Holds the entry to replace next, once the cache is full.
+         */
+        unsigned next;
+
+        /**
+         * Works out and remembers the factor for a damping value that
+         * isn't in the cache.
+         */
+        T addFactor(T damping, T duration);
+
+    public:
+        /**
+         * Creates an empty cache.
+         */
+        BasicDampingCache();
+
+        /**
+         * Forgets every cached factor.
+         */
+        void clear();
+
+        /**
+         * Returns real_pow(damping, duration), from the cache if
+         * possible.
+         */
+        T getFactor(T damping, T duration)
+        {
+            if (duration == BasicDampingCache::duration)
+            {
+                for (unsigned i = 0; i < used; i++)
+                {
+                    if (BasicDampingCache::damping[i] == damping) return factor[i];
+                }
+            }
+            return addFactor(damping, duration);
+        }
+    };
+
+    /**
+     * The damping cache of the library's own real type.
+     */
+    typedef BasicDampingCache<real> DampingCache;
+
     /**
      * A particle is the simplest object that can be simulated in the
      * physics system.
@@ -32,8 +116,15 @@ namespace cyclone {
      * velocity. It can be integrated forward through time, and have
      * linear forces, and impulses applied to it. The particle manages
      * its state and allows access through a set of methods.
+     *
+     * The scalar type is a template parameter, as it is for vectors,
+     * so particles of floats and of doubles can be simulated side by
+     * side, each with the force generators and contacts of its own
+     * precision. The world and the tools built on it use Particle,
+     * the particle of the library's own real type.
      */
-    class Particle
+    template <typename T>
+    class BasicParticle
     {
 
     protected:
@@ -46,42 +137,81 @@ namespace cyclone {
          * infinite mass (immovable) than zero mass
          * (completely unstable in numerical simulation).
          */
-        real inverseMass;
+        T inverseMass;
 
         /**
          * Holds the amount of damping applied to linear
          * motion. Damping is required to remove energy added
          * through numerical instability in the integrator.
          */
-        real damping;
+        T damping;
 
         /**
          * Holds the linear position of the particle in
          * world space.
          */
-        Vector3 position;
+        BasicVector3<T> position;
 
         /**
          * Holds the linear velocity of the particle in
          * world space.
          */
-        Vector3 velocity;
+        BasicVector3<T> velocity;
 
         /**
          * Holds the acceleration of the particle.  This value
          * can be used to set acceleration due to gravity (its primary
          * use), or any other constant acceleration.
          */
-        Vector3 acceleration;
+        BasicVector3<T> acceleration;
 
         /**
          * Holds the accumulated force to be applied at the next
          * simulation iteration only. This value is zeroed at each
          * integration step.
          */
-        Vector3 forceAccum;
+        BasicVector3<T> forceAccum;
+
+        /**
+         * Holds the amount of motion of the particle. This is a
+         * recency weighted mean of the square of its speed, used to
+         * decide when it can be put to sleep.
+         */
+        T motion;
+
+        /**
+         * A particle can be put to sleep to avoid it being updated by
+         * the integration functions, the force registry or the
+         * contact generators.
+         */
+        bool isAwake;
+
+        /**
+         * Some particles may never be allowed to fall asleep. Particles
+         * are created unable to sleep, so a scene behaves as it always
+         * has until sleeping is asked for.
+         */
+        bool canSleep;
+
+        /**
+         * Updates the motion average from the current velocity, and
+         * puts the particle to sleep if it has been still for long
+         * enough. The bias is the weight the old average keeps.
+         */
+        void updateMotion(T bias);
+
+        friend class ParticleSnapshot;
+        friend struct TrajectoryView;
+        friend struct VelocityVerlet;
+        friend struct RungeKutta4;
 
     public:
+
+        /**
+         * Creates an awake particle with unit mass and no damping,
+         * at rest at the origin.
+         */
+        BasicParticle();
         
 
         /**
@@ -90,7 +220,14 @@ namespace cyclone {
          * linear approximation to the correct integral. For this reason it
          * may be inaccurate in some cases.
          */
-        void integrate(real duration);
+        void integrate(T duration);
+
+        /**
+         * Integrates the particle forward in time as above, taking
+         * the drag factor from the given cache. The version without a
+         * cache calls this with an empty one.
+         */
+        void integrate(T duration, BasicDampingCache<T> &cache);
 
         /**
          * Sets the mass of the particle.
@@ -104,14 +241,14 @@ namespace cyclone {
          * function should be called before trying to get any settings
          * from the particle.
          */
-        void setMass(const real mass);
+        void setMass(const T mass);
 
         /**
          * Gets the mass of the particle.
          *
          * @return The current mass of the particle.
          */
-        real getMass() const;
+        T getMass() const;
 
         /**
          * Sets the inverse mass of the particle.
@@ -125,14 +262,14 @@ namespace cyclone {
          * function should be called before trying to get any settings
          * from the particle.
          */
-        void setInverseMass(const real inverseMass);
+        void setInverseMass(const T inverseMass);
 
         /**
          * Gets the inverse mass of the particle.
          *
          * @return The current inverse mass of the particle.
          */
-        real getInverseMass() const;
+        T getInverseMass() const;
 
         /**
          * Returns true if the mass of the particle is not-infinite.
@@ -142,19 +279,19 @@ namespace cyclone {
         /**
          * Sets both the damping of the particle.
          */
-        void setDamping(const real damping);
+        void setDamping(const T damping);
 
         /**
          * Gets the current damping value.
          */
-        real getDamping() const;
+        T getDamping() const;
 
         /**
          * Sets the position of the particle.
          *
          * @param position The new position of the particle.
          */
-        void setPosition(const Vector3 &position);
+        void setPosition(const BasicVector3<T> &position);
 
         /**
          * Sets the position of the particle by component.
@@ -168,7 +305,7 @@ namespace cyclone {
          * @param z The z coordinate of the new position of the rigid
          * body.
          */
-        void setPosition(const real x, const real y, const real z);
+        void setPosition(const T x, const T y, const T z);
 
         /**
          * Fills the given vector with the position of the particle.
@@ -176,21 +313,21 @@ namespace cyclone {
          * @param position A pointer to a vector into which to write
          * the position.
          */
-        void getPosition(Vector3 *position) const;
+        void getPosition(BasicVector3<T> *position) const;
 
         /**
          * Gets the position of the particle.
          *
          * @return The position of the particle.
          */
-        Vector3 getPosition() const;
+        BasicVector3<T> getPosition() const;
 
         /**
          * Sets the velocity of the particle.
          *
          * @param velocity The new velocity of the particle.
          */
-        void setVelocity(const Vector3 &velocity);
+        void setVelocity(const BasicVector3<T> &velocity);
 
         /**
          * Sets the velocity of the particle by component.
@@ -204,7 +341,7 @@ namespace cyclone {
          * @param z The z coordinate of the new velocity of the rigid
          * body.
          */
-        void setVelocity(const real x, const real y, const real z);
+        void setVelocity(const T x, const T y, const T z);
 
         /**
          * Fills the given vector with the velocity of the particle.
@@ -212,7 +349,7 @@ namespace cyclone {
          * @param velocity A pointer to a vector into which to write
          * the velocity. The velocity is given in world local space.
          */
-        void getVelocity(Vector3 *velocity) const;
+        void getVelocity(BasicVector3<T> *velocity) const;
 
         /**
          * Gets the velocity of the particle.
@@ -220,14 +357,14 @@ namespace cyclone {
          * @return The velocity of the particle. The velocity is
          * given in world local space.
          */
-        Vector3 getVelocity() const;
+        BasicVector3<T> getVelocity() const;
 
         /**
          * Sets the constant acceleration of the particle.
          *
          * @param acceleration The new acceleration of the particle.
          */
-        void setAcceleration(const Vector3 &acceleration);
+        void setAcceleration(const BasicVector3<T> &acceleration);
 
         /**
          * Sets the constant acceleration of the particle by component.
@@ -241,7 +378,7 @@ namespace cyclone {
          * @param z The z coordinate of the new acceleration of the rigid
          * body.
          */
-        void setAcceleration(const real x, const real y, const real z);
+        void setAcceleration(const T x, const T y, const T z);
 
         /**
          * Fills the given vector with the acceleration of the particle.
@@ -249,7 +386,7 @@ namespace cyclone {
          * @param acceleration A pointer to a vector into which to write
          * the acceleration. The acceleration is given in world local space.
          */
-        void getAcceleration(Vector3 *acceleration) const;
+        void getAcceleration(BasicVector3<T> *acceleration) const;
 
         /**
          * Gets the acceleration of the particle.
@@ -257,20 +394,252 @@ namespace cyclone {
          * @return The acceleration of the particle. The acceleration is
          * given in world local space.
          */
-        Vector3 getAcceleration() const;
+        BasicVector3<T> getAcceleration() const;
 
         /**
          * Adds the given force to the particle to be applied at the
          * next iteration only.
          */
-        void addForce(const Vector3 &force);
+        void addForce(const BasicVector3<T> &force);
+
+        /**
+         * Gets the force accumulated for the next integration step.
+         * Integrators other than Particle::integrate use this.
+         */
+        BasicVector3<T> getForceAccumulator() const;
 
         /**
          * Clears the forces applied to the particle. This will be
          * called automatically after each integration step.
          */
         void clearAccumulator();
+
+        /**
+         * Returns true if the particle is awake and responding to
+         * integration.
+         *
+         * @return The awake state of the particle.
+         */
+        bool getAwake() const;
+
+        /**
+         * Sets the awake state of the particle. If the particle is put
+         * to sleep, it will not be integrated, have forces applied to
+         * it, or generate contacts with other sleeping particles. Its
+         * velocity is zeroed. A sleeping particle is woken by a
+         * contact with a moving particle, or by having a force added
+         * to it.
+         *
+         * @param awake The new awake state of the particle.
+         */
+        void setAwake(const bool awake=true);
+
+        /**
+         * Returns true if the particle is allowed to go to sleep at
+         * any time.
+         */
+        bool getCanSleep() const;
+
+        /**
+         * Sets whether the particle is ever allowed to go to sleep.
+         * Particles that are not allowed to sleep are woken.
+         *
+         * @param canSleep Whether the particle can now be put to
+         * sleep.
+         */
+        void setCanSleep(const bool canSleep=true);
+
+        /**
+         * Gets the recency weighted mean of the square of the
+         * particle's speed, which is compared against sleepEpsilon.
+         */
+        T getMotion() const;
     };
+
+    /**
+     * The particle of the library's own real type, which the rest of
+     * the engine uses, and particles of each precision.
+     */
+    typedef BasicParticle<real> Particle;
+    typedef BasicParticle<float> Particlef;
+    typedef BasicParticle<double> Particled;
+
+    /**
+     * Integrates each of the particles in the given array forward in
+     * time by the given amount. If a job system is given, the array
+     * is split between its workers. Drag factors are cached for
+     * each run of particles, so real_pow is only called once for
+     * each distinct damping value in the run.
+     */
+    void integrateParticles(Particlef* particles, unsigned count, float duration,
+        JobSystem* jobs = 0);
+    void integrateParticles(Particled* particles, unsigned count, double duration,
+        JobSystem* jobs = 0);
+
+    // The accessors are used in the inner loops of the force
+    // generators, so they are defined inline.
+
+    template <typename T>
+    inline void BasicParticle<T>::setMass(const T mass)
+    {
+        assert(mass != 0);
+        BasicParticle::inverseMass = ((T)1.0)/mass;
+    }
+
+    template <typename T>
+    inline T BasicParticle<T>::getMass() const
+    {
+        if (inverseMass == 0) {
+            return std::numeric_limits<T>::max();
+        } else {
+            return ((T)1.0)/inverseMass;
+        }
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setInverseMass(const T inverseMass)
+    {
+        BasicParticle::inverseMass = inverseMass;
+    }
+
+    template <typename T>
+    inline T BasicParticle<T>::getInverseMass() const
+    {
+        return inverseMass;
+    }
+
+    template <typename T>
+    inline bool BasicParticle<T>::hasFiniteMass() const
+    {
+        return inverseMass > 0.0f;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setDamping(const T damping)
+    {
+        BasicParticle::damping = damping;
+    }
+
+    template <typename T>
+    inline T BasicParticle<T>::getDamping() const
+    {
+        return damping;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setPosition(const BasicVector3<T> &position)
+    {
+        BasicParticle::position = position;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setPosition(const T x, const T y, const T z)
+    {
+        position.x = x;
+        position.y = y;
+        position.z = z;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::getPosition(BasicVector3<T> *position) const
+    {
+        *position = BasicParticle::position;
+    }
+
+    template <typename T>
+    inline BasicVector3<T> BasicParticle<T>::getPosition() const
+    {
+        return position;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setVelocity(const BasicVector3<T> &velocity)
+    {
+        BasicParticle::velocity = velocity;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setVelocity(const T x, const T y, const T z)
+    {
+        velocity.x = x;
+        velocity.y = y;
+        velocity.z = z;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::getVelocity(BasicVector3<T> *velocity) const
+    {
+        *velocity = BasicParticle::velocity;
+    }
+
+    template <typename T>
+    inline BasicVector3<T> BasicParticle<T>::getVelocity() const
+    {
+        return velocity;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setAcceleration(const BasicVector3<T> &acceleration)
+    {
+        BasicParticle::acceleration = acceleration;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::setAcceleration(const T x, const T y, const T z)
+    {
+        acceleration.x = x;
+        acceleration.y = y;
+        acceleration.z = z;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::getAcceleration(BasicVector3<T> *acceleration) const
+    {
+        *acceleration = BasicParticle::acceleration;
+    }
+
+    template <typename T>
+    inline BasicVector3<T> BasicParticle<T>::getAcceleration() const
+    {
+        return acceleration;
+    }
+
+    template <typename T>
+    inline BasicVector3<T> BasicParticle<T>::getForceAccumulator() const
+    {
+        return forceAccum;
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::addForce(const BasicVector3<T> &force)
+    {
+        forceAccum += force;
+        if (!isAwake) setAwake();
+    }
+
+    template <typename T>
+    inline void BasicParticle<T>::clearAccumulator()
+    {
+        forceAccum.clear();
+    }
+
+    template <typename T>
+    inline bool BasicParticle<T>::getAwake() const
+    {
+        return isAwake;
+    }
+
+    template <typename T>
+    inline bool BasicParticle<T>::getCanSleep() const
+    {
+        return canSleep;
+    }
+
+    template <typename T>
+    inline T BasicParticle<T>::getMotion() const
+    {
+        return motion;
+    }
 }
 
 #endif // CYCLONE_BODY_H
\ No newline at end of file
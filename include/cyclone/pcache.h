@@ -0,0 +1,128 @@
+/*
+ * Interface file for the particle contact cache.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a cache that carries contact impulses from one
+ * step to the next, so the resolver can start from last step's answer.
+ */
+#ifndef CYCLONE_PCACHE_H
+#define CYCLONE_PCACHE_H
+
+#include <vector>
+#include "pcontacts.h"
+
+namespace cyclone {
+
+    /**
+     * Remembers the impulse applied at each contact, keyed on the
+     * contact's particles and the generator that produced it.
+     *
+     * Before the contacts of a step are resolved, warmStart looks
+     * each one up. A contact that existed in the last step has a
+     * proportion of last step's impulse applied straight away. For
+     * a resting contact that is most of the answer, so the resolver
+     * has far less to do. After resolution, store records the
+     * impulses for the next step.
+     *
+     * Only the impulse is carried over. Penetration is measured
+     * afresh by the generators each step, so reapplying last step's
+     * movement would correct the same overlap twice.
+     */
+    class ParticleContactCache
+    {
+    protected:
+
+        /**
+         * Holds the remembered impulse of one contact.
+         */
+        struct Entry
+        {
+            Particle* particle[2];
+            const ParticleContactGenerator* source;
+            real impulse;
+        };
+
+        /**
+         * Orders entries on their keys.
+         */
+        static bool entryLess(const Entry &a, const Entry &b);
+
+        /**
+         * Holds the entries from the last call to store, sorted.
+         */
+        std::vector<Entry> entries;
+
+        /**
+         * Holds the proportion of the remembered impulse applied.
+         */
+        real warmStartFactor;
+
+        /**
+         * Holds the number of contacts matched by the last warmStart.
+         */
+        unsigned matched;
+
+        friend class ParticleSnapshot;
+
+    public:
+
+        /**
+         * Creates an empty cache that applies the given proportion
+         * of each remembered impulse.
+         */
+        ParticleContactCache(real warmStartFactor = 0.8f);
+
+        /**
+         * Sets the proportion of each remembered impulse applied.
+         */
+        void setWarmStartFactor(real warmStartFactor);
+
+        /**
+         * Applies the remembered impulse to each contact found in the
+         * cache and sets its accumulated impulse to match. Other
+         * contacts have their accumulated impulse set to zero.
+         */
+        void warmStart(ParticleContact* contacts, unsigned numContacts);
+
+        /**
+         * Remembers the accumulated impulse of each contact for the
+         * next step, forgetting everything else.
+         */
+        void store(const ParticleContact* contacts, unsigned numContacts);
+
+        /**
+         * Forgets every remembered impulse.
+         */
+        void clear();
+
+        /**
+         * Updates the remembered contacts after the given remap has
+         * moved their particles, so they still match next step.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Returns the number of contacts the last warmStart found in
+         * the cache.
+         */
+        unsigned getMatchedCount() const;
+
+        /**
+         * Returns the number of contacts remembered.
+         */
+        unsigned size() const;
+    };
+}
+
+#endif // CYCLONE_PCACHE_H
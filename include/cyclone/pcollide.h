@@ -0,0 +1,395 @@
+/*
+ * Interface file for particle-particle collision detection.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a uniform spatial hash for particles, and a
+ * contact generator that uses it to find colliding particles without
+ * testing every pair.
+ */
+#ifndef CYCLONE_PCOLLIDE_H
+#define CYCLONE_PCOLLIDE_H
+
+#include <vector>
+#include "pcontacts.h"
+
+namespace cyclone {
+
+    class JobSystem;
+
+    /**
+     * A spatial hash divides space into a uniform grid of cubic
+     * cells and sorts particles by the cell they are in. Only the
+     * occupied cells cost anything, so the grid is unbounded. Cells
+     * are mapped onto a fixed number of buckets with a hash function,
+     * so distant cells may share a bucket: callers must still check
+     * the actual positions of the particles they get back.
+     */
+    class ParticleSpatialHash
+    {
+    protected:
+
+        /**
+         * Holds the length of the side of each cell.
+         */
+        real cellSize;
+
+        /**
+         * Holds the number of buckets, which is always a power of two.
+         */
+        unsigned bucketCount;
+
+        /**
+         * Holds the particles in the hash, as given to build.
+         */
+        Particle* const* particles;
+
+        /**
+         * Holds the number of particles in the hash.
+         */
+        unsigned particleCount;
+
+        /**
+         * Holds the bucket each particle is in.
+         */
+        std::vector<unsigned> particleBucket;
+
+        /**
+         * Holds the index of each particle, sorted by bucket.
+         */
+        std::vector<unsigned> sortedParticles;
+
+        /**
+         * Holds the position in sortedParticles where each bucket's
+         * particles start. There is one extra entry at the end.
+         */
+        std::vector<unsigned> bucketStart;
+
+        /**
+         * Holds the buckets a query visits. It is scratch space for
+         * query, which is const, so it is mutable.
+         */
+        mutable std::vector<unsigned> queryBuckets;
+
+    public:
+
+        /**
+         * Creates an empty hash with the given cell size.
+         */
+        ParticleSpatialHash(real cellSize = 1);
+
+        /**
+         * Sets the length of the side of each cell. For collision
+         * detection this is usually the diameter of the particles.
+         * The change takes effect at the next build.
+         */
+        void setCellSize(real cellSize);
+
+        /**
+         * Gets the length of the side of each cell.
+         */
+        real getCellSize() const;
+
+        /**
+         * Sorts the given particles into the hash. The array must stay
+         * valid until the hash is rebuilt. The bucket table grows to
+         * keep at least two buckets per particle, and keeps its size
+         * after that, so rebuilding a hash of a steady number of
+         * particles allocates nothing.
+         */
+        void build(Particle* const* particles, unsigned count);
+
+        /**
+         * Gets the grid cell that the given position falls in.
+         */
+        void getCell(const Vector3 &position, int *cell) const;
+
+        /**
+         * Gets the bucket the given grid cell maps to.
+         */
+        unsigned getBucket(int x, int y, int z) const;
+
+        /**
+         * Gets the number of buckets.
+         */
+        unsigned getBucketCount() const;
+
+        /**
+         * Gets the range of positions in the sorted particle list
+         * holding the particles in the given bucket.
+         */
+        unsigned getBucketBegin(unsigned bucket) const;
+        unsigned getBucketEnd(unsigned bucket) const;
+
+        /**
+         * Gets the index (into the array given to build) of the
+         * particle at the given position in the sorted list.
+         */
+        unsigned getSortedParticle(unsigned position) const;
+
+        /**
+         * Gets the particle with the given index.
+         */
+        Particle* getParticle(unsigned index) const;
+
+        /**
+         * Gets the number of particles in the hash.
+         */
+        unsigned getParticleCount() const;
+
+        /**
+         * Adds the index of every particle whose position is inside
+         * the given box to the given list, and returns the number
+         * added. Only the buckets of the cells the box covers are
+         * searched, each once, so the cost follows the size of the
+         * box rather than the number of particles in the hash.
+         */
+        unsigned query(const Vector3 &min, const Vector3 &max,
+            std::vector<unsigned> &found) const;
+    };
+
+    /**
+     * Generates contacts between particles that overlap, treating
+     * each particle as a sphere of the same radius. A spatial hash
+     * with cells one particle diameter across is rebuilt each time
+     * contacts are requested, so only particles in neighbouring cells
+     * are tested against one another. The neighbours of particles
+     * that are asleep or immovable aren't searched, and no contact is
+     * generated between two such particles.
+     *
+     * A particle moving further in one step than its own diameter can
+     * pass straight through another without the two ever being seen
+     * to overlap. With continuous collision on, the generator records
+     * where its particles start each step, and sweeps each particle
+     * that moves further than the sweep threshold along its path,
+     * against the paths of the particles near it. A pair that met
+     * during the step gets a contact with the time they met and the
+     * normal at that moment, whether or not they still overlap, so
+     * resolving it puts the fast particle back on the side it hit
+     * rather than pushing it out of whichever side it ended nearest.
+     * Only the fast particles pay for the sweep.
+     *
+     * Given a job system, the generator splits its particles into
+     * ranges and finds each range's contacts on a different worker,
+     * into a buffer of its own. The buffers are copied out in the
+     * order of the ranges, so the contacts are exactly those found
+     * without the job system, in the same order.
+     */
+    class ParticleCollisionGenerator : public ParticleContactGenerator
+    {
+    protected:
+
+        /**
+         * Holds the particles that can collide with one another.
+         */
+        std::vector<Particle*> particles;
+
+        /**
+         * Holds the radius of every particle.
+         */
+        real radius;
+
+        /**
+         * Holds the restitution of the generated contacts.
+         */
+        real restitution;
+
+        /**
+         * Holds the spatial hash. It is rebuilt in addContact, which
+         * is const, so it is mutable.
+         */
+        mutable ParticleSpatialHash hash;
+
+        /**
+         * True if fast particles are swept along their paths.
+         */
+        bool continuous;
+
+        /**
+         * Holds the distance a particle must move in a step to be
+         * swept.
+         */
+        real sweepThreshold;
+
+        /**
+         * Holds where each particle started the step, recorded by
+         * beginStep when collision is continuous.
+         */
+        std::vector<Vector3> startPositions;
+
+        /**
+         * Holds the particles found near a swept particle's path, and
+         * which particles are being swept.
+         */
+        mutable std::vector<unsigned> sweepFound;
+        mutable std::vector<unsigned char> sweeping;
+
+        /**
+         * Holds the number of particles swept in the last call to
+         * addContact.
+         */
+        mutable unsigned swept;
+
+        /**
+         * Holds the job system used to find contacts, or NULL.
+         */
+        JobSystem* jobs;
+
+        /**
+         * Holds each range's contacts, and how many it found, when
+         * contacts are found in parallel.
+         */
+        mutable std::vector<std::vector<ParticleContact> > rangeContacts;
+        mutable std::vector<unsigned> rangeUsed;
+
+        /**
+         * Writes the contacts found from the side of the particle with
+         * the given index, up to the limit, and returns the number
+         * written. Particles being swept have none.
+         */
+        unsigned addParticleContacts(unsigned i, bool sweep,
+            ParticleContact* contact, unsigned limit) const;
+
+        /**
+         * The job function that finds the contacts of ranges of the
+         * particles.
+         */
+        static void rangeJob(void* data, unsigned begin, unsigned end);
+
+        /**
+         * Writes the contacts between the fast particle with the given
+         * index and the particles it passed through, up to the limit,
+         * and returns the number written.
+         */
+        unsigned addSweptContacts(unsigned i, ParticleContact* contact, unsigned limit) const;
+
+    public:
+
+        /**
+         * Creates a generator for particles of the given radius. The
+         * cell size of the spatial hash is set to the particle
+         * diameter.
+         */
+        ParticleCollisionGenerator(real radius = 0.5f, real restitution = 0.5f);
+
+        /**
+         * Adds a particle to the set that can collide.
+         */
+        void addParticle(Particle* particle);
+
+        /**
+         * Adds each particle in the given array to the set that can
+         * collide.
+         */
+        void addParticles(Particle* particles, unsigned count);
+
+        /**
+         * Removes the given particle. This moves the last particle
+         * into its place.
+         */
+        void removeParticle(Particle* particle);
+
+        /**
+         * Removes all the particles.
+         */
+        void clearParticles();
+
+        /**
+         * Sets the radius of the particles, and the cell size of the
+         * hash to match.
+         */
+        void setRadius(real radius);
+
+        /**
+         * Gets the radius of the particles.
+         */
+        real getRadius() const;
+
+        /**
+         * Sets the cell size of the hash. It must be at least the
+         * particle diameter for every collision to be found.
+         */
+        void setCellSize(real cellSize);
+
+        /**
+         * Sets the restitution of the generated contacts.
+         */
+        void setRestitution(real restitution);
+
+        /**
+         * Sets whether fast particles are swept along their paths
+         * each step, so they can't pass through other particles. It
+         * is off by default. The particles' start positions are
+         * recorded by beginStep, which the world calls; used outside
+         * a world, beginStep must be called before the particles are
+         * integrated.
+         */
+        void setContinuous(bool continuous);
+
+        /**
+         * Returns true if fast particles are swept.
+         */
+        bool isContinuous() const;
+
+        /**
+         * Sets how far a particle must move in a step to be swept.
+         * It starts at the particle radius.
+         */
+        void setSweepThreshold(real sweepThreshold);
+
+        /**
+         * Returns the number of particles swept by the last call to
+         * addContact.
+         */
+        unsigned getSweptCount() const;
+
+        /**
+         * Sets a job system to share the search for contacts between.
+         * Pass NULL to search on the calling thread. The generator
+         * must then not itself be run from inside the job system, by
+         * a world generating its contacts in parallel.
+         */
+        void setJobSystem(JobSystem* jobs);
+
+        /**
+         * Returns the job system, or NULL if there is none.
+         */
+        JobSystem* getJobSystem() const;
+
+        /**
+         * Records where each particle starts the step, if collision
+         * is continuous.
+         */
+        virtual void beginStep();
+
+        /**
+         * Gets the spatial hash, as built by the last call to
+         * addContact.
+         */
+        const ParticleSpatialHash& getSpatialHash() const;
+
+        /**
+         * Fills the given contact array with the contacts between
+         * overlapping particles, writing at most limit contacts.
+         */
+        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+
+        /**
+         * Moves the particles with the remap, keeping them in memory
+         * order so the hash is built and searched in that order.
+         */
+        virtual void remapParticles(const ParticleRemap &remap);
+    };
+}
+
+#endif // CYCLONE_PCOLLIDE_H
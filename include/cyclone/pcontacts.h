@@ -15,9 +15,13 @@
 
 #include "core.h"
 #include "particle.h"
+#include "preorder.h"
+#include <vector>
 
 namespace cyclone {
 
+    template <typename T> class BasicParticleContactGenerator;
+
     /**
      * A contact represents two objects in contact (in
      * this case ParticleContact representing two particles).
@@ -29,13 +33,15 @@ namespace cyclone {
      * contact details. To resolve a set of contacts, use the 
      * particle contact resolver class.
      */
-    class ParticleContact
+    template <typename T>
+    class BasicParticleContact
     {
         /**
          * The contact resolver object needs access into the contacts to
          * set and effect the contact.
          */
-        friend class ParticleContactResolver;
+        template <typename U> friend class BasicParticleContactResolver;
+        friend class ParticleIslandResolver;
 
     public:
 
@@ -44,56 +50,142 @@ namespace cyclone {
          * contact. The second of these two particles can be
          * NULL for contacts with the scenery.
          */
-        Particle* particle[2];
+        BasicParticle<T>* particle[2];
 
         /**
          * Holds the normal restitution coefficient at the contact.
          */
-        real restitution;
+        T restitution;
 
         /**
          * Holds the direction of the contact in world coordinates.
          */
-        Vector3 contactNormal;
+        BasicVector3<T> contactNormal;
 
         /**
          * Holds the depth of penetration at the contact.
          */
-        real penetration;
+        T penetration;
 
         /**
          * Holds the amount each particle is moved by during interpenetration
          * resolution.
          */
-        Vector3 particleMovement[2];
+        BasicVector3<T> particleMovement[2];
+
+        /**
+         * Holds the generator that produced this contact. Together
+         * with the particles it identifies the same contact from one
+         * step to the next. ParticleWorld fills it in.
+         */
+        const BasicParticleContactGenerator<T>* source;
+
+        /**
+         * Holds the total impulse applied along the contact normal
+         * this step, including any warm-start impulse.
+         */
+        T accumulatedImpulse;
+
+        /**
+         * Holds the fraction of the step at which the particles
+         * first touched. Contacts found from where the particles
+         * ended the step have 1; a swept test that catches a fast
+         * particle passing through something gives the moment it
+         * hit. The contact's normal is the one at that moment, and
+         * a world moves the particles back to it before resolving.
+         */
+        T timeOfImpact;
+
+        /**
+         * Creates a contact with no particles, whose time of impact
+         * is the end of the step.
+         */
+        BasicParticleContact();
+
+        /**
+         * Wakes a sleeping particle in the contact if the other
+         * particle is awake and can move. Contacts with the scenery
+         * or with immovable particles never wake anything.
+         */
+        void matchAwakeState();
+
+        /**
+         * Returns true if neither particle in the contact can be
+         * moving, being either asleep or immovable. Such a contact
+         * needn't be resolved.
+         */
+        bool isStill() const;
 
     protected:
 
         /**
          * Resolves this contact for both velocity and interpenetration.
          */
-        void resolve(real duration);
+        void resolve(T duration);
 
         /**
          * Calculates the separating velocity at this contact.
          */
-        real calculateSeparatingVelocity() const;
+        T calculateSeparatingVelocity() const;
 
     private:
 
         /**
          * Handles the impulse calculations for this collision.
          */
-        void resolveVelocity(real duration);
+        void resolveVelocity(T duration);
 
         /**
          * Handles the interpenetration resolution for this contact.
          */
-        void resolveInterpenetration(real duration);
+        void resolveInterpenetration(T duration);
     };
 
-    class ParticleContactResolver
+    /**
+     * The contact resolution routine. One resolver instance can be
+     * shared for a whole simulation.
+     *
+     * Each iteration resolves the contact with the most negative
+     * separating velocity. Resolving a contact moves its particles,
+     * so the penetration of every other contact involving those
+     * particles is updated before the next iteration.
+     *
+     * Resolution stops when the iteration budget runs out or when
+     * no contact is closing faster than the velocity tolerance or
+     * penetrating deeper than the penetration tolerance. Both
+     * tolerances are zero by default, so every contact is resolved
+     * completely; raising them stops the resolver spending
+     * iterations on corrections too small to matter. After each
+     * call the resolver reports whether it converged and, if it has
+     * tolerances, what was left unresolved.
+     */
+    template <typename T>
+    class BasicParticleContactResolver
     {
+    public:
+
+        /**
+         * Selects how the resolver finds the next contact to resolve.
+         */
+        enum ResolveMode
+        {
+            /**
+             * Scans every contact on every iteration. This needs no
+             * extra memory and is quickest for a handful of contacts.
+             */
+            RESOLVE_LINEAR_SCAN,
+
+            /**
+             * Keeps the contacts in a binary heap keyed on separating
+             * velocity. After each resolution only the contacts that
+             * share a particle with the resolved one are updated, so
+             * an iteration costs O(k log n) rather than O(n). The
+             * contacts are resolved in the same order as the linear
+             * scan.
+             */
+            RESOLVE_PRIORITY
+        };
+
     protected:
 
         /**
@@ -107,31 +199,181 @@ namespace cyclone {
          */
         unsigned iterationsUsed;
 
+        /**
+         * Holds the closing velocity and penetration a contact may
+         * be left with.
+         */
+        T velocityTolerance;
+        T penetrationTolerance;
+
+        /**
+         * Holds the largest closing velocity and penetration left
+         * after the last call to resolveContacts, and whether every
+         * contact was then within the tolerances.
+         */
+        T velocityResidual;
+        T penetrationResidual;
+        bool converged;
+
+        /**
+         * Holds the way the next contact to resolve is found.
+         */
+        ResolveMode mode;
+
+        /**
+         * Holds the contacts that need resolving as a binary heap of
+         * contact indices, ordered on their separating velocity.
+         */
+        std::vector<unsigned> heap;
+
+        /**
+         * Holds the position of each contact in the heap, or ~0 for
+         * contacts that are not in it.
+         */
+        std::vector<unsigned> heapPosition;
+
+        /**
+         * Holds the separating velocity of each contact, as last
+         * calculated.
+         */
+        std::vector<T> heapKey;
+
+        /**
+         * Holds (particle, contact) entries sorted by particle, so the
+         * contacts involving a particle are contiguous, along with the
+         * position of each contact's particles in that list.
+         */
+        struct ParticleContactEntry
+        {
+            BasicParticle<T>* particle;
+            unsigned contact;
+        };
+        std::vector<ParticleContactEntry> particleContacts;
+        std::vector<unsigned> contactEntry;
+
+        /**
+         * Marks contacts already updated in the current iteration.
+         */
+        std::vector<unsigned> updateStamp;
+
+        /**
+         * Resolves contacts by scanning the whole array each iteration.
+         */
+        void resolveLinear(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration);
+
+        /**
+         * Resolves contacts through the priority heap.
+         */
+        void resolvePriority(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration);
+
+        /**
+         * Updates the penetration of the given contact to account for
+         * the movement made when the other contact was resolved.
+         */
+        static void updatePenetration(BasicParticleContact<T> &contact, const BasicParticleContact<T> &resolved);
+
+        /**
+         * Returns true if a contact with the given separating
+         * velocity and penetration is outside the tolerances.
+         */
+        bool needsResolving(T separatingVelocity, T penetration) const;
+
+        /**
+         * Measures what is left unresolved in the given contacts.
+         */
+        void measureResiduals(BasicParticleContact<T>* contactArray, unsigned numContacts);
+
+        /**
+         * Returns true if either tolerance is set, so residuals are
+         * measured.
+         */
+        bool hasTolerances() const;
+
+        /**
+         * Recalculates the key of the given contact and moves it in,
+         * around or out of the heap to match.
+         */
+        void updateHeap(BasicParticleContact<T>* contactArray, unsigned index);
+
+        /**
+         * Heap maintenance.
+         */
+        bool heapLess(unsigned a, unsigned b) const;
+        void heapSwap(unsigned a, unsigned b);
+        void siftUp(unsigned position);
+        void siftDown(unsigned position);
+        void heapRemove(unsigned position);
+
     public:
 
         /**
          * Creates a new contact resolver.
          */
-        ParticleContactResolver(unsigned iterations);
-        ParticleContactResolver();
+        BasicParticleContactResolver(unsigned iterations);
+        BasicParticleContactResolver();
 
         /**
          * Sets the number of iterations that can be used.
          */
         void setIterations(unsigned iterations);
 
+        /**
+         * Sets the way the next contact to resolve is found.
+         */
+        void setMode(ResolveMode mode);
+
+        /**
+         * Gets the way the next contact to resolve is found.
+         */
+        ResolveMode getMode() const;
+
+        /**
+         * Returns the number of iterations used by the last call to
+         * resolveContacts.
+         */
+        unsigned getIterationsUsed() const;
+
+        /**
+         * Sets the closing velocity and penetration a contact may be
+         * left with. Both must be zero or more.
+         */
+        void setTolerances(T velocityTolerance, T penetrationTolerance);
+
+        /**
+         * Returns true if the last call to resolveContacts found every
+         * contact within the tolerances before it ran out of
+         * iterations. In the linear scan mode a call that runs out of
+         * iterations just as the last contact is resolved reports
+         * false, as finding out would take another pass.
+         */
+        bool hasConverged() const;
+
+        /**
+         * Returns the largest closing velocity and the largest
+         * penetration left among the contacts after the last call to
+         * resolveContacts. Either is zero if no contact is closing or
+         * penetrating.
+         *
+         * Measuring them takes a pass over the contacts, so it is
+         * only done when a tolerance is set; with both tolerances at
+         * zero the residuals are always zero.
+         */
+        T getVelocityResidual() const;
+        T getPenetrationResidual() const;
+
         /**
          * Resolves a set of particle contacts for both penetration
          * and velocity.
          */
-        void resolveContacts(ParticleContact* contactArray, unsigned numContacts, real duration);
+        void resolveContacts(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration);
     };
 
     /**
      * This is the basic polymorphic interface for contact
      * generators applying to particles.
      */
-    class ParticleContactGenerator
+    template <typename T>
+    class BasicParticleContactGenerator
     {
     public:
 
@@ -143,8 +385,33 @@ namespace cyclone {
          * to. The method returns the number of contacts that been 
          * written.
          */
-        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const = 0;    
+        virtual unsigned addContact(BasicParticleContact<T>* contact, unsigned limit) const = 0;    
+
+        /**
+         * Updates the particles the generator holds after the given
+         * remap has moved them. Generators that hold particles
+         * override this; the default does nothing.
+         */
+        virtual void remapParticles(const BasicParticleRemap<T> &remap);
+
+        /**
+         * Called by the world at the start of each step, before the
+         * particles move. Generators that need to know where their
+         * particles started the step, such as swept collision tests,
+         * record it here; the default does nothing.
+         */
+        virtual void beginStep();
+
+        virtual ~BasicParticleContactGenerator() {}
     };
+
+    /**
+     * The contact, resolver and contact generator of the library's
+     * own real type.
+     */
+    typedef BasicParticleContact<real> ParticleContact;
+    typedef BasicParticleContactResolver<real> ParticleContactResolver;
+    typedef BasicParticleContactGenerator<real> ParticleContactGenerator;
 }
 
-#endif // CYCLONE_PCONTACTS_H
\ No newline at end of file
+#endif // CYCLONE_PCONTACTS_H
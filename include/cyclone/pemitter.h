@@ -0,0 +1,262 @@
+/*
+ * Interface file for the particle emitter.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains an emitter for large numbers of short-lived
+ * particles, such as sparks, smoke and fireworks. Each particle has
+ * a type, whose rule gives the range of its lifetime and launch
+ * velocity and what it turns into when it dies.
+ *
+ * The particles live in a particle store of fixed capacity, with the
+ * live ones packed at the front. When a particle dies the last live
+ * one moves into its slot, so ageing and integrating only walk the
+ * live particles, and an emitter running at a steady rate makes no
+ * allocations. Spawning is done in batches: requests made during a
+ * frame, and the payloads of every particle that dies in it, are
+ * queued and then filled in a single pass, drawing all their random
+ * numbers in one go.
+ */
+#ifndef CYCLONE_PEMITTER_H
+#define CYCLONE_PEMITTER_H
+
+#include <vector>
+#include "pstore.h"
+#include "random.h"
+
+namespace cyclone {
+
+    /**
+     * The rule for one type of emitted particle.
+     */
+    struct ParticleEmitterRule
+    {
+        /**
+         * A number of particles of another type, created where a
+         * particle of this type dies.
+         */
+        struct Payload
+        {
+            unsigned type;
+            unsigned count;
+        };
+
+        /** Holds the range of the particle's lifetime. */
+        real minAge;
+        real maxAge;
+
+        /**
+         * Holds the range of the particle's launch velocity, which is
+         * added to the velocity of the request or of the particle it
+         * came from.
+         */
+        Vector3 minVelocity;
+        Vector3 maxVelocity;
+
+        /** Holds the particle's damping and constant acceleration. */
+        real damping;
+        Vector3 acceleration;
+
+        /** Holds what the particle turns into when it dies. */
+        std::vector<Payload> payloads;
+
+        /**
+         * Creates a rule for particles that live for one second, are
+         * launched at rest and fall under gravity.
+         */
+        ParticleEmitterRule();
+
+        /**
+         * Sets the lifetime, launch velocity and damping in one go.
+         */
+        void setParameters(real minAge, real maxAge,
+            const Vector3 &minVelocity, const Vector3 &maxVelocity, real damping);
+
+        /**
+         * Adds a payload of the given number of particles of the given
+         * type.
+         */
+        void addPayload(unsigned type, unsigned count);
+    };
+
+    /**
+     * Spawns, ages and integrates particles according to a table of
+     * rules.
+     */
+    class ParticleEmitter
+    {
+    protected:
+
+        /**
+         * A queued request for particles.
+         */
+        struct SpawnRequest
+        {
+            unsigned type;
+            unsigned count;
+            Vector3 position;
+            Vector3 velocity;
+        };
+
+        /**
+         * Holds the rules, indexed by particle type.
+         */
+        std::vector<ParticleEmitterRule> rules;
+
+        /**
+         * Holds the particles. Its size is the capacity of the
+         * emitter. The first liveCount slots hold the live particles;
+         * the rest have zero inverse mass.
+         */
+        ParticleStore store;
+
+        /**
+         * Holds the time each particle has left to live, and its type.
+         */
+        std::vector<real> age;
+        std::vector<unsigned> type;
+
+        /**
+         * Holds the requests waiting to be spawned, and the random
+         * numbers drawn for them.
+         */
+        std::vector<SpawnRequest> requests;
+        std::vector<real> randoms;
+
+        /**
+         * Holds the stream the random numbers are drawn from.
+         */
+        Random random;
+
+        /**
+         * Holds the height below which particles die.
+         */
+        real killHeight;
+
+        /**
+         * Holds the number of particles alive, and the numbers spawned,
+         * died and dropped for want of a free slot, in the last update.
+         */
+        unsigned liveCount;
+        unsigned spawned;
+        unsigned died;
+        unsigned dropped;
+
+        /**
+         * Ages every live particle, killing those whose time is up or
+         * that have fallen below the kill height, and queues their
+         * payloads.
+         */
+        void expire(real duration);
+
+        /**
+         * Fills every queued request.
+         */
+        void spawn();
+
+    public:
+
+        /**
+         * Creates an emitter with room for the given number of live
+         * particles, drawing random numbers from the given seed.
+         */
+        ParticleEmitter(unsigned capacity, unsigned seed = 1);
+
+        /**
+         * Adds a rule, returning the type of particle it is for.
+         * Types count up from zero.
+         */
+        unsigned addRule(const ParticleEmitterRule &rule);
+
+        /**
+         * Gets the rule for the given type.
+         */
+        ParticleEmitterRule& getRule(unsigned type);
+
+        /**
+         * Gets the number of rules.
+         */
+        unsigned getRuleCount() const;
+
+        /**
+         * Sets the height below which particles die, delivering their
+         * payloads. By default particles only die of old age.
+         */
+        void setKillHeight(real killHeight);
+
+        /**
+         * Queues the given number of particles of the given type to be
+         * spawned at the given position, with the given velocity added
+         * to their launch velocity. They are created by the next call
+         * to update.
+         */
+        void emit(unsigned type, unsigned count, const Vector3 &position,
+            const Vector3 &velocity = Vector3());
+
+        /**
+         * Advances the emitter by the given duration: integrates the
+         * live particles, ages them, kills those whose time is up, and
+         * then spawns every queued request and payload in one pass.
+         */
+        void update(real duration);
+
+        /**
+         * Kills every particle and drops every queued request.
+         */
+        void clear();
+
+        /**
+         * Gets the store holding the particles. The live particles are
+         * the first getLiveCount slots; the rest hold dead particles.
+         * A particle's slot changes when another dies, so slots only
+         * identify particles until the next update.
+         */
+        ParticleStore& getStore();
+        const ParticleStore& getStore() const;
+
+        /**
+         * Returns true if the particle in the given slot is alive.
+         */
+        bool isAlive(unsigned index) const;
+
+        /**
+         * Gets the type of the particle in the given slot.
+         */
+        unsigned getType(unsigned index) const;
+
+        /**
+         * Gets the time the particle in the given slot has left.
+         */
+        real getAge(unsigned index) const;
+
+        /**
+         * Gets the number of particle slots.
+         */
+        unsigned getCapacity() const;
+
+        /**
+         * Gets the number of live particles.
+         */
+        unsigned getLiveCount() const;
+
+        /**
+         * Gets the numbers of particles spawned, died, and dropped
+         * because the emitter was full, in the last update.
+         */
+        unsigned getSpawnedCount() const;
+        unsigned getDiedCount() const;
+        unsigned getDroppedCount() const;
+    };
+}
+
+#endif // CYCLONE_PEMITTER_H
@@ -20,15 +20,20 @@
 
 #include "core.h"
 #include "particle.h"
+#include "preorder.h"
+#include <stddef.h>
 #include <vector>
 
 namespace cyclone {
 
+    class JobSystem;
+
     /**
      * A force generator can be asked to add a force to one or more
      * particleseach frame while registered.
      */
-    class ParticleForceGenerator
+    template <typename T>
+    class BasicParticleForceGenerator
     {
         public:
 
@@ -36,14 +41,89 @@ namespace cyclone {
              * Overload this method in the implementation of the interface
              * to calculate and update the force applied to th given particle.
              */
-            virtual void updateForce(Particle* particle, real duration) = 0; 
+            virtual void updateForce(BasicParticle<T>* particle, T duration) = 0; 
+
+            /**
+             * Calculates and updates the force applied to each of the
+             * given particles. This is the entry point used by a
+             * batched registry, which makes one call per generator
+             * rather than one per registration.
+             *
+             * The default implementation calls updateForce for each
+             * particle in turn. Generators that apply the same
+             * calculation to every particle should override it with
+             * a loop that avoids the per-particle virtual call.
+             */
+            virtual void updateForces(BasicParticle<T>* const* particles, size_t count, T duration);
+
+            /**
+             * Called by a registry once each time it updates forces,
+             * on the calling thread, before any of this generator's
+             * forces are updated. Generators that work out something
+             * shared by all their particles, such as a tree of bodies,
+             * do it here; the default does nothing. Code that calls a
+             * generator without a registry should call this first.
+             */
+            virtual void prepareForces(T duration);
+
+            /**
+             * Updates the particles the generator holds, other than
+             * the ones it is registered against, after the given
+             * remap has moved them. Generators that hold particles
+             * override this; the default does nothing.
+             */
+            virtual void remapParticles(const BasicParticleRemap<T> &remap);
+
+            virtual ~BasicParticleForceGenerator() {}
+    };
+
+    /**
+     * A force generator whose force is limited to a region of space.
+     * It can be registered against particles like any other, but is
+     * meant to be given to a ParticleRegionForces instead, which asks
+     * a spatial hash for the particles inside its bounds each step,
+     * so the generator only runs for the particles it can affect.
+     */
+    template <typename T>
+    class BasicParticleRegionForceGenerator : public BasicParticleForceGenerator<T>
+    {
+        public:
+
+            /**
+             * Gets the box outside which the generator applies no
+             * force. The generator must still check the exact shape
+             * of its region, as particles anywhere in the box are
+             * passed to it.
+             */
+            virtual void getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const = 0;
     };
 
     /**
      * Holds all force generators and the particles that they apply to.
      */
-    class ParticleForceRegistry
+    template <typename T>
+    class BasicParticleForceRegistry
     {
+        public:
+
+            /**
+             * Identifies one registration, as returned by add. A
+             * handle stays valid while its registration is in the
+             * registry, however other registrations are added or
+             * removed, and is safely rejected once it has been
+             * removed.
+             */
+            struct Handle
+            {
+                unsigned slot;
+                unsigned generation;
+
+                /**
+                 * Creates a handle that refers to no registration.
+                 */
+                Handle() : slot(~0u), generation(0) {}
+            };
+
         protected:
 
             /**
@@ -52,8 +132,14 @@ namespace cyclone {
              */
             struct ParticleForceRegistration
             {
-                Particle* particle;
-                ParticleForceGenerator* fg;
+                BasicParticle<T>* particle;
+                BasicParticleForceGenerator<T>* fg;
+
+                /**
+                 * Holds the slot that the handle for this
+                 * registration refers to.
+                 */
+                unsigned slot;
             };
 
             /**
@@ -62,20 +148,213 @@ namespace cyclone {
             typedef std::vector<ParticleForceRegistration> Registry;
             Registry registrations;
 
+            /**
+             * Maps a handle to the current position of its
+             * registration. The generation is bumped each time the
+             * slot is released, so stale handles can be detected.
+             */
+            struct Slot
+            {
+                unsigned index;
+                unsigned generation;
+            };
+
+            /**
+             * Holds the slot map, and the list of slots that are free
+             * to be reused.
+             */
+            std::vector<Slot> slots;
+            std::vector<unsigned> freeSlots;
+
+            /**
+             * Removes the registration at the given position by moving
+             * the last registration into its place.
+             */
+            void removeAt(unsigned index);
+
+            /**
+             * Holds one force generator and every particle it is
+             * registered against, for use in batched mode.
+             */
+            struct ParticleForceBatch
+            {
+                BasicParticleForceGenerator<T>* fg;
+                std::vector<BasicParticle<T>*> particles;
+
+                /**
+                 * True if a particle is in the batch more than once,
+                 * so the batch can't be split between workers.
+                 */
+                bool repeats;
+            };
+
+            /**
+             * Holds the registrations grouped by force generator, in
+             * the order each generator was first registered.
+             */
+            typedef std::vector<ParticleForceBatch> Batches;
+            Batches batches;
+
+            /**
+             * Scratch space used when building the batches.
+             */
+            std::vector<unsigned> batchOrder;
+            std::vector<unsigned> batchStarts;
+            std::vector<BasicParticle<T>*> batchSorted;
+
+            /**
+             * Scratch space holding the awake particles of a batch.
+             */
+            std::vector<BasicParticle<T>*> awakeParticles;
+
+            /**
+             * Scratch space holding each generator told of a remap.
+             */
+            std::vector<BasicParticleForceGenerator<T>*> remapGenerators;
+
+            /**
+             * Holds the number of batches in use. Batches beyond this
+             * count are kept so their storage can be reused.
+             */
+            unsigned batchCount;
+
+            /**
+             * True if registrations are processed one generator at a
+             * time through ParticleForceGenerator::updateForces.
+             */
+            bool batched;
+
+            /**
+             * True if the registrations have changed since the
+             * batches were last built.
+             */
+            bool batchesDirty;
+
+            /**
+             * Regroups the registrations into batches.
+             */
+            void buildBatches();
+
+            /**
+             * Holds the registration indices ordered by particle, and
+             * the position where each particle's registrations start
+             * (with a final entry marking the end). This is used to
+             * share the work between threads, one particle at a time.
+             */
+            std::vector<unsigned> particleOrder;
+            std::vector<unsigned> particleStarts;
+
+            /**
+             * True if the registrations have changed since they were
+             * last grouped by particle.
+             */
+            bool particleGroupsDirty;
+
+            /**
+             * Groups the registrations by particle.
+             */
+            void buildParticleGroups();
+
+            /**
+             * Calls prepareForces once for each generator in the
+             * registry, in registry order.
+             */
+            void prepareGenerators(T duration);
+
+            /**
+             * Orders registrations, and registration indices, for the
+             * sorts that group them. These are members so they can see
+             * the registrations; they are defined with the registry.
+             */
+            static bool registrationLess(const ParticleForceRegistration &a,
+                const ParticleForceRegistration &b);
+            struct GeneratorOrder;
+            struct ParticleOrder;
+
+            /**
+             * Holds what the force update jobs need to know.
+             */
+            struct ForceJobData;
+
+            /**
+             * The job function used by the threaded updateForces.
+             */
+            static void updateForcesJob(void* data, unsigned begin, unsigned end);
+
+            friend class ParticleSnapshot;
+
         public:
 
+            /**
+             * Creates an empty registry in unbatched mode.
+             */
+            BasicParticleForceRegistry();
+
+            /**
+             * Sets whether the registry runs in batched mode. In
+             * batched mode registrations are grouped by generator and
+             * each generator is called once with all its particles.
+             * The forces applied are the same as in unbatched mode,
+             * but a particle with several generators has them applied
+             * in the order the generators first appear in the
+             * registry, rather than in the order of its own
+             * registrations.
+             */
+            void setBatched(bool batched);
+
+            /**
+             * Returns true if the registry runs in batched mode.
+             */
+            bool isBatched() const;
+
+            /**
+             * Makes room for the given number of registrations, so
+             * that adding and removing up to that many makes no
+             * memory allocations.
+             */
+            void reserve(unsigned capacity);
+
             /**
              * Registers the given force generator to apply to the 
-             * given particle.
+             * given particle, and returns a handle that can be used to
+             * remove the registration again.
              */
-            void add(Particle* particle, ParticleForceGenerator* fg);
+            Handle add(BasicParticle<T>* particle, BasicParticleForceGenerator<T>* fg);
+
+            /**
+             * Removes the registration with the given handle in
+             * constant time. If the handle no longer refers to a
+             * registration, the method will have no effect.
+             *
+             * @note Removal moves the last registration into the gap,
+             * so the order in which generators are called changes.
+             */
+            void remove(Handle handle);
 
             /**
              * Removes the given registered pair from the registry.
              * If the pair is not regiestered, method will have no
-             * effect.
+             * effect. This has to search for the pair; prefer
+             * removing by handle where possible.
+             */
+            void remove(BasicParticle<T>* particle, BasicParticleForceGenerator<T>* fg);
+
+            /**
+             * Removes every registration for the given particle, in a
+             * single pass over the registry.
+             */
+            void removeAllFor(BasicParticle<T>* particle);
+
+            /**
+             * Returns true if the given handle refers to a registration
+             * that is still in the registry.
              */
-            void remove(Particle* particle, ParticleForceGenerator* fg);
+            bool isRegistered(Handle handle) const;
+
+            /**
+             * Returns the number of registrations.
+             */
+            unsigned size() const;
 
             /**
              * Clears registry of all registrations. This will not delete
@@ -84,100 +363,225 @@ namespace cyclone {
              */
             void clear();
 
+            /**
+             * Updates every registration after the given remap has
+             * moved its particles, and sorts the registrations into
+             * the particles' new order. Each particle keeps its own
+             * registrations in the same order, and handles stay
+             * valid. Each generator is then told of the remap once.
+             */
+            void remapParticles(const BasicParticleRemap<T> &remap);
+
+            /**
+             * Calls all the force generators to update the forces of
+             * their corresponding particles. Particles that are asleep
+             * are skipped.
+             */
+            void updateForces(T duration);
+
             /**
              * Calls all the force generators to update the forces of
-             * their corresponding particles.
+             * their corresponding particles, sharing the work between
+             * the workers of the given job system.
+             *
+             * In batched mode the batches still run one after another,
+             * and each batch's awake particles are split into ranges,
+             * each given to the generator's updateForces on one
+             * worker. A batch holding a particle more than once runs
+             * on the calling thread.
+             *
+             * In unbatched mode work is divided by particle: all the
+             * registrations for one particle run on the same worker,
+             * in registration order.
+             *
+             * Either way each particle's forces are summed in the same
+             * order as in the serial version, whatever the number of
+             * workers, and no locking is needed. This relies on each
+             * generator only writing to the particles it is given
+             * (every built-in generator does; a spring only reads the
+             * position of its other end), and on generators being
+             * safe to call from several threads at once for different
+             * particles. As in the serial version, particles that are
+             * asleep are skipped.
              */
-            void updateForces(real duration);
+            void updateForces(T duration, JobSystem &jobs);
+
+            /**
+             * Calls all the force generators to update the forces of
+             * their corresponding particles, always applying each
+             * particle's registrations in the order they were made,
+             * whether or not the registry is batched. The work is
+             * divided by particle as for the threaded updateForces,
+             * between the workers of the given job system if there is
+             * one, so the forces on every particle are summed in the
+             * same order for any number of workers.
+             */
+            void updateForcesInOrder(T duration, JobSystem* jobs);
     };
 
     /**
      * A force generator used to apply a gravitational force. One
      * instance can be used for multiple particles.
      */
-    class ParticleGravity : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleGravity : public BasicParticleForceGenerator<T>
     {
         /**
          * Holds the acceleration due to gravity.
          */
-        Vector3 gravity;
+        BasicVector3<T> gravity;
 
         public:
 
             /**
              * Creates the generator with the given acceleration.
              */
-            ParticleGravity(const Vector3 &gravity);
-            ParticleGravity();
+            BasicParticleGravity(const BasicVector3<T> &gravity);
+            BasicParticleGravity();
 
             /**
              * Returns this force generator's gravity vector.
              */
-            Vector3 getGravity() const;
+            BasicVector3<T> getGravity() const;
 
             /**
              * Applies the gravitational force to the given particle.
              */
-            virtual void updateForce(Particle* particle, real duration);
+            virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+            /**
+             * Applies the gravitational force to each of the given
+             * particles.
+             */
+            virtual void updateForces(BasicParticle<T>* const* particles, size_t count, T duration);
+
+            /**
+             * Adds the gravitational force on a particle in the given
+             * state to the given sum. Returns false, leaving the sum
+             * alone, if the particle has infinite mass. This is
+             * inlined so a ForceStack can fuse it with other forces.
+             */
+            bool accumulateForce(const BasicVector3<T> &position, const BasicVector3<T> &velocity,
+                T inverseMass, BasicVector3<T> *force) const;
+    };
+
+    /**
+     * A force generator that applies a drag force. One instance can
+     * be used for multiple particles.
+     *
+     * The drag opposes the particle's velocity, and its magnitude is
+     * k1 * speed + k2 * speed * speed.
+     */
+    template <typename T>
+    class BasicParticleDrag : public BasicParticleForceGenerator<T>
+    {
+        /**
+         * Holds the velocity drag coefficient.
+         */
+        T k1;
+
+        /**
+         * Holds the velocity squared drag coefficient.
+         */
+        T k2;
+
+        public:
+
+            /**
+             * Creates the generator with the given coefficients.
+             */
+            BasicParticleDrag(T k1, T k2);
+            BasicParticleDrag();
+
+            /**
+             * Applies the drag force to the given particle.
+             */
+            virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+            /**
+             * Applies the drag force to each of the given particles.
+             */
+            virtual void updateForces(BasicParticle<T>* const* particles, size_t count, T duration);
+
+            /**
+             * Adds the drag force on a particle in the given state to
+             * the given sum. Returns false, leaving the sum alone, if
+             * the particle isn't moving. This is inlined so a
+             * ForceStack can fuse it with other forces.
+             */
+            bool accumulateForce(const BasicVector3<T> &position, const BasicVector3<T> &velocity,
+                T inverseMass, BasicVector3<T> *force) const;
     };
 
-    class ParticlePointGravity : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticlePointGravity : public BasicParticleForceGenerator<T>
     {
         /**
          * Holds the scalar acceleration due to gravity. This force is scaled
          * based on the inverse square of the distance between the given
          * particle and the gravityPoint.
          */
-        real gravityScalar;
+        T gravityScalar;
 
         /**
          * Holds the position of the gravitational
          * attraction. All registered particles will be 
          * pulled toward this location.
          */
-        Vector3 gravityPoint;
+        BasicVector3<T> gravityPoint;
 
         public:
 
             /**
              * Creates the generator with the given acceleration and attraction point.
              */
-            ParticlePointGravity(const real &gravityScalar, const Vector3 &gravityPoint);
-            ParticlePointGravity();
+            BasicParticlePointGravity(const T &gravityScalar, const BasicVector3<T> &gravityPoint);
+            BasicParticlePointGravity();
+
+            /**
+             * Returns the scalar strength of the attraction.
+             */
+            T getGravityScalar() const;
+
+            /**
+             * Returns the point particles are pulled toward.
+             */
+            BasicVector3<T> getGravityPoint() const;
 
             /**
              * Applies the gravitational force to the given particle.
              */
-            virtual void updateForce(Particle* particle, real duration);
+            virtual void updateForce(BasicParticle<T>* particle, T duration);
     };
 
     /**
      * A force generator used to apply a gravitational force. One
      * instance can be used for multiple particles.
      */
-    class ParticleUplift : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleUplift : public BasicParticleRegionForceGenerator<T>
     {
         /**
          * Holds the acceleration due to gravity.
          */
-        Vector3 upliftForce;
+        BasicVector3<T> upliftForce;
 
         /**
          * Center point of area affected by uplift force.
          */
-        Vector3 upliftPoint;
+        BasicVector3<T> upliftPoint;
 
         /**
          * Radius from uplift point that uplift force
          * has effect.
          */
-        real upliftRadius;
+        T upliftRadius;
 
         /**
          * Holds the maximum height (y-val) that this
          * force generator can lift a particle.
          */
-        real maxUpliftHeight;
+        T maxUpliftHeight;
 
         /**
          * Gravity force generator associated with this uplift
@@ -186,189 +590,314 @@ namespace cyclone {
          * is the negative of the gravity force so that the particle 
          * levitates in place.
          */
-        ParticleGravity gravity;
+        BasicParticleGravity<T> gravity;
 
         public:
 
             /**
              * Creates the generator with the given acceleration.
              */
-            ParticleUplift(const Vector3 &upliftForce, 
-                            const Vector3 &upliftPoint,
-                            const real &upliftRadius,
-                            const real &maxUpliftHeight,
-                            const ParticleGravity &gravity);
-            ParticleUplift();
+            BasicParticleUplift(const BasicVector3<T> &upliftForce, 
+                            const BasicVector3<T> &upliftPoint,
+                            const T &upliftRadius,
+                            const T &maxUpliftHeight,
+                            const BasicParticleGravity<T> &gravity);
+            BasicParticleUplift();
 
             /**
              * Applies the gravitational force to the given particle.
              */
-            virtual void updateForce(Particle* particle, real duration);
+            virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+            /**
+             * Gets the box around the sphere the uplift acts in.
+             */
+            virtual void getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const;
+    };
+
+    /**
+     * A force generator that pushes particles away from a point, with
+     * a force that falls off linearly to nothing at the edge of its
+     * radius. It makes a blast when applied for a short time.
+     */
+    template <typename T>
+    class BasicParticleBlast : public BasicParticleRegionForceGenerator<T>
+    {
+        /**
+         * Holds the centre of the blast.
+         */
+        BasicVector3<T> centre;
+
+        /**
+         * Holds the distance from the centre the force reaches.
+         */
+        T radius;
+
+        /**
+         * Holds the force at the centre.
+         */
+        T peakForce;
+
+    public:
+
+        /**
+         * Creates a blast with the given centre, radius and force.
+         */
+        BasicParticleBlast(const BasicVector3<T> &centre, T radius, T peakForce);
+
+        /**
+         * Moves the blast and sets its force. A force of zero turns
+         * it off.
+         */
+        void set(const BasicVector3<T> &centre, T peakForce);
+
+        /**
+         * Applies the blast force to the given particle.
+         */
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+        /**
+         * Gets the box around the blast's sphere.
+         */
+        virtual void getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const;
     };
 
     /**
      * A force generator that applies a spring force.
      */
-    class ParticleSpring : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleSpring : public BasicParticleForceGenerator<T>
     {
         /**
          * The particle at the other end of the spring.
          */
-        Particle* other;
+        BasicParticle<T>* other;
 
         /**
          * Holds the spring constant.
          */
-        real springConstant;
+        T springConstant;
 
         /**
          * Holds the resting length of the spring.
          */
-        real restLength;
+        T restLength;
 
     public:
 
         /**
          * Creates a new spring with the given parameters.
          */
-        ParticleSpring(Particle* other, real &springConstant, real &restLength);
-        ParticleSpring();
+        BasicParticleSpring(BasicParticle<T>* other, T &springConstant, T &restLength);
+        BasicParticleSpring();
 
         /**
          * Applies the spring force to the given particle.
          */
-        virtual void updateForce(Particle* particle, real duration);
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
+        /**
+         * Moves the other end of the spring with its particle.
+         */
+        virtual void remapParticles(const BasicParticleRemap<T> &remap);
     };
 
-    class ParticleAnchoredSpring : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleAnchoredSpring : public BasicParticleForceGenerator<T>
     {
     protected:
 
         /**
          * The location of the anchored end of the spring.
          */
-        Vector3* anchorPoint;
+        BasicVector3<T>* anchorPoint;
 
         /**
          * Holds the spring constant.
          */
-        real springConstant;
+        T springConstant;
 
         /**
          * Holds the resting length of the spring.
          */
-        real restLength;
+        T restLength;
 
     public:
 
         /**
          * Creates a new spring with given parameters.
          */
-        ParticleAnchoredSpring(Vector3* anchorPoint, real& springConstant, real& restLength);
-        ParticleAnchoredSpring();
+        BasicParticleAnchoredSpring(BasicVector3<T>* anchorPoint, T& springConstant, T& restLength);
+        BasicParticleAnchoredSpring();
 
         /**
          * Applies the spring force to the given particle.
          */
-        virtual void updateForce(Particle* particle, real duration);
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
     };
 
-    class ParticleBungee : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleBungee : public BasicParticleForceGenerator<T>
     {
         /**
          * The particle at the other end of the spring.
          */
-        Particle* other;
+        BasicParticle<T>* other;
 
         /**
          * Holds the spring constant.
          */
-        real springConstant;
+        T springConstant;
 
         /**
          * Holds the resting length of the spring.
          */
-        real restLength;
+        T restLength;
 
     public:
 
         /**
          * Creates a new spring with the given parameters.
          */
-        ParticleBungee(Particle* other, real &springConstant, real &restLength);
-        ParticleBungee();
+        BasicParticleBungee(BasicParticle<T>* other, T &springConstant, T &restLength);
+        BasicParticleBungee();
 
         /**
          * Applies the spring force to the given particle.
          */
-        virtual void updateForce(Particle* particle, real duration);
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
+        /**
+         * Moves the other end of the spring with its particle.
+         */
+        virtual void remapParticles(const BasicParticleRemap<T> &remap);
     };
 
-    class ParticleBuoyancy : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleBuoyancy : public BasicParticleForceGenerator<T>
     {
         /**
          * The maximum submersion depth of the object before
          * it generates its maximum buoyancy force (fully submerged).
          */
-        real maxDepth;
+        T maxDepth;
 
         /**
          * The volume of the object.
          */
-        real volume;
+        T volume;
 
         /**
          * The height of the water plane above y = 0. The plane is 
          * assumed to be parallel to the XZ plane.
          */
-        real waterHeight;
+        T waterHeight;
 
         /**
          * The density of the liquid. Pure water has a density of
          * 1000kg per cubic meter.
          */
-        real liquidDensity;
+        T liquidDensity;
 
     public:
 
         /**
          * Creates a new buoyancy force with the given parameters.
          */
-        ParticleBuoyancy(real maxDepth, real volume, real waterHeight, real liquidDensity = 1000.0f);
-        ParticleBuoyancy();
+        BasicParticleBuoyancy(T maxDepth, T volume, T waterHeight, T liquidDensity = 1000.0f);
+        BasicParticleBuoyancy();
 
         /**
          * Applies the spring force to the given particle.
          */
-        virtual void updateForce(Particle* particle, real duration);
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+        /**
+         * Applies the buoyancy force to each of the given particles.
+         */
+        virtual void updateForces(BasicParticle<T>* const* particles, size_t count, T duration);
+
+        /**
+         * Adds the buoyancy force on a particle in the given state to
+         * the given sum. Returns false, leaving the sum alone, if the
+         * particle is out of the water. This is inlined so a
+         * ForceStack can fuse it with other forces.
+         */
+        bool accumulateForce(const BasicVector3<T> &position, const BasicVector3<T> &velocity,
+            T inverseMass, BasicVector3<T> *force) const;
+    };
+
+    /**
+     * A force generator that applies a buoyancy force inside a box of
+     * liquid, such as a pool, whose surface is the top of the box.
+     * The force is worked out as by ParticleBuoyancy.
+     */
+    template <typename T>
+    class BasicParticleBuoyancyZone : public BasicParticleRegionForceGenerator<T>
+    {
+        /**
+         * Holds the corners of the liquid.
+         */
+        BasicVector3<T> min, max;
+
+        /**
+         * Holds the buoyancy of the liquid, with its surface at the
+         * top of the box.
+         */
+        BasicParticleBuoyancy<T> buoyancy;
+
+        /**
+         * Holds the maximum submersion depth, which the bounds reach
+         * above the surface.
+         */
+        T maxDepth;
+
+    public:
+
+        /**
+         * Creates a zone of liquid filling the given box.
+         */
+        BasicParticleBuoyancyZone(const BasicVector3<T> &min, const BasicVector3<T> &max,
+            T maxDepth, T volume, T liquidDensity = 1000.0f);
+
+        /**
+         * Applies the buoyancy force to the given particle, if it is
+         * over the liquid.
+         */
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
+
+        /**
+         * Gets the box of liquid, and the space just above it that
+         * partly submerged particles are in.
+         */
+        virtual void getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const;
     };
 
     /**
      * A force generator that applies an uplift force to particles that diminishes as they
      */
-    class ParticleLighterThanAir : public ParticleForceGenerator
+    template <typename T>
+    class BasicParticleLighterThanAir : public BasicParticleForceGenerator<T>
     {
         /**
          * Holds the density of the particle object.
          */
-        real particleDensity;
+        T particleDensity;
 
         /**
          * Holds the volume of the particle object.
          */
-        real particleVolume;
+        T particleVolume;
 
         /**
          * Holds the density of the air at ground level.
          */
-        real airDensityAtGround;
+        T airDensityAtGround;
 
         /**
          * Describes how quickly air density decreases as altitude
          * increases. Should be a negative value. The larger the absolute
          * value, the faster density decreases as altitude increases.
          */
-        real densityAltitudeSlope;
+        T densityAltitudeSlope;
 
         /**
          * Gravity force generator associated with this uplift
@@ -377,21 +906,85 @@ namespace cyclone {
          * is the negative of the gravity force so that the particle 
          * levitates in place.
          */
-        ParticleGravity gravity;
+        BasicParticleGravity<T> gravity;
 
     public:
 
         /**
          * Creates a new buoyancy force with the given parameters.
          */
-        ParticleLighterThanAir(real particleDensity, real particleVolume, real airDensityAtGround, real densityAltitudeSlope, ParticleGravity gravity);
-        ParticleLighterThanAir();
+        BasicParticleLighterThanAir(T particleDensity, T particleVolume, T airDensityAtGround, T densityAltitudeSlope, BasicParticleGravity<T> gravity);
+        BasicParticleLighterThanAir();
 
         /**
          * Applies the spring force to the given particle.
          */
-        virtual void updateForce(Particle* particle, real duration);
+        virtual void updateForce(BasicParticle<T>* particle, T duration);
     };
+
+    /**
+     * The force generators and registry of the library's own real
+     * type.
+     */
+    typedef BasicParticleForceGenerator<real> ParticleForceGenerator;
+    typedef BasicParticleRegionForceGenerator<real> ParticleRegionForceGenerator;
+    typedef BasicParticleForceRegistry<real> ParticleForceRegistry;
+    typedef BasicParticleGravity<real> ParticleGravity;
+    typedef BasicParticleDrag<real> ParticleDrag;
+    typedef BasicParticlePointGravity<real> ParticlePointGravity;
+    typedef BasicParticleUplift<real> ParticleUplift;
+    typedef BasicParticleBlast<real> ParticleBlast;
+    typedef BasicParticleSpring<real> ParticleSpring;
+    typedef BasicParticleAnchoredSpring<real> ParticleAnchoredSpring;
+    typedef BasicParticleBungee<real> ParticleBungee;
+    typedef BasicParticleBuoyancy<real> ParticleBuoyancy;
+    typedef BasicParticleBuoyancyZone<real> ParticleBuoyancyZone;
+    typedef BasicParticleLighterThanAir<real> ParticleLighterThanAir;
+
+    // The force calculations a ForceStack fuses are inlined.
+
+    template <typename T>
+    inline bool BasicParticleGravity<T>::accumulateForce(const BasicVector3<T> &,
+        const BasicVector3<T> &, T inverseMass, BasicVector3<T> *force) const
+    {
+        if (inverseMass <= 0.0f) return false;
+        *force += gravity * (((T)1.0)/inverseMass);
+        return true;
+    }
+
+    template <typename T>
+    inline bool BasicParticleDrag<T>::accumulateForce(const BasicVector3<T> &,
+        const BasicVector3<T> &velocity, T, BasicVector3<T> *force) const
+    {
+        T speed = velocity.magnitude();
+        if (speed <= 0) return false;
+
+        // The force has magnitude k1 * speed + k2 * speed^2, so
+        // scaling the velocity by k1 + k2 * speed saves normalising it.
+        *force += velocity * -(k1 + k2 * speed);
+        return true;
+    }
+
+    template <typename T>
+    inline bool BasicParticleBuoyancy<T>::accumulateForce(const BasicVector3<T> &position,
+        const BasicVector3<T> &, T, BasicVector3<T> *force) const
+    {
+        T depth = position.y;
+
+        // Out of the water there is no force, fully submerged there is
+        // the maximum, and in between it is proportional to depth (see
+        // updateForce).
+        if (depth >= waterHeight + maxDepth) return false;
+        if (depth <= waterHeight - maxDepth)
+        {
+            force->y += liquidDensity * volume;
+        }
+        else
+        {
+            force->y += liquidDensity * volume * (depth - maxDepth - waterHeight) / (2 * maxDepth);
+        }
+        return true;
+    }
 }
 
 
@@ -0,0 +1,201 @@
+/*
+ * Interface file for fused stacks of force generators.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains ForceStack, which fuses several force generators
+ * into one. Particles often get the same few forces, such as gravity
+ * and buoyancy. Registered separately, each is a virtual call and a
+ * read and write of the particle's accumulator. A stack of them sums
+ * their forces for each particle in one loop, with every generator's
+ * calculation inlined, and adds the sum to the accumulator once.
+ *
+ * A generator can go in a stack if it has an inline accumulateForce
+ * method, as ParticleGravity, ParticleDrag and ParticleBuoyancy do:
+ *
+ *     bool accumulateForce(const Vector3 &position,
+ *         const Vector3 &velocity, real inverseMass,
+ *         Vector3 *force) const;
+ *
+ * which adds its force on a particle in the given state to the sum,
+ * and returns false if it has no force to add.
+ */
+#ifndef CYCLONE_PFORCESTACK_H
+#define CYCLONE_PFORCESTACK_H
+
+#include "pfgen.h"
+#include "pstore.h"
+#include "jobs.h"
+
+namespace cyclone {
+
+    /**
+     * Holds a list of force generators and sums their forces. The
+     * list is unrolled at compile time, so the sum is a straight run
+     * of inlined calculations.
+     */
+    template <class... Generators>
+    struct ForceTerms;
+
+    template <>
+    struct ForceTerms<>
+    {
+        bool accumulate(const Vector3 &, const Vector3 &, real, Vector3 *) const
+        {
+            return false;
+        }
+    };
+
+    template <class First, class... Rest>
+    struct ForceTerms<First, Rest...>
+    {
+        const First* first;
+        ForceTerms<Rest...> rest;
+
+        ForceTerms(const First &first, const Rest&... rest)
+            : first(&first), rest(rest...) {}
+
+        /**
+         * Adds each generator's force on a particle in the given
+         * state to the sum, in order. Returns true if any of them had
+         * a force to add.
+         */
+        bool accumulate(const Vector3 &position, const Vector3 &velocity,
+            real inverseMass, Vector3 *force) const
+        {
+            bool applied = first->accumulateForce(position, velocity, inverseMass, force);
+            return rest.accumulate(position, velocity, inverseMass, force) || applied;
+        }
+    };
+
+    /**
+     * A force generator that applies the forces of all the given
+     * generators. It holds the generators by reference, so they must
+     * outlive it, and changes to them apply to the stack.
+     *
+     * The stack can be registered with a force registry like any
+     * other generator, or applied straight to a particle store. A
+     * particle gets exactly the force it would from the generators
+     * registered one after another, and is woken in the same way:
+     * only if one of them has a force for it.
+     */
+    template <class... Generators>
+    class ForceStack : public ParticleForceGenerator
+    {
+    protected:
+
+        /**
+         * Holds the generators.
+         */
+        ForceTerms<Generators...> terms;
+
+        /**
+         * Applies the forces to a range of a particle store.
+         */
+        struct StoreBody
+        {
+            const ForceTerms<Generators...>* terms;
+            const Vector3* positions;
+            const Vector3* velocities;
+            const real* inverseMasses;
+            Vector3* forces;
+
+            void operator()(unsigned begin, unsigned end)
+            {
+                for (unsigned i = begin; i < end; i++)
+                {
+                    Vector3 force;
+                    if (terms->accumulate(positions[i], velocities[i],
+                        inverseMasses[i], &force))
+                    {
+                        forces[i] += force;
+                    }
+                }
+            }
+        };
+
+        /**
+         * Sets up a body for the whole of the given store.
+         */
+        StoreBody makeBody(ParticleStore &store) const
+        {
+            StoreBody body;
+            body.terms = &terms;
+            body.positions = store.getPositions();
+            body.velocities = store.getVelocities();
+            body.inverseMasses = store.getInverseMasses();
+            body.forces = store.getForceAccumulators();
+            return body;
+        }
+
+    public:
+
+        /**
+         * Creates a stack of the given generators.
+         */
+        ForceStack(const Generators&... generators) : terms(generators...) {}
+
+        /**
+         * Applies the forces to the given particle.
+         */
+        virtual void updateForce(Particle* particle, real duration)
+        {
+            Vector3 force;
+            if (terms.accumulate(particle->getPosition(), particle->getVelocity(),
+                particle->getInverseMass(), &force))
+            {
+                particle->addForce(force);
+            }
+        }
+
+        /**
+         * Applies the forces to each of the given particles.
+         */
+        virtual void updateForces(Particle* const* particles, size_t count, real duration)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                Particle* particle = particles[i];
+                Vector3 force;
+                if (terms.accumulate(particle->getPosition(), particle->getVelocity(),
+                    particle->getInverseMass(), &force))
+                {
+                    particle->addForce(force);
+                }
+            }
+        }
+
+        /**
+         * Applies the forces to every particle in the given store, in
+         * a single pass over its arrays.
+         */
+        void updateForces(ParticleStore &store, real duration)
+        {
+            StoreBody body = makeBody(store);
+            body(0, store.size());
+        }
+
+        /**
+         * Applies the forces to every particle in the given store,
+         * sharing the work between the workers of the given job
+         * system.
+         */
+        void updateForces(ParticleStore &store, real duration, JobSystem &jobs)
+        {
+            StoreBody body = makeBody(store);
+            jobs.parallelFor(store.size(), 0, body);
+        }
+    };
+}
+
+#endif // CYCLONE_PFORCESTACK_H
@@ -0,0 +1,203 @@
+/*
+ * Interface file for mutual gravitation between particles.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a force generator that makes a set of particles
+ * attract one another, using a Barnes-Hut octree so that the cost
+ * grows as N log N rather than N squared.
+ */
+#ifndef CYCLONE_PGRAVITY_H
+#define CYCLONE_PGRAVITY_H
+
+#include <vector>
+#include "pfgen.h"
+
+namespace cyclone {
+
+    /**
+     * A force generator that makes a set of bodies attract each
+     * other. The falloff is the same as ParticlePointGravity's: the
+     * acceleration towards a body is gravityScalar times its mass,
+     * divided by the distance raised to the power 1.5. A softening
+     * length is added to the distance so close encounters don't
+     * produce enormous forces.
+     *
+     * The bodies are sorted into an octree. For each particle the
+     * tree is walked from the root, and any node that is small
+     * compared to its distance from the particle (its size divided by
+     * its distance is less than the opening angle) is treated as a
+     * single body at its centre of mass.
+     *
+     * The tree is rebuilt by prepareForces, which a registry calls
+     * once each time it updates forces, so the generator works the
+     * same whether the registry is batched, unbatched or threaded.
+     * updateForce and updateForces only read the tree, so code that
+     * calls them without a registry must call prepareForces (or
+     * buildTree) once per step first.
+     */
+    class ParticleMutualGravity : public ParticleForceGenerator
+    {
+    protected:
+
+        /**
+         * Holds one node of the octree. Leaves hold a range of the
+         * bodies array, other nodes a range of the nodes array.
+         */
+        struct Node
+        {
+            Vector3 centreOfMass;
+            real mass;
+            real size;
+            unsigned first;
+            unsigned count;
+            bool leaf;
+        };
+
+        /**
+         * Holds the position and mass of a body, copied out of its
+         * particle when the tree is built.
+         */
+        struct Body
+        {
+            Vector3 position;
+            real mass;
+            const Particle* particle;
+        };
+
+        /**
+         * Holds the scalar strength of the attraction.
+         */
+        real gravityScalar;
+
+        /**
+         * Holds the opening angle. Zero opens every node, giving the
+         * exact (and slow) answer.
+         */
+        real openingAngle;
+
+        /**
+         * Holds the softening length.
+         */
+        real softening;
+
+        /**
+         * Holds the particles that attract one another.
+         */
+        std::vector<Particle*> particles;
+
+        /**
+         * Holds the octree built by buildTree. The root is node zero.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the bodies, sorted so each leaf's bodies are together.
+         */
+        std::vector<Body> bodies;
+
+        /**
+         * Holds scratch space used when sorting bodies into octants.
+         */
+        std::vector<Body> scratch;
+
+        /**
+         * Builds the given node from the range of bodies, and the
+         * nodes beneath it.
+         */
+        void buildNode(unsigned node, unsigned begin, unsigned end,
+            const Vector3 &centre, real halfSize, unsigned depth);
+
+    public:
+
+        /**
+         * Creates the generator with the given strength, opening
+         * angle and softening length.
+         */
+        ParticleMutualGravity(real gravityScalar,
+            real openingAngle = 0.5f, real softening = 0.1f);
+
+        /**
+         * Adds a body to the set that attract one another. Particles
+         * with infinite mass don't attract anything.
+         */
+        void addParticle(Particle* particle);
+
+        /**
+         * Adds each particle in the given array as a body.
+         */
+        void addParticles(Particle* particles, unsigned count);
+
+        /**
+         * Removes all the bodies.
+         */
+        void clearParticles();
+
+        /**
+         * Sets the opening angle.
+         */
+        void setOpeningAngle(real openingAngle);
+
+        /**
+         * Sets the softening length.
+         */
+        void setSoftening(real softening);
+
+        /**
+         * Returns the scalar strength of the attraction.
+         */
+        real getGravityScalar() const;
+
+        /**
+         * Returns the softening length.
+         */
+        real getSoftening() const;
+
+        /**
+         * Sorts the bodies into the octree at their current positions.
+         */
+        void buildTree();
+
+        /**
+         * Returns the gravitational acceleration at the given
+         * position, leaving out the attraction of the given particle
+         * (which may be NULL).
+         */
+        Vector3 getAcceleration(const Vector3 &position, const Particle* self) const;
+
+        /**
+         * Applies the attraction of the bodies to the given particle,
+         * using the tree from the last call to buildTree.
+         */
+        virtual void updateForce(Particle* particle, real duration);
+
+        /**
+         * Applies the attraction of the bodies to each of the given
+         * particles, using the tree from the last call to buildTree.
+         */
+        virtual void updateForces(Particle* const* particles, size_t count, real duration);
+
+        /**
+         * Rebuilds the tree at the bodies' current positions.
+         */
+        virtual void prepareForces(real duration);
+
+        /**
+         * Moves the bodies with their particles, keeping them in
+         * memory order.
+         */
+        virtual void remapParticles(const ParticleRemap &remap);
+    };
+}
+
+#endif // CYCLONE_PGRAVITY_H
@@ -0,0 +1,278 @@
+/*
+ * Interface file for the implicit spring network integrator.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a network of springs that is integrated with
+ * backward Euler rather than the explicit step in Particle::integrate,
+ * so stiff springs stay stable at large timesteps.
+ */
+#ifndef CYCLONE_PIMPLICIT_H
+#define CYCLONE_PIMPLICIT_H
+
+#include <map>
+#include <vector>
+#include "particle.h"
+#include "preorder.h"
+
+namespace cyclone {
+
+
+    /**
+     * A set of particles joined by springs, integrated implicitly.
+     *
+     * Each step solves the backward Euler equation for the change in
+     * velocity,
+     *
+     *     (M - h^2 K) dv = h (f + h K v)
+     *
+     * where K is the stiffness matrix of the springs, by conjugate
+     * gradients started from the last step's answer. The matrix has a
+     * 3x3 block for each particle and for each pair of particles
+     * joined by a spring; its layout is worked out once from the
+     * spring topology and only its values change from step to step.
+     *
+     * The network integrates its own particles: forces from the
+     * particles' accumulators and their acceleration are included,
+     * and so is their damping, but they must not also be integrated
+     * with Particle::integrate. Particles with infinite mass stay
+     * where they are, and can be used to pin the network.
+     */
+    class ParticleSpringNetwork
+    {
+    public:
+
+        /**
+         * The kinds of spring the network can hold, matching the
+         * force generators in pfgen.h.
+         */
+        enum SpringType
+        {
+            SPRING,
+            ANCHORED_SPRING,
+            BUNGEE
+        };
+
+    protected:
+
+        /**
+         * Holds one spring. Anchored springs use the anchor in place
+         * of a second particle.
+         */
+        struct Spring
+        {
+            SpringType type;
+            unsigned particle[2];
+            const Vector3* anchor;
+            real springConstant;
+            real restLength;
+
+            /**
+             * Holds the position in the block array of the blocks
+             * this spring adds to: (0,0), (0,1), (1,0) and (1,1).
+             */
+            unsigned block[4];
+        };
+
+        /**
+         * Holds a 3x3 block of the matrix, in row order.
+         */
+        struct Block
+        {
+            real data[9];
+        };
+
+        /**
+         * Holds the particles in the network.
+         */
+        std::vector<Particle*> particles;
+
+        /**
+         * Maps particles to their index, for the convenience methods
+         * that take particle pointers.
+         */
+        std::map<Particle*, unsigned> particleIndex;
+
+        /**
+         * Holds the springs.
+         */
+        std::vector<Spring> springs;
+
+        /**
+         * True if the springs or particles have changed since the
+         * matrix layout was worked out.
+         */
+        bool topologyDirty;
+
+        /**
+         * Holds the matrix in block compressed sparse row form: the
+         * blocks of row i are at [rowStart[i], rowStart[i+1]), and
+         * blockColumn gives the column of each.
+         */
+        std::vector<unsigned> rowStart;
+        std::vector<unsigned> blockColumn;
+        std::vector<Block> blocks;
+
+        /**
+         * Holds the position of each row's diagonal block.
+         */
+        std::vector<unsigned> diagonalBlock;
+
+        /**
+         * Holds the per-particle vectors used by the solver.
+         */
+        std::vector<Vector3> force;
+        std::vector<Vector3> stiffnessVelocity;
+        std::vector<Vector3> rhs;
+        std::vector<Vector3> deltaVelocity;
+        std::vector<Vector3> residual;
+        std::vector<Vector3> direction;
+        std::vector<Vector3> product;
+        std::vector<Vector3> preconditioned;
+        std::vector<Vector3> inverseDiagonal;
+
+        /**
+         * Holds whether each particle can move.
+         */
+        std::vector<bool> movable;
+
+        /**
+         * Holds the most conjugate gradient iterations per step.
+         */
+        unsigned maxIterations;
+
+        /**
+         * Holds the iterations used in the last step.
+         */
+        unsigned iterationsUsed;
+
+        /**
+         * Holds the residual, relative to the right hand side, at
+         * which the solve stops.
+         */
+        real tolerance;
+
+        /**
+         * Works out the matrix layout from the springs.
+         */
+        void buildTopology();
+
+        /**
+         * Works out the forces, the matrix and the right hand side
+         * for a step of the given duration.
+         */
+        void assemble(real duration);
+
+        /**
+         * Multiplies the matrix by the given vector.
+         */
+        void multiply(const std::vector<Vector3> &in, std::vector<Vector3> &out) const;
+
+        /**
+         * Solves for deltaVelocity, starting from its current value.
+         */
+        void solve();
+
+        /**
+         * Adds the spring to the list and marks the layout as dirty.
+         */
+        void addSpring(SpringType type, unsigned a, unsigned b,
+            const Vector3* anchor, real springConstant, real restLength);
+
+    public:
+
+        /**
+         * Creates an empty network.
+         */
+        ParticleSpringNetwork(unsigned maxIterations = 50, real tolerance = 1e-4f);
+
+        /**
+         * Adds a particle to the network, if it isn't there already,
+         * and returns its index.
+         */
+        unsigned addParticle(Particle* particle);
+
+        /**
+         * Adds a spring between the particles with the given indices.
+         */
+        void addSpring(unsigned a, unsigned b, real springConstant, real restLength);
+
+        /**
+         * Adds a spring between the given particles, adding them to
+         * the network if need be.
+         */
+        void addSpring(Particle* a, Particle* b, real springConstant, real restLength);
+
+        /**
+         * Adds a spring between the given particle and a fixed point.
+         * The anchor is read at every step, so it can be moved.
+         */
+        void addAnchoredSpring(Particle* particle, const Vector3* anchor,
+            real springConstant, real restLength);
+
+        /**
+         * Adds a bungee between the given particles: a spring that
+         * only pulls, when stretched past its rest length.
+         */
+        void addBungee(Particle* a, Particle* b, real springConstant, real restLength);
+
+        /**
+         * Removes every particle and spring.
+         */
+        void clear();
+
+        /**
+         * Updates the particles after their array has been
+         * reordered. The network isn't held by a world, so when its
+         * particles belong to one this is called with the world's
+         * ParticleWorld::getLastReorder whenever its reorder count
+         * changes. The springs keep their particles' indices in the
+         * network, so the matrix layout is still good.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Returns the number of particles in the network.
+         */
+        unsigned getParticleCount() const;
+
+        /**
+         * Returns the number of springs in the network.
+         */
+        unsigned getSpringCount() const;
+
+        /**
+         * Sets the most conjugate gradient iterations per step.
+         */
+        void setMaxIterations(unsigned maxIterations);
+
+        /**
+         * Sets the relative residual at which the solve stops.
+         */
+        void setTolerance(real tolerance);
+
+        /**
+         * Returns the conjugate gradient iterations used by the last
+         * step.
+         */
+        unsigned getIterationsUsed() const;
+
+        /**
+         * Integrates the particles in the network forward in time by
+         * the given amount, and clears their force accumulators.
+         */
+        void integrate(real duration);
+    };
+}
+
+#endif // CYCLONE_PIMPLICIT_H
@@ -0,0 +1,286 @@
+/*
+ * Interface file for the particle integration policies.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains integrators a particle world can use in place
+ * of Particle::integrate. Each integration scheme is a policy class,
+ * and ParticlePolicyIntegrator turns a policy into an integrator,
+ * with the policy's code inlined into its loops so no particle pays
+ * for a choice of scheme.
+ *
+ * The world applies its forces once at the start of each step.
+ * Schemes with more than one stage move the particles to each
+ * stage's state and ask the world to apply its forces again there,
+ * so a step costs one force evaluation per stage:
+ *
+ * - SemiImplicitEuler: one stage, exactly what Particle::integrate
+ *   does.
+ *
+ * - VelocityVerlet: two stages. Positions and velocities are both
+ *   second order and stay in step with each other, so an orbit's
+ *   energy error is far smaller than Euler's at the same timestep.
+ *
+ * - RungeKutta4: four stages, fourth order, for smooth forces where
+ *   accuracy matters more than cost. Unlike the other two it isn't
+ *   symplectic, so over very many orbits its energy slowly drifts.
+ *
+ * Damping is applied to the velocity at the end of each step, and
+ * sleeping works as it does for Particle::integrate.
+ */
+#ifndef CYCLONE_PINTEGRATOR_H
+#define CYCLONE_PINTEGRATOR_H
+
+#include <assert.h>
+#include <vector>
+#include "pworld.h"
+#include "jobs.h"
+
+namespace cyclone {
+
+    /**
+     * Identifies a stage of an integration scheme, so each stage can
+     * be a separate overload chosen at compile time.
+     */
+    template <unsigned Stage>
+    struct IntegrationStage {};
+
+    /**
+     * Semi-implicit Euler: the velocity is updated from the force,
+     * then the position from the new velocity. This is the engine's
+     * default scheme.
+     */
+    struct SemiImplicitEuler
+    {
+        enum { Stages = 1, ScratchVectors = 0 };
+
+        static void stage(IntegrationStage<0>, Particle &particle,
+            Vector3*, real duration, DampingCache &cache)
+        {
+            particle.integrate(duration, cache);
+        }
+    };
+
+    /**
+     * Velocity Verlet: half the velocity change is applied from the
+     * force at the start of the step, the particle moves, and the
+     * other half is applied from the force where it ends up.
+     */
+    struct VelocityVerlet
+    {
+        enum { Stages = 2, ScratchVectors = 0 };
+
+        static void stage(IntegrationStage<0>, Particle &particle,
+            Vector3*, real duration, DampingCache &)
+        {
+            const real halfDuration = duration * (real)0.5;
+            particle.velocity.addScaledVector(particle.acceleration, halfDuration);
+            particle.velocity.addScaledVector(particle.forceAccum,
+                particle.inverseMass * halfDuration);
+            particle.position.addScaledVector(particle.velocity, duration);
+            particle.clearAccumulator();
+        }
+
+        static void stage(IntegrationStage<1>, Particle &particle,
+            Vector3*, real duration, DampingCache &cache)
+        {
+            const real halfDuration = duration * (real)0.5;
+            particle.velocity.addScaledVector(particle.acceleration, halfDuration);
+            particle.velocity.addScaledVector(particle.forceAccum,
+                particle.inverseMass * halfDuration);
+            particle.velocity *= cache.getFactor(particle.damping, duration);
+            particle.clearAccumulator();
+            if (particle.canSleep) particle.updateMotion(cache.getFactor(0.5f, duration));
+        }
+    };
+
+    /**
+     * The classical fourth order Runge-Kutta scheme. The scratch
+     * vectors hold the position and velocity at the start of the
+     * step, and the weighted sums of the stages' velocities and
+     * accelerations.
+     */
+    struct RungeKutta4
+    {
+        enum { Stages = 4, ScratchVectors = 4 };
+
+        /**
+         * Adds the weighted velocity and acceleration of the stage
+         * just evaluated to the sums, and moves the particle to the
+         * state the next stage is evaluated at, the given fraction of
+         * the step along.
+         */
+        static void advance(Particle &particle, Vector3* scratch,
+            real weight, real fraction, real duration)
+        {
+            Vector3 acceleration = particle.acceleration;
+            acceleration.addScaledVector(particle.forceAccum, particle.inverseMass);
+
+            scratch[2].addScaledVector(particle.velocity, weight);
+            scratch[3].addScaledVector(acceleration, weight);
+
+            const real step = duration * fraction;
+            particle.position = scratch[0];
+            particle.position.addScaledVector(particle.velocity, step);
+            particle.velocity = scratch[1];
+            particle.velocity.addScaledVector(acceleration, step);
+            particle.clearAccumulator();
+        }
+
+        static void stage(IntegrationStage<0>, Particle &particle,
+            Vector3* scratch, real duration, DampingCache &)
+        {
+            scratch[0] = particle.position;
+            scratch[1] = particle.velocity;
+            scratch[2].clear();
+            scratch[3].clear();
+            advance(particle, scratch, 1, 0.5f, duration);
+        }
+
+        static void stage(IntegrationStage<1>, Particle &particle,
+            Vector3* scratch, real duration, DampingCache &)
+        {
+            advance(particle, scratch, 2, 0.5f, duration);
+        }
+
+        static void stage(IntegrationStage<2>, Particle &particle,
+            Vector3* scratch, real duration, DampingCache &)
+        {
+            advance(particle, scratch, 2, 1, duration);
+        }
+
+        static void stage(IntegrationStage<3>, Particle &particle,
+            Vector3* scratch, real duration, DampingCache &cache)
+        {
+            Vector3 acceleration = particle.acceleration;
+            acceleration.addScaledVector(particle.forceAccum, particle.inverseMass);
+            scratch[2] += particle.velocity;
+            scratch[3] += acceleration;
+
+            const real sixth = duration / (real)6;
+            particle.position = scratch[0];
+            particle.position.addScaledVector(scratch[2], sixth);
+            particle.velocity = scratch[1];
+            particle.velocity.addScaledVector(scratch[3], sixth);
+            particle.velocity *= cache.getFactor(particle.damping, duration);
+            particle.clearAccumulator();
+            if (particle.canSleep) particle.updateMotion(cache.getFactor(0.5f, duration));
+        }
+    };
+
+    /**
+     * An integrator a particle world can be given in place of its
+     * own integration. See ParticleWorld::setIntegrator.
+     */
+    class ParticleIntegrator
+    {
+    public:
+        virtual ~ParticleIntegrator() {}
+
+        /**
+         * Integrates the world's particles forward by the given
+         * duration. The world has already applied its forces for the
+         * start of the step.
+         */
+        virtual void integrate(ParticleWorld &world, real duration) = 0;
+    };
+
+    /**
+     * Integrates a world's particles with the scheme given by the
+     * policy. Each stage is a separate loop over the particles, split
+     * between the world's job system if it has one, and the world's
+     * forces are applied again before every stage after the first.
+     */
+    template <class Policy>
+    class ParticlePolicyIntegrator : public ParticleIntegrator
+    {
+    protected:
+
+        /**
+         * Holds the policy's scratch vectors for each particle.
+         */
+        std::vector<Vector3> scratch;
+
+        /**
+         * Runs one stage over a range of the particles.
+         */
+        template <unsigned Stage>
+        struct StageBody
+        {
+            Particle* particles;
+            Vector3* scratch;
+            real duration;
+
+            void operator()(unsigned begin, unsigned end)
+            {
+                DampingCache cache;
+                for (unsigned i = begin; i < end; i++)
+                {
+                    Particle &particle = particles[i];
+
+                    // We don't integrate things with zero mass, or
+                    // things that are asleep.
+                    if (particle.getInverseMass() <= 0) continue;
+                    if (!particle.getAwake())
+                    {
+                        particle.clearAccumulator();
+                        continue;
+                    }
+
+                    Policy::stage(IntegrationStage<Stage>(), particle,
+                        scratch + i * Policy::ScratchVectors, duration, cache);
+                }
+            }
+        };
+
+        template <unsigned Stage>
+        void runStages(ParticleWorld &world, real duration, IntegrationStage<Stage>)
+        {
+            const unsigned count = world.getParticleCount();
+            if (Stage > 0) world.applyForces(duration);
+
+            StageBody<Stage> body;
+            body.particles = world.getParticles();
+            body.scratch = scratch.empty() ? 0 : &scratch[0];
+            body.duration = duration;
+
+            JobSystem* jobs = world.getJobSystem();
+            if (jobs) jobs->parallelFor(count, 0, body);
+            else body(0, count);
+
+            runStages(world, duration, IntegrationStage<Stage + 1>());
+        }
+
+        void runStages(ParticleWorld &, real, IntegrationStage<Policy::Stages>)
+        {
+        }
+
+    public:
+
+        virtual void integrate(ParticleWorld &world, real duration)
+        {
+            assert(duration > 0.0);
+            scratch.resize(world.getParticleCount() * Policy::ScratchVectors);
+            runStages(world, duration, IntegrationStage<0>());
+        }
+    };
+
+    /**
+     * The integrators for each of the schemes.
+     */
+    typedef ParticlePolicyIntegrator<SemiImplicitEuler> ParticleEulerIntegrator;
+    typedef ParticlePolicyIntegrator<VelocityVerlet> ParticleVerletIntegrator;
+    typedef ParticlePolicyIntegrator<RungeKutta4> ParticleRungeKuttaIntegrator;
+}
+
+#endif // CYCLONE_PINTEGRATOR_H
@@ -0,0 +1,357 @@
+/*
+ * Interface file for resolving contacts in independent islands.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a contact resolver that splits the contacts into
+ * groups that share no moving particles, so the groups can be
+ * resolved at the same time on different threads.
+ */
+#ifndef CYCLONE_PISLANDS_H
+#define CYCLONE_PISLANDS_H
+
+#include <vector>
+#include "pcontacts.h"
+
+namespace cyclone {
+
+    class JobSystem;
+    class FrameArena;
+
+    /**
+     * Resolves contacts island by island.
+     *
+     * An island is a set of contacts joined through the particles
+     * they move: two contacts are in the same island if they share a
+     * particle with finite mass, or are joined through a chain of
+     * such contacts. Particles with infinite mass (and the scenery)
+     * don't join islands, as no contact can change them. Contacts in
+     * different islands can't affect one another, so the islands are
+     * shared between the workers of a job system, each resolved by an
+     * ordinary ParticleContactResolver belonging to the worker.
+     *
+     * An island with many contacts would leave the other workers
+     * waiting, so islands above a threshold size are instead coloured:
+     * contacts of the same colour share no moving particle. Such an
+     * island is resolved by a fixed number of sweeps, each resolving
+     * every contact once, colour by colour, with the contacts of each
+     * colour shared between the workers.
+     *
+     * Either way, the results don't depend on the number of workers.
+     */
+    class ParticleIslandResolver
+    {
+    protected:
+
+        /**
+         * Holds what the resolver knows about each contact.
+         */
+        struct ContactInfo
+        {
+            /**
+             * Holds the index of each moving particle, or ~0.
+             */
+            unsigned node[2];
+            unsigned island;
+            unsigned colour;
+        };
+
+        /**
+         * Holds the moving particles found in the contacts, sorted by
+         * address.
+         */
+        std::vector<Particle*> nodeParticle;
+
+        /**
+         * Holds the union-find forest over the moving particles.
+         */
+        std::vector<unsigned> parent;
+        std::vector<unsigned> treeSize;
+
+        /**
+         * Holds the information for each contact, in the current
+         * order of the contact array.
+         */
+        std::vector<ContactInfo> info;
+
+        /**
+         * Holds scratch space for sorting the contact array. The
+         * copy of the contacts comes from the frame arena if there is
+         * one, and otherwise from contactStorage.
+         */
+        ParticleContact* contactScratch;
+        std::vector<ParticleContact> contactStorage;
+        std::vector<ContactInfo> infoScratch;
+        std::vector<unsigned> sortStart;
+        std::vector<unsigned> sortCursor;
+
+        /**
+         * Holds where each island starts in the sorted contact array.
+         * There is one extra entry at the end.
+         */
+        std::vector<unsigned> islandStart;
+
+        /**
+         * Holds the islands that are coloured.
+         */
+        std::vector<unsigned> colouredIslands;
+
+        /**
+         * Holds where each of an island's colours start in the sorted
+         * contact array, and where each island's entries start in that
+         * list. Uncoloured islands have a single colour.
+         */
+        std::vector<unsigned> colourStart;
+        std::vector<unsigned> islandColour;
+
+        /**
+         * Holds the colours taken at each moving particle while
+         * colouring.
+         */
+        std::vector<unsigned long long> colourMask;
+
+        /**
+         * Holds how far each moving particle has been moved during
+         * the sweeps of a coloured island, and the penetration of
+         * each contact before any were resolved.
+         */
+        std::vector<Vector3> displacement;
+        std::vector<real> penetration;
+
+        /**
+         * Holds one resolver for each worker.
+         */
+        std::vector<ParticleContactResolver> resolvers;
+
+        /**
+         * Holds the contact resolutions made by each worker in the
+         * last resolveContacts, by its resolver and in the sweeps
+         * over coloured islands.
+         */
+        std::vector<unsigned> workerIterations;
+
+        /**
+         * Holds what each worker's resolver left unresolved in the
+         * islands it resolved in the last resolveContacts.
+         */
+        struct WorkerResiduals
+        {
+            real velocity;
+            real penetration;
+            bool converged;
+        };
+        std::vector<WorkerResiduals> workerResiduals;
+
+        /**
+         * Holds the arena the contact scratch space is taken from, or
+         * NULL.
+         */
+        FrameArena* arena;
+
+        /**
+         * Holds the number of iterations each island's resolver may
+         * use, or zero to use twice the island's contact count.
+         */
+        unsigned iterations;
+
+        /**
+         * Holds the way each island's resolver finds the next contact.
+         */
+        ParticleContactResolver::ResolveMode mode;
+
+        /**
+         * Holds the closing velocity and penetration a contact may
+         * be left with, as for ParticleContactResolver.
+         */
+        real velocityTolerance;
+        real penetrationTolerance;
+
+        /**
+         * Holds the largest closing velocity and penetration left
+         * after the last call to resolveContacts, and whether every
+         * island was then within the tolerances.
+         */
+        real velocityResidual;
+        real penetrationResidual;
+        bool converged;
+
+        /**
+         * Holds the smallest island that is coloured.
+         */
+        unsigned colourThreshold;
+
+        /**
+         * Holds the number of sweeps over a coloured island.
+         */
+        unsigned colourSweeps;
+
+        /**
+         * Returns the index of the given particle's node, or ~0 if it
+         * doesn't move.
+         */
+        unsigned findNode(const Particle* particle) const;
+
+        /**
+         * Union-find operations.
+         */
+        unsigned findRoot(unsigned node);
+        void join(unsigned a, unsigned b);
+
+        /**
+         * Colours the contacts of the given island and sorts them by
+         * colour.
+         */
+        void colourIsland(ParticleContact* contacts, unsigned island);
+
+        /**
+         * Resolves the uncoloured islands in the given range, using
+         * the resolver of the current worker.
+         */
+        void resolveIslands(ParticleContact* contacts, unsigned begin, unsigned end,
+            real duration, unsigned worker);
+
+        /**
+         * Resolves the contacts in the given range of one colour,
+         * counting them against the given worker.
+         */
+        void resolveColour(ParticleContact* contacts, unsigned begin, unsigned end,
+            real duration, unsigned worker);
+
+        /**
+         * Returns the total of workerIterations.
+         */
+        unsigned countIterations() const;
+
+        /**
+         * Brings the penetration of every contact of the coloured
+         * islands up to date with the moves of all the sweeps, and
+         * measures what those contacts leave unresolved if there are
+         * tolerances.
+         */
+        void finishColouredIslands(ParticleContact* contacts);
+
+        /**
+         * The job functions used to share islands and colours between
+         * workers.
+         */
+        static void islandJob(void* data, unsigned begin, unsigned end);
+        static void colourJob(void* data, unsigned begin, unsigned end);
+
+    public:
+
+        /**
+         * Creates a resolver. Islands with at least colourThreshold
+         * contacts are coloured and given colourSweeps sweeps.
+         */
+        ParticleIslandResolver(unsigned colourThreshold = 512, unsigned colourSweeps = 8);
+
+        /**
+         * Sets the number of iterations each island's resolver may
+         * use. Zero, the default, gives each island twice as many
+         * iterations as it has contacts.
+         */
+        void setIterations(unsigned iterations);
+
+        /**
+         * Sets the way each island's resolver finds the next contact.
+         */
+        void setMode(ParticleContactResolver::ResolveMode mode);
+
+        /**
+         * Sets the closing velocity and penetration a contact may be
+         * left with. Every island's resolver stops once its contacts
+         * are within them, and the sweeps over a coloured island skip
+         * contacts within them and stop once a sweep has nothing left
+         * to resolve.
+         */
+        void setTolerances(real velocityTolerance, real penetrationTolerance);
+
+        /**
+         * Sets the smallest island that is coloured and the number of
+         * sweeps it gets.
+         */
+        void setColouring(unsigned colourThreshold, unsigned colourSweeps);
+
+        /**
+         * Sets the arena the scratch space for sorting the contacts
+         * is taken from each partition, or NULL to keep it in the
+         * resolver. The arena must not be reset between a partition
+         * and the end of the resolveContacts that made it. A world
+         * given the resolver sets its own frame arena.
+         */
+        void setFrameArena(FrameArena* arena);
+
+        /**
+         * Splits the contacts into islands, reordering the array so
+         * each island's contacts are together (and, for coloured
+         * islands, each colour's contacts within it).
+         */
+        void partition(ParticleContact* contacts, unsigned numContacts);
+
+        /**
+         * Returns the number of islands found by the last partition.
+         */
+        unsigned getIslandCount() const;
+
+        /**
+         * Returns the range of the contact array holding the given
+         * island's contacts.
+         */
+        unsigned getIslandBegin(unsigned island) const;
+        unsigned getIslandEnd(unsigned island) const;
+
+        /**
+         * Returns the number of colours in the given island: one if
+         * it wasn't coloured.
+         */
+        unsigned getColourCount(unsigned island) const;
+
+        /**
+         * Partitions and resolves the given contacts for both
+         * penetration and velocity. The work is shared between the
+         * workers of the job system, if one is given.
+         */
+        void resolveContacts(ParticleContact* contacts, unsigned numContacts,
+            real duration, JobSystem* jobs = 0);
+
+        /**
+         * Returns the number of contact resolutions made by the last
+         * resolveContacts: the iterations of every island's resolver,
+         * plus each contact resolved by the sweeps over coloured
+         * islands.
+         */
+        unsigned getIterationsUsed() const;
+
+        /**
+         * Returns true if the last call to resolveContacts found every
+         * contact within the tolerances: each island's resolver
+         * converged, and each coloured island's last sweep had nothing
+         * to resolve.
+         */
+        bool hasConverged() const;
+
+        /**
+         * Returns the largest closing velocity and the largest
+         * penetration left among the contacts after the last call to
+         * resolveContacts. As for ParticleContactResolver, they are
+         * only measured when a tolerance is set, and are otherwise
+         * zero. They are gathered from the island resolvers and the
+         * coloured islands, so measuring them costs no extra pass
+         * over the other contacts.
+         */
+        real getVelocityResidual() const;
+        real getPenetrationResidual() const;
+    };
+}
+
+#endif // CYCLONE_PISLANDS_H
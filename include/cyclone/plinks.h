@@ -13,11 +13,14 @@
 #ifndef CYCLONE_PLINKS_H
 #define CYCLONE_PLINKS_H
 
+#include <vector>
 #include "core.h"
 #include "pcontacts.h"
 
 namespace cyclone {
 
+    class ParticleStore;
+
     /**
      * Links connect two particles together, generating a contact
      * if they violate the constraints of their link. It is used
@@ -40,6 +43,12 @@ namespace cyclone {
          */
         real currentLength() const;
 
+        /**
+         * Returns true if neither end of the link can be moving: each
+         * is either asleep or immovable.
+         */
+        bool isStill() const;
+
     public:
 
         /**
@@ -51,6 +60,19 @@ namespace cyclone {
          * cable wasn't overextended, or 1 if a contact was needed.
          */
         virtual unsigned addContact(ParticleContact* contact, unsigned limit) const = 0;
+
+        /**
+         * Gets the range of lengths this link allows, for solvers
+         * that treat links as distance constraints rather than
+         * generating contacts. Returns false if the link can't be
+         * expressed that way, which is the default.
+         */
+        virtual bool getLengthLimits(real* minLength, real* maxLength) const;
+
+        /**
+         * Moves the ends of the link with their particles.
+         */
+        virtual void remapParticles(const ParticleRemap &remap);
     };
 
     /**
@@ -76,6 +98,11 @@ namespace cyclone {
          * to keep the cable from overextended.
          */
         virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+
+        /**
+         * A cable allows any length up to its maximum.
+         */
+        virtual bool getLengthLimits(real* minLength, real* maxLength) const;
     };
 
     class ParticleRod : public ParticleLink
@@ -92,6 +119,180 @@ namespace cyclone {
          * to keep the rod from extended or compressing.
          */
         virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+
+        /**
+         * A rod allows only its own length.
+         */
+        virtual bool getLengthLimits(real* minLength, real* maxLength) const;
+    };
+
+    /**
+     * Holds any number of rods and cables between particles of one
+     * array, such as a world's, as a single contact generator, or
+     * between the particles of a particle store.
+     *
+     * Each link is a pair of indices into the array with a range of
+     * lengths; rods have a single length and cables allow anything up
+     * to their maximum. They are held in parallel arrays rather than
+     * as an object each, and addContact works out the length of every
+     * link in one tight loop before writing contacts for just the ones
+     * that are out of range. A rope of thousands of segments is then
+     * one generator rather than thousands of virtual calls.
+     *
+     * The contacts are the ones ParticleRod and ParticleCable would
+     * generate, except that a link exactly at its limit generates
+     * none.
+     *
+     * A store has no particle objects for contacts to refer to, so
+     * links in a store are kept in range by resolve, which corrects
+     * each link that is out of range in turn, straight on the store's
+     * arrays.
+     */
+    class ParticleLinkSet : public ParticleContactGenerator
+    {
+    protected:
+        /**
+         * Holds the array the links index into, or NULL if they
+         * index into a store.
+         */
+        Particle* particles;
+
+        /**
+         * Holds the store the links index into, or NULL.
+         */
+        ParticleStore* store;
+
+        /**
+         * Holds the indices of the particles at each end of each
+         * link.
+         */
+        std::vector<unsigned> first;
+        std::vector<unsigned> second;
+
+        /**
+         * Holds the range of lengths each link allows, squared for
+         * the length test, and its restitution.
+         */
+        std::vector<real> minLength;
+        std::vector<real> maxLength;
+        std::vector<real> minLengthSquared;
+        std::vector<real> maxLengthSquared;
+        std::vector<real> restitution;
+
+        /**
+         * Holds the vector from each link's first particle to its
+         * second and its squared length, worked out at the start of
+         * each call to addContact.
+         */
+        mutable std::vector<Vector3> offset;
+        mutable std::vector<real> lengthSquared;
+
+        /**
+         * Adds a link, returning its index.
+         */
+        unsigned addLink(unsigned a, unsigned b, real minLength,
+            real maxLength, real restitution);
+
+        /**
+         * Works out the offset and squared length of every link, from
+         * the store if there is one.
+         */
+        void measureLengths() const;
+
+    public:
+
+        /**
+         * Creates an empty set of links between particles of the
+         * given array.
+         */
+        ParticleLinkSet(Particle* particles = 0);
+
+        /**
+         * Sets the array the links index into.
+         */
+        void setParticles(Particle* particles);
+
+        /**
+         * Gets the array the links index into.
+         */
+        Particle* getParticles() const;
+
+        /**
+         * Sets the particle store the links index into, in place of
+         * an array of particles. Pass NULL to go back to the array.
+         */
+        void setStore(ParticleStore* store);
+
+        /**
+         * Gets the store the links index into, or NULL.
+         */
+        ParticleStore* getStore() const;
+
+        /**
+         * Adds a rod of the given length between the particles with
+         * the given indices, and returns the index of the link. Like
+         * ParticleRod it has no bounce.
+         */
+        unsigned addRod(unsigned a, unsigned b, real length);
+
+        /**
+         * Adds a cable of the given maximum length and restitution
+         * between the particles with the given indices, and returns
+         * the index of the link.
+         */
+        unsigned addCable(unsigned a, unsigned b, real maxLength, real restitution);
+
+        /**
+         * Removes every link.
+         */
+        void clear();
+
+        /**
+         * Returns the number of links.
+         */
+        unsigned size() const;
+
+        /**
+         * Gets the indices of the particles at the ends of the given
+         * link.
+         */
+        unsigned getFirst(unsigned link) const;
+        unsigned getSecond(unsigned link) const;
+
+        /**
+         * Gets the range of lengths the given link allows.
+         */
+        void getLengthLimits(unsigned link, real* minLength, real* maxLength) const;
+
+        /**
+         * Writes a contact for each link that is out of its range,
+         * up to the limit, and returns the number written. Links
+         * whose particles are both still generate nothing. The links
+         * must index an array of particles.
+         *
+         * A rod whose particles are at the same point has no direction
+         * to push them apart in, so it pushes the second particle up.
+         */
+        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+
+        /**
+         * Brings each link of a store that is out of range back to
+         * its limit, after a step of the given duration. As a contact
+         * would, it removes the velocity taking the link further out
+         * (bouncing cables by their restitution) and then moves the
+         * particles in proportion to their inverse masses. Each move
+         * is also added to the particle's velocity, divided by the
+         * duration, as the link solver does. The links are corrected
+         * one after another, each seeing the corrections before it.
+         * Returns the number of links corrected.
+         */
+        unsigned resolve(real duration);
+
+        /**
+         * Moves the ends of each link with their particles, if the
+         * remap is of the array the links index into.
+         */
+        virtual void remapParticles(const ParticleRemap &remap);
     };
 }
 
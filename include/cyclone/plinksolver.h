@@ -0,0 +1,271 @@
+/*
+ * Interface file for the position based link solver.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a solver that keeps particle links within their
+ * lengths by moving the particles directly, as an alternative to
+ * turning each link into a contact for the impulse resolver.
+ */
+#ifndef CYCLONE_PLINKSOLVER_H
+#define CYCLONE_PLINKSOLVER_H
+
+#include <vector>
+#include "plinks.h"
+
+namespace cyclone {
+
+    class JobSystem;
+
+    /**
+     * Treats links as distance constraints and satisfies them by
+     * sweeping over the whole list a fixed number of times, moving
+     * each pair of particles apart or together in proportion to their
+     * inverse masses. Every correction to a particle's position is
+     * also applied to its velocity (divided by the step duration), so
+     * the particles don't spring back on the next step.
+     *
+     * In Gauss-Seidel mode the constraints are taken one after
+     * another in the order they were added, each seeing the
+     * corrections made before it. Coloured mode is Gauss-Seidel too,
+     * but the constraints are first coloured so that no two of the
+     * same colour share a particle; the constraints in each colour
+     * are then independent, and are shared between the workers of a
+     * job system.
+     *
+     * In Jacobi mode every constraint is measured against the
+     * positions at the start of the sweep, and the corrections are
+     * applied together once all of them are known. Each particle
+     * moves by the mean of the corrections it was given, which keeps
+     * a particle between several violated constraints from being
+     * pushed too far. A Jacobi sweep needs no colouring and shares
+     * out well, but converges more slowly than a Gauss-Seidel one.
+     *
+     * In every mode the result doesn't depend on the number of
+     * workers.
+     *
+     * Links given to this solver shouldn't also be registered as
+     * contact generators, or they'll be resolved twice.
+     */
+    class ParticleLinkSolver
+    {
+    public:
+
+        /**
+         * The ways the solver can sweep over its constraints.
+         */
+        enum SolveMode
+        {
+            SOLVE_GAUSS_SEIDEL,
+            SOLVE_COLOURED,
+            SOLVE_JACOBI
+        };
+
+    protected:
+
+        /**
+         * Holds one distance constraint.
+         */
+        struct Constraint
+        {
+            Particle* particle[2];
+            real minLength;
+            real maxLength;
+        };
+
+        /**
+         * Holds the constraints, in the order they were added.
+         */
+        std::vector<Constraint> constraints;
+
+        /**
+         * Holds the correction one constraint asks for in a Jacobi
+         * sweep.
+         */
+        struct Correction
+        {
+            Vector3 correction;
+            bool active;
+        };
+
+        /**
+         * Holds the constraints sorted by colour, for coloured mode.
+         */
+        std::vector<Constraint> coloured;
+
+        /**
+         * Holds where each colour starts in the coloured list. There
+         * is one extra entry at the end.
+         */
+        std::vector<unsigned> colourStart;
+
+        /**
+         * True if the constraints have changed since they were
+         * coloured.
+         */
+        bool colourDirty;
+
+        /**
+         * Holds each particle the constraints move, in the order the
+         * constraints first use them, for Jacobi mode.
+         */
+        std::vector<Particle*> ends;
+
+        /**
+         * Holds where each particle's entries start in the end links.
+         * There is one extra entry at the end.
+         */
+        std::vector<unsigned> endStart;
+
+        /**
+         * Holds the constraint ends that move each particle, in
+         * constraint order. Each is the constraint index times two,
+         * plus one for the constraint's second particle.
+         */
+        std::vector<unsigned> endLinks;
+
+        /**
+         * Holds the correction of each constraint in the current
+         * Jacobi sweep.
+         */
+        std::vector<Correction> corrections;
+
+        /**
+         * True if the constraints have changed since the end links
+         * were built.
+         */
+        bool endsDirty;
+
+        /**
+         * Holds the number of sweeps per step.
+         */
+        unsigned iterations;
+
+        /**
+         * Holds the sweep order.
+         */
+        SolveMode mode;
+
+        /**
+         * Sorts the constraints into colours.
+         */
+        void colourConstraints();
+
+        /**
+         * Lists the constraint ends moving each particle.
+         */
+        void buildEnds();
+
+        /**
+         * Works out the correction that would satisfy the given
+         * constraint, to be shared between its particles in
+         * proportion to their inverse masses. Returns false if the
+         * constraint is satisfied or can't be corrected.
+         */
+        static bool measureConstraint(const Constraint &constraint, Vector3 *correction);
+
+        /**
+         * Moves the particles of the given constraint so it is
+         * satisfied.
+         */
+        static void solveConstraint(const Constraint &constraint, real inverseDuration);
+
+        /**
+         * The job function used to solve one colour in parallel.
+         */
+        static void solveJob(void* data, unsigned begin, unsigned end);
+
+        /**
+         * The job function used to measure the constraints of a
+         * Jacobi sweep in parallel.
+         */
+        static void measureJob(void* data, unsigned begin, unsigned end);
+
+        /**
+         * The job function used to apply the corrections of a Jacobi
+         * sweep to the particles in parallel.
+         */
+        static void applyJob(void* data, unsigned begin, unsigned end);
+
+    public:
+
+        /**
+         * Creates a solver that makes the given number of sweeps.
+         */
+        ParticleLinkSolver(unsigned iterations = 8);
+
+        /**
+         * Adds a constraint for the given link. Returns false, adding
+         * nothing, if the link has no length limits.
+         */
+        bool addLink(const ParticleLink* link);
+
+        /**
+         * Adds a constraint keeping the given particles between the
+         * two lengths apart.
+         */
+        void addConstraint(Particle* a, Particle* b, real minLength, real maxLength);
+
+        /**
+         * Adds a constraint for each link in the given set, which must
+         * index an array of particles rather than a store.
+         */
+        void addLinks(const ParticleLinkSet &links);
+
+        /**
+         * Removes every constraint.
+         */
+        void clear();
+
+        /**
+         * Updates the constraints after the given remap has moved
+         * their particles.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Returns the number of constraints.
+         */
+        unsigned getConstraintCount() const;
+
+        /**
+         * Returns the number of colours the constraints fall into.
+         */
+        unsigned getColourCount();
+
+        /**
+         * Sets the number of sweeps per step.
+         */
+        void setIterations(unsigned iterations);
+
+        /**
+         * Sets the sweep order.
+         */
+        void setMode(SolveMode mode);
+
+        /**
+         * Gets the sweep order.
+         */
+        SolveMode getMode() const;
+
+        /**
+         * Moves the particles to satisfy the constraints, after a
+         * step of the given duration. In coloured and Jacobi modes
+         * the work is shared between the workers of the given job
+         * system, if there is one.
+         */
+        void solve(real duration, JobSystem* jobs = 0);
+    };
+}
+
+#endif // CYCLONE_PLINKSOLVER_H
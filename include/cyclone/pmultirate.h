@@ -0,0 +1,226 @@
+/*
+ * Interface file for multi-rate particle integration.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains an integrator that lets each particle take the
+ * longest timestep its motion allows. Particles are sorted into
+ * levels: a particle at level k is integrated once every 2^k steps,
+ * with 2^k times the step's duration. A shell in flight stays at
+ * level zero and is integrated every step, while a float bobbing on
+ * a pond climbs to the top level and costs a fraction as much.
+ */
+#ifndef CYCLONE_PMULTIRATE_H
+#define CYCLONE_PMULTIRATE_H
+
+#include <vector>
+#include "particle.h"
+#include "preorder.h"
+
+namespace cyclone {
+
+    class JobSystem;
+
+    /**
+     * Integrates particles at power of two multiples of the step's
+     * duration.
+     *
+     * Each level's steps end on the boundaries of the steps of every
+     * coarser level, so after every 2^maxLevel steps the whole set is
+     * at the same time again. A particle's level is chosen at the end
+     * of each of its steps: the coarsest level, up to maxLevel, whose
+     * step would move it no further than the displacement limit,
+     * allowing for both its velocity and its acceleration. It can
+     * only climb to a level whose step starts there, so it may wait a
+     * few steps to get there; it can always drop.
+     *
+     * Forces applied to a particle between its steps build up in its
+     * accumulator, and are averaged over its step when it is
+     * integrated, so a constant force has the same effect at any
+     * level.
+     *
+     * Between its steps, a particle above level zero stays where its
+     * last step left it, so contact generators see it a little behind
+     * the others. That is what makes the slow levels cheap, and as
+     * they are slow it mostly doesn't matter. A sleeping particle
+     * that is woken, or one passed to disturbParticle whose velocity
+     * has changed, part way through a longer step doesn't wait for
+     * it to end: at the next step it is integrated over the time it
+     * has waited and dropped to level zero. The world passes the
+     * particles of each step's contacts.
+     *
+     * Give it to a world with ParticleWorld::setMultiRateIntegrator,
+     * and it replaces the world's integration. It must be called with
+     * the same duration each step, as the world's fixed timestep does.
+     */
+    class ParticleMultiRateIntegrator
+    {
+    public:
+
+        /**
+         * Holds the number of levels there can be.
+         */
+        enum { MaxLevels = 8 };
+
+    protected:
+
+        /**
+         * Holds the indices of the particles at each level.
+         */
+        std::vector<unsigned> levels[MaxLevels];
+
+        /**
+         * Holds the level of each particle.
+         */
+        std::vector<unsigned char> level;
+
+        /**
+         * Holds the velocity and awake state each particle was left
+         * in by its last step, so disturbed particles can be found.
+         */
+        std::vector<Vector3> lastVelocity;
+        std::vector<unsigned char> lastAwake;
+
+        /**
+         * Holds the particles that may have been disturbed since the
+         * last step, the particles left asleep by their last step,
+         * and which particles have been found disturbed.
+         */
+        std::vector<unsigned> pending;
+        std::vector<unsigned> sleepers;
+        std::vector<unsigned char> marked;
+
+        /**
+         * Holds the particles being integrated in this step, and
+         * those found to be disturbed.
+         */
+        std::vector<unsigned> due;
+        std::vector<unsigned> disturbed;
+
+        /**
+         * Holds the highest level particles can reach.
+         */
+        unsigned maxLevel;
+
+        /**
+         * Holds the furthest a particle should move in one of its
+         * steps.
+         */
+        real maxDisplacement;
+
+        /**
+         * Holds the number of steps taken since the last reset.
+         */
+        unsigned stepCount;
+
+        /**
+         * Holds the number of particles integrated in the last step.
+         */
+        unsigned integrated;
+
+        /**
+         * True if a particle has been moved to level zero since the
+         * last step, so the level lists need building again.
+         */
+        bool dirty;
+
+        /**
+         * Rebuilds the level lists from the particles' levels.
+         */
+        void rebuildLevels();
+
+        /**
+         * Adds those of the given particles that are part way
+         * through a step, and have been woken or had their velocity
+         * changed since it began, to the disturbed list.
+         */
+        void checkDisturbed(const Particle* particles,
+            const std::vector<unsigned> &candidates, unsigned dueLevel);
+
+    public:
+
+        /**
+         * Creates an integrator with the given number of levels above
+         * the step's own, and the given displacement limit.
+         */
+        ParticleMultiRateIntegrator(unsigned maxLevel = 4, real maxDisplacement = 0.1f);
+
+        /**
+         * Sets the highest level particles can reach. Particles above
+         * it are dropped to it at the end of their current step.
+         */
+        void setMaxLevel(unsigned maxLevel);
+
+        /**
+         * Sets the furthest a particle should move in one of its
+         * steps. Smaller limits keep more particles at low levels.
+         */
+        void setMaxDisplacement(real maxDisplacement);
+
+        /**
+         * Puts every particle back at level zero and starts counting
+         * steps again. Call this after moving particles by hand. The
+         * world calls it when it is cleared, which restoring a
+         * snapshot does.
+         */
+        void reset();
+
+        /**
+         * Puts the particle at the given index at level zero, for
+         * example because it has just been added. The world calls
+         * this for the particles it adds.
+         */
+        void resetParticle(unsigned index);
+
+        /**
+         * Says that the particle at the given index may have been
+         * woken or had its velocity changed, for example by a
+         * contact. If it has, and it is part way through a longer
+         * step, it is caught up and dropped to level zero at the next
+         * step. The world calls this for the particles of its
+         * contacts once they are resolved.
+         */
+        void disturbParticle(unsigned index);
+
+        /**
+         * Moves each particle's level with it after the given remap
+         * has reordered the array. The world calls this when it
+         * reorders its particles.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Takes one step of the given duration. The particles due at
+         * this step are integrated forward to the end of it, and
+         * given their levels for their next step. Particles beyond
+         * the ones seen before start at level zero. If a job system
+         * is given, each level's particles are split between its
+         * workers.
+         */
+        void integrate(Particle* particles, unsigned count, real duration,
+            JobSystem* jobs = 0);
+
+        /**
+         * Returns the number of particles at the given level.
+         */
+        unsigned getLevelCount(unsigned level) const;
+
+        /**
+         * Returns the number of particles integrated in the last
+         * step.
+         */
+        unsigned getIntegratedCount() const;
+    };
+}
+
+#endif // CYCLONE_PMULTIRATE_H
@@ -0,0 +1,314 @@
+/*
+ * Interface file for the pooled and per-frame allocators.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains two allocators for objects that are created and
+ * destroyed at a high rate: a pool of objects of one type, recycled
+ * through a free list, and an arena for scratch memory that is all
+ * thrown away at the end of each frame. Both get their memory from
+ * the heap only while they are growing, so once a simulation has
+ * reached its steady state they make no allocations.
+ */
+#ifndef CYCLONE_POOL_H
+#define CYCLONE_POOL_H
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+namespace cyclone {
+
+    /**
+     * Holds objects of one type in blocks, recycling the slots of
+     * released objects through a free list.
+     *
+     * Objects never move, so pointers to them stay valid until they
+     * are released. Blocks are only allocated when the pool is full,
+     * and are kept until the pool is destroyed, so a pool that has
+     * been reserved (or has been running long enough to reach its
+     * high water mark) allocates and frees objects without touching
+     * the heap.
+     *
+     * A pool may hold polymorphic objects of a single concrete type,
+     * for example the spring generators of a cloth, but not a mixture
+     * of types.
+     */
+    template <typename T>
+    class ObjectPool
+    {
+    protected:
+
+        /**
+         * Holds the storage for one object, and the free list link
+         * used while the slot is empty. The storage must be the first
+         * member, so a pointer to the object is a pointer to its slot.
+         */
+        struct Slot
+        {
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+            Slot* nextFree;
+            bool live;
+        };
+
+        /**
+         * Holds the blocks of slots.
+         */
+        std::vector<Slot*> blocks;
+
+        /**
+         * Holds the number of slots in each new block.
+         */
+        unsigned blockSize;
+
+        /**
+         * Holds the first empty slot.
+         */
+        Slot* firstFree;
+
+        /**
+         * Holds the number of live objects.
+         */
+        unsigned liveCount;
+
+        /**
+         * Allocates another block and adds its slots to the free
+         * list.
+         */
+        void addBlock()
+        {
+            Slot* block = new Slot[blockSize];
+            blocks.push_back(block);
+            for (unsigned i = blockSize; i > 0; i--)
+            {
+                block[i-1].live = false;
+                block[i-1].nextFree = firstFree;
+                firstFree = block + i - 1;
+            }
+        }
+
+    public:
+
+        /**
+         * Creates an empty pool that grows the given number of objects
+         * at a time.
+         */
+        ObjectPool(unsigned blockSize = 256)
+            : blockSize(blockSize > 0 ? blockSize : 1), firstFree(0), liveCount(0)
+        {
+        }
+
+        /**
+         * Destroys every live object and frees the pool's memory.
+         */
+        ~ObjectPool()
+        {
+            clear();
+            for (unsigned b = 0; b < blocks.size(); b++) delete[] blocks[b];
+        }
+
+        /**
+         * Makes sure the pool can hold the given number of objects
+         * without allocating.
+         */
+        void reserve(unsigned capacity)
+        {
+            while (getCapacity() < capacity) addBlock();
+        }
+
+        /**
+         * Creates an object in the pool, passing the given arguments
+         * to its constructor.
+         */
+        template <typename... Args>
+        T* allocate(Args&&... args)
+        {
+            if (!firstFree) addBlock();
+
+            Slot* slot = firstFree;
+            T* object = new (&slot->storage) T(std::forward<Args>(args)...);
+            firstFree = slot->nextFree;
+            slot->live = true;
+            liveCount++;
+            return object;
+        }
+
+        /**
+         * Destroys the given object, which must have come from this
+         * pool, and makes its slot available again.
+         */
+        void release(T* object)
+        {
+            Slot* slot = reinterpret_cast<Slot*>(object);
+            if (!slot->live) return;
+
+            object->~T();
+            slot->live = false;
+            slot->nextFree = firstFree;
+            firstFree = slot;
+            liveCount--;
+        }
+
+        /**
+         * Destroys every live object, keeping the pool's memory.
+         */
+        void clear()
+        {
+            firstFree = 0;
+            for (unsigned b = (unsigned)blocks.size(); b > 0; b--)
+            {
+                Slot* block = blocks[b-1];
+                for (unsigned i = blockSize; i > 0; i--)
+                {
+                    Slot &slot = block[i-1];
+                    if (slot.live)
+                    {
+                        reinterpret_cast<T*>(&slot.storage)->~T();
+                        slot.live = false;
+                    }
+                    slot.nextFree = firstFree;
+                    firstFree = &slot;
+                }
+            }
+            liveCount = 0;
+        }
+
+        /**
+         * Returns the number of live objects.
+         */
+        unsigned size() const
+        {
+            return liveCount;
+        }
+
+        /**
+         * Returns the number of objects the pool can hold before it
+         * next allocates.
+         */
+        unsigned getCapacity() const
+        {
+            return (unsigned)blocks.size() * blockSize;
+        }
+
+    private:
+        ObjectPool(const ObjectPool&);
+        ObjectPool& operator=(const ObjectPool&);
+    };
+
+    /**
+     * Hands out scratch memory that lives until the next call to
+     * reset, usually once a frame or once a step.
+     *
+     * Memory is taken from the front of one buffer, so allocation is
+     * a pointer increment and reset frees everything at once. If a
+     * frame needs more than the buffer holds, the extra comes from
+     * the heap; the next reset replaces the buffer with one big
+     * enough for the whole of that frame, so the arena quickly settles
+     * at the size the simulation needs.
+     *
+     * Objects in the arena are never destroyed, so only trivially
+     * destructible types (such as contacts, vectors and indices) may
+     * be put in it.
+     */
+    class FrameArena
+    {
+    protected:
+
+        /**
+         * Holds the main buffer.
+         */
+        unsigned char* buffer;
+
+        /**
+         * Holds the size of the main buffer, and how much of it has
+         * been handed out since the last reset.
+         */
+        size_t capacity;
+        size_t used;
+
+        /**
+         * Holds the memory handed out since the last reset that
+         * didn't fit in the main buffer, and its total size.
+         */
+        std::vector<unsigned char*> overflow;
+        size_t overflowUsed;
+
+        /**
+         * Holds the most memory any frame has needed.
+         */
+        size_t peak;
+
+    public:
+
+        /**
+         * Creates an arena with a main buffer of the given size in
+         * bytes.
+         */
+        FrameArena(size_t capacity = 0);
+
+        /**
+         * Frees the arena's memory.
+         */
+        ~FrameArena();
+
+        /**
+         * Returns a block of at least the given number of bytes, with
+         * the given alignment (which must be a power of two).
+         */
+        void* allocate(size_t bytes, size_t alignment = alignof(double));
+
+        /**
+         * Returns an array of the given number of default constructed
+         * objects.
+         */
+        template <typename T>
+        T* allocateArray(size_t count)
+        {
+            static_assert(std::is_trivially_destructible<T>::value,
+                "objects in a frame arena are never destroyed");
+
+            T* array = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            for (size_t i = 0; i < count; i++) new (array + i) T();
+            return array;
+        }
+
+        /**
+         * Frees everything handed out since the last reset, growing
+         * the main buffer first if it overflowed.
+         */
+        void reset();
+
+        /**
+         * Returns the number of bytes handed out since the last reset.
+         */
+        size_t getUsed() const;
+
+        /**
+         * Returns the size of the main buffer.
+         */
+        size_t getCapacity() const;
+
+        /**
+         * Returns the most bytes handed out between two resets.
+         */
+        size_t getPeak() const;
+
+    private:
+        FrameArena(const FrameArena&);
+        FrameArena& operator=(const FrameArena&);
+    };
+}
+
+#endif // CYCLONE_POOL_H
@@ -18,7 +18,24 @@
 
 namespace cyclone {
 
-#if 0
+    /*
+     * The library is built in double precision unless
+     * CYCLONE_SINGLE_PRECISION is defined (for example with
+     * -DCYCLONE_SINGLE_PRECISION on the compiler command line, or
+     * PRECISION=single with linuxmake.mk). Every file of the library
+     * and of the program using it must be built with the same
+     * setting. That setting only picks what real is.
+     *
+     * Vectors, particles, contacts, the contact resolver and the
+     * force generators and registry of pfgen.h are templates on their
+     * scalar type (BasicVector3, BasicParticle, and so on), and the
+     * plain names are the ones of real. They are built for float and
+     * double whatever real is, so a float particle cloud can be
+     * simulated with its own registry and resolver next to double
+     * subsystems in the same program. The world, particle stores and
+     * the tools built on them work in real alone.
+     */
+#if defined(CYCLONE_SINGLE_PRECISION)
     /**
      * Defines we're in single precision mode, for any code
      * that needs to be conditionally compiled.
@@ -27,8 +44,8 @@ namespace cyclone {
 
     /**
      * Defines a real number precision. Cyclone can be compiled in
-     * single or double precision versions. By default single precision is
-     * provided.
+     * single or double precision versions. By default double precision
+     * is provided.
      */
     typedef float real;
 
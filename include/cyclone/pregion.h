@@ -0,0 +1,155 @@
+/*
+ * Interface file for force generators limited to regions of space.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the holder for force generators that only act
+ * in a region of space, such as an uplift, a blast or a pool. Rather
+ * than registering each generator against every particle that might
+ * wander into its region, the generators and particles are given to
+ * a ParticleRegionForces, which sorts the particles into a spatial
+ * hash each step and hands each generator only the particles inside
+ * its bounds.
+ */
+#ifndef CYCLONE_PREGION_H
+#define CYCLONE_PREGION_H
+
+#include <vector>
+#include "pfgen.h"
+#include "pcollide.h"
+
+namespace cyclone {
+
+    /**
+     * Applies a set of region force generators to a set of particles,
+     * finding the particles in each generator's region with a spatial
+     * hash. The cost of a step is one rebuild of the hash, plus the
+     * work for the particles each generator actually affects.
+     *
+     * Give it to a world with ParticleWorld::setRegionForces, and it
+     * runs after the world's force registry at each step.
+     */
+    class ParticleRegionForces
+    {
+    protected:
+
+        /**
+         * Holds the particles the generators can act on.
+         */
+        std::vector<Particle*> particles;
+
+        /**
+         * Holds the generators.
+         */
+        std::vector<ParticleRegionForceGenerator*> generators;
+
+        /**
+         * Holds the spatial hash of the particles.
+         */
+        ParticleSpatialHash hash;
+
+        /**
+         * Holds the indices, and then the particles, found in each
+         * generator's region.
+         */
+        std::vector<unsigned> found;
+        std::vector<Particle*> affected;
+
+        /**
+         * Holds the number of particles passed to generators in the
+         * last step.
+         */
+        unsigned evaluations;
+
+    public:
+
+        /**
+         * Creates an empty set, with the given cell size for the
+         * spatial hash. Cells about the size of a typical region work
+         * well.
+         */
+        ParticleRegionForces(real cellSize = 4);
+
+        /**
+         * Adds a particle to the set the generators can act on.
+         */
+        void addParticle(Particle* particle);
+
+        /**
+         * Adds each particle in the given array to the set the
+         * generators can act on.
+         */
+        void addParticles(Particle* particles, unsigned count);
+
+        /**
+         * Removes the given particle. This moves the last particle
+         * into its place.
+         */
+        void removeParticle(Particle* particle);
+
+        /**
+         * Removes all the particles.
+         */
+        void clearParticles();
+
+        /**
+         * Moves the particles with the remap, keeping them in memory
+         * order. The generators aren't told.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Adds a generator. It isn't owned: it must stay alive until
+         * it is removed.
+         */
+        void addGenerator(ParticleRegionForceGenerator* generator);
+
+        /**
+         * Removes the given generator.
+         */
+        void removeGenerator(ParticleRegionForceGenerator* generator);
+
+        /**
+         * Removes all the generators.
+         */
+        void clearGenerators();
+
+        /**
+         * Sets the cell size of the spatial hash.
+         */
+        void setCellSize(real cellSize);
+
+        /**
+         * Gets the spatial hash, as built by the last call to
+         * updateForces.
+         */
+        const ParticleSpatialHash& getSpatialHash() const;
+
+        /**
+         * Returns the number of particles passed to generators by the
+         * last call to updateForces.
+         */
+        unsigned getEvaluationCount() const;
+
+        /**
+         * Rebuilds the spatial hash, then calls each generator's
+         * updateForces with the particles inside its bounds. Unlike
+         * the force registry it passes sleeping particles as well,
+         * so a blast or current reaching a resting heap wakes the
+         * particles it pushes, through Particle::addForce.
+         */
+        void updateForces(real duration);
+    };
+}
+
+#endif // CYCLONE_PREGION_H
@@ -0,0 +1,115 @@
+/*
+ * Interface file for reordering particles in memory.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the tools a particle world uses to sort its
+ * particles into Z-order (Morton order): a Morton code for a point,
+ * and the remap that tells everything holding particles where each
+ * one has moved to. Particles close in space then sit close in
+ * memory, so the broadphase, springs and contact resolution walk
+ * through memory in order rather than jumping about it.
+ */
+#ifndef CYCLONE_PREORDER_H
+#define CYCLONE_PREORDER_H
+
+#include <vector>
+#include "particle.h"
+
+namespace cyclone {
+
+    /**
+     * Returns the Morton code of the point with the given quantised
+     * coordinates, each of which is clamped to ten bits. The bits of
+     * the three are interleaved, so points with close codes tend to
+     * be close in space.
+     */
+    unsigned mortonCode(unsigned x, unsigned y, unsigned z);
+
+    /**
+     * Says where each particle of an array has moved to when the
+     * array is reordered.
+     *
+     * Particles outside the array are left alone by the remap
+     * methods, so objects holding particles from several arrays, or
+     * particles outside any world, can pass them all through.
+     */
+    template <typename T>
+    class BasicParticleRemap
+    {
+        /**
+         * Holds the array that was reordered.
+         */
+        BasicParticle<T>* particles;
+
+        /**
+         * Holds the length of the array.
+         */
+        unsigned count;
+
+        /**
+         * Holds the new index of the particle at each old index.
+         */
+        const unsigned* newIndex;
+
+    public:
+
+        /**
+         * Creates a remap for the given array, given the new index of
+         * each particle in it.
+         */
+        BasicParticleRemap(BasicParticle<T>* particles, unsigned count, const unsigned* newIndex);
+
+        /**
+         * Gets the array that was reordered.
+         */
+        BasicParticle<T>* getParticles() const;
+
+        /**
+         * Gets the length of the array.
+         */
+        unsigned getCount() const;
+
+        /**
+         * Returns true if the given particle is in the array.
+         */
+        bool contains(const BasicParticle<T>* particle) const;
+
+        /**
+         * Returns the new index of the particle at the given old
+         * index.
+         */
+        unsigned remap(unsigned index) const;
+
+        /**
+         * Returns where the given particle has moved to, or the
+         * particle itself if it isn't in the array. NULL stays NULL.
+         */
+        BasicParticle<T>* remap(BasicParticle<T>* particle) const;
+
+        /**
+         * Remaps every particle in the given list, then sorts the
+         * particles in the array into memory order, so a pass over
+         * the list walks through the array in order. Particles from
+         * outside the array keep their place after them.
+         */
+        void remap(std::vector<BasicParticle<T>*> &list) const;
+    };
+
+    /**
+     * The remap of particles of the library's own real type.
+     */
+    typedef BasicParticleRemap<real> ParticleRemap;
+}
+
+#endif // CYCLONE_PREORDER_H
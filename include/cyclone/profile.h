@@ -0,0 +1,276 @@
+/*
+ * Interface file for the frame profiler.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a profiler that records how long each phase of
+ * a simulation step takes, along with a few counters, for the last
+ * few hundred steps.
+ *
+ * The engine's hot paths are instrumented with the CYCLONE_PROFILE_
+ * macros below. Unless CYCLONE_ENABLE_PROFILING is defined when the
+ * library is compiled these expand to nothing, so a normal build
+ * pays nothing for them, and a profiler given to the world records
+ * nothing.
+ */
+#ifndef CYCLONE_PROFILE_H
+#define CYCLONE_PROFILE_H
+
+#include <vector>
+
+namespace cyclone {
+
+    /**
+     * The phases of a simulation step that are timed.
+     */
+    enum ProfilePhase
+    {
+        /** The whole step. The other phases are inside it. */
+        PROFILE_STEP,
+        PROFILE_FORCES,
+        PROFILE_INTEGRATION,
+        PROFILE_LINKS,
+        PROFILE_CONTACT_GENERATION,
+        PROFILE_RESOLUTION,
+        PROFILE_PHASE_COUNT
+    };
+
+    /**
+     * The values counted at each step.
+     */
+    enum ProfileCounter
+    {
+        /** The number of contacts resolved. */
+        PROFILE_CONTACTS,
+
+        /** The number of resolver iterations used. */
+        PROFILE_ITERATIONS,
+
+        /** The number of contacts warm started from the cache. */
+        PROFILE_CACHED_CONTACTS,
+
+        /** The number of particles awake at the end of the step. */
+        PROFILE_AWAKE_PARTICLES,
+
+        PROFILE_COUNTER_COUNT
+    };
+
+    /**
+     * Holds what was recorded for one frame (one simulation step).
+     * Times are in nanoseconds since the profiler was created.
+     */
+    struct ProfileFrame
+    {
+        /** Holds the number of the frame, counting from zero. */
+        unsigned long long index;
+
+        /**
+         * Holds when each phase first started in the frame, and the
+         * total time spent in it. Phases that didn't run have zero
+         * duration.
+         */
+        unsigned long long start[PROFILE_PHASE_COUNT];
+        unsigned long long duration[PROFILE_PHASE_COUNT];
+
+        /**
+         * Holds the counters.
+         */
+        unsigned counter[PROFILE_COUNTER_COUNT];
+    };
+
+    /**
+     * Records the phase timings and counters of the most recent
+     * frames in a ring buffer. The buffer is allocated when the
+     * profiler is created, so recording makes no allocations.
+     *
+     * A profiler is not safe to record into from several threads;
+     * the engine only records from the thread that steps the world.
+     */
+    class Profiler
+    {
+    protected:
+
+        /**
+         * Holds the ring buffer of finished frames.
+         */
+        std::vector<ProfileFrame> frames;
+
+        /**
+         * Holds the position of the oldest frame in the ring, and the
+         * number of frames held.
+         */
+        unsigned first;
+        unsigned count;
+
+        /**
+         * Holds the frame being recorded.
+         */
+        ProfileFrame current;
+
+        /**
+         * Holds the number of the next frame to be started.
+         */
+        unsigned long long nextIndex;
+
+        /**
+         * Holds the clock reading that times are measured from.
+         */
+        unsigned long long origin;
+
+    public:
+
+        /**
+         * Creates a profiler that remembers the given number of
+         * frames.
+         */
+        Profiler(unsigned capacity = 600);
+
+        /**
+         * Returns the current time in nanoseconds, from a steady
+         * clock.
+         */
+        static unsigned long long now();
+
+        /**
+         * Starts recording a new frame, clearing its times and
+         * counters.
+         */
+        void beginFrame();
+
+        /**
+         * Finishes the current frame and adds it to the ring buffer,
+         * replacing the oldest frame if the buffer is full.
+         */
+        void endFrame();
+
+        /**
+         * Adds the time between the given clock readings to the given
+         * phase of the current frame.
+         */
+        void addTime(ProfilePhase phase, unsigned long long start, unsigned long long end);
+
+        /**
+         * Sets a counter of the current frame.
+         */
+        void setCounter(ProfileCounter counter, unsigned value);
+
+        /**
+         * Returns the number of finished frames held.
+         */
+        unsigned getFrameCount() const;
+
+        /**
+         * Returns a finished frame. Frame zero is the oldest held.
+         */
+        const ProfileFrame& getFrame(unsigned frame) const;
+
+        /**
+         * Returns the mean time spent in the given phase over the
+         * frames held, in nanoseconds.
+         */
+        double getMeanDuration(ProfilePhase phase) const;
+
+        /**
+         * Forgets every finished frame.
+         */
+        void clear();
+
+        /**
+         * Returns the name used for a phase or counter in exports.
+         */
+        static const char* getPhaseName(ProfilePhase phase);
+        static const char* getCounterName(ProfileCounter counter);
+
+        /**
+         * Writes the frames held to the given file in the Chrome
+         * trace event format, which chrome://tracing and Perfetto can
+         * display. Returns false if the file couldn't be written.
+         */
+        bool writeChromeTrace(const char* filename) const;
+    };
+
+    /**
+     * Times the enclosing scope into a phase of the given profiler,
+     * which may be NULL. Use it through CYCLONE_PROFILE_SCOPE.
+     */
+    class ProfileScope
+    {
+        Profiler* profiler;
+        ProfilePhase phase;
+        unsigned long long start;
+
+    public:
+        ProfileScope(Profiler* profiler, ProfilePhase phase)
+            : profiler(profiler), phase(phase), start(profiler ? Profiler::now() : 0)
+        {
+        }
+
+        ~ProfileScope()
+        {
+            if (profiler) profiler->addTime(phase, start, Profiler::now());
+        }
+    };
+
+    /**
+     * Records the enclosing scope as one frame of the given profiler,
+     * which may be NULL, timing it as PROFILE_STEP. Use it through
+     * CYCLONE_PROFILE_FRAME.
+     */
+    class ProfileFrameScope
+    {
+        Profiler* profiler;
+        unsigned long long start;
+
+    public:
+        ProfileFrameScope(Profiler* profiler)
+            : profiler(profiler), start(0)
+        {
+            if (!profiler) return;
+            profiler->beginFrame();
+            start = Profiler::now();
+        }
+
+        ~ProfileFrameScope()
+        {
+            if (!profiler) return;
+            profiler->addTime(PROFILE_STEP, start, Profiler::now());
+            profiler->endFrame();
+        }
+    };
+}
+
+#if defined(CYCLONE_ENABLE_PROFILING)
+    #define CYCLONE_PROFILE_JOIN2(a, b) a##b
+    #define CYCLONE_PROFILE_JOIN(a, b) CYCLONE_PROFILE_JOIN2(a, b)
+
+    /** Records the enclosing scope as a frame of the profiler. */
+    #define CYCLONE_PROFILE_FRAME(profiler) \
+        cyclone::ProfileFrameScope CYCLONE_PROFILE_JOIN(profileFrame, __LINE__)(profiler)
+
+    /** Times the enclosing scope into the given phase. */
+    #define CYCLONE_PROFILE_SCOPE(profiler, phase) \
+        cyclone::ProfileScope CYCLONE_PROFILE_JOIN(profileScope, __LINE__)(profiler, phase)
+
+    /**
+     * Sets a counter of the current frame. The value isn't worked
+     * out unless there is a profiler.
+     */
+    #define CYCLONE_PROFILE_COUNTER(profiler, counter, value) \
+        do { if (profiler) (profiler)->setCounter(counter, value); } while (0)
+#else
+    #define CYCLONE_PROFILE_FRAME(profiler) do {} while (0)
+    #define CYCLONE_PROFILE_SCOPE(profiler, phase) do {} while (0)
+    #define CYCLONE_PROFILE_COUNTER(profiler, counter, value) do {} while (0)
+#endif
+
+#endif // CYCLONE_PROFILE_H
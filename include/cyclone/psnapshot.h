@@ -0,0 +1,360 @@
+/*
+ * Interface file for particle world snapshots.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the snapshot format for the state of a particle
+ * world: its particles, force registrations, contact generators
+ * (with the cables and rods among them) and, optionally, a contact
+ * cache. A snapshot can be written at any point between steps and
+ * restored into a world to carry on from the same state, which is
+ * much quicker than building a large scene one call at a time.
+ *
+ * A snapshot file is a header followed by a section for each kind of
+ * record. Every record is plain data, and every section starts on a
+ * 64 byte boundary, so an open snapshot is used in place from a
+ * memory mapping of the file: nothing is parsed or copied until it
+ * is restored, and the sections can be read directly through the
+ * typed accessors.
+ *
+ * Files are written in the byte order and precision of the machine
+ * and build that wrote them, and are only opened by matching builds.
+ */
+#ifndef CYCLONE_PSNAPSHOT_H
+#define CYCLONE_PSNAPSHOT_H
+
+#include <stddef.h>
+#include <vector>
+#include "pworld.h"
+#include "pool.h"
+
+namespace cyclone {
+
+    class ParticleContactCache;
+
+    /**
+     * The version of the snapshot format written by this build.
+     */
+    enum { SNAPSHOT_VERSION = 1 };
+
+    /**
+     * The sections of a snapshot file.
+     */
+    enum SnapshotSectionType
+    {
+        /** The particle slots of the world, as SnapshotParticle. */
+        SNAPSHOT_PARTICLES,
+
+        /** The slots of removed particles, as unsigned indices. */
+        SNAPSHOT_FREE_PARTICLES,
+
+        /** The force registrations, as SnapshotRegistration. */
+        SNAPSHOT_REGISTRATIONS,
+
+        /** The world's contact generators, as SnapshotContactGenerator. */
+        SNAPSHOT_CONTACT_GENERATORS,
+
+        /** The cables and rods, as SnapshotLink. */
+        SNAPSHOT_LINKS,
+
+        /** The contact cache, as SnapshotCacheEntry. */
+        SNAPSHOT_CACHE,
+
+        SNAPSHOT_SECTION_COUNT
+    };
+
+    /**
+     * Marks a particle or generator reference that refers to nothing.
+     */
+    enum { SNAPSHOT_NONE = 0xffffffffu };
+
+    /**
+     * Describes where a section is in the file.
+     */
+    struct SnapshotSection
+    {
+        unsigned long long offset;
+        unsigned long long count;
+        unsigned recordSize;
+        unsigned pad;
+    };
+
+    /**
+     * The header at the start of every snapshot file.
+     */
+    struct SnapshotHeader
+    {
+        /** Holds "CYCSNAP" and a terminating zero. */
+        char magic[8];
+        unsigned version;
+
+        /**
+         * Holds 0x01020304 as written, so files from a machine with
+         * the other byte order can be recognised.
+         */
+        unsigned byteOrder;
+
+        /** Holds the size of a real number in the writing build. */
+        unsigned realSize;
+        unsigned headerSize;
+        unsigned long long fileSize;
+
+        /** Holds the world's timestep and unsimulated time. */
+        double timestep;
+        double accumulator;
+        unsigned maxSteps;
+        unsigned pad;
+
+        SnapshotSection sections[SNAPSHOT_SECTION_COUNT];
+    };
+
+    /**
+     * The state of one particle slot.
+     */
+    struct SnapshotParticle
+    {
+        enum { AWAKE = 1, CAN_SLEEP = 2 };
+
+        real position[3];
+        real velocity[3];
+        real acceleration[3];
+        real forceAccum[3];
+        real inverseMass;
+        real damping;
+        real motion;
+        unsigned flags;
+    };
+
+    /**
+     * One force registration: a particle index and the binding ID of
+     * its force generator.
+     */
+    struct SnapshotRegistration
+    {
+        unsigned particle;
+        unsigned generator;
+    };
+
+    /**
+     * One entry in the world's list of contact generators: either a
+     * link, by its index in the links section, or a generator given
+     * by the application, by its binding ID.
+     */
+    struct SnapshotContactGenerator
+    {
+        enum { LINK = 0, BOUND = 1 };
+
+        unsigned kind;
+        unsigned index;
+    };
+
+    /**
+     * A cable or rod between two particles. The length is the
+     * cable's maximum length or the rod's length; the restitution
+     * is only used by cables.
+     */
+    struct SnapshotLink
+    {
+        enum { CABLE = 0, ROD = 1 };
+
+        unsigned type;
+        unsigned particle[2];
+        real length;
+        real restitution;
+    };
+
+    /**
+     * One remembered contact impulse. The source is the position of
+     * the contact's generator in the contact generators section.
+     */
+    struct SnapshotCacheEntry
+    {
+        unsigned particle[2];
+        unsigned source;
+        real impulse;
+    };
+
+    /**
+     * Connects the generators in a snapshot to the objects of the
+     * application. Force generators and contact generators other than
+     * cables and rods are owned by the application, so can't be
+     * stored; instead each one is bound here and stored by the ID it
+     * was given. The application binds the same generators in the
+     * same order before it restores a snapshot.
+     *
+     * The cables and rods created by restoring a snapshot are owned
+     * by the bindings, and last until it is destroyed or restores
+     * another snapshot.
+     */
+    class SnapshotBindings
+    {
+    protected:
+
+        /**
+         * Holds the bound generators, indexed by ID.
+         */
+        std::vector<ParticleForceGenerator*> forceGenerators;
+        std::vector<ParticleContactGenerator*> contactGenerators;
+
+        /**
+         * Holds the links created when restoring.
+         */
+        ObjectPool<ParticleCable> cables;
+        ObjectPool<ParticleRod> rods;
+
+        friend class ParticleSnapshot;
+
+    public:
+
+        /**
+         * Binds a force generator, returning its ID.
+         */
+        unsigned addForceGenerator(ParticleForceGenerator* generator);
+
+        /**
+         * Binds a contact generator, returning its ID. Cables and rods
+         * are stored as links, so don't need binding.
+         */
+        unsigned addContactGenerator(ParticleContactGenerator* generator);
+
+        /**
+         * Returns the generator with the given ID, or NULL if there
+         * is none.
+         */
+        ParticleForceGenerator* getForceGenerator(unsigned id) const;
+        ParticleContactGenerator* getContactGenerator(unsigned id) const;
+
+        /**
+         * Forgets every binding and destroys the restored links.
+         */
+        void clear();
+    };
+
+    /**
+     * Writes snapshots, and opens them for reading in place or for
+     * restoring into a world.
+     *
+     * Methods that can fail return false, and getError then describes
+     * what went wrong.
+     */
+    class ParticleSnapshot
+    {
+    protected:
+
+        /**
+         * Holds the open file's contents and size, and whether they
+         * are a memory mapping (rather than a copy on the heap).
+         */
+        const unsigned char* data;
+        size_t size;
+        bool mapped;
+
+        /**
+         * Holds the description of the last failure.
+         */
+        const char* error;
+
+        /**
+         * Records the given failure and returns false.
+         */
+        bool fail(const char* error);
+
+        /**
+         * Checks the header and section table of the open file.
+         */
+        bool validate();
+
+    public:
+
+        /**
+         * Creates a snapshot with no file open.
+         */
+        ParticleSnapshot();
+
+        /**
+         * Closes the snapshot's file.
+         */
+        ~ParticleSnapshot();
+
+        /**
+         * Writes the state of the given world, and of the given cache
+         * if it isn't NULL, to the given file. Every force generator
+         * registered in the world, and every contact generator that
+         * isn't a cable or rod, must be bound, and every particle a
+         * registration, link or cache entry refers to must belong to
+         * the world. Both ends of every link must be set.
+         */
+        bool write(const char* filename, const ParticleWorld &world,
+            const SnapshotBindings &bindings, const ParticleContactCache* cache = 0);
+
+        /**
+         * Opens the given snapshot file, closing any open one. The
+         * file is mapped into memory where the platform allows.
+         */
+        bool open(const char* filename);
+
+        /**
+         * Closes the open file, if there is one.
+         */
+        void close();
+
+        /**
+         * Returns true if a file is open.
+         */
+        bool isOpen() const;
+
+        /**
+         * Returns the header of the open file.
+         */
+        const SnapshotHeader& getHeader() const;
+
+        /**
+         * Returns the records of a section of the open file, in place,
+         * and stores their number in count.
+         */
+        const void* getSection(SnapshotSectionType type, unsigned* count) const;
+
+        /**
+         * Typed versions of getSection.
+         */
+        const SnapshotParticle* getParticles(unsigned* count) const;
+        const SnapshotRegistration* getRegistrations(unsigned* count) const;
+        const SnapshotLink* getLinks(unsigned* count) const;
+
+        /**
+         * Replaces the state of the given world, and of the given
+         * cache if it isn't NULL, with the state in the open file.
+         * The world must have room for the snapshot's particles, and
+         * the same generators must be bound as when it was written.
+         * The world's job system, solvers, cache, region forces,
+         * multi-rate integrator and profiler are left as they are,
+         * though the multi-rate integrator starts again with every
+         * particle at level zero. Links the application had added to a
+         * link solver, and particles it had added to region forces,
+         * must be added again.
+         */
+        bool restore(ParticleWorld &world, SnapshotBindings &bindings,
+            ParticleContactCache* cache = 0);
+
+        /**
+         * Returns a description of the last failure.
+         */
+        const char* getError() const;
+
+    private:
+        ParticleSnapshot(const ParticleSnapshot&);
+        ParticleSnapshot& operator=(const ParticleSnapshot&);
+    };
+}
+
+#endif // CYCLONE_PSNAPSHOT_H
@@ -0,0 +1,464 @@
+/*
+ * Interface file for the structure-of-arrays particle store.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the particle store, which holds the state of a
+ * large number of particles with each field in its own contiguous
+ * array, and the handle class used to access a single stored
+ * particle.
+ */
+#ifndef CYCLONE_PSTORE_H
+#define CYCLONE_PSTORE_H
+
+#include <assert.h>
+#include <vector>
+#include "particle.h"
+
+namespace cyclone {
+
+    class JobSystem;
+    class ParticleStore;
+
+    /**
+     * A handle refers to a single particle held in a particle store.
+     * It offers the same accessors as the particle class, so code
+     * written against particles can be moved to a store with few
+     * changes.
+     *
+     * Handles are small and are intended to be passed by value. A
+     * handle holds an index into the store, so it remains valid
+     * while the store grows, but not after the store is cleared.
+     */
+    class ParticleHandle
+    {
+        /**
+         * Holds the store the particle lives in.
+         */
+        ParticleStore* store;
+
+        /**
+         * Holds the index of the particle within the store.
+         */
+        unsigned index;
+
+    public:
+
+        /**
+         * Creates a handle that refers to no particle.
+         */
+        ParticleHandle() : store(0), index(0) {}
+
+        /**
+         * Creates a handle to the given particle of the given store.
+         */
+        ParticleHandle(ParticleStore* store, unsigned index)
+            : store(store), index(index) {}
+
+        /**
+         * Returns true if this handle refers to a particle.
+         */
+        bool isValid() const { return store != 0; }
+
+        /**
+         * Gets the index of the particle within its store.
+         */
+        unsigned getIndex() const { return index; }
+
+        /**
+         * Gets the store the particle lives in.
+         */
+        ParticleStore* getStore() const { return store; }
+
+        /**
+         * Sets the mass of the particle. The mass may not be zero.
+         */
+        void setMass(const real mass);
+
+        /**
+         * Gets the mass of the particle.
+         */
+        real getMass() const;
+
+        /**
+         * Sets the inverse mass of the particle. This may be zero,
+         * for a particle with infinite mass (i.e. unmovable).
+         */
+        void setInverseMass(const real inverseMass);
+
+        /**
+         * Gets the inverse mass of the particle.
+         */
+        real getInverseMass() const;
+
+        /**
+         * Returns true if the mass of the particle is not-infinite.
+         */
+        bool hasFiniteMass() const;
+
+        /**
+         * Sets the damping of the particle.
+         */
+        void setDamping(const real damping);
+
+        /**
+         * Gets the current damping value.
+         */
+        real getDamping() const;
+
+        /**
+         * Sets the position of the particle.
+         */
+        void setPosition(const Vector3 &position);
+
+        /**
+         * Sets the position of the particle by component.
+         */
+        void setPosition(const real x, const real y, const real z);
+
+        /**
+         * Fills the given vector with the position of the particle.
+         */
+        void getPosition(Vector3 *position) const;
+
+        /**
+         * Gets the position of the particle.
+         */
+        Vector3 getPosition() const;
+
+        /**
+         * Sets the velocity of the particle.
+         */
+        void setVelocity(const Vector3 &velocity);
+
+        /**
+         * Sets the velocity of the particle by component.
+         */
+        void setVelocity(const real x, const real y, const real z);
+
+        /**
+         * Fills the given vector with the velocity of the particle.
+         */
+        void getVelocity(Vector3 *velocity) const;
+
+        /**
+         * Gets the velocity of the particle.
+         */
+        Vector3 getVelocity() const;
+
+        /**
+         * Sets the constant acceleration of the particle.
+         */
+        void setAcceleration(const Vector3 &acceleration);
+
+        /**
+         * Sets the constant acceleration of the particle by component.
+         */
+        void setAcceleration(const real x, const real y, const real z);
+
+        /**
+         * Fills the given vector with the acceleration of the particle.
+         */
+        void getAcceleration(Vector3 *acceleration) const;
+
+        /**
+         * Gets the acceleration of the particle.
+         */
+        Vector3 getAcceleration() const;
+
+        /**
+         * Adds the given force to the particle to be applied at the
+         * next integration only.
+         */
+        void addForce(const Vector3 &force);
+
+        /**
+         * Clears the forces applied to the particle.
+         */
+        void clearAccumulator();
+    };
+
+    /**
+     * A particle store holds a set of particles in structure-of-arrays
+     * form: the positions of all particles are contiguous in memory,
+     * as are their velocities, and so on. Integrating the whole set in
+     * one pass then only touches the data it needs, and does so in
+     * order, which is much kinder to the cache than integrating
+     * particle objects one at a time.
+     *
+     * Particles in a store are identified by their index. Use a
+     * ParticleHandle to access one particle with the same methods as
+     * the particle class.
+     */
+    class ParticleStore
+    {
+        friend class ParticleHandle;
+
+    protected:
+
+        /**
+         * Holds the linear position of each particle in world space.
+         */
+        std::vector<Vector3> position;
+
+        /**
+         * Holds the linear velocity of each particle in world space.
+         */
+        std::vector<Vector3> velocity;
+
+        /**
+         * Holds the constant acceleration of each particle.
+         */
+        std::vector<Vector3> acceleration;
+
+        /**
+         * Holds the force accumulated on each particle for the next
+         * integration step only.
+         */
+        std::vector<Vector3> forceAccum;
+
+        /**
+         * Holds the inverse mass of each particle.
+         */
+        std::vector<real> inverseMass;
+
+        /**
+         * Holds the amount of damping applied to the linear motion
+         * of each particle.
+         */
+        std::vector<real> damping;
+
+        /**
+         * The job function used by the threaded integrateAll.
+         */
+        static void integrateJob(void* data, unsigned begin, unsigned end);
+
+    public:
+
+        /**
+         * Creates an empty store.
+         */
+        ParticleStore();
+
+        /**
+         * Creates an empty store with room for the given number of
+         * particles before any memory needs to be allocated.
+         */
+        ParticleStore(unsigned capacity);
+
+        /**
+         * Makes sure the store can hold the given number of particles
+         * without further allocation.
+         */
+        void reserve(unsigned capacity);
+
+        /**
+         * Adds a new particle to the store and returns a handle to
+         * it. The new particle is at rest at the origin, has unit
+         * mass and no damping.
+         */
+        ParticleHandle add();
+
+        /**
+         * Returns a handle to the particle with the given index.
+         */
+        ParticleHandle get(unsigned index);
+
+        /**
+         * Returns the number of particles in the store.
+         */
+        unsigned size() const;
+
+        /**
+         * Removes all particles from the store. Handles to them are
+         * no longer valid.
+         */
+        void clear();
+
+        /**
+         * Clears the accumulated force of every particle.
+         */
+        void clearAccumulators();
+
+        /**
+         * Integrates every particle in the store forward in time by
+         * the given amount. This performs exactly the same
+         * calculation as Particle::integrate, in a single pass over
+         * the arrays. Drag factors come from a DampingCache, so
+         * real_pow is only called once per distinct damping value.
+         */
+        void integrateAll(real duration);
+
+        /**
+         * Integrates the particles in the range [begin, end), as
+         * integrateAll does for the whole store.
+         */
+        void integrateRange(unsigned begin, unsigned end, real duration);
+
+        /**
+         * Integrates every particle in the store, sharing the work
+         * between the workers of the given job system. Each worker
+         * takes its own range of the arrays.
+         */
+        void integrateAll(real duration, JobSystem &jobs);
+
+        /**
+         * Gets the array of particle positions. The array holds size()
+         * elements and is invalidated if the store grows.
+         */
+        Vector3* getPositions();
+        const Vector3* getPositions() const;
+
+        /**
+         * Gets the array of particle velocities.
+         */
+        Vector3* getVelocities();
+        const Vector3* getVelocities() const;
+
+        /**
+         * Gets the array of particle accelerations.
+         */
+        Vector3* getAccelerations();
+        const Vector3* getAccelerations() const;
+
+        /**
+         * Gets the array of accumulated particle forces.
+         */
+        Vector3* getForceAccumulators();
+        const Vector3* getForceAccumulators() const;
+
+        /**
+         * Gets the array of particle inverse masses.
+         */
+        real* getInverseMasses();
+        const real* getInverseMasses() const;
+
+        /**
+         * Gets the array of particle damping values.
+         */
+        real* getDampings();
+        const real* getDampings() const;
+    };
+
+    // The handle accessors are small enough to be worth inlining.
+
+    inline void ParticleHandle::setMass(const real mass)
+    {
+        assert(mass != 0);
+        store->inverseMass[index] = ((real)1.0)/mass;
+    }
+
+    inline real ParticleHandle::getMass() const
+    {
+        real im = store->inverseMass[index];
+        if (im == 0) return REAL_MAX;
+        return ((real)1.0)/im;
+    }
+
+    inline void ParticleHandle::setInverseMass(const real inverseMass)
+    {
+        store->inverseMass[index] = inverseMass;
+    }
+
+    inline real ParticleHandle::getInverseMass() const
+    {
+        return store->inverseMass[index];
+    }
+
+    inline bool ParticleHandle::hasFiniteMass() const
+    {
+        return store->inverseMass[index] > 0.0f;
+    }
+
+    inline void ParticleHandle::setDamping(const real damping)
+    {
+        store->damping[index] = damping;
+    }
+
+    inline real ParticleHandle::getDamping() const
+    {
+        return store->damping[index];
+    }
+
+    inline void ParticleHandle::setPosition(const Vector3 &position)
+    {
+        store->position[index] = position;
+    }
+
+    inline void ParticleHandle::setPosition(const real x, const real y, const real z)
+    {
+        store->position[index] = Vector3(x, y, z);
+    }
+
+    inline void ParticleHandle::getPosition(Vector3 *position) const
+    {
+        *position = store->position[index];
+    }
+
+    inline Vector3 ParticleHandle::getPosition() const
+    {
+        return store->position[index];
+    }
+
+    inline void ParticleHandle::setVelocity(const Vector3 &velocity)
+    {
+        store->velocity[index] = velocity;
+    }
+
+    inline void ParticleHandle::setVelocity(const real x, const real y, const real z)
+    {
+        store->velocity[index] = Vector3(x, y, z);
+    }
+
+    inline void ParticleHandle::getVelocity(Vector3 *velocity) const
+    {
+        *velocity = store->velocity[index];
+    }
+
+    inline Vector3 ParticleHandle::getVelocity() const
+    {
+        return store->velocity[index];
+    }
+
+    inline void ParticleHandle::setAcceleration(const Vector3 &acceleration)
+    {
+        store->acceleration[index] = acceleration;
+    }
+
+    inline void ParticleHandle::setAcceleration(const real x, const real y, const real z)
+    {
+        store->acceleration[index] = Vector3(x, y, z);
+    }
+
+    inline void ParticleHandle::getAcceleration(Vector3 *acceleration) const
+    {
+        *acceleration = store->acceleration[index];
+    }
+
+    inline Vector3 ParticleHandle::getAcceleration() const
+    {
+        return store->acceleration[index];
+    }
+
+    inline void ParticleHandle::addForce(const Vector3 &force)
+    {
+        store->forceAccum[index] += force;
+    }
+
+    inline void ParticleHandle::clearAccumulator()
+    {
+        store->forceAccum[index].clear();
+    }
+}
+
+#endif // CYCLONE_PSTORE_H
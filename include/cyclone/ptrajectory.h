@@ -0,0 +1,359 @@
+/*
+ * Interface file for the particle trajectory recorder.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a recorder that streams the positions (and
+ * optionally velocities) of a set of particles to a file every frame,
+ * for analysis offline, and the reader for the files it writes.
+ *
+ * The simulation thread only copies each frame into a ring buffer.
+ * A thread belonging to the recorder quantizes the frame to a fixed
+ * grid, encodes each value as the difference from the previous
+ * frame, and writes the result as one chunk of the file. Particles
+ * that move little between frames take a byte or two per component.
+ *
+ * The file is a header followed by one chunk per frame. Every chunk
+ * starts with its own header, giving its size, so a reader can skip
+ * through the file. Key frames, which are encoded against zero
+ * rather than the previous frame, are written at a fixed interval
+ * and whenever the number of particles changes, so a reader can
+ * start decoding at any key frame.
+ */
+#ifndef CYCLONE_PTRAJECTORY_H
+#define CYCLONE_PTRAJECTORY_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "core.h"
+#include "particle.h"
+#include "preorder.h"
+
+namespace cyclone {
+
+    class ParticleStore;
+    class ParticleWorld;
+
+    /**
+     * Refers to the positions and velocities of a set of particles
+     * where they already are in memory, without copying them. The
+     * vectors are a fixed number of bytes apart, so a view can cover
+     * the arrays of a particle store or the members of an array of
+     * particles.
+     */
+    struct TrajectoryView
+    {
+        const Vector3* position;
+        const Vector3* velocity;
+        size_t stride;
+        unsigned count;
+
+        /**
+         * Returns a view of every particle in the given store.
+         */
+        static TrajectoryView of(const ParticleStore &store);
+
+        /**
+         * Returns a view of the given array of particles, such as a
+         * world's particles.
+         */
+        static TrajectoryView of(const Particle* particles, unsigned count);
+    };
+
+    /**
+     * The header at the start of a trajectory file.
+     */
+    struct TrajectoryFileHeader
+    {
+        /** Holds "CYCTRAJ" and a terminating zero. */
+        char magic[8];
+        unsigned version;
+        unsigned flags;
+        double positionQuantum;
+        double velocityQuantum;
+    };
+
+    /**
+     * The header at the start of each frame's chunk. The encoded
+     * values follow it.
+     */
+    struct TrajectoryChunkHeader
+    {
+        enum { KEY_FRAME = 1, VELOCITIES = 2 };
+
+        unsigned magic;
+        unsigned flags;
+        unsigned long long frame;
+        double time;
+        unsigned particleCount;
+        unsigned payloadSize;
+    };
+
+    /**
+     * Streams frames of particle positions and velocities to a file
+     * from a thread of its own.
+     *
+     * The ring buffer is allocated when the recorder is created, so
+     * recording a frame makes no allocations. If the writing thread
+     * falls behind and the ring fills up, recordFrame waits for it.
+     */
+    class TrajectoryRecorder
+    {
+    protected:
+
+        /**
+         * Holds one frame waiting to be written.
+         */
+        struct Frame
+        {
+            std::vector<Vector3> position;
+            std::vector<Vector3> velocity;
+            unsigned count;
+            double time;
+        };
+
+        /**
+         * Holds the ring buffer of frames, and the number of frames
+         * recorded into it and written out of it.
+         */
+        std::vector<Frame> ring;
+        unsigned long long recorded;
+        unsigned long long written;
+
+        /**
+         * Holds the largest number of particles in a frame.
+         */
+        unsigned maxParticles;
+
+        /**
+         * Holds the slot of the view each particle of a frame is read
+         * from, once reordering has moved the particles, or nothing
+         * while each is read from its own slot. Also holds the world
+         * reorder count seen at the last frame.
+         */
+        std::vector<unsigned> slots;
+        unsigned reorderCount;
+
+        /**
+         * Holds the size of the quantization grids, the number of
+         * frames between key frames and whether velocities are
+         * recorded.
+         */
+        real positionQuantum;
+        real velocityQuantum;
+        unsigned keyFrameInterval;
+        bool velocities;
+
+        /**
+         * Holds the open file, or NULL.
+         */
+        FILE* file;
+
+        /**
+         * Holds the writing thread and what it uses to wait for
+         * frames, and recordFrame to wait for space.
+         */
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable frameReady;
+        std::condition_variable spaceReady;
+        bool closing;
+
+        /**
+         * Holds the number of bytes written, the number of times
+         * recordFrame had to wait, and whether a write has failed.
+         * These are only changed with the mutex held.
+         */
+        unsigned long long bytesWritten;
+        unsigned stalls;
+        bool failed;
+
+        /**
+         * Holds the quantized values of the last frame written, and
+         * the buffer each chunk is encoded into, which is big enough
+         * for the largest possible chunk. These belong to the writing
+         * thread.
+         */
+        std::vector<long long> previous;
+        std::vector<unsigned char> buffer;
+
+        /**
+         * The body of the writing thread.
+         */
+        void writeFrames();
+
+        /**
+         * Encodes one frame into the buffer and writes it, returning
+         * the number of bytes written, or zero if writing failed.
+         */
+        size_t writeFrame(const Frame &frame, unsigned long long index);
+
+    public:
+
+        /**
+         * Creates a recorder for frames of up to the given number of
+         * particles, with the given number of frames in its ring.
+         */
+        TrajectoryRecorder(unsigned maxParticles, unsigned ringFrames = 8);
+
+        /**
+         * Closes the file, writing any frames still in the ring.
+         */
+        ~TrajectoryRecorder();
+
+        /**
+         * Sets the size of the grids positions and velocities are
+         * rounded to. The defaults are a tenth of a millimetre and a
+         * millimetre per second. It must not be called while a file
+         * is open. Values too far from zero for the grid, over 2^61
+         * steps of it, are recorded at its edge, and values that
+         * aren't numbers are recorded as zero.
+         */
+        void setQuantization(real positionQuantum, real velocityQuantum);
+
+        /**
+         * Sets the number of frames from one key frame to the next.
+         * The default is 60. It must not be called while a file is
+         * open.
+         */
+        void setKeyFrameInterval(unsigned keyFrameInterval);
+
+        /**
+         * Creates the given file and starts the writing thread,
+         * closing any file already open. Returns false if the file
+         * can't be created.
+         */
+        bool open(const char* filename, bool velocities = true);
+
+        /**
+         * Copies one frame into the ring buffer, to be written by
+         * the writing thread. Particles beyond the recorder's maximum
+         * are left out.
+         */
+        void recordFrame(const TrajectoryView &view, double time);
+
+        /**
+         * Records a frame of the given world's particles. If the
+         * world has reordered its particles since the last frame,
+         * the recorder follows them, so each particle keeps its
+         * place in the file. Frames must then be recorded at least
+         * once between reorderings, as they are if one is recorded
+         * every step.
+         */
+        void recordFrame(ParticleWorld &world, double time);
+
+        /**
+         * Follows the particles of the views being recorded after
+         * their array has been reordered, so each particle keeps its
+         * place in the frames written.
+         */
+        void remapParticles(const ParticleRemap &remap);
+
+        /**
+         * Waits for every recorded frame to be written, then closes
+         * the file and stops the writing thread.
+         */
+        void close();
+
+        /**
+         * Returns true if a file is open.
+         */
+        bool isOpen() const;
+
+        /**
+         * Returns the number of frames recorded since the file was
+         * opened.
+         */
+        unsigned long long getFrameCount() const;
+
+        /**
+         * Returns the number of bytes written to the file so far.
+         */
+        unsigned long long getBytesWritten();
+
+        /**
+         * Returns the number of frames recordFrame had to wait for
+         * space in the ring. If this grows, the ring is too small or
+         * the disk too slow.
+         */
+        unsigned getStallCount();
+
+        /**
+         * Returns true if writing to the file has failed.
+         */
+        bool hasFailed();
+
+    private:
+        TrajectoryRecorder(const TrajectoryRecorder&);
+        TrajectoryRecorder& operator=(const TrajectoryRecorder&);
+    };
+
+    /**
+     * Reads back the frames of a trajectory file in order.
+     */
+    class TrajectoryReader
+    {
+    protected:
+
+        FILE* file;
+        TrajectoryFileHeader header;
+
+        /**
+         * Holds the quantized values of the last frame read, and the
+         * buffer each chunk is read into.
+         */
+        std::vector<long long> previous;
+        std::vector<unsigned char> buffer;
+
+    public:
+
+        TrajectoryReader();
+        ~TrajectoryReader();
+
+        /**
+         * Opens the given trajectory file. Returns false if it can't
+         * be opened or isn't a trajectory file.
+         */
+        bool open(const char* filename);
+
+        /**
+         * Closes the file.
+         */
+        void close();
+
+        /**
+         * Returns the header of the open file.
+         */
+        const TrajectoryFileHeader& getHeader() const;
+
+        /**
+         * Reads the next frame, storing its positions and, if the
+         * file has them and the pointer isn't NULL, velocities.
+         * Values are accurate to half the quantization grid. Returns
+         * false at the end of the file or if it is damaged; a file
+         * whose recording was cut short ends at its last whole frame.
+         */
+        bool readFrame(std::vector<Vector3>* positions, std::vector<Vector3>* velocities,
+            double* time = 0, unsigned long long* frame = 0);
+
+    private:
+        TrajectoryReader(const TrajectoryReader&);
+        TrajectoryReader& operator=(const TrajectoryReader&);
+    };
+}
+
+#endif // CYCLONE_PTRAJECTORY_H
@@ -0,0 +1,681 @@
+/*
+ * Interface file for the particle / mass aggregate world structure.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the definitions for a structure to hold any number of
+ * particle masses, and their connections.
+ */
+#ifndef CYCLONE_PWORLD_H
+#define CYCLONE_PWORLD_H
+
+#include <utility>
+#include <vector>
+#include "pfgen.h"
+#include "plinks.h"
+#include "pool.h"
+#include "preorder.h"
+
+namespace cyclone {
+
+    class JobSystem;
+    class ParticleLinkSolver;
+    class ParticleIslandResolver;
+    class ParticleContactCache;
+    class ParticleRegionForces;
+    class ParticleMultiRateIntegrator;
+    class ParticleIntegrator;
+    class Profiler;
+
+    /**
+     * Keeps track of a set of particles, and provides the means to
+     * update them all.
+     *
+     * The world owns its particles, its force registry and a contact
+     * buffer, all sized when the world is created. It steps the
+     * simulation with a fixed timestep: runPhysics is given the
+     * length of each rendered frame and takes however many fixed
+     * steps fit, carrying the remainder over to the next frame.
+     *
+     * Particles can be removed and added at any time: removed
+     * particles go on a free list and their slots are reused, so
+     * spawning and killing particles at a high rate makes no memory
+     * allocations either. Once the scene is set up, and the frame
+     * arena has grown to fit a step, running the simulation makes no
+     * memory allocations.
+     */
+    class ParticleWorld
+    {
+    public:
+
+        typedef std::vector<ParticleContactGenerator*> ContactGenerators;
+
+    protected:
+
+        /**
+         * Holds the particles. The array is allocated once, so
+         * pointers to the particles stay valid for the life of the
+         * world.
+         */
+        Particle* particles;
+
+        /**
+         * Holds the number of particle slots in use, including
+         * removed particles waiting to be reused.
+         */
+        unsigned particleCount;
+
+        /**
+         * Holds the indices of removed particles, ready for reuse. It
+         * is reserved for every particle when the world is created.
+         */
+        std::vector<unsigned> freeParticles;
+
+        /**
+         * Holds, for each slot, true if its particle has been removed
+         * and the slot not yet reused.
+         */
+        std::vector<bool> removed;
+
+        /**
+         * Holds the number of particles the world can hold.
+         */
+        unsigned maxParticles;
+
+        /**
+         * True if the world should calculate the number of iterations
+         * to give the contact resolver at each step.
+         */
+        bool calculateIterations;
+
+        /**
+         * Holds the force generators for the particles in this world.
+         */
+        ParticleForceRegistry registry;
+
+        /**
+         * Holds the resolver for contacts.
+         */
+        ParticleContactResolver resolver;
+
+        /**
+         * Holds the contact generators.
+         */
+        ContactGenerators contactGenerators;
+
+        /**
+         * Holds the list of contacts.
+         */
+        ParticleContact *contacts;
+
+        /**
+         * Holds the maximum number of contacts allowed (i.e. the
+         * size of the contacts array).
+         */
+        unsigned maxContacts;
+
+        /**
+         * Holds the number of contacts found in the last step.
+         */
+        unsigned contactsUsed;
+
+        /**
+         * Holds the length of one simulation step.
+         */
+        real timestep;
+
+        /**
+         * Holds the frame time not yet simulated.
+         */
+        real accumulator;
+
+        /**
+         * Holds the most steps taken in one call to runPhysics.
+         */
+        unsigned maxSteps;
+
+        /**
+         * Holds the job system used to share the work between
+         * threads, or NULL to run on the calling thread.
+         */
+        JobSystem* jobs;
+
+        /**
+         * Holds the solver for position based links, or NULL if
+         * there is none.
+         */
+        ParticleLinkSolver* linkSolver;
+
+        /**
+         * Holds the island resolver used in place of the contact
+         * resolver, or NULL if there is none.
+         */
+        ParticleIslandResolver* islandResolver;
+
+        /**
+         * Holds the cache used to warm start contacts, or NULL if
+         * there is none.
+         */
+        ParticleContactCache* contactCache;
+
+        /**
+         * Holds the region force generators applied after the force
+         * registry, or NULL if there are none.
+         */
+        ParticleRegionForces* regionForces;
+
+        /**
+         * Holds the integrator that steps particles at their own
+         * rates, or NULL to integrate every particle every step.
+         */
+        ParticleMultiRateIntegrator* multiRate;
+
+        /**
+         * Holds the integrator used in place of the particles' own
+         * integration, or NULL if there is none.
+         */
+        ParticleIntegrator* integrator;
+
+        /**
+         * Holds the profiler each step is recorded into, or NULL if
+         * there is none.
+         */
+        Profiler* profiler;
+
+        /**
+         * Holds the number of steps between reorderings of the
+         * particles, or zero if they are never reordered.
+         */
+        unsigned reorderInterval;
+
+        /**
+         * Holds the number of steps taken since the last reordering,
+         * and the number of reorderings so far.
+         */
+        unsigned stepsSinceReorder;
+        unsigned reorderCount;
+
+        /**
+         * Holds the scratch space kept between reorderings: the new
+         * index of each particle, which is kept until the next
+         * reordering, and the distinct contact generators. The Morton
+         * codes and the copy of the particles come from the frame
+         * arena.
+         */
+        std::vector<unsigned> reorderIndex;
+        std::vector<ParticleContactGenerator*> reorderGenerators;
+
+        /**
+         * True if contacts are generated into buffers, one per worker
+         * of the job system, and then merged.
+         */
+        bool parallelContacts;
+
+        /**
+         * True if the world's results mustn't depend on the number of
+         * workers of its job system.
+         */
+        bool deterministic;
+
+        /**
+         * Holds each worker's contact buffer, and how much of it the
+         * current step has used.
+         */
+        std::vector<std::vector<ParticleContact> > contactBuffers;
+        std::vector<unsigned> contactBufferUsed;
+
+        /**
+         * Holds the number of contacts the last step found but had no
+         * room for, and whether it found more than it had room for.
+         */
+        unsigned contactsDropped;
+        bool contactOverflow;
+
+        /**
+         * True if the last contact generation found any contact with
+         * a time of impact before the end of the step.
+         */
+        bool sweptContacts;
+
+        /**
+         * Generates contacts through the workers' buffers, as
+         * generateContacts does when generation is parallel.
+         */
+        unsigned generateBufferedContacts();
+
+        /**
+         * Moves each particle of a contact found part way through the
+         * step back along its velocity to the earliest moment any of
+         * its contacts touched, and updates the penetration of every
+         * contact to match.
+         */
+        void rewindToImpact(real duration);
+
+        /**
+         * Holds the scratch memory reset at the start of each step.
+         * The world takes the bookkeeping of parallel contact
+         * generation and the scratch space of reordering from it, and
+         * gives it to the island resolver.
+         */
+        FrameArena frameArena;
+
+        friend class ParticleSnapshot;
+
+    public:
+
+        /**
+         * Creates a new particle simulator that can handle up to the
+         * given number of particles and contacts, and optionally a
+         * number of contact-resolution iterations to use. If you
+         * don't give a number of iterations, then twice the number
+         * of contacts will be used.
+         */
+        ParticleWorld(unsigned maxParticles, unsigned maxContacts, unsigned iterations=0);
+
+        /**
+         * Deletes the simulator and its particles.
+         */
+        ~ParticleWorld();
+
+        /**
+         * Adds a particle to the world and returns it. The particle
+         * is at rest at the origin, has unit mass and no damping.
+         * Returns NULL if the world is full.
+         */
+        Particle* addParticle();
+
+        /**
+         * Removes the given particle, and every force registration
+         * for it, from the world. Its slot goes on a free list to be
+         * reused by a later addParticle, so the pointer must not be
+         * used afterwards. Until then the particle stays in the
+         * array, immovable and asleep. Removing a particle that has
+         * already been removed does nothing.
+         *
+         * @note Contact generators the particle was given to are not
+         * told; remove it from them too.
+         */
+        void removeParticle(Particle* particle);
+
+        /**
+         * Removes every particle, registration and contact generator
+         * from the world.
+         */
+        void clear();
+
+        /**
+         * Returns the array of particles.
+         */
+        Particle* getParticles();
+
+        /**
+         * Returns the number of particle slots in use: the length of
+         * the array from getParticles. This includes removed
+         * particles whose slots haven't been reused yet.
+         */
+        unsigned getParticleCount() const;
+
+        /**
+         * Returns the number of particles in the world, not counting
+         * removed ones.
+         */
+        unsigned getLiveParticleCount() const;
+
+        /**
+         * Returns the number of particles in the world that are
+         * awake. This walks every particle, so is meant for
+         * statistics rather than for use each step.
+         */
+        unsigned getAwakeCount() const;
+
+        /**
+         * Returns the world's frame arena, which is reset at the start
+         * of each step. Contact and force generators given a pointer
+         * to it can take their per-step scratch memory from it rather
+         * than from the heap.
+         *
+         * @note The arena is not thread safe. It may only be used on
+         * the thread calling step, so not by contact generators when
+         * contact generation is parallel.
+         */
+        FrameArena& getFrameArena();
+
+        /**
+         * Returns the number of particles the world can hold.
+         */
+        unsigned getMaxParticles() const;
+
+        /**
+         * Returns the force registry.
+         */
+        ParticleForceRegistry& getForceRegistry();
+
+        /**
+         * Returns the list of contact generators.
+         */
+        ContactGenerators& getContactGenerators();
+
+        /**
+         * Returns the contact resolver.
+         */
+        ParticleContactResolver& getContactResolver();
+
+        /**
+         * Returns the contacts found in the last step.
+         */
+        ParticleContact* getContacts();
+
+        /**
+         * Returns the number of contacts found in the last step.
+         */
+        unsigned getContactCount() const;
+
+        /**
+         * Returns true if the last step found more contacts than the
+         * contact array holds, so some were dropped. Generators are
+         * only given the room left in the array, so unless generation
+         * is parallel this is true whenever a generator fills it.
+         */
+        bool getContactOverflow() const;
+
+        /**
+         * Returns the number of contacts the last step found but had
+         * no room for. Only parallel generation can count them, since
+         * its buffers grow to hold everything the generators find;
+         * otherwise this is zero, even on overflow.
+         */
+        unsigned getContactsDropped() const;
+
+        /**
+         * Returns the number of resolver iterations used by the last
+         * step, from the island resolver if one is set.
+         */
+        unsigned getIterationsUsed() const;
+
+        /**
+         * Sets the length of one simulation step.
+         */
+        void setTimestep(real timestep);
+
+        /**
+         * Gets the length of one simulation step.
+         */
+        real getTimestep() const;
+
+        /**
+         * Sets the most steps a single call to runPhysics will take.
+         * If the simulation falls further behind than this, the
+         * excess time is dropped rather than letting the number of
+         * steps per frame keep growing.
+         */
+        void setMaxSteps(unsigned maxSteps);
+
+        /**
+         * Returns the most steps a single call to runPhysics will
+         * take.
+         */
+        unsigned getMaxSteps() const;
+
+        /**
+         * Returns how far the simulation is between its last step and
+         * the next one, as a proportion of the timestep. Renderers can
+         * use this to interpolate particle positions.
+         */
+        real getInterpolationAlpha() const;
+
+        /**
+         * Sets the job system used to share force accumulation and
+         * integration between threads. Pass NULL to run everything on
+         * the calling thread.
+         */
+        void setJobSystem(JobSystem* jobs);
+
+        /**
+         * Returns the job system, or NULL if there is none.
+         */
+        JobSystem* getJobSystem() const;
+
+        /**
+         * Sets whether contacts are generated in parallel. Each
+         * worker of the job system then runs whole generators at a
+         * time, writing into its own buffer, which grows to hold all
+         * they find. The buffers are then merged into the contact
+         * array in the order of the generators, so the contacts are
+         * the same whatever the number of workers, and any that don't
+         * fit are counted. Without a job system the one buffer is
+         * still used.
+         *
+         * Serial generation wakes the sleeping particles a generator's
+         * contacts touch before the next generator runs. Here every
+         * generator sees the particles as they were at the start of
+         * the step, and they are woken once all have run. Generators
+         * that skip sleeping particles can then find fewer contacts
+         * than serial generation would, in the step a sleeper is first
+         * touched. And serial generation stops once the contact array
+         * is full, where here each generator finds all its contacts
+         * before the merge drops those that don't fit.
+         *
+         * Different generators run at once, so a generator must not
+         * be in the list twice, and must only read the particles.
+         * All of the engine's own generators qualify. A generator may
+         * be called again, with more room, if it fills its buffer. A
+         * generator run this way must not have a job system of its
+         * own.
+         */
+        void setParallelContactGeneration(bool parallel);
+
+        /**
+         * Sets whether the world runs in deterministic mode, so that
+         * the same starting state gives bit-identical results with
+         * job systems of any number of workers. It is off by default.
+         *
+         * Each parallel stage already writes to separate particles or
+         * contacts, and merges its results in a fixed order: contacts
+         * in the order of their generators, and islands and colours
+         * by particle, and the force registry sums each particle's
+         * forces in the same order, batched or not, for any number of
+         * workers. So the engine's own stages already repeat exactly;
+         * what is left to vary is how each parallel loop is split.
+         * During each step of a deterministic world its job system
+         * is made deterministic too (see JobSystem::setDeterministic),
+         * so any generator, integrator or solver whose results depend
+         * on the split, such as one that reduces over its own range,
+         * sees the same split whatever the number of workers.
+         * Batching and everything else work as usual.
+         */
+        void setDeterministic(bool deterministic);
+
+        /**
+         * Returns true if the world runs in deterministic mode.
+         */
+        bool isDeterministic() const;
+
+        /**
+         * Sets a solver for links treated as distance constraints. It
+         * runs after integration, before contacts are generated. Pass
+         * NULL to remove it.
+         */
+        void setLinkSolver(ParticleLinkSolver* linkSolver);
+
+        /**
+         * Sets an island resolver to use in place of the world's
+         * contact resolver, so independent groups of contacts can be
+         * resolved on different threads of the job system. Pass NULL
+         * to go back to the contact resolver. The resolver takes its
+         * scratch space from the world's frame arena while it is set.
+         */
+        void setIslandResolver(ParticleIslandResolver* islandResolver);
+
+        /**
+         * Sets a cache that carries contact impulses from each step
+         * to the next. Contacts that persist are warm started with
+         * last step's impulse before they are resolved. Pass NULL to
+         * resolve every step from scratch.
+         */
+        void setContactCache(ParticleContactCache* contactCache);
+
+        /**
+         * Sets a set of region force generators to apply at each
+         * step, after the force registry. Pass NULL to remove it.
+         */
+        void setRegionForces(ParticleRegionForces* regionForces);
+
+        /**
+         * Sets an integrator that lets slow particles take longer
+         * steps, integrating them less often than the world steps.
+         * It is reset, putting every particle at its shortest step.
+         * Pass NULL to integrate every particle every step. It can't
+         * be used together with setIntegrator.
+         */
+        void setMultiRateIntegrator(ParticleMultiRateIntegrator* multiRate);
+
+        /**
+         * Sets an integrator to use in place of the particles' own,
+         * for example a ParticleVerletIntegrator. Pass NULL to go
+         * back to Particle::integrate. A world can't have both this
+         * and a multi-rate integrator, which has no way to step
+         * particles but its own: stepping with both set asserts, and
+         * in release builds only this one is used.
+         */
+        void setIntegrator(ParticleIntegrator* integrator);
+
+        /**
+         * Sets a profiler to record the time each phase of a step
+         * takes, along with the contact, iteration and awake particle
+         * counts. Profiling is only compiled in if the library is
+         * built with CYCLONE_ENABLE_PROFILING defined; otherwise the
+         * profiler records nothing. Pass NULL to stop recording.
+         */
+        void setProfiler(Profiler* profiler);
+
+        /**
+         * Sets the world to reorder its particles every given number
+         * of steps, before the step's forces are applied. Pass zero,
+         * the default, to never reorder them. See reorderParticles.
+         *
+         * Reordering costs a sort and a pass over everything holding
+         * particles, and only pays once the particles no longer fit
+         * in cache. The bench's pile of 4000 runs within noise of the
+         * same pile unreordered, so leave it off unless profiling a
+         * larger scene shows a gain.
+         */
+        void setReorderInterval(unsigned steps);
+
+        /**
+         * Returns the number of steps between reorderings, or zero if
+         * the particles are never reordered.
+         */
+        unsigned getReorderInterval() const;
+
+        /**
+         * Sorts the particles into Morton order of their positions,
+         * so particles close in space are close in the array, and
+         * moves removed particles' slots to the end. Slow scenes of
+         * many particles, such as piles of grains, drift out of order
+         * as they move, and the broadphase and resolver then jump
+         * about memory, which for scenes too big for the cache a
+         * reorder every few dozen steps puts right.
+         *
+         * Everything the world holds is told where each particle has
+         * gone: the force registry, which tells each of its
+         * generators once, each contact generator, last step's
+         * contacts, and the link solver, contact cache, region forces
+         * and multi-rate integrator.
+         *
+         * @note Anything else holding pointers to the world's
+         * particles, or their indices, is not told and will refer to
+         * other particles afterwards. It can watch getReorderCount
+         * and pass getLastReorder to its remapParticles method, as a
+         * ParticleSpringNetwork can, or the caller can update it. If
+         * newIndex is given, it is filled with the new index of the
+         * particle at each old index.
+         */
+        void reorderParticles(std::vector<unsigned>* newIndex = 0);
+
+        /**
+         * Returns the number of times the particles have been
+         * reordered. Something outside the world holding particles
+         * can check it once a step, as the world thread and the
+         * trajectory recorder do, and follow the particles with
+         * getLastReorder when it changes by one. A scheduled reorder
+         * happens at the start of a step, so checking after each step
+         * never misses one.
+         */
+        unsigned getReorderCount() const;
+
+        /**
+         * Returns where each particle went in the last reordering.
+         * It stays valid until the next one. Before the first it
+         * holds no particles, so it leaves every particle alone.
+         */
+        ParticleRemap getLastReorder() const;
+
+        /**
+         * Initializes the world for a simulation frame. This clears
+         * the force accumulators for particles in the world. After
+         * calling this, the particles can have their forces for this
+         * frame added. Those forces apply to the first step taken by
+         * the next call to runPhysics.
+         */
+        void startFrame();
+
+        /**
+         * Calls each of the registered contact generators to report
+         * their contacts, marking each contact with the generator
+         * that produced it. Returns the number of generated contacts.
+         */
+        unsigned generateContacts();
+
+        /**
+         * Applies the force registry, then the region forces if
+         * there are any, to the particles. A step does this before it
+         * integrates, and integrators with more than one stage do it
+         * again at each stage.
+         */
+        void applyForces(real duration);
+
+        /**
+         * Integrates all the particles in this world forward in time
+         * by the given duration.
+         */
+        void integrate(real duration);
+
+        /**
+         * Takes a single simulation step of the given duration:
+         * forces, integration, the link solver, then contact
+         * generation and resolution.
+         *
+         * If a contact generator finds contacts part way through the
+         * step, as a continuous collision generator does for fast
+         * particles, their particles are first moved back to the
+         * moment they touched, so the resolver separates them there
+         * rather than from wherever they ended up past the obstacle.
+         * They go back along their velocity at the end of the step,
+         * and the rest of the step is lost.
+         */
+        void step(real duration);
+
+        /**
+         * Advances the simulation by the given frame duration, taking
+         * as many fixed timesteps as fit. Returns the number of steps
+         * taken.
+         */
+        unsigned runPhysics(real duration);
+
+    private:
+        ParticleWorld(const ParticleWorld&);
+        ParticleWorld& operator=(const ParticleWorld&);
+    };
+}
+
+#endif // CYCLONE_PWORLD_H
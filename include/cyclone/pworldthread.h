@@ -0,0 +1,334 @@
+/*
+ * Interface file for running a particle world on its own thread.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a thread that steps a particle world at a fixed
+ * rate of its own, independent of how long each rendered frame takes,
+ * and the buffer it hands the results over in.
+ *
+ * After every step the thread copies the particles' positions and
+ * velocities, along with their positions after the step before, into
+ * a triple buffer. The buffer never makes either side wait: the
+ * physics thread always has a state of its own to write, and the
+ * reader (a renderer, or something sending the state over the
+ * network) always has the newest state, whose two sets of positions
+ * it can interpolate between for the time it is drawing.
+ */
+#ifndef CYCLONE_PWORLDTHREAD_H
+#define CYCLONE_PWORLDTHREAD_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "core.h"
+
+namespace cyclone {
+
+    class ParticleWorld;
+
+    /**
+     * The state of a world's particles after one step, with their
+     * positions after the step before it.
+     */
+    struct ParticleState
+    {
+        /**
+         * Holds the position and velocity of every particle slot in
+         * the world, including removed particles.
+         */
+        std::vector<Vector3> position;
+        std::vector<Vector3> velocity;
+
+        /**
+         * Holds the positions after the step before.
+         */
+        std::vector<Vector3> previousPosition;
+
+        /**
+         * Holds the number of particle slots in use after this step
+         * and after the step before.
+         */
+        unsigned count;
+        unsigned previousCount;
+
+        /**
+         * Holds the number of steps taken to reach this state.
+         */
+        unsigned long long step;
+
+        /**
+         * Holds the world's reorder count after this step. When it
+         * changes, the slots hold different particles than before
+         * (see ParticleWorld::reorderParticles); the previous
+         * positions have already been moved to match.
+         */
+        unsigned reorderCount;
+
+        /**
+         * Holds the times of this step and the step before, in
+         * seconds on the clock of the thread that published them.
+         * Steps the thread dropped move the clock on without being
+         * simulated.
+         */
+        double time;
+        double previousTime;
+    };
+
+    /**
+     * Passes states from one writing thread to one reading thread
+     * without locks. There are three states: the one being written,
+     * the one being read, and the newest finished one between them,
+     * which the two sides swap for with a single atomic exchange.
+     */
+    class ParticleStateBuffer
+    {
+    protected:
+
+        /**
+         * Holds the three states.
+         */
+        ParticleState states[3];
+
+        /**
+         * Holds the index of the state between the two sides, with
+         * the fresh bit set if the writer has published it since the
+         * reader last took it.
+         */
+        std::atomic<unsigned> middle;
+
+        /**
+         * Holds the index of the writer's state and of the reader's.
+         */
+        unsigned writing;
+        unsigned reading;
+
+        enum { FRESH = 4 };
+
+    public:
+
+        /**
+         * Creates a buffer for states of up to the given number of
+         * particles.
+         */
+        ParticleStateBuffer(unsigned maxParticles);
+
+        /**
+         * Empties the buffer, so it has no states to read. It must
+         * not be called while either side is using it.
+         */
+        void reset();
+
+        /**
+         * Returns the state for the writer to fill in.
+         */
+        ParticleState& getWriteState();
+
+        /**
+         * Publishes the state returned by getWriteState, making it the
+         * newest state, and gives the writer a new one to fill in.
+         */
+        void publish();
+
+        /**
+         * Takes the newest published state, if there is one the
+         * reader hasn't taken yet. Returns true if there was.
+         */
+        bool update();
+
+        /**
+         * Returns the newest state the reader has taken. It has a
+         * count of zero until a state has been taken.
+         */
+        const ParticleState& getLatest() const;
+    };
+
+    /**
+     * Steps a particle world at a fixed rate on a thread of its own,
+     * publishing the particles' state after each step.
+     *
+     * While the thread is running it owns the world: nothing else may
+     * touch the world, its particles or its generators. Changes to
+     * the simulation (applying the player's input, say) are made in
+     * the step callback, which runs on the physics thread just before
+     * each step; anything it reads from other threads must be safe to
+     * share. Other threads see the particles only through the
+     * published states.
+     *
+     * The step length is the world's timestep. Steps are timed
+     * against a steady clock, so a slow frame of the renderer doesn't
+     * stretch them. If the physics thread itself falls more than the
+     * world's maximum number of steps behind, it drops the time it
+     * couldn't simulate, as runPhysics does.
+     */
+    class ParticleWorldThread
+    {
+    public:
+
+        /**
+         * The type of the step callback. It is given the world and
+         * the data pointer the callback was set with.
+         */
+        typedef void (*StepCallback)(ParticleWorld &world, void* data);
+
+    protected:
+
+        /**
+         * Holds the world being stepped.
+         */
+        ParticleWorld &world;
+
+        /**
+         * Holds the buffer states are published to.
+         */
+        ParticleStateBuffer buffer;
+
+        /**
+         * Holds the length of each step, from the world.
+         */
+        real timestep;
+
+        /**
+         * Holds the step callback and its data.
+         */
+        StepCallback callback;
+        void* callbackData;
+
+        /**
+         * Holds the thread, and whether it has been asked to stop.
+         */
+        std::thread thread;
+        std::atomic<bool> stopping;
+
+        /**
+         * Holds the clock reading, in nanoseconds, at which the
+         * thread started, and the number of steps taken since.
+         */
+        unsigned long long startTime;
+        std::atomic<unsigned long long> steps;
+
+        /**
+         * Holds the number of steps dropped because the thread fell
+         * behind.
+         */
+        std::atomic<unsigned long long> droppedSteps;
+
+        /**
+         * Holds the world's reorder count when the previous positions
+         * were recorded, and scratch space for moving them.
+         */
+        unsigned previousReorderCount;
+        std::vector<Vector3> reorderScratch;
+
+        /**
+         * The body of the physics thread.
+         */
+        void run();
+
+        /**
+         * Copies the world's particle positions into the buffer's
+         * write state as the positions after the step before.
+         */
+        void recordPrevious(double time);
+
+        /**
+         * Copies the world's particles into the buffer's write state
+         * and publishes it as the state after the given step, at the
+         * given time. If the world reordered its particles since the
+         * previous positions were recorded, they are moved to the
+         * particles' new slots first.
+         */
+        void publish(unsigned long long step, double time);
+
+    public:
+
+        /**
+         * Creates a thread to step the given world. It doesn't start
+         * until start is called.
+         */
+        ParticleWorldThread(ParticleWorld &world);
+
+        /**
+         * Stops the thread, if it is running.
+         */
+        ~ParticleWorldThread();
+
+        /**
+         * Sets the function called before each step. Pass NULL to
+         * remove it. It must not be called while the thread is
+         * running.
+         */
+        void setStepCallback(StepCallback callback, void* data = 0);
+
+        /**
+         * Starts stepping the world, first publishing its current
+         * state as step zero. Does nothing if the thread is already
+         * running.
+         */
+        void start();
+
+        /**
+         * Stops stepping the world, waiting for the step in progress
+         * to finish. The world can be used again once it returns.
+         */
+        void stop();
+
+        /**
+         * Returns true if the thread is running.
+         */
+        bool isRunning() const;
+
+        /**
+         * Returns the number of seconds since the thread started, on
+         * the clock its steps are timed by.
+         */
+        double getTime() const;
+
+        /**
+         * Returns the number of steps taken, and the number dropped,
+         * since the thread started.
+         */
+        unsigned long long getStepCount() const;
+        unsigned long long getDroppedStepCount() const;
+
+        /**
+         * Returns the buffer the states are published to. Only one
+         * thread may read from it.
+         */
+        ParticleStateBuffer& getBuffer();
+
+        /**
+         * Fills the given array with the particles' positions at the
+         * given time, interpolated between the two newest steps, and
+         * returns the number of positions written (no more than the
+         * given maximum). A time outside the two steps gives the
+         * nearer of them. Drawing at one step before getTime keeps the
+         * time between the two steps when the thread is keeping up.
+         * This takes the newest state from the buffer, so only one
+         * thread may call it.
+         */
+        unsigned interpolate(double time, Vector3* positions, unsigned max);
+
+        /**
+         * Fills the given array with the positions interpolated for
+         * one step before the current time.
+         */
+        unsigned interpolate(Vector3* positions, unsigned max);
+
+    private:
+        ParticleWorldThread(const ParticleWorldThread&);
+        ParticleWorldThread& operator=(const ParticleWorldThread&);
+    };
+}
+
+#endif // CYCLONE_PWORLDTHREAD_H
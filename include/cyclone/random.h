@@ -28,6 +28,23 @@ namespace cyclone {
      * This is used to get random numbers. Rather than a funcion, this
      * allows there to be several streams of repeatable random numbers
      * at the same time. Uses the RandRotB algorithm.
+     *
+     * A stream must only be used by one thread at a time. To share
+     * random work between threads, give each piece of work its own
+     * stream: either one of a numbered family of streams from a
+     * single seed, or a stream split off another. Numbering streams
+     * by piece of work (rather than by the thread that happens to
+     * run it) keeps the results the same however many threads there
+     * are.
+     *
+     * The fill methods make many numbers at once, several at a time,
+     * which is much quicker than calling the single value methods in
+     * a loop. fillBits and fillReal give exactly the values the same
+     * number of calls to randomBits or randomReal would. The vector
+     * fills give vectors with the same distribution as randomVector,
+     * with components drawn in x, y, z order, but not the same
+     * vectors: the order randomVector draws its components in is up
+     * to the compiler.
      */
     class Random
     {
@@ -53,11 +70,32 @@ namespace cyclone {
          */
         Random(unsigned seed);
 
+        /**
+         * Creates the given stream of the family of streams with the
+         * given seed. Different streams of a family are independent
+         * of one another. Stream zero is the stream Random(seed)
+         * gives.
+         */
+        Random(unsigned seed, unsigned stream);
+
         /**
          * Sets the seed value for the random stream.
          */
         void seed(unsigned seed);
 
+        /**
+         * Makes this the given stream of the family of streams with
+         * the given seed.
+         */
+        void seed(unsigned seed, unsigned stream);
+
+        /**
+         * Returns a new stream, independent of this one, seeded from
+         * this stream's output. A stream split the same number of
+         * times in the same order gives the same new streams.
+         */
+        Random split();
+
         /**
          * Returns the next random bitstring from the stream. This is
          * the fastest method.
@@ -119,16 +157,44 @@ namespace cyclone {
         Vector3 randomXZVector(real scale);
 
         /**
-         * Returns a random orientation (i.e. normalized) quaternion.
+         * Fills the given array with the next count random bitstrings
+         * from the stream.
          */
-        Quaternion randomQuaternion();
+        void fillBits(unsigned* out, unsigned count);
+
+        /**
+         * Fills the given array with random floating point numbers
+         * between 0 and 1, or between min and max.
+         */
+        void fillReal(real* out, unsigned count);
+        void fillReal(real* out, unsigned count, real min, real max);
+
+        /**
+         * Fills the given array with random vectors whose components
+         * are binomially distributed in the range (-scale to scale),
+         * as randomVector(scale).
+         */
+        void fillVectors(Vector3* out, unsigned count, real scale);
+
+        /**
+         * Fills the given array with random vectors uniformly
+         * distributed in the cube defined by the given minimum and
+         * maximum vectors, as randomVector(min, max).
+         */
+        void fillVectors(Vector3* out, unsigned count, const Vector3 &min, const Vector3 &max);
 
     private:
         // Internal mechanics
         int p1, p2;
         unsigned buffer[17];
+
+        /**
+         * Fills the buffer from the given key with the SplitMix64
+         * generator, which turns nearby keys into unrelated states.
+         */
+        void seedFromKey(unsigned long long key);
     };
 
 } // namespace cyclone
 
-#endif // CYCLONE_BODY_H
+#endif // CYCLONE_RANDOM_H
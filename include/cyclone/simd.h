@@ -0,0 +1,389 @@
+/*
+ * Interface file for the SIMD kernels used by the vector class.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file selects four-wide SIMD instruction sets for each scalar
+ * type the vector class can hold, and wraps the handful of operations
+ * the vector class needs. A vector holds x, y, z and a pad word
+ * contiguously, so one SIMD register holds a whole vector.
+ *
+ * The instruction sets are chosen at compile time:
+ *
+ * - float vectors use SSE on x86 or NEON on ARM,
+ * - double vectors use AVX on x86 (four doubles per register), or
+ *   else SSE2 (two registers of two doubles), which every x86-64
+ *   compiler enables.
+ *
+ * Both can be in use in the same build. A scalar type with no
+ * matching instruction set enabled by the compiler flags (or every
+ * type, if CYCLONE_NO_SIMD is defined) uses scalar code.
+ * CYCLONE_SIMD is defined if vectors of the library's own real type
+ * have SIMD kernels.
+ */
+#ifndef CYCLONE_SIMD_H
+#define CYCLONE_SIMD_H
+
+#include "precision.h"
+
+#if !defined(CYCLONE_NO_SIMD)
+    #if defined(__SSE__)
+        #define CYCLONE_SIMD_SSE
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        #define CYCLONE_SIMD_NEON
+    #endif
+    #if defined(__AVX__)
+        #define CYCLONE_SIMD_AVX
+    #elif defined(__SSE2__)
+        #define CYCLONE_SIMD_SSE2
+    #endif
+#endif
+
+#if defined(CYCLONE_SIMD_SSE)
+    #include <xmmintrin.h>
+#elif defined(CYCLONE_SIMD_NEON)
+    #include <arm_neon.h>
+#endif
+#if defined(CYCLONE_SIMD_AVX)
+    #include <immintrin.h>
+#elif defined(CYCLONE_SIMD_SSE2)
+    #include <emmintrin.h>
+#endif
+
+#if defined(SINGLE_PRECISION) && (defined(CYCLONE_SIMD_SSE) || defined(CYCLONE_SIMD_NEON))
+    #define CYCLONE_SIMD
+#elif defined(DOUBLE_PRECISION) && (defined(CYCLONE_SIMD_AVX) || defined(CYCLONE_SIMD_SSE2))
+    #define CYCLONE_SIMD
+#endif
+
+namespace cyclone {
+
+    /**
+     * The simd namespace holds the register level kernels. Each
+     * function works on four scalars: the x, y, z and pad members of
+     * a vector. Loads and stores are unaligned, so vectors do not need
+     * any particular alignment in memory.
+     */
+    namespace simd {
+
+        /**
+         * Holds the kernels for vectors of the given scalar type. It
+         * is specialised for each scalar type that has an instruction
+         * set, with enabled set to one. The generic version works one
+         * component at a time; the vector class uses its own scalar
+         * code instead when enabled is zero. The cross member is
+         * non-zero if cross3 is a SIMD kernel rather than scalar code.
+         */
+        template <typename T>
+        struct Lanes
+        {
+            enum { enabled = 0, cross = 0 };
+
+            struct vec4 { T x, y, z, w; };
+
+            static vec4 load(const T* p)
+            {
+                vec4 a = { p[0], p[1], p[2], p[3] };
+                return a;
+            }
+
+            static void store(T* p, vec4 a)
+            {
+                p[0] = a.x; p[1] = a.y; p[2] = a.z; p[3] = a.w;
+            }
+
+            static vec4 splat(T value)
+            {
+                vec4 a = { value, value, value, value };
+                return a;
+            }
+
+            static vec4 add(vec4 a, vec4 b)
+            {
+                vec4 r = { a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w };
+                return r;
+            }
+
+            static vec4 sub(vec4 a, vec4 b)
+            {
+                vec4 r = { a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w };
+                return r;
+            }
+
+            static vec4 mul(vec4 a, vec4 b)
+            {
+                vec4 r = { a.x*b.x, a.y*b.y, a.z*b.z, a.w*b.w };
+                return r;
+            }
+
+            /** Returns a + b * c. */
+            static vec4 madd(vec4 a, vec4 b, vec4 c)
+            {
+                vec4 r = { a.x+b.x*c.x, a.y+b.y*c.y, a.z+b.z*c.z, a.w+b.w*c.w };
+                return r;
+            }
+
+            /** Returns the sum of the x, y and z lanes of a * b. */
+            static T dot3(vec4 a, vec4 b)
+            {
+                return a.x*b.x + a.y*b.y + a.z*b.z;
+            }
+
+            /** Returns the vector product of the x, y and z lanes. */
+            static vec4 cross3(vec4 a, vec4 b)
+            {
+                vec4 r = { a.y*b.z-a.z*b.y, a.z*b.x-a.x*b.z, a.x*b.y-a.y*b.x, 0 };
+                return r;
+            }
+        };
+
+#if defined(CYCLONE_SIMD_SSE)
+
+        template <>
+        struct Lanes<float>
+        {
+            enum { enabled = 1, cross = 1 };
+
+            typedef __m128 vec4;
+
+            static vec4 load(const float* p) { return _mm_loadu_ps(p); }
+            static void store(float* p, vec4 a) { _mm_storeu_ps(p, a); }
+            static vec4 splat(float value) { return _mm_set1_ps(value); }
+            static vec4 add(vec4 a, vec4 b) { return _mm_add_ps(a, b); }
+            static vec4 sub(vec4 a, vec4 b) { return _mm_sub_ps(a, b); }
+            static vec4 mul(vec4 a, vec4 b) { return _mm_mul_ps(a, b); }
+
+            /** Returns a + b * c. */
+            static vec4 madd(vec4 a, vec4 b, vec4 c)
+            {
+                return _mm_add_ps(a, _mm_mul_ps(b, c));
+            }
+
+            /** Returns the sum of the x, y and z lanes of a * b. */
+            static float dot3(vec4 a, vec4 b)
+            {
+                vec4 m = _mm_mul_ps(a, b);
+                vec4 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,1,1,1)));
+                s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2,2,2,2)));
+                return _mm_cvtss_f32(s);
+            }
+
+            /** Returns the vector product of the x, y and z lanes. */
+            static vec4 cross3(vec4 a, vec4 b)
+            {
+                vec4 ayzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,0,2,1));
+                vec4 bzxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3,1,0,2));
+                vec4 azxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,1,0,2));
+                vec4 byzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3,0,2,1));
+                return _mm_sub_ps(_mm_mul_ps(ayzx, bzxy), _mm_mul_ps(azxy, byzx));
+            }
+        };
+
+#elif defined(CYCLONE_SIMD_NEON)
+
+        template <>
+        struct Lanes<float>
+        {
+            enum { enabled = 1, cross = 0 };
+
+            typedef float32x4_t vec4;
+
+            static vec4 load(const float* p) { return vld1q_f32(p); }
+            static void store(float* p, vec4 a) { vst1q_f32(p, a); }
+            static vec4 splat(float value) { return vdupq_n_f32(value); }
+            static vec4 add(vec4 a, vec4 b) { return vaddq_f32(a, b); }
+            static vec4 sub(vec4 a, vec4 b) { return vsubq_f32(a, b); }
+            static vec4 mul(vec4 a, vec4 b) { return vmulq_f32(a, b); }
+
+            /** Returns a + b * c. */
+            static vec4 madd(vec4 a, vec4 b, vec4 c)
+            {
+                return vaddq_f32(a, vmulq_f32(b, c));
+            }
+
+            /** Returns the sum of the x, y and z lanes of a * b. */
+            static float dot3(vec4 a, vec4 b)
+            {
+                vec4 m = vmulq_f32(a, b);
+                return vgetq_lane_f32(m, 0) + vgetq_lane_f32(m, 1) +
+                    vgetq_lane_f32(m, 2);
+            }
+
+            /** Returns the vector product of the x, y and z lanes. */
+            static vec4 cross3(vec4 a, vec4 b)
+            {
+                float pa[4], pb[4];
+                vst1q_f32(pa, a);
+                vst1q_f32(pb, b);
+                float r[4] = {
+                    pa[1]*pb[2]-pa[2]*pb[1],
+                    pa[2]*pb[0]-pa[0]*pb[2],
+                    pa[0]*pb[1]-pa[1]*pb[0],
+                    0 };
+                return vld1q_f32(r);
+            }
+        };
+
+#endif
+
+#if defined(CYCLONE_SIMD_AVX)
+
+        template <>
+        struct Lanes<double>
+        {
+#if defined(__AVX2__)
+            enum { enabled = 1, cross = 1 };
+#else
+            enum { enabled = 1, cross = 0 };
+#endif
+
+            typedef __m256d vec4;
+
+            static vec4 load(const double* p) { return _mm256_loadu_pd(p); }
+            static void store(double* p, vec4 a) { _mm256_storeu_pd(p, a); }
+            static vec4 splat(double value) { return _mm256_set1_pd(value); }
+            static vec4 add(vec4 a, vec4 b) { return _mm256_add_pd(a, b); }
+            static vec4 sub(vec4 a, vec4 b) { return _mm256_sub_pd(a, b); }
+            static vec4 mul(vec4 a, vec4 b) { return _mm256_mul_pd(a, b); }
+
+            /** Returns a + b * c. */
+            static vec4 madd(vec4 a, vec4 b, vec4 c)
+            {
+                return _mm256_add_pd(a, _mm256_mul_pd(b, c));
+            }
+
+            /** Returns the sum of the x, y and z lanes of a * b. */
+            static double dot3(vec4 a, vec4 b)
+            {
+                vec4 m = _mm256_mul_pd(a, b);
+                __m128d xy = _mm256_castpd256_pd128(m);
+                __m128d zw = _mm256_extractf128_pd(m, 1);
+                __m128d s = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+                s = _mm_add_sd(s, zw);
+                return _mm_cvtsd_f64(s);
+            }
+
+            /** Returns the vector product of the x, y and z lanes. */
+            static vec4 cross3(vec4 a, vec4 b)
+            {
+#if defined(__AVX2__)
+                vec4 ayzx = _mm256_permute4x64_pd(a, _MM_SHUFFLE(3,0,2,1));
+                vec4 bzxy = _mm256_permute4x64_pd(b, _MM_SHUFFLE(3,1,0,2));
+                vec4 azxy = _mm256_permute4x64_pd(a, _MM_SHUFFLE(3,1,0,2));
+                vec4 byzx = _mm256_permute4x64_pd(b, _MM_SHUFFLE(3,0,2,1));
+                return _mm256_sub_pd(_mm256_mul_pd(ayzx, bzxy), _mm256_mul_pd(azxy, byzx));
+#else
+                double pa[4], pb[4];
+                _mm256_storeu_pd(pa, a);
+                _mm256_storeu_pd(pb, b);
+                return _mm256_set_pd(0,
+                    pa[0]*pb[1]-pa[1]*pb[0],
+                    pa[2]*pb[0]-pa[0]*pb[2],
+                    pa[1]*pb[2]-pa[2]*pb[1]);
+#endif
+            }
+        };
+
+#elif defined(CYCLONE_SIMD_SSE2)
+
+        template <>
+        struct Lanes<double>
+        {
+            enum { enabled = 1, cross = 1 };
+
+            /**
+             * Holds the x and y lanes in one register and the z and
+             * pad lanes in the other.
+             */
+            struct vec4 { __m128d xy, zw; };
+
+            static vec4 load(const double* p)
+            {
+                vec4 a = { _mm_loadu_pd(p), _mm_loadu_pd(p + 2) };
+                return a;
+            }
+
+            static void store(double* p, vec4 a)
+            {
+                _mm_storeu_pd(p, a.xy);
+                _mm_storeu_pd(p + 2, a.zw);
+            }
+
+            static vec4 splat(double value)
+            {
+                vec4 a = { _mm_set1_pd(value), _mm_set1_pd(value) };
+                return a;
+            }
+
+            static vec4 add(vec4 a, vec4 b)
+            {
+                vec4 r = { _mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw) };
+                return r;
+            }
+
+            static vec4 sub(vec4 a, vec4 b)
+            {
+                vec4 r = { _mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw) };
+                return r;
+            }
+
+            static vec4 mul(vec4 a, vec4 b)
+            {
+                vec4 r = { _mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw) };
+                return r;
+            }
+
+            /** Returns a + b * c. */
+            static vec4 madd(vec4 a, vec4 b, vec4 c)
+            {
+                vec4 r = {
+                    _mm_add_pd(a.xy, _mm_mul_pd(b.xy, c.xy)),
+                    _mm_add_pd(a.zw, _mm_mul_pd(b.zw, c.zw)) };
+                return r;
+            }
+
+            /** Returns the sum of the x, y and z lanes of a * b. */
+            static double dot3(vec4 a, vec4 b)
+            {
+                __m128d xy = _mm_mul_pd(a.xy, b.xy);
+                __m128d zw = _mm_mul_pd(a.zw, b.zw);
+                __m128d s = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+                s = _mm_add_sd(s, zw);
+                return _mm_cvtsd_f64(s);
+            }
+
+            /** Returns the vector product of the x, y and z lanes. */
+            static vec4 cross3(vec4 a, vec4 b)
+            {
+                // The result's (x, y) is a(y, z) * b(z, x) - a(z, x) * b(y, z),
+                // and its (z, pad) is a(x, pad) * b(y, pad) - a(y, pad) * b(x, pad).
+                __m128d ayz = _mm_shuffle_pd(a.xy, a.zw, 1);
+                __m128d azx = _mm_shuffle_pd(a.zw, a.xy, 0);
+                __m128d axw = _mm_shuffle_pd(a.xy, a.zw, 2);
+                __m128d ayw = _mm_shuffle_pd(a.xy, a.zw, 3);
+                __m128d byz = _mm_shuffle_pd(b.xy, b.zw, 1);
+                __m128d bzx = _mm_shuffle_pd(b.zw, b.xy, 0);
+                __m128d bxw = _mm_shuffle_pd(b.xy, b.zw, 2);
+                __m128d byw = _mm_shuffle_pd(b.xy, b.zw, 3);
+                vec4 r = {
+                    _mm_sub_pd(_mm_mul_pd(ayz, bzx), _mm_mul_pd(azx, byz)),
+                    _mm_sub_pd(_mm_mul_pd(axw, byw), _mm_mul_pd(ayw, bxw)) };
+                return r;
+            }
+        };
+
+#endif
+    }
+}
+
+#endif // CYCLONE_SIMD_H
@@ -4,7 +4,8 @@
 PLATFORM = $(shell uname)
 
 ifeq ($(PLATFORM), Linux)
-    LDFLAGS = -lGL -lGLU -lglut
+    LDFLAGS = -lGL -lGLU -lglut -pthread
+    BENCHLDFLAGS = -pthread
 else
     $(error This OS is not Ubuntu Linux. Aborting)
 endif
@@ -15,8 +16,11 @@ DEMOPATH = ./src/demos/
 # Build directory path
 BUILDPATH = ./build/
 
+# Benchmark files path.
+BENCHPATH = ./src/bench/
+
 # Demo core files.
-DEMOCOREFILES = $(DEMOPATH)main.cpp $(DEMOPATH)app.cpp $(DEMOPATH)timing.cpp
+DEMOCOREFILES = $(DEMOPATH)main.cpp $(DEMOPATH)app.cpp $(DEMOPATH)timing.cpp $(DEMOPATH)render.cpp $(DEMOPATH)compute.cpp
 
 # Demo files.
 # DEMOLIST = ballistic bigballistic blob bridge explosion fireworks flightsim fracture platform ragdoll sailboat
@@ -24,11 +28,29 @@ DEMOLIST = lighter ballistic
 
 # Cyclone core files.
 # CYCLONEFILES = ./src/body.cpp ./src/collide_coarse.cpp ./src/collide_fine.cpp ./src/contacts.cpp ./src/fgen.cpp ./src/joints.cpp ./src/plinks.cpp ./src/pworld.cpp ./src/random.cpp ./src/world.cpp
-CYCLONEFILES = ./src/core.cpp ./src/particle.cpp ./src/pfgen.cpp ./src/pcontacts.cpp ./src/plinks.cpp
-.PHONY: clean
+CYCLONEFILES = ./src/core.cpp ./src/particle.cpp ./src/pfgen.cpp ./src/pcontacts.cpp ./src/plinks.cpp ./src/pstore.cpp ./src/jobs.cpp ./src/pworld.cpp ./src/pcollide.cpp ./src/random.cpp ./src/pgravity.cpp ./src/pimplicit.cpp ./src/plinksolver.cpp ./src/pislands.cpp ./src/pcache.cpp ./src/pool.cpp ./src/profile.cpp ./src/psnapshot.cpp ./src/ptrajectory.cpp ./src/pworldthread.cpp ./src/pregion.cpp ./src/pemitter.cpp ./src/pmultirate.cpp ./src/preorder.cpp
+
+# The Vector3 SIMD kernels (see include/cyclone/simd.h) follow the
+# compiler's instruction set flags: float vectors use SSE or NEON,
+# double vectors use SSE2, or AVX given -mavx (and -mavx2 for the
+# vector product).
+
+# The library is built in double precision. Build with
+# PRECISION=single to build it in single precision.
+ifeq ($(PRECISION), single)
+    PRECISIONFLAGS = -DCYCLONE_SINGLE_PRECISION
+endif
+
+# Build with PROFILE=1 to compile in the per-phase profiler (see
+# include/cyclone/profile.h).
+ifeq ($(PROFILE), 1)
+    PROFILEFLAGS = -DCYCLONE_ENABLE_PROFILING
+endif
+
+.PHONY: clean bench
 
 # Build the project
-all: build $(DEMOLIST)
+all: build $(DEMOLIST) bench
 
 # Create build directory
 build:
@@ -36,7 +58,12 @@ build:
 
 # Compile demo files
 $(DEMOLIST):
-	g++ -O2 -Iinclude $(DEMOCOREFILES) $(CYCLONEFILES) $(DEMOPATH)$@/$@.cpp -o $(BUILDPATH)$@ $(LDFLAGS) 
+	g++ -O2 $(PRECISIONFLAGS) $(PROFILEFLAGS) -Iinclude $(DEMOCOREFILES) $(CYCLONEFILES) $(DEMOPATH)$@/$@.cpp -o $(BUILDPATH)$@ $(LDFLAGS) 
+
+# Compile the headless benchmark. It links only the engine, so it
+# builds and runs without OpenGL.
+bench: build
+	g++ -O2 $(PRECISIONFLAGS) $(PROFILEFLAGS) -Iinclude $(CYCLONEFILES) $(BENCHPATH)bench.cpp -o $(BUILDPATH)bench $(BENCHLDFLAGS)
 
 # Remove build directory
 clean:
@@ -0,0 +1,1708 @@
+/*
+ * Headless benchmark for the particle engine.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/*
+ * Runs a fixed set of scenarios through ParticleWorld and prints the
+ * results as JSON on stdout. Every scenario is built from its own
+ * fixed seed, so two runs of the same build simulate exactly the same
+ * thing.
+ *
+ * Usage: bench [steps] [threads] [trace prefix]
+ *
+ * With threads of zero (the default) everything runs on the calling
+ * thread; otherwise the world is given a job system with that many
+ * workers. Each scenario that steps a world also reports a hash of
+ * its final state, so runs can be checked against each other. The
+ * scenarios ending in _deterministic put the world in deterministic
+ * mode. Each reports its overhead over the same scenario run
+ * normally, and is run a second time on a job system with a
+ * different number of workers, reporting whether that reproduced its
+ * hash. Scenarios that check their own results, such as that a
+ * trajectory file or snapshot reads back what was saved, report the
+ * check and whether it passed.
+ *
+ * Each scenario reports the peak resident memory while it ran. The
+ * high-water mark is reset before every scenario, so one scenario's
+ * peak does not hide the next one's; the highest of them is
+ * reported at the end as the peak of the whole run.
+ *
+ * When built with profiling (make PROFILE=1) each scenario that steps
+ * a world also reports the mean time per step of each phase, and if a
+ * trace prefix is given writes a Chrome trace of its steps to the
+ * file <prefix><scenario name>.json.
+ */
+
+#include <cyclone/cyclone.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <sys/resource.h>
+
+using namespace cyclone;
+
+namespace {
+
+    /**
+     * Holds the measurements for one scenario.
+     */
+    struct BenchResult
+    {
+        const char* name;
+        unsigned particles;
+        unsigned steps;
+        double seconds;
+        unsigned long contacts;
+        unsigned long iterations;
+        unsigned awake;
+
+        /**
+         * Holds the peak resident memory in kilobytes while the
+         * scenario ran.
+         */
+        long peakMemory;
+
+        /**
+         * Holds whether the final state was hashed, and if so the
+         * hash of every particle's position and velocity.
+         */
+        bool hashed;
+        unsigned long long stateHash;
+
+        /**
+         * Holds the name of the scenario this one is a deterministic
+         * version of, or NULL. Such a scenario is run a second time
+         * on a different number of workers, and its overhead and
+         * whether the second run's hash matched are reported.
+         */
+        const char* baseline;
+        double overhead;
+        bool reproduced;
+
+        /**
+         * Holds the name of a check the scenario makes of its
+         * results, or NULL, and whether it passed.
+         */
+        const char* check;
+        bool passed;
+
+        /**
+         * Holds whether the scenario fires rounds at a wall, and if
+         * so how many ended up past it.
+         */
+        bool countsTunnelled;
+        unsigned tunnelled;
+
+        /**
+         * Holds whether the phases were profiled, and if so the mean
+         * nanoseconds per step spent in each.
+         */
+        bool profiled;
+        double phaseNanoseconds[PROFILE_PHASE_COUNT];
+    };
+
+    /**
+     * Holds the options common to every scenario.
+     */
+    struct BenchOptions
+    {
+        unsigned steps;
+        JobSystem* jobs;
+        const char* tracePrefix;
+    };
+
+    /**
+     * Keeps particles above the ground plane at y = 0.
+     */
+    template <typename T>
+    class BasicGroundContacts : public BasicParticleContactGenerator<T>
+    {
+    public:
+        BasicParticle<T>* particles;
+        unsigned count;
+        T radius;
+        T restitution;
+
+        virtual unsigned addContact(BasicParticleContact<T>* contact, unsigned limit) const
+        {
+            unsigned used = 0;
+            for (unsigned i = 0; i < count && used < limit; i++)
+            {
+                T y = particles[i].getPosition().y;
+                if (y >= radius) continue;
+
+                contact->particle[0] = particles + i;
+                contact->particle[1] = 0;
+                contact->contactNormal = BasicVector3<T>::UP;
+                contact->penetration = radius - y;
+                contact->restitution = restitution;
+                contact++;
+                used++;
+            }
+            return used;
+        }
+    };
+    typedef BasicGroundContacts<real> GroundContacts;
+
+    /**
+     * Hands freed memory back to the system and resets the resident
+     * high-water mark to what is resident now, so peakMemoryKB then
+     * measures from here. Returns false if the mark can't be reset.
+     */
+    bool resetPeakMemory()
+    {
+        malloc_trim(0);
+        FILE* file = fopen("/proc/self/clear_refs", "w");
+        if (!file) return false;
+        bool reset = fputs("5", file) >= 0;
+        if (fclose(file) != 0) reset = false;
+        return reset;
+    }
+
+    /**
+     * Returns the peak resident memory since the last call to
+     * resetPeakMemory. The reset also applies to getrusage, which is
+     * used if the mark can't be read.
+     */
+    long peakMemoryKB()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        FILE* file = fopen("/proc/self/status", "r");
+        if (!file) return usage.ru_maxrss;
+
+        long peak = -1;
+        char line[256];
+        while (fgets(line, sizeof(line), file))
+        {
+            if (sscanf(line, "VmHWM: %ld", &peak) == 1) break;
+        }
+        fclose(file);
+        return peak >= 0 ? peak : usage.ru_maxrss;
+    }
+
+    /**
+     * Adds the bytes of the given vector's components to an FNV-1a
+     * hash.
+     */
+    void hashVector(const Vector3 &v, unsigned long long *hash)
+    {
+        const real components[3] = { v.x, v.y, v.z };
+        const unsigned char* bytes = (const unsigned char*)components;
+        for (unsigned i = 0; i < sizeof(components); i++)
+        {
+            *hash ^= bytes[i];
+            *hash *= 1099511628211ULL;
+        }
+    }
+
+    /**
+     * Returns a hash of the position and velocity of every particle
+     * in the world, which only matches another run's if the two
+     * agree to the last bit.
+     */
+    unsigned long long hashWorld(ParticleWorld &world)
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        const Particle* particles = world.getParticles();
+        for (unsigned i = 0; i < world.getParticleCount(); i++)
+        {
+            hashVector(particles[i].getPosition(), &hash);
+            hashVector(particles[i].getVelocity(), &hash);
+        }
+        return hash;
+    }
+
+    /**
+     * Steps the world and times it.
+     */
+    void run(ParticleWorld &world, const BenchOptions &options, BenchResult *result)
+    {
+        world.setJobSystem(options.jobs);
+        real timestep = world.getTimestep();
+
+        result->particles = world.getParticleCount();
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+
+#ifdef CYCLONE_ENABLE_PROFILING
+        Profiler profiler(options.steps);
+        world.setProfiler(&profiler);
+#endif
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            world.step(timestep);
+            result->contacts += world.getContactCount();
+            result->iterations += world.getIterationsUsed();
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = world.getAwakeCount();
+        result->hashed = true;
+        result->stateHash = hashWorld(world);
+
+#ifdef CYCLONE_ENABLE_PROFILING
+        world.setProfiler(0);
+        result->profiled = true;
+        for (unsigned p = 0; p < PROFILE_PHASE_COUNT; p++)
+        {
+            result->phaseNanoseconds[p] = profiler.getMeanDuration((ProfilePhase)p);
+        }
+
+        if (options.tracePrefix)
+        {
+            std::string filename = std::string(options.tracePrefix) + result->name + ".json";
+            if (!profiler.writeChromeTrace(filename.c_str()))
+            {
+                fprintf(stderr, "bench: couldn't write %s\n", filename.c_str());
+            }
+        }
+#endif
+    }
+
+    /**
+     * Many free particles falling under one shared gravity generator.
+     */
+    void benchGravity(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned count = 20000;
+        Random random(1);
+        ParticleWorld world(count, 1);
+        ParticleGravity gravity(Vector3::GRAVITY);
+
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-50, 0, -50), Vector3(50, 100, 50)));
+            p->setVelocity(random.randomVector(5));
+            p->setDamping(0.99f);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        result->name = "gravity";
+        run(world, options, result);
+    }
+
+    /**
+     * A few shells in flight over a pond full of slowly drifting
+     * floats. With a multi-rate integrator the floats climb to its
+     * top level and are integrated a sixteenth as often.
+     */
+    void runMixedSpeeds(const BenchOptions &options, BenchResult *result,
+        ParticleMultiRateIntegrator* multiRate)
+    {
+        const unsigned count = 20000;
+        const unsigned shells = count / 10;
+        Random random(10);
+        ParticleWorld world(count, 1);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-50, 0, -50), Vector3(50, 0, 50)));
+            if (i < shells)
+            {
+                p->setVelocity(random.randomVector(Vector3(-20, 30, -20), Vector3(20, 60, 20)));
+                p->setAcceleration(Vector3::GRAVITY);
+                p->setDamping(0.99f);
+            }
+            else
+            {
+                p->setVelocity(random.randomVector(Vector3(-0.2f, 0, -0.2f), Vector3(0.2f, 0, 0.2f)));
+                p->setDamping(0.9f);
+            }
+        }
+        world.setMultiRateIntegrator(multiRate);
+
+        run(world, options, result);
+        world.setMultiRateIntegrator(0);
+    }
+
+    void benchMixedSpeeds(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "mixed_speeds";
+        runMixedSpeeds(options, result, 0);
+    }
+
+    void benchMixedSpeedsMultiRate(const BenchOptions &options, BenchResult *result)
+    {
+        ParticleMultiRateIntegrator multiRate;
+        result->name = "mixed_speeds_multirate";
+        runMixedSpeeds(options, result, &multiRate);
+    }
+
+    /**
+     * Particles in orbit around a point. Velocity Verlet at eight
+     * times the timestep keeps the orbits' energy error smaller than
+     * Euler's, so its scenario simulates the same length of time in
+     * an eighth of the steps.
+     */
+    void runOrbits(const BenchOptions &options, BenchResult *result,
+        ParticleIntegrator* integrator, unsigned stepRatio)
+    {
+        const unsigned count = 20000;
+        const real gravityScalar = 100;
+        Random random(11);
+        ParticleWorld world(count, 1);
+        ParticlePointGravity gravity(gravityScalar, Vector3());
+
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            real radius = random.randomReal(10, 40);
+            real angle = random.randomReal(0, (real)6.2831853);
+            real speed = real_sqrt(gravityScalar / real_sqrt(radius));
+
+            Particle* p = world.addParticle();
+            p->setPosition(radius * real_cos(angle), random.randomBinomial(1), radius * real_sin(angle));
+            p->setVelocity(-speed * real_sin(angle), 0, speed * real_cos(angle));
+            world.getForceRegistry().add(p, &gravity);
+        }
+        world.setIntegrator(integrator);
+        world.setTimestep(world.getTimestep() * (real)stepRatio);
+
+        BenchOptions scaled = options;
+        scaled.steps = options.steps / stepRatio;
+        if (scaled.steps == 0) scaled.steps = 1;
+        run(world, scaled, result);
+        world.setIntegrator(0);
+    }
+
+    void benchOrbits(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "orbits";
+        runOrbits(options, result, 0, 1);
+    }
+
+    void benchOrbitsVerlet(const BenchOptions &options, BenchResult *result)
+    {
+        ParticleVerletIntegrator verlet;
+        result->name = "orbits_verlet";
+        runOrbits(options, result, &verlet, 8);
+    }
+
+    /**
+     * A square cloth of springs hanging from its top edge.
+     */
+    void benchSpringLattice(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned side = 64;
+        real springConstant = 100;
+        real restLength = 1;
+
+        Random random(2);
+        ParticleWorld world(side * side, 1);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        std::vector<ParticleSpring> springs;
+        springs.reserve(side * side * 4);
+
+        for (unsigned y = 0; y < side; y++)
+        for (unsigned x = 0; x < side; x++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(x * restLength, 100 - y * restLength, random.randomReal(-0.1f, 0.1f));
+            p->setDamping(0.95f);
+            if (y == 0) p->setInverseMass(0);
+        }
+
+        Particle* particles = world.getParticles();
+        ParticleForceRegistry &registry = world.getForceRegistry();
+        for (unsigned y = 0; y < side; y++)
+        for (unsigned x = 0; x < side; x++)
+        {
+            Particle* p = particles + y * side + x;
+            registry.add(p, &gravity);
+
+            // Link each particle to its right and lower neighbours,
+            // with a generator for each end.
+            if (x + 1 < side)
+            {
+                Particle* q = p + 1;
+                springs.push_back(ParticleSpring(q, springConstant, restLength));
+                registry.add(p, &springs.back());
+                springs.push_back(ParticleSpring(p, springConstant, restLength));
+                registry.add(q, &springs.back());
+            }
+            if (y + 1 < side)
+            {
+                Particle* q = p + side;
+                springs.push_back(ParticleSpring(q, springConstant, restLength));
+                registry.add(p, &springs.back());
+                springs.push_back(ParticleSpring(p, springConstant, restLength));
+                registry.add(q, &springs.back());
+            }
+        }
+
+        result->name = "spring_lattice";
+        run(world, options, result);
+    }
+
+    /**
+     * A much stiffer cloth, integrated implicitly with four times the
+     * usual timestep. The explicit integrator can't run this at all.
+     */
+    void benchImplicitLattice(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned side = 64;
+        const real springConstant = 2000;
+        const real restLength = 1;
+        const real timestep = (real)4.0 / (real)60.0;
+
+        Random random(7);
+        std::vector<Particle> particles(side * side);
+        ParticleSpringNetwork network;
+
+        for (unsigned y = 0; y < side; y++)
+        for (unsigned x = 0; x < side; x++)
+        {
+            Particle* p = &particles[y * side + x];
+            p->setPosition(x * restLength, 100 - y * restLength, random.randomReal(-0.1f, 0.1f));
+            p->setVelocity(0, 0, 0);
+            p->setAcceleration(Vector3::GRAVITY);
+            p->setMass(1);
+            p->setDamping(0.95f);
+            p->clearAccumulator();
+            if (y == 0) p->setInverseMass(0);
+        }
+        for (unsigned y = 0; y < side; y++)
+        for (unsigned x = 0; x < side; x++)
+        {
+            Particle* p = &particles[y * side + x];
+            if (x + 1 < side) network.addSpring(p, p + 1, springConstant, restLength);
+            if (y + 1 < side) network.addSpring(p, p + side, springConstant, restLength);
+        }
+
+        result->name = "spring_lattice_implicit";
+        result->particles = side * side;
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            network.integrate(timestep);
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = result->particles;
+    }
+
+    /**
+     * Hanging chains, alternately of rods and cables. The links are
+     * either contact generators, one for each link or, if linkSet is
+     * set, one link set for them all, or, if a link solver is given,
+     * constraints for it. The contact generators may be run in
+     * parallel, and the world may be deterministic. As contacts
+     * there are thousands per step,
+     * far too many for the resolver's linear scan, so this and the
+     * pile use its priority mode.
+     */
+    void runChains(const BenchOptions &options, BenchResult *result,
+        ParticleLinkSolver* solver, bool linkSet, bool parallelGeneration,
+        bool deterministic)
+    {
+        const unsigned chains = 64;
+        const unsigned links = 32;
+
+        Random random(3);
+        ParticleWorld world(chains * (links + 1), chains * links);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        std::vector<ParticleRod> rods(chains * links / 2);
+        std::vector<ParticleCable> cables(chains * links / 2);
+        unsigned rodsUsed = 0, cablesUsed = 0;
+        ParticleLinkSet set(world.getParticles());
+
+        world.getContactResolver().setMode(ParticleContactResolver::RESOLVE_PRIORITY);
+        world.getForceRegistry().setBatched(true);
+        for (unsigned c = 0; c < chains; c++)
+        {
+            Vector3 top((real)(c % 8) * 4, 100, (real)(c / 8) * 4);
+            Particle* previous = 0;
+            for (unsigned l = 0; l <= links; l++)
+            {
+                Particle* p = world.addParticle();
+                p->setPosition(top + Vector3((real)l, 0, 0) + random.randomVector(0.01f));
+                p->setDamping(0.99f);
+                if (l == 0) p->setInverseMass(0);
+                else world.getForceRegistry().add(p, &gravity);
+
+                if (previous && linkSet)
+                {
+                    unsigned index = world.getParticleCount() - 1;
+                    if (c % 2 == 0) set.addRod(index - 1, index, 1);
+                    else set.addCable(index - 1, index, 1, 0.3f);
+                }
+                else if (previous)
+                {
+                    ParticleLink* link;
+                    if (c % 2 == 0)
+                    {
+                        ParticleRod &rod = rods[rodsUsed++];
+                        rod.length = 1;
+                        link = &rod;
+                    }
+                    else
+                    {
+                        ParticleCable &cable = cables[cablesUsed++];
+                        cable.maxLength = 1;
+                        cable.restitution = 0.3f;
+                        link = &cable;
+                    }
+                    link->particle[0] = previous;
+                    link->particle[1] = p;
+                    if (solver) solver->addLink(link);
+                    else world.getContactGenerators().push_back(link);
+                }
+                previous = p;
+            }
+        }
+
+        if (linkSet) world.getContactGenerators().push_back(&set);
+        world.setParallelContactGeneration(parallelGeneration);
+        world.setLinkSolver(solver);
+        world.setDeterministic(deterministic);
+        run(world, options, result);
+    }
+
+    void benchChains(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "chains";
+        runChains(options, result, 0, false, false, false);
+    }
+
+    void benchChainsParallelGeneration(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "chains_parallel_generation";
+        runChains(options, result, 0, false, true, false);
+    }
+
+    void benchChainsDeterministic(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "chains_deterministic";
+        result->baseline = "chains_parallel_generation";
+        runChains(options, result, 0, false, true, true);
+    }
+
+    void benchChainsLinkSet(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "chains_link_set";
+        runChains(options, result, 0, true, false, false);
+    }
+
+    void benchChainsPositionBased(const BenchOptions &options, BenchResult *result)
+    {
+        ParticleLinkSolver solver(8);
+        solver.setMode(ParticleLinkSolver::SOLVE_COLOURED);
+        result->name = "chains_position_based";
+        runChains(options, result, &solver, false, false, false);
+    }
+
+    /**
+     * The position based chains with Jacobi sweeps, which measure
+     * every link before moving any particle.
+     */
+    void benchChainsJacobi(const BenchOptions &options, BenchResult *result)
+    {
+        ParticleLinkSolver solver(8);
+        solver.setMode(ParticleLinkSolver::SOLVE_JACOBI);
+        result->name = "chains_jacobi";
+        runChains(options, result, &solver, false, false, false);
+    }
+
+    /**
+     * The hanging chains held in a particle store, with a link set
+     * into the store resolving their links several times a step. The
+     * links must end within 15% of their limits.
+     */
+    void benchChainsStore(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned chains = 64;
+        const unsigned links = 32;
+        const unsigned passes = 16;
+        const real timestep = (real)1.0 / (real)60.0;
+
+        Random random(3);
+        ParticleStore store(chains * (links + 1));
+        ParticleLinkSet set;
+        set.setStore(&store);
+        for (unsigned c = 0; c < chains; c++)
+        {
+            Vector3 top((real)(c % 8) * 4, 100, (real)(c / 8) * 4);
+            for (unsigned l = 0; l <= links; l++)
+            {
+                ParticleHandle p = store.add();
+                p.setPosition(top + Vector3((real)l, 0, 0) + random.randomVector(0.01f));
+                p.setDamping(0.99f);
+                if (l == 0) p.setInverseMass(0);
+                else p.setAcceleration(Vector3::GRAVITY);
+
+                if (l == 0) continue;
+                unsigned index = p.getIndex();
+                if (c % 2 == 0) set.addRod(index - 1, index, 1);
+                else set.addCable(index - 1, index, 1, 0.3f);
+            }
+        }
+
+        result->name = "chains_store";
+        result->particles = store.size();
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+        result->check = "links_held";
+        result->passed = true;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            if (options.jobs) store.integrateAll(timestep, *options.jobs);
+            else store.integrateAll(timestep);
+            for (unsigned p = 0; p < passes; p++)
+            {
+                unsigned corrected = set.resolve(timestep);
+                if (p == 0) result->contacts += corrected;
+                result->iterations += corrected;
+            }
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = store.size();
+
+        const Vector3* position = store.getPositions();
+        const Vector3* velocity = store.getVelocities();
+        for (unsigned i = 0; i < set.size(); i++)
+        {
+            real minLength, maxLength;
+            set.getLengthLimits(i, &minLength, &maxLength);
+            real length = (position[set.getSecond(i)] - position[set.getFirst(i)]).magnitude();
+            if (length > maxLength * (real)1.15 || length < minLength * (real)0.85)
+            {
+                result->passed = false;
+            }
+        }
+
+        unsigned long long hash = 14695981039346656037ULL;
+        for (unsigned i = 0; i < store.size(); i++)
+        {
+            hashVector(position[i], &hash);
+            hashVector(velocity[i], &hash);
+        }
+        result->hashed = true;
+        result->stateHash = hash;
+    }
+
+    /**
+     * Particles of mixed density bobbing in a pool. Gravity and
+     * buoyancy are either registered separately or, if stack is set,
+     * fused into one force stack. The world may be deterministic.
+     */
+    void runBuoyancy(const BenchOptions &options, BenchResult *result, bool stack,
+        bool deterministic)
+    {
+        const unsigned count = 20000;
+        Random random(4);
+        ParticleWorld world(count, 1);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        ParticleBuoyancy buoyancy(0.5f, 0.002f, 10);
+        ForceStack<ParticleGravity, ParticleBuoyancy> forces(gravity, buoyancy);
+
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-50, 0, -50), Vector3(50, 20, 50)));
+            p->setMass(random.randomReal(1, 3));
+            p->setDamping(0.9f);
+            if (stack)
+            {
+                world.getForceRegistry().add(p, &forces);
+            }
+            else
+            {
+                world.getForceRegistry().add(p, &gravity);
+                world.getForceRegistry().add(p, &buoyancy);
+            }
+        }
+
+        world.setDeterministic(deterministic);
+        run(world, options, result);
+    }
+
+    void benchBuoyancy(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "buoyancy";
+        runBuoyancy(options, result, false, false);
+    }
+
+    void benchBuoyancyForceStack(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "buoyancy_force_stack";
+        runBuoyancy(options, result, true, false);
+    }
+
+    void benchBuoyancyDeterministic(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "buoyancy_deterministic";
+        result->baseline = "buoyancy";
+        runBuoyancy(options, result, false, true);
+    }
+
+    /**
+     * Particles drifting through a field of small uplift columns and
+     * blasts. The generators are either registered against every
+     * particle or, if regions is set, given to a region force set, so
+     * each only sees the particles near it.
+     */
+    void runUplift(const BenchOptions &options, BenchResult *result, bool regions)
+    {
+        const unsigned count = 20000;
+        const unsigned columns = 16;
+        Random random(10);
+        ParticleWorld world(count, 1);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        ParticleRegionForces regionForces(4);
+        std::vector<ParticleUplift> uplifts;
+        std::vector<ParticleBlast> blasts;
+
+        for (unsigned c = 0; c < columns; c++)
+        {
+            Vector3 point = random.randomVector(Vector3(-45, 0, -45), Vector3(45, 0, 45));
+            uplifts.push_back(ParticleUplift(Vector3(0, 15, 0), point, 3, 20, gravity));
+            point = random.randomVector(Vector3(-45, 0, -45), Vector3(45, 10, 45));
+            blasts.push_back(ParticleBlast(point, 4, 50));
+        }
+
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-50, 0, -50), Vector3(50, 20, 50)));
+            p->setVelocity(random.randomVector(2));
+            p->setDamping(0.99f);
+            world.getForceRegistry().add(p, &gravity);
+            if (regions) continue;
+
+            for (unsigned c = 0; c < columns; c++)
+            {
+                world.getForceRegistry().add(p, &uplifts[c]);
+                world.getForceRegistry().add(p, &blasts[c]);
+            }
+        }
+
+        if (regions)
+        {
+            regionForces.addParticles(world.getParticles(), count);
+            for (unsigned c = 0; c < columns; c++)
+            {
+                regionForces.addGenerator(&uplifts[c]);
+                regionForces.addGenerator(&blasts[c]);
+            }
+            world.setRegionForces(&regionForces);
+        }
+
+        result->name = regions ? "uplift_regions" : "uplift";
+        run(world, options, result);
+    }
+
+    void benchUplift(const BenchOptions &options, BenchResult *result)
+    {
+        runUplift(options, result, false);
+    }
+
+    void benchUpliftRegions(const BenchOptions &options, BenchResult *result)
+    {
+        runUplift(options, result, true);
+    }
+
+    /**
+     * Two clusters of bodies attracting one another through the
+     * Barnes-Hut tree. The world may be deterministic.
+     */
+    void runMutualGravity(const BenchOptions &options, BenchResult *result,
+        bool deterministic)
+    {
+        const unsigned count = 4000;
+        Random random(6);
+        ParticleWorld world(count, 1);
+        ParticleMutualGravity gravity(0.01f, 0.5f, 0.1f);
+
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Vector3 centre(i % 2 ? 20 : -20, 0, 0);
+            Particle* p = world.addParticle();
+            p->setPosition(centre + random.randomVector(5));
+            p->setVelocity(random.randomVector(0.5f));
+            p->setMass(random.randomReal(1, 2));
+            p->setDamping(1);
+            gravity.addParticle(p);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        world.setDeterministic(deterministic);
+        run(world, options, result);
+    }
+
+    void benchMutualGravity(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "mutual_gravity";
+        runMutualGravity(options, result, false);
+    }
+
+    void benchMutualGravityDeterministic(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "mutual_gravity_deterministic";
+        result->baseline = "mutual_gravity";
+        runMutualGravity(options, result, true);
+    }
+
+    /**
+     * Balls dropped into a heap on the ground, colliding with one
+     * another. The resolver may be given tolerances, so it leaves
+     * small corrections unmade, the world may reorder the particles
+     * every reorderInterval steps, the collision generator may
+     * share its search between the workers, and contacts may be
+     * warm started from the given cache.
+     */
+    void runPile(const BenchOptions &options, BenchResult *result, bool tolerant,
+        unsigned reorderInterval, bool parallelCollisions,
+        ParticleContactCache* cache = 0)
+    {
+        const unsigned count = 4000;
+        const real radius = 0.5f;
+
+        Random random(5);
+        ParticleWorld world(count, count * 8);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        ParticleCollisionGenerator collisions(radius, 0.2f);
+        GroundContacts ground;
+
+        world.getContactResolver().setMode(ParticleContactResolver::RESOLVE_PRIORITY);
+        if (tolerant) world.getContactResolver().setTolerances(0.05f, 0.005f);
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-10, radius, -10), Vector3(10, 40, 10)));
+            p->setDamping(0.95f);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        collisions.addParticles(world.getParticles(), count);
+        ground.particles = world.getParticles();
+        ground.count = count;
+        ground.radius = radius;
+        ground.restitution = 0.2f;
+        world.getContactGenerators().push_back(&ground);
+        world.getContactGenerators().push_back(&collisions);
+        if (parallelCollisions) collisions.setJobSystem(options.jobs);
+
+        world.setReorderInterval(reorderInterval);
+        world.setContactCache(cache);
+        run(world, options, result);
+    }
+
+    void benchPile(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "pile";
+        runPile(options, result, false, 0, false);
+    }
+
+    /**
+     * The pile with tolerances. With none, the resolver spends every
+     * iteration it is given on contacts closing or penetrating by
+     * rounding error, so early on it leaves the falling balls
+     * penetrating and they make about twice as many contacts as the
+     * tolerant pile does. The two piles come to rest alike, so over
+     * the default 300 steps they make contacts within 7% of one
+     * another, and the tolerant pile uses about a quarter fewer
+     * iterations. Short runs compare piles that are still different.
+     */
+    void benchPileTolerant(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "pile_tolerant";
+        runPile(options, result, true, 0, false);
+    }
+
+    /**
+     * The pile fits in cache, so reordering it is expected to cost
+     * about what it saves; this is here to show that cost.
+     */
+    void benchPileReordered(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "pile_reordered";
+        runPile(options, result, false, 30, false);
+    }
+
+    void benchPileParallelCollisions(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "pile_parallel_collisions";
+        runPile(options, result, false, 0, true);
+    }
+
+    /**
+     * The pile with each step's contacts warm started from the last
+     * step's impulses. Once the balls come to rest most contacts
+     * persist, so the resolver starts close to its answer and leaves
+     * less penetration; over 100 steps the pile makes about a tenth
+     * fewer contacts than it does uncached.
+     */
+    void benchPileCached(const BenchOptions &options, BenchResult *result)
+    {
+        ParticleContactCache cache;
+        result->name = "pile_cached";
+        runPile(options, result, false, 0, false, &cache);
+    }
+
+    /**
+     * Rounds fired at 100 m/s into a wall one particle thick, each
+     * aimed at the centre of its own wall particle, so nothing but
+     * the wall is in its way. A cloud of slow particles beside the
+     * wall, well clear of the rounds, keeps the collision detection
+     * busy. At the usual timestep a round moves several diameters a
+     * step, so most pass through the wall unless collision is
+     * continuous; the alternative is to shorten the step for the
+     * whole scene, which substeps does. The rounds that end up
+     * beyond the wall are counted as having tunnelled.
+     */
+    void runRounds(const BenchOptions &options, BenchResult *result,
+        bool continuous, unsigned substeps)
+    {
+        const unsigned side = 40;
+        const unsigned cloud = 4000;
+        const unsigned rounds = 200;
+        const real radius = 0.25f;
+
+        Random random(12);
+        ParticleWorld world(side * side + cloud + rounds, (side * side + cloud + rounds) * 8);
+        ParticleCollisionGenerator collisions(radius, 0.5f);
+        collisions.setContinuous(continuous);
+
+        world.getContactResolver().setMode(ParticleContactResolver::RESOLVE_PRIORITY);
+        for (unsigned x = 0; x < side; x++)
+        for (unsigned y = 0; y < side; y++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition((real)x * radius * 2 - 10, (real)y * radius * 2 - 10, 30);
+            p->setInverseMass(0);
+        }
+        for (unsigned i = 0; i < cloud; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(20, -10, 0), Vector3(40, 10, 28)));
+            p->setVelocity(random.randomVector(1));
+        }
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            // Every round has a wall particle of its own, so no two
+            // share a line of fire.
+            unsigned x = (i % (side / 2)) * 2 + 1;
+            unsigned y = (i / (side / 2)) * 4 + 1;
+            Particle* p = world.addParticle();
+            p->setPosition((real)x * radius * 2 - 10, (real)y * radius * 2 - 10,
+                random.randomReal(10, 28));
+            p->setVelocity(0, 0, 100);
+        }
+
+        collisions.addParticles(world.getParticles(), world.getParticleCount());
+        world.getContactGenerators().push_back(&collisions);
+        world.setTimestep(world.getTimestep() / (real)substeps);
+
+        BenchOptions scaled = options;
+        scaled.steps = options.steps * substeps;
+        run(world, scaled, result);
+
+        const Particle* fired = world.getParticles() + side * side + cloud;
+        result->countsTunnelled = true;
+        result->tunnelled = 0;
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            if (fired[i].getPosition().z > 30 + radius) result->tunnelled++;
+        }
+    }
+
+    void benchRounds(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "rounds";
+        runRounds(options, result, false, 1);
+        result->check = "tunnels";
+        result->passed = result->tunnelled > 0;
+    }
+
+    void benchRoundsContinuous(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "rounds_continuous";
+        runRounds(options, result, true, 1);
+        result->check = "stops_rounds";
+        result->passed = result->tunnelled == 0;
+    }
+
+    void benchRoundsSubstepped(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "rounds_substepped";
+        runRounds(options, result, false, 8);
+        result->check = "stops_rounds";
+        result->passed = result->tunnelled == 0;
+    }
+
+    /**
+     * Debris scattered thinly over the ground, left to settle before
+     * it is timed, so measures a long-running scene in which most
+     * particles are at rest. Sleeping may be allowed.
+     */
+    void runDebris(const BenchOptions &options, BenchResult *result, bool canSleep)
+    {
+        const unsigned count = 4000;
+        const unsigned settleSteps = 900;
+        const real radius = 0.5f;
+
+        Random random(9);
+        ParticleWorld world(count, count * 8);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        ParticleCollisionGenerator collisions(radius, 0.2f);
+        GroundContacts ground;
+
+        world.getContactResolver().setMode(ParticleContactResolver::RESOLVE_PRIORITY);
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-50, radius, -50), Vector3(50, 10, 50)));
+            p->setDamping(0.95f);
+            p->setCanSleep(canSleep);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        collisions.addParticles(world.getParticles(), count);
+        ground.particles = world.getParticles();
+        ground.count = count;
+        ground.radius = radius;
+        ground.restitution = 0.2f;
+        world.getContactGenerators().push_back(&ground);
+        world.getContactGenerators().push_back(&collisions);
+
+        world.setJobSystem(options.jobs);
+        for (unsigned s = 0; s < settleSteps; s++) world.step(world.getTimestep());
+
+        run(world, options, result);
+    }
+
+    void benchDebris(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "debris";
+        runDebris(options, result, false);
+    }
+
+    void benchDebrisSleeping(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "debris_sleeping";
+        runDebris(options, result, true);
+    }
+
+    /**
+     * Many small separate heaps, the case the island resolver is
+     * for. With a job system the heaps are resolved in parallel. The
+     * world may be deterministic.
+     */
+    void runIslands(const BenchOptions &options, BenchResult *result, bool deterministic)
+    {
+        const unsigned heaps = 100;
+        const unsigned perHeap = 40;
+        const unsigned count = heaps * perHeap;
+        const real radius = 0.5f;
+
+        Random random(8);
+        ParticleWorld world(count, count * 8);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        ParticleCollisionGenerator collisions(radius, 0.2f);
+        ParticleIslandResolver islands;
+        GroundContacts ground;
+
+        islands.setMode(ParticleContactResolver::RESOLVE_PRIORITY);
+        world.setIslandResolver(&islands);
+        world.getForceRegistry().setBatched(true);
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned heap = i / perHeap;
+            Vector3 centre((real)(heap % 10) * 10, 0, (real)(heap / 10) * 10);
+            Particle* p = world.addParticle();
+            p->setPosition(centre + random.randomVector(Vector3(-1.5f, radius, -1.5f), Vector3(1.5f, 10, 1.5f)));
+            p->setDamping(0.95f);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        collisions.addParticles(world.getParticles(), count);
+        ground.particles = world.getParticles();
+        ground.count = count;
+        ground.radius = radius;
+        ground.restitution = 0.2f;
+        world.getContactGenerators().push_back(&ground);
+        world.getContactGenerators().push_back(&collisions);
+
+        world.setDeterministic(deterministic);
+        run(world, options, result);
+    }
+
+    void benchIslands(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "heaps_islands";
+        runIslands(options, result, false);
+    }
+
+    void benchIslandsDeterministic(const BenchOptions &options, BenchResult *result)
+    {
+        result->name = "heaps_islands_deterministic";
+        result->baseline = "heaps_islands";
+        runIslands(options, result, true);
+    }
+
+    /**
+     * A fountain of sparks, each of which bursts into smaller sparks
+     * when it dies, kept at a steady state of about eighty thousand
+     * live particles. Nearly every step spawns and kills thousands.
+     */
+    void benchEmitter(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned capacity = 200000;
+        const real timestep = (real)1.0 / (real)60.0;
+
+        ParticleEmitter emitter(capacity, 9);
+        ParticleEmitterRule rule;
+
+        rule.setParameters(0.5f, 1.5f, Vector3(-4, 15, -4), Vector3(4, 25, 4), 0.9f);
+        rule.addPayload(1, 8);
+        emitter.addRule(rule);
+
+        rule.setParameters(0.5f, 1.0f, Vector3(-3, -3, -3), Vector3(3, 3, 3), 0.5f);
+        rule.payloads.clear();
+        emitter.addRule(rule);
+        emitter.setKillHeight(0);
+
+        result->name = "emitter";
+        result->particles = capacity;
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            emitter.emit(0, 200, Vector3());
+            emitter.update(timestep);
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = emitter.getLiveCount();
+    }
+
+    /**
+     * Steps a cloud of particles of the given precision bouncing on
+     * the ground, with a registry, contact generator and resolver of
+     * the same precision and no world. Returns the time taken and
+     * leaves the final positions in the given list.
+     */
+    template <typename T>
+    double runCloud(unsigned count, const BenchOptions &options, BenchResult *result,
+        std::vector<Vector3> *positions)
+    {
+        const T timestep = (T)1.0 / (T)60.0;
+        Random random(12);
+        std::vector< BasicParticle<T> > particles(count);
+        BasicParticleGravity<T> gravity(BasicVector3<T>::GRAVITY);
+        BasicParticleForceRegistry<T> registry;
+        registry.setBatched(true);
+        registry.reserve(count);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            BasicParticle<T> &p = particles[i];
+            p.setPosition(BasicVector3<T>(random.randomVector(Vector3(-50, 1, -50), Vector3(50, 20, 50))));
+            p.setVelocity(BasicVector3<T>(random.randomVector(5)));
+            p.setDamping((T)0.99);
+            registry.add(&p, &gravity);
+        }
+
+        BasicGroundContacts<T> ground;
+        ground.particles = &particles[0];
+        ground.count = count;
+        ground.radius = (T)0.5;
+        ground.restitution = (T)0.5;
+        std::vector< BasicParticleContact<T> > contacts(count);
+        BasicParticleContactResolver<T> resolver;
+        resolver.setMode(BasicParticleContactResolver<T>::RESOLVE_PRIORITY);
+
+        result->contacts = 0;
+        result->iterations = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            if (options.jobs) registry.updateForces(timestep, *options.jobs);
+            else registry.updateForces(timestep);
+            integrateParticles(&particles[0], count, timestep, options.jobs);
+
+            unsigned used = ground.addContact(&contacts[0], count);
+            if (used == 0) continue;
+            resolver.setIterations(used * 2);
+            resolver.resolveContacts(&contacts[0], used, timestep);
+            result->contacts += used;
+            result->iterations += resolver.getIterationsUsed();
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        positions->resize(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            (*positions)[i] = Vector3(particles[i].getPosition());
+        }
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    /**
+     * Twenty thousand float particles bouncing on the ground, in a
+     * build whose real may be double. The cloud is run again in
+     * double, and the check is that the float particles end up
+     * within a millimetre of the double ones. A particle whose
+     * bounce falls on a different step is briefly further off, so
+     * one in a thousand may be.
+     */
+    void benchFloatCloud(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned count = 20000;
+
+        std::vector<Vector3> floats, doubles;
+        BenchResult other;
+        runCloud<double>(count, options, &other, &doubles);
+        result->seconds = runCloud<float>(count, options, result, &floats);
+
+        unsigned strays = 0;
+        unsigned long long hash = 14695981039346656037ULL;
+        for (unsigned i = 0; i < count; i++)
+        {
+            hashVector(floats[i], &hash);
+            if ((floats[i] - doubles[i]).magnitude() > (real)0.001) strays++;
+        }
+
+        result->name = "float_cloud";
+        result->particles = count;
+        result->steps = options.steps;
+        result->awake = count;
+        result->hashed = true;
+        result->stateHash = hash;
+        result->check = "tracks_double";
+        result->passed = strays <= count / 1000;
+    }
+
+    /**
+     * Returns true if a value read back from a trajectory file is
+     * within half the grid of the value recorded.
+     */
+    bool onGrid(const Vector3 &read, const Vector3 &recorded, real quantum)
+    {
+        Vector3 error = read - recorded;
+        real tolerance = quantum * (real)0.5 + recorded.magnitude() * (real)1e-6;
+        return real_abs(error.x) <= tolerance && real_abs(error.y) <= tolerance &&
+            real_abs(error.z) <= tolerance;
+    }
+
+    /**
+     * A falling cloud recorded to a trajectory file every step, then
+     * read back. Every value must come back to within half the
+     * quantization grid. The last frame also holds a particle whose
+     * position isn't a number, which must come back as zero, and one
+     * far off the grid, which must come back at its edge.
+     */
+    void benchTrajectory(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned count = 1000;
+        const char* filename = "bench_trajectory.tmp";
+        const real positionQuantum = (real)0.0001;
+        const real velocityQuantum = (real)0.001;
+
+        Random random(9);
+        ParticleWorld world(count, 1);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* p = world.addParticle();
+            p->setPosition(random.randomVector(Vector3(-10, 0, -10), Vector3(10, 20, 10)));
+            p->setVelocity(random.randomVector(5));
+            p->setDamping(0.99f);
+            world.getForceRegistry().add(p, &gravity);
+        }
+
+        TrajectoryRecorder recorder(count);
+        recorder.setQuantization(positionQuantum, velocityQuantum);
+
+        result->name = "trajectory";
+        result->particles = count;
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+        result->check = "round_trip";
+        result->passed = recorder.open(filename);
+        if (!result->passed)
+        {
+            result->seconds = 0;
+            result->awake = 0;
+            return;
+        }
+
+        std::vector<Vector3> positions(count * options.steps);
+        std::vector<Vector3> velocities(count * options.steps);
+        real timestep = world.getTimestep();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < options.steps; s++)
+        {
+            world.step(timestep);
+
+            Particle* particles = world.getParticles();
+            if (s + 1 == options.steps)
+            {
+                real nan = real_sqrt((real)-1);
+                particles[0].setPosition(nan, nan, nan);
+                particles[1].setPosition(1e30f, -1e30f, 0);
+            }
+            recorder.recordFrame(world, s * timestep);
+
+            for (unsigned i = 0; i < count; i++)
+            {
+                positions[s * count + i] = particles[i].getPosition();
+                velocities[s * count + i] = particles[i].getVelocity();
+            }
+        }
+        recorder.close();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = world.getAwakeCount();
+
+        TrajectoryReader reader;
+        result->passed = reader.open(filename) && !recorder.hasFailed();
+        std::vector<Vector3> readPositions, readVelocities;
+        unsigned frames = 0;
+        while (result->passed && reader.readFrame(&readPositions, &readVelocities))
+        {
+            if (frames == options.steps || readPositions.size() != count) result->passed = false;
+            for (unsigned i = 0; i < count && result->passed; i++)
+            {
+                unsigned n = frames * count + i;
+                bool last = frames + 1 == options.steps;
+                if (last && i == 0) result->passed = readPositions[i] == Vector3();
+                else if (last && i == 1)
+                {
+                    result->passed = readPositions[i].x > 1e10f && readPositions[i].y < -1e10f &&
+                        readPositions[i].z == 0;
+                }
+                else result->passed = onGrid(readPositions[i], positions[n], positionQuantum);
+
+                if (result->passed)
+                {
+                    result->passed = onGrid(readVelocities[i], velocities[n], velocityQuantum);
+                }
+            }
+            frames++;
+        }
+        if (frames != options.steps) result->passed = false;
+        reader.close();
+        remove(filename);
+    }
+
+    /**
+     * Hanging chains saved to a snapshot half way through, run on,
+     * then restored and run on again. The two runs must end in the
+     * same state, and a copy of the snapshot with a link to no
+     * particle must be refused.
+     */
+    void benchSnapshot(const BenchOptions &options, BenchResult *result)
+    {
+        const unsigned chains = 16;
+        const unsigned links = 16;
+        const char* filename = "bench_snapshot.tmp";
+        const char* damagedFilename = "bench_snapshot_damaged.tmp";
+
+        Random random(10);
+        ParticleWorld world(chains * (links + 1), chains * links);
+        ParticleGravity gravity(Vector3::GRAVITY);
+        std::vector<ParticleRod> rods(chains * links);
+        for (unsigned c = 0; c < chains; c++)
+        {
+            Vector3 top((real)(c % 4) * 4, 50, (real)(c / 4) * 4);
+            for (unsigned l = 0; l <= links; l++)
+            {
+                Particle* p = world.addParticle();
+                p->setPosition(top + Vector3((real)l, 0, 0) + random.randomVector(0.01f));
+                p->setDamping(0.99f);
+                if (l == 0)
+                {
+                    p->setInverseMass(0);
+                    continue;
+                }
+                world.getForceRegistry().add(p, &gravity);
+
+                ParticleRod &rod = rods[c * links + l - 1];
+                rod.particle[0] = p - 1;
+                rod.particle[1] = p;
+                rod.length = 1;
+                world.getContactGenerators().push_back(&rod);
+            }
+        }
+
+        SnapshotBindings bindings;
+        bindings.addForceGenerator(&gravity);
+        world.setJobSystem(options.jobs);
+        real timestep = world.getTimestep();
+        unsigned half = options.steps / 2;
+
+        result->name = "snapshot";
+        result->particles = world.getParticleCount();
+        result->steps = options.steps;
+        result->contacts = 0;
+        result->iterations = 0;
+        result->check = "round_trip";
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned s = 0; s < half; s++) world.step(timestep);
+        ParticleSnapshot snapshot;
+        result->passed = snapshot.write(filename, world, bindings);
+        for (unsigned s = half; s < options.steps; s++) world.step(timestep);
+        unsigned long long firstHash = hashWorld(world);
+
+        result->passed = result->passed && snapshot.open(filename) &&
+            snapshot.restore(world, bindings);
+        for (unsigned s = half; s < options.steps; s++)
+        {
+            world.step(timestep);
+            result->contacts += world.getContactCount();
+            result->iterations += world.getIterationsUsed();
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        result->seconds = std::chrono::duration<double>(end - start).count();
+        result->awake = world.getAwakeCount();
+        result->hashed = true;
+        result->stateHash = hashWorld(world);
+        result->passed = result->passed && result->stateHash == firstHash;
+
+        // Point the first link's second end at no particle.
+        std::vector<unsigned char> bytes;
+        FILE* file = fopen(filename, "rb");
+        if (file)
+        {
+            unsigned char chunk[4096];
+            size_t read;
+            while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            {
+                bytes.insert(bytes.end(), chunk, chunk + read);
+            }
+            fclose(file);
+        }
+        snapshot.close();
+
+        bool refused = false;
+        if (bytes.size() >= sizeof(SnapshotHeader))
+        {
+            SnapshotHeader header;
+            memcpy(&header, &bytes[0], sizeof(header));
+            const SnapshotSection &section = header.sections[SNAPSHOT_LINKS];
+            if (section.count > 0 && section.offset + sizeof(SnapshotLink) <= bytes.size())
+            {
+                SnapshotLink link;
+                memcpy(&link, &bytes[section.offset], sizeof(link));
+                link.particle[1] = SNAPSHOT_NONE;
+                memcpy(&bytes[section.offset], &link, sizeof(link));
+
+                file = fopen(damagedFilename, "wb");
+                if (file)
+                {
+                    fwrite(&bytes[0], 1, bytes.size(), file);
+                    fclose(file);
+                    ParticleSnapshot damaged;
+                    refused = damaged.open(damagedFilename) && !damaged.restore(world, bindings);
+                }
+            }
+        }
+        result->passed = result->passed && refused;
+
+        remove(filename);
+        remove(damagedFilename);
+    }
+
+    typedef void (*BenchFunction)(const BenchOptions &options, BenchResult *result);
+
+    void printResult(const BenchResult &result, bool last)
+    {
+        double particleSteps = (double)result.particles * result.steps;
+        printf("    {\"name\": \"%s\", \"particles\": %u, \"steps\": %u, "
+            "\"seconds\": %.6f, \"ns_per_particle_step\": %.3f, "
+            "\"contacts\": %lu, \"contacts_per_second\": %.1f, "
+            "\"iterations\": %lu, \"awake\": %u, \"peak_memory_kb\": %ld",
+            result.name, result.particles, result.steps,
+            result.seconds, result.seconds * 1e9 / particleSteps,
+            result.contacts, result.contacts / result.seconds,
+            result.iterations, result.awake, result.peakMemory);
+        if (result.hashed) printf(", \"state_hash\": \"%016llx\"", result.stateHash);
+        if (result.baseline)
+        {
+            printf(", \"baseline\": \"%s\", \"overhead\": %.3f, \"reproduced\": %s",
+                result.baseline, result.overhead, result.reproduced ? "true" : "false");
+        }
+        if (result.check)
+        {
+            printf(", \"check\": \"%s\", \"passed\": %s",
+                result.check, result.passed ? "true" : "false");
+        }
+        if (result.countsTunnelled) printf(", \"tunnelled\": %u", result.tunnelled);
+        if (result.profiled)
+        {
+            printf(", \"phase_ns\": {");
+            for (unsigned p = 0; p < PROFILE_PHASE_COUNT; p++)
+            {
+                printf("%s\"%s\": %.1f", p ? ", " : "",
+                    Profiler::getPhaseName((ProfilePhase)p), result.phaseNanoseconds[p]);
+            }
+            printf("}");
+        }
+        printf("}%s\n", last ? "" : ",");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    options.steps = 300;
+    options.jobs = 0;
+    options.tracePrefix = 0;
+
+    unsigned threads = 0;
+    if (argc > 1) options.steps = (unsigned)atoi(argv[1]);
+    if (argc > 2) threads = (unsigned)atoi(argv[2]);
+    if (argc > 3) options.tracePrefix = argv[3];
+    if (options.steps == 0) options.steps = 1;
+
+    JobSystem* jobs = 0;
+    if (threads > 0) jobs = new JobSystem(threads);
+    options.jobs = jobs;
+
+    BenchFunction scenarios[] = {
+        benchGravity,
+        benchMixedSpeeds,
+        benchMixedSpeedsMultiRate,
+        benchOrbits,
+        benchOrbitsVerlet,
+        benchSpringLattice,
+        benchImplicitLattice,
+        benchChains,
+        benchChainsParallelGeneration,
+        benchChainsDeterministic,
+        benchChainsLinkSet,
+        benchChainsPositionBased,
+        benchChainsJacobi,
+        benchChainsStore,
+        benchBuoyancy,
+        benchBuoyancyForceStack,
+        benchBuoyancyDeterministic,
+        benchUplift,
+        benchUpliftRegions,
+        benchMutualGravity,
+        benchMutualGravityDeterministic,
+        benchPile,
+        benchPileTolerant,
+        benchPileReordered,
+        benchPileParallelCollisions,
+        benchPileCached,
+        benchRounds,
+        benchRoundsContinuous,
+        benchRoundsSubstepped,
+        benchDebris,
+        benchDebrisSleeping,
+        benchIslands,
+        benchIslandsDeterministic,
+        benchEmitter,
+        benchFloatCloud,
+        benchTrajectory,
+        benchSnapshot
+    };
+    const unsigned scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+
+#ifdef SINGLE_PRECISION
+    const char* precision = "single";
+#else
+    const char* precision = "double";
+#endif
+
+    printf("{\n  \"steps\": %u,\n  \"threads\": %u,\n  \"precision\": \"%s\",\n",
+        options.steps, threads, precision);
+    printf("  \"scenarios\": [\n");
+    std::vector<BenchResult> results;
+    long peakMemory = 0;
+    for (unsigned i = 0; i < scenarioCount; i++)
+    {
+        BenchResult result;
+        result.hashed = false;
+        result.profiled = false;
+        result.baseline = 0;
+        result.check = 0;
+        result.countsTunnelled = false;
+        resetPeakMemory();
+        scenarios[i](options, &result);
+        result.peakMemory = peakMemoryKB();
+
+        if (result.baseline)
+        {
+            // Compare with the same scenario run normally.
+            result.overhead = 0;
+            for (unsigned r = 0; r < results.size(); r++)
+            {
+                if (strcmp(results[r].name, result.baseline) != 0) continue;
+                result.overhead = result.seconds / results[r].seconds - 1;
+            }
+
+            // And run it again on a different number of workers.
+            JobSystem other(threads == 1 ? 2 : 1);
+            BenchOptions otherOptions = options;
+            otherOptions.jobs = &other;
+            otherOptions.tracePrefix = 0;
+            BenchResult check;
+            check.hashed = false;
+            check.profiled = false;
+            check.baseline = 0;
+            check.check = 0;
+            check.countsTunnelled = false;
+            scenarios[i](otherOptions, &check);
+            result.reproduced = check.stateHash == result.stateHash;
+        }
+        peakMemory = std::max(peakMemory, peakMemoryKB());
+
+        results.push_back(result);
+        printResult(result, i + 1 == scenarioCount);
+        fflush(stdout);
+    }
+    printf("  ],\n  \"peak_memory_kb\": %ld\n}\n", peakMemory);
+
+    delete jobs;
+    return 0;
+}
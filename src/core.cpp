@@ -14,11 +14,32 @@
 
 using namespace cyclone;
 
-const Vector3 Vector3::GRAVITY = Vector3(0, -9.81, 0);
-const Vector3 Vector3::HIGH_GRAVITY = Vector3(0, -19.62, 0);
-const Vector3 Vector3::UP = Vector3(0, 1, 0);
-const Vector3 Vector3::RIGHT = Vector3(1, 0, 0);
-const Vector3 Vector3::OUT_OF_SCREEN = Vector3(0, 0, 1);
-const Vector3 Vector3::X = Vector3(0, 1, 0);
-const Vector3 Vector3::Y = Vector3(1, 0, 0);
-const Vector3 Vector3::Z = Vector3(0, 0, 1);
+template <> const BasicVector3<float> BasicVector3<float>::GRAVITY = BasicVector3<float>(0, -9.81, 0);
+template <> const BasicVector3<float> BasicVector3<float>::HIGH_GRAVITY = BasicVector3<float>(0, -19.62, 0);
+template <> const BasicVector3<float> BasicVector3<float>::UP = BasicVector3<float>(0, 1, 0);
+template <> const BasicVector3<float> BasicVector3<float>::RIGHT = BasicVector3<float>(1, 0, 0);
+template <> const BasicVector3<float> BasicVector3<float>::OUT_OF_SCREEN = BasicVector3<float>(0, 0, 1);
+template <> const BasicVector3<float> BasicVector3<float>::X = BasicVector3<float>(0, 1, 0);
+template <> const BasicVector3<float> BasicVector3<float>::Y = BasicVector3<float>(1, 0, 0);
+template <> const BasicVector3<float> BasicVector3<float>::Z = BasicVector3<float>(0, 0, 1);
+
+template <> const BasicVector3<double> BasicVector3<double>::GRAVITY = BasicVector3<double>(0, -9.81, 0);
+template <> const BasicVector3<double> BasicVector3<double>::HIGH_GRAVITY = BasicVector3<double>(0, -19.62, 0);
+template <> const BasicVector3<double> BasicVector3<double>::UP = BasicVector3<double>(0, 1, 0);
+template <> const BasicVector3<double> BasicVector3<double>::RIGHT = BasicVector3<double>(1, 0, 0);
+template <> const BasicVector3<double> BasicVector3<double>::OUT_OF_SCREEN = BasicVector3<double>(0, 0, 1);
+template <> const BasicVector3<double> BasicVector3<double>::X = BasicVector3<double>(0, 1, 0);
+template <> const BasicVector3<double> BasicVector3<double>::Y = BasicVector3<double>(1, 0, 0);
+template <> const BasicVector3<double> BasicVector3<double>::Z = BasicVector3<double>(0, 0, 1);
+
+real cyclone::sleepEpsilon = ((real)0.3);
+
+void cyclone::setSleepEpsilon(real value)
+{
+    cyclone::sleepEpsilon = value;
+}
+
+real cyclone::getSleepEpsilon()
+{
+    return cyclone::sleepEpsilon;
+}
@@ -0,0 +1,513 @@
+/*
+ * The definition file for the GPU compute backend.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <cstring>
+#include <typeinfo>
+#include "ogl_headers.h"
+#include <GL/glext.h>
+#ifdef __gnu_linux__
+    #include <GL/freeglut_ext.h>
+#endif
+#include "compute.h"
+
+namespace {
+    /**
+     * Holds the GL entry points the backend needs, which have to be
+     * looked up at run time.
+     */
+    struct GLFunctions
+    {
+        PFNGLGENBUFFERSPROC genBuffers;
+        PFNGLDELETEBUFFERSPROC deleteBuffers;
+        PFNGLBINDBUFFERPROC bindBuffer;
+        PFNGLBUFFERDATAPROC bufferData;
+        PFNGLBUFFERSUBDATAPROC bufferSubData;
+        PFNGLGETBUFFERSUBDATAPROC getBufferSubData;
+        PFNGLBINDBUFFERBASEPROC bindBufferBase;
+        PFNGLCREATESHADERPROC createShader;
+        PFNGLDELETESHADERPROC deleteShader;
+        PFNGLSHADERSOURCEPROC shaderSource;
+        PFNGLCOMPILESHADERPROC compileShader;
+        PFNGLGETSHADERIVPROC getShaderiv;
+        PFNGLCREATEPROGRAMPROC createProgram;
+        PFNGLDELETEPROGRAMPROC deleteProgram;
+        PFNGLATTACHSHADERPROC attachShader;
+        PFNGLLINKPROGRAMPROC linkProgram;
+        PFNGLGETPROGRAMIVPROC getProgramiv;
+        PFNGLUSEPROGRAMPROC useProgram;
+        PFNGLGETUNIFORMLOCATIONPROC getUniformLocation;
+        PFNGLUNIFORM1UIPROC uniform1ui;
+        PFNGLUNIFORM1FPROC uniform1f;
+        PFNGLDISPATCHCOMPUTEPROC dispatchCompute;
+        PFNGLMEMORYBARRIERPROC memoryBarrier;
+    };
+
+    GLFunctions gl;
+
+    void* lookup(const char* name)
+    {
+#ifdef __gnu_linux__
+        return (void*)glutGetProcAddress(name);
+#else
+        return (void*)wglGetProcAddress(name);
+#endif
+    }
+
+    /**
+     * Looks up every entry point. Returns false if any is missing.
+     */
+    bool loadFunctions()
+    {
+        #define CYCLONE_DEMO_LOAD(member, name) \
+            if (!(gl.member = (decltype(gl.member))lookup(name))) return false
+
+        CYCLONE_DEMO_LOAD(genBuffers, "glGenBuffers");
+        CYCLONE_DEMO_LOAD(deleteBuffers, "glDeleteBuffers");
+        CYCLONE_DEMO_LOAD(bindBuffer, "glBindBuffer");
+        CYCLONE_DEMO_LOAD(bufferData, "glBufferData");
+        CYCLONE_DEMO_LOAD(bufferSubData, "glBufferSubData");
+        CYCLONE_DEMO_LOAD(getBufferSubData, "glGetBufferSubData");
+        CYCLONE_DEMO_LOAD(bindBufferBase, "glBindBufferBase");
+        CYCLONE_DEMO_LOAD(createShader, "glCreateShader");
+        CYCLONE_DEMO_LOAD(deleteShader, "glDeleteShader");
+        CYCLONE_DEMO_LOAD(shaderSource, "glShaderSource");
+        CYCLONE_DEMO_LOAD(compileShader, "glCompileShader");
+        CYCLONE_DEMO_LOAD(getShaderiv, "glGetShaderiv");
+        CYCLONE_DEMO_LOAD(createProgram, "glCreateProgram");
+        CYCLONE_DEMO_LOAD(deleteProgram, "glDeleteProgram");
+        CYCLONE_DEMO_LOAD(attachShader, "glAttachShader");
+        CYCLONE_DEMO_LOAD(linkProgram, "glLinkProgram");
+        CYCLONE_DEMO_LOAD(getProgramiv, "glGetProgramiv");
+        CYCLONE_DEMO_LOAD(useProgram, "glUseProgram");
+        CYCLONE_DEMO_LOAD(getUniformLocation, "glGetUniformLocation");
+        CYCLONE_DEMO_LOAD(uniform1ui, "glUniform1ui");
+        CYCLONE_DEMO_LOAD(uniform1f, "glUniform1f");
+        CYCLONE_DEMO_LOAD(dispatchCompute, "glDispatchCompute");
+        CYCLONE_DEMO_LOAD(memoryBarrier, "glMemoryBarrier");
+
+        #undef CYCLONE_DEMO_LOAD
+        return true;
+    }
+
+    /**
+     * Returns true if the context is at least the given GL version.
+     */
+    bool hasVersion(int major, int minor)
+    {
+        const char* version = (const char*)glGetString(GL_VERSION);
+        if (!version) return false;
+
+        int haveMajor = 0, haveMinor = 0;
+        const char* c = version;
+        while (*c >= '0' && *c <= '9') haveMajor = haveMajor * 10 + (*c++ - '0');
+        if (*c == '.') c++;
+        while (*c >= '0' && *c <= '9') haveMinor = haveMinor * 10 + (*c++ - '0');
+        return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+    }
+
+    /** The buffers, in the order they are bound to the shader. */
+    enum
+    {
+        POSITIONS_IN, POSITIONS_OUT, VELOCITIES, ACCELERATIONS,
+        FORCES, PROPERTIES, GENERATORS, BUFFER_COUNT
+    };
+
+    /** The kinds of generator the shader knows. */
+    enum { UNIFORM_GRAVITY = 0, POINT_GRAVITY = 1, MUTUAL_GRAVITY = 2 };
+
+    /**
+     * The compute shader applies each particle's generators and then
+     * integrates it, reading positions from one buffer and writing
+     * them to the other, so mutual gravity always sees every body
+     * where it was at the start of the step. The bodies pass through
+     * shared memory a workgroup's worth at a time.
+     */
+    const char* computeShader =
+        "#version 430\n"
+        "layout(local_size_x = 256) in;\n"
+        "struct Generator { vec4 a; vec4 b; uvec4 info; };\n"
+        "layout(std430, binding = 0) readonly buffer PositionsIn { vec4 positionIn[]; };\n"
+        "layout(std430, binding = 1) writeonly buffer PositionsOut { vec4 positionOut[]; };\n"
+        "layout(std430, binding = 2) buffer Velocities { vec4 velocity[]; };\n"
+        "layout(std430, binding = 3) readonly buffer Accelerations { vec4 acceleration[]; };\n"
+        "layout(std430, binding = 4) buffer Forces { vec4 force[]; };\n"
+        "layout(std430, binding = 5) readonly buffer Properties { vec4 properties[]; };\n"
+        "layout(std430, binding = 6) readonly buffer Generators { Generator generators[]; };\n"
+        "uniform uint count;\n"
+        "uniform uint generatorCount;\n"
+        "uniform float duration;\n"
+        "shared vec4 bodies[256];\n"
+        "void main()\n"
+        "{\n"
+        "    uint i = gl_GlobalInvocationID.x;\n"
+        "    uint local = gl_LocalInvocationID.x;\n"
+        "    bool inRange = i < count;\n"
+        "    vec3 position = vec3(0.0);\n"
+        "    vec4 props = vec4(0.0);\n"
+        "    if (inRange) { position = positionIn[i].xyz; props = properties[i]; }\n"
+        "    uint mask = floatBitsToUint(props.z);\n"
+        "    vec3 pull = vec3(0.0);\n"
+        "    bool stop = false;\n"
+        "    for (uint g = 0u; g < generatorCount; g++)\n"
+        "    {\n"
+        "        Generator generator = generators[g];\n"
+        "        uint bit = 1u << g;\n"
+        "        bool applies = (mask & bit) != 0u;\n"
+        "        if (generator.info.x == 0u)\n"
+        "        {\n"
+        "            if (applies) pull += generator.a.xyz;\n"
+        "        }\n"
+        "        else if (generator.info.x == 1u)\n"
+        "        {\n"
+        "            vec3 toPoint = generator.a.xyz - position;\n"
+        "            float distance = length(toPoint);\n"
+        "            if (applies && distance < 0.5) stop = true;\n"
+        "            else if (applies) pull += toPoint * (generator.b.x / (distance * pow(distance, 1.5)));\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            float softeningSquared = generator.b.y * generator.b.y;\n"
+        "            vec3 sum = vec3(0.0);\n"
+        "            for (uint base = 0u; base < count; base += 256u)\n"
+        "            {\n"
+        "                uint j = base + local;\n"
+        "                vec4 body = vec4(0.0);\n"
+        "                if (j < count)\n"
+        "                {\n"
+        "                    vec4 bodyProps = properties[j];\n"
+        "                    if ((floatBitsToUint(bodyProps.z) & bit) != 0u && bodyProps.x > 0.0)\n"
+        "                        body = vec4(positionIn[j].xyz, 1.0 / bodyProps.x);\n"
+        "                }\n"
+        "                bodies[local] = body;\n"
+        "                barrier();\n"
+        "                for (uint k = 0u; k < 256u; k++)\n"
+        "                {\n"
+        "                    vec4 other = bodies[k];\n"
+        "                    vec3 d = other.xyz - position;\n"
+        "                    float s = dot(d, d) + softeningSquared;\n"
+        "                    if (other.w > 0.0 && base + k != i && s > 0.0)\n"
+        "                        sum += d * (generator.b.x * other.w / (s * sqrt(sqrt(s))));\n"
+        "                }\n"
+        "                barrier();\n"
+        "            }\n"
+        "            if (applies) pull += sum;\n"
+        "        }\n"
+        "    }\n"
+        "    if (!inRange) return;\n"
+        "    float inverseMass = props.x;\n"
+        "    if (inverseMass <= 0.0)\n"
+        "    {\n"
+        "        positionOut[i] = vec4(position, 0.0);\n"
+        "        force[i] = vec4(0.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    vec3 v = stop ? vec3(0.0) : velocity[i].xyz;\n"
+        "    v += (acceleration[i].xyz + pull + force[i].xyz * inverseMass) * duration;\n"
+        "    v *= pow(props.y, duration);\n"
+        "    position += v * duration;\n"
+        "    velocity[i] = vec4(v, 0.0);\n"
+        "    positionOut[i] = vec4(position, 0.0);\n"
+        "    force[i] = vec4(0.0);\n"
+        "}\n";
+
+    /**
+     * Writes the given vectors into the staging array, as four floats
+     * each.
+     */
+    void pack(std::vector<float> &staging, const cyclone::Vector3* vectors, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            staging[i * 4 + 0] = (float)vectors[i].x;
+            staging[i * 4 + 1] = (float)vectors[i].y;
+            staging[i * 4 + 2] = (float)vectors[i].z;
+            staging[i * 4 + 3] = 0;
+        }
+    }
+
+    /**
+     * Reads the vectors back out of the staging array.
+     */
+    void unpack(const std::vector<float> &staging, cyclone::Vector3* vectors, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            vectors[i].x = staging[i * 4 + 0];
+            vectors[i].y = staging[i * 4 + 1];
+            vectors[i].z = staging[i * 4 + 2];
+        }
+    }
+
+    /**
+     * Returns true if the backend knows how to run the generator.
+     */
+    bool isSupported(const cyclone::ParticleForceGenerator* generator)
+    {
+        const std::type_info &type = typeid(*generator);
+        return type == typeid(cyclone::ParticleGravity) ||
+            type == typeid(cyclone::ParticlePointGravity) ||
+            type == typeid(cyclone::ParticleMutualGravity);
+    }
+}
+
+ParticleComputeBackend::ParticleComputeBackend(unsigned maxParticles)
+: maxParticles(maxParticles), count(0), ready(false), program(0),
+  countLocation(-1), generatorCountLocation(-1), durationLocation(-1),
+  current(0)
+{
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) buffers[i] = 0;
+}
+
+bool ParticleComputeBackend::init()
+{
+    deinit();
+    if (maxParticles == 0 || !hasVersion(4, 3) || !loadFunctions()) return false;
+
+    // The program.
+    GLuint shader = gl.createShader(GL_COMPUTE_SHADER);
+    gl.shaderSource(shader, 1, &computeShader, NULL);
+    gl.compileShader(shader);
+
+    GLint compiled = 0;
+    gl.getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+    {
+        gl.deleteShader(shader);
+        return false;
+    }
+
+    program = gl.createProgram();
+    gl.attachShader(program, shader);
+    gl.linkProgram(program);
+    gl.deleteShader(shader);
+
+    GLint linked = 0;
+    gl.getProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        gl.deleteProgram(program);
+        program = 0;
+        return false;
+    }
+    countLocation = gl.getUniformLocation(program, "count");
+    generatorCountLocation = gl.getUniformLocation(program, "generatorCount");
+    durationLocation = gl.getUniformLocation(program, "duration");
+
+    // The buffers, each big enough for every particle.
+    GLuint names[BUFFER_COUNT];
+    gl.genBuffers(BUFFER_COUNT, names);
+    for (unsigned i = 0; i < BUFFER_COUNT; i++)
+    {
+        buffers[i] = names[i];
+        GLsizeiptr size = (i == GENERATORS)
+            ? (GLsizeiptr)(MaxGenerators * sizeof(Generator))
+            : (GLsizeiptr)maxParticles * 4 * sizeof(float);
+        gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+        gl.bufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    }
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    staging.resize(maxParticles * 4);
+    table.reserve(MaxGenerators);
+    current = 0;
+    ready = glGetError() == GL_NO_ERROR;
+    if (!ready) deinit();
+    return ready;
+}
+
+void ParticleComputeBackend::deinit()
+{
+    if (!program && !buffers[0]) return;
+
+    GLuint names[BUFFER_COUNT];
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) names[i] = buffers[i];
+    if (buffers[0]) gl.deleteBuffers(BUFFER_COUNT, names);
+    if (program) gl.deleteProgram(program);
+
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) buffers[i] = 0;
+    program = 0;
+    count = 0;
+    ready = false;
+}
+
+bool ParticleComputeBackend::isReady() const
+{
+    return ready;
+}
+
+bool ParticleComputeBackend::add(unsigned index, cyclone::ParticleForceGenerator* generator)
+{
+    if (index >= maxParticles || !generator || !isSupported(generator)) return false;
+
+    unsigned g = 0;
+    while (g < generators.size() && generators[g] != generator) g++;
+    if (g == generators.size())
+    {
+        if (g == MaxGenerators) return false;
+        generators.push_back(generator);
+    }
+
+    if (index >= masks.size()) masks.resize(index + 1, 0);
+    masks[index] |= 1u << g;
+    return true;
+}
+
+void ParticleComputeBackend::clear()
+{
+    generators.clear();
+    masks.clear();
+}
+
+void ParticleComputeBackend::upload(cyclone::ParticleStore &store)
+{
+    if (!ready) return;
+
+    count = store.size() < maxParticles ? store.size() : maxParticles;
+    current = 0;
+    if (count == 0) return;
+
+    const GLsizeiptr size = (GLsizeiptr)count * 4 * sizeof(float);
+    const cyclone::Vector3* vectors[4] = {
+        store.getPositions(), store.getVelocities(),
+        store.getAccelerations(), store.getForceAccumulators()
+    };
+    const unsigned targets[4] = { POSITIONS_IN, VELOCITIES, ACCELERATIONS, FORCES };
+    for (unsigned v = 0; v < 4; v++)
+    {
+        pack(staging, vectors[v], count);
+        gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[targets[v]]);
+        gl.bufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &staging[0]);
+    }
+
+    // The mask is stored as the bits of a float, so it can share the
+    // particle's properties.
+    const cyclone::real* inverseMass = store.getInverseMasses();
+    const cyclone::real* damping = store.getDampings();
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned mask = i < masks.size() ? masks[i] : 0;
+        staging[i * 4 + 0] = (float)inverseMass[i];
+        staging[i * 4 + 1] = (float)damping[i];
+        memcpy(&staging[i * 4 + 2], &mask, sizeof(float));
+        staging[i * 4 + 3] = 0;
+    }
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[PROPERTIES]);
+    gl.bufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &staging[0]);
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // The accumulated forces are the GPU's to apply now.
+    store.clearAccumulators();
+}
+
+void ParticleComputeBackend::fillTable()
+{
+    table.resize(generators.size());
+    for (unsigned g = 0; g < generators.size(); g++)
+    {
+        Generator &entry = table[g];
+        memset(&entry, 0, sizeof(entry));
+
+        const cyclone::ParticleForceGenerator* generator = generators[g];
+        const std::type_info &type = typeid(*generator);
+        if (type == typeid(cyclone::ParticleGravity))
+        {
+            cyclone::Vector3 gravity =
+                static_cast<const cyclone::ParticleGravity*>(generator)->getGravity();
+            entry.type = UNIFORM_GRAVITY;
+            entry.parameters[0] = (float)gravity.x;
+            entry.parameters[1] = (float)gravity.y;
+            entry.parameters[2] = (float)gravity.z;
+        }
+        else if (type == typeid(cyclone::ParticlePointGravity))
+        {
+            const cyclone::ParticlePointGravity* point =
+                static_cast<const cyclone::ParticlePointGravity*>(generator);
+            cyclone::Vector3 centre = point->getGravityPoint();
+            entry.type = POINT_GRAVITY;
+            entry.parameters[0] = (float)centre.x;
+            entry.parameters[1] = (float)centre.y;
+            entry.parameters[2] = (float)centre.z;
+            entry.parameters[4] = (float)point->getGravityScalar();
+        }
+        else
+        {
+            const cyclone::ParticleMutualGravity* mutual =
+                static_cast<const cyclone::ParticleMutualGravity*>(generator);
+            entry.type = MUTUAL_GRAVITY;
+            entry.parameters[4] = (float)mutual->getGravityScalar();
+            entry.parameters[5] = (float)mutual->getSoftening();
+        }
+    }
+}
+
+void ParticleComputeBackend::step(cyclone::real duration)
+{
+    if (!ready || count == 0) return;
+
+    // The generators' parameters may have changed since last step.
+    fillTable();
+    if (!table.empty())
+    {
+        gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[GENERATORS]);
+        gl.bufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+            (GLsizeiptr)(table.size() * sizeof(Generator)), &table[0]);
+        gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    gl.useProgram(program);
+    gl.uniform1ui(countLocation, count);
+    gl.uniform1ui(generatorCountLocation, (GLuint)table.size());
+    gl.uniform1f(durationLocation, (float)duration);
+
+    gl.bindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITIONS_IN, buffers[POSITIONS_IN + current]);
+    gl.bindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITIONS_OUT, buffers[POSITIONS_OUT - current]);
+    for (unsigned b = VELOCITIES; b < BUFFER_COUNT; b++)
+    {
+        gl.bindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+    }
+
+    gl.dispatchCompute((count + 255) / 256, 1, 1);
+
+    // The next step reads what this one wrote, and a renderer may
+    // draw from it.
+    gl.memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT |
+        GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    gl.useProgram(0);
+
+    current = 1 - current;
+}
+
+void ParticleComputeBackend::download(cyclone::ParticleStore &store)
+{
+    if (!ready || count == 0) return;
+
+    unsigned n = store.size() < count ? store.size() : count;
+    const GLsizeiptr size = (GLsizeiptr)n * 4 * sizeof(float);
+
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, getPositionBuffer());
+    gl.getBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &staging[0]);
+    unpack(staging, store.getPositions(), n);
+
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[VELOCITIES]);
+    gl.getBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &staging[0]);
+    unpack(staging, store.getVelocities(), n);
+    gl.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+unsigned ParticleComputeBackend::getCount() const
+{
+    return count;
+}
+
+unsigned ParticleComputeBackend::getPositionBuffer() const
+{
+    return buffers[POSITIONS_IN + current];
+}
@@ -0,0 +1,185 @@
+/*
+ * The GPU compute backend used by the demos.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a backend that keeps a copy of a particle store on the GPU,
+ * and runs force accumulation and integration there with a compute
+ * shader.
+ */
+#ifndef CYCLONE_DEMO_COMPUTE_H
+#define CYCLONE_DEMO_COMPUTE_H
+
+#include <vector>
+#include <cyclone/cyclone.h>
+
+/**
+ * Steps a particle store on the GPU.
+ *
+ * The store's particles are copied to the GPU by upload, and stay
+ * there: each call to step applies the force generators and
+ * integrates, all on the GPU, and the results only come back to the
+ * store when download is called. A demo that only needs to draw them
+ * can give the position buffer straight to ParticleRenderer's
+ * drawBuffer, and never download at all.
+ *
+ * Only the engine's own gravity generators can run on the GPU, and
+ * each acts exactly as it does for the force registry:
+ *
+ * - ParticleGravity pulls its particles with a constant acceleration.
+ *
+ * - ParticlePointGravity pulls its particles toward its point, and
+ *   stops any that come within half a unit of it.
+ *
+ * - ParticleMutualGravity pulls each of its particles toward all the
+ *   others given with it, which are its bodies. The sum is taken
+ *   over every body, as with an opening angle of zero, which on the
+ *   GPU is faster than walking a tree.
+ *
+ * Particles are integrated as by ParticleStore::integrateAll, in
+ * single precision. Particles with infinite mass don't move.
+ *
+ * This needs OpenGL 4.3, for compute shaders and shader storage
+ * buffers. Where they aren't available, init returns false and the
+ * demo should step the store on the CPU instead.
+ */
+class ParticleComputeBackend
+{
+public:
+    /** Holds the most generators the backend can run. */
+    enum { MaxGenerators = 32 };
+
+protected:
+    /**
+     * Holds one force generator, as the shader sees it.
+     */
+    struct Generator
+    {
+        float parameters[8];
+        unsigned type;
+        unsigned padding[3];
+    };
+
+    /** Holds the most particles the backend can hold. */
+    unsigned maxParticles;
+
+    /** Holds the number of particles uploaded. */
+    unsigned count;
+
+    /** True if the GL objects are set up. */
+    bool ready;
+
+    /** Holds the compute program and its uniforms. */
+    unsigned program;
+    int countLocation;
+    int generatorCountLocation;
+    int durationLocation;
+
+    /**
+     * Holds the buffers: two of positions, which steps read from and
+     * write to in turn, then the velocities, accelerations, forces,
+     * each particle's inverse mass, damping and generator mask, and
+     * the generator table.
+     */
+    unsigned buffers[7];
+
+    /** Holds which of the two position buffers is current. */
+    unsigned current;
+
+    /**
+     * Holds the generators, and the set of them each particle is
+     * given, one bit for each.
+     */
+    std::vector<cyclone::ParticleForceGenerator*> generators;
+    std::vector<unsigned> masks;
+
+    /** Holds the generators' parameters, as the shader sees them. */
+    std::vector<Generator> table;
+
+    /** Holds floats on their way to or from the GPU. */
+    std::vector<float> staging;
+
+    /** Reads each generator's parameters into the table. */
+    void fillTable();
+
+public:
+    /**
+     * Creates a backend for up to the given number of particles.
+     */
+    ParticleComputeBackend(unsigned maxParticles);
+
+    /**
+     * Sets up the backend's GL objects. It must be called once GL is
+     * set up, for example from initGraphics. Returns false if the
+     * backend can't be used.
+     */
+    bool init();
+
+    /**
+     * Releases the backend's GL objects.
+     */
+    void deinit();
+
+    /**
+     * Returns true if the backend is set up.
+     */
+    bool isReady() const;
+
+    /**
+     * Registers the given generator to act on the particle with the
+     * given index. Returns false if the generator isn't one the
+     * backend can run, or if too many different generators have been
+     * given. Registrations are sent with the next upload, but the
+     * generators' parameters are read at every step, so a point of
+     * attraction can be moved without uploading again.
+     */
+    bool add(unsigned index, cyclone::ParticleForceGenerator* generator);
+
+    /**
+     * Removes every registration.
+     */
+    void clear();
+
+    /**
+     * Copies the whole store to the GPU: positions, velocities,
+     * accelerations, inverse masses, damping, and the forces
+     * accumulated so far, which apply to the next step only and are
+     * cleared from the store. Only the first maxParticles are copied.
+     */
+    void upload(cyclone::ParticleStore &store);
+
+    /**
+     * Takes one step of the given duration on the GPU.
+     */
+    void step(cyclone::real duration);
+
+    /**
+     * Copies the positions and velocities back from the GPU into the
+     * given store, which must be the one uploaded. This waits for the
+     * GPU to finish the steps it has been given.
+     */
+    void download(cyclone::ParticleStore &store);
+
+    /**
+     * Returns the number of particles uploaded.
+     */
+    unsigned getCount() const;
+
+    /**
+     * Returns the buffer holding the current positions, as four
+     * floats for each particle.
+     */
+    unsigned getPositionBuffer() const;
+};
+
+#endif // CYCLONE_DEMO_COMPUTE_H
@@ -19,162 +19,6 @@
 
 static cyclone::Random crandom;
 
-/**
- * Fireworks are particles, with additional data for rendering and
- * evolution.
- */
-class Firework : public cyclone::Particle
-{
-public:
-    /** Fireworks have an integer type, used for firework rules. */
-    unsigned type;
-
-    /**
-     * The age of a firework determines when it detonates. Age gradually
-     * decreases, when it passes zero the firework delivers its payload.
-     * Think of age as fuse-left.
-     */
-    cyclone::real age;
-
-    /**
-     * Updates the firework by the given duration of time. Returns true
-     * if the firework has reached the end of its life and needs to be
-     * removed.
-     */
-    bool update(cyclone::real duration)
-    {
-        // Update our physical state
-        integrate(duration);
-
-        // We work backwards from our age to zero.
-        age -= duration;
-        return (age < 0) || (position.y < 0);
-    }
-};
-
-/**
- * Firework rules control the length of a firework's fuse and the
- * particles it should evolve into.
- */
-struct FireworkRule
-{
-    /** The type of firework that is managed by this rule. */
-    unsigned type;
-
-    /** The minimum length of the fuse. */
-    cyclone::real minAge;
-
-    /** The maximum legnth of the fuse. */
-    cyclone::real maxAge;
-
-    /** The minimum relative velocity of this firework. */
-    cyclone::Vector3 minVelocity;
-
-    /** The maximum relative velocity of this firework. */
-    cyclone::Vector3 maxVelocity;
-
-    /** The damping of this firework type. */
-    cyclone::real damping;
-
-    /**
-     * The payload is the new firework type to create when this
-     * firework's fuse is over.
-     */
-    struct Payload
-    {
-        /** The type of the new particle to create. */
-        unsigned type;
-
-        /** The number of particles in this payload. */
-        unsigned count;
-
-        /** Sets the payload properties in one go. */
-        void set(unsigned type, unsigned count)
-        {
-            Payload::type = type;
-            Payload::count = count;
-        }
-    };
-
-    /** The number of payloads for this firework type. */
-    unsigned payloadCount;
-
-    /** The set of payloads. */
-    Payload *payloads;
-
-    FireworkRule()
-    :
-    payloadCount(0),
-    payloads(NULL)
-    {
-    }
-
-    void init(unsigned payloadCount)
-    {
-        FireworkRule::payloadCount = payloadCount;
-        payloads = new Payload[payloadCount];
-    }
-
-    ~FireworkRule()
-    {
-        if (payloads != NULL) delete[] payloads;
-    }
-
-    /**
-     * Set all the rule parameters in one go.
-     */
-    void setParameters(unsigned type, cyclone::real minAge, cyclone::real maxAge,
-        const cyclone::Vector3 &minVelocity, const cyclone::Vector3 &maxVelocity,
-        cyclone::real damping)
-    {
-        FireworkRule::type = type;
-        FireworkRule::minAge = minAge;
-        FireworkRule::maxAge = maxAge;
-        FireworkRule::minVelocity = minVelocity;
-        FireworkRule::maxVelocity = maxVelocity;
-        FireworkRule::damping = damping;
-    }
-
-    /**
-     * Creates a new firework of this type and writes it into the given
-     * instance. The optional parent firework is used to base position
-     * and velocity on.
-     */
-    void create(Firework *firework, const Firework *parent = NULL) const
-    {
-        firework->type = type;
-        firework->age = crandom.randomReal(minAge, maxAge);
-
-        cyclone::Vector3 vel;
-        if (parent) {
-            // The position and velocity are based on the parent.
-            firework->setPosition(parent->getPosition());
-            vel += parent->getVelocity();
-        }
-        else
-        {
-            cyclone::Vector3 start;
-            int x = (int)crandom.randomInt(3) - 1;
-            start.x = 5.0f * cyclone::real(x);
-            firework->setPosition(start);
-        }
-
-        vel += crandom.randomVector(minVelocity, maxVelocity);
-        firework->setVelocity(vel);
-
-        // We use a mass of one in all cases (no point having fireworks
-        // with different masses, since they are only under the influence
-        // of gravity).
-        firework->setMass(1);
-
-        firework->setDamping(damping);
-
-        firework->setAcceleration(cyclone::Vector3::GRAVITY);
-
-        firework->clearAccumulator();
-    }
-};
-
 /**
  * The main demo class definition.
  */
@@ -185,23 +29,11 @@ class FireworksDemo : public Application
      */
     const static unsigned maxFireworks = 1024;
 
-    /** Holds the firework data. */
-    Firework fireworks[maxFireworks];
-
-    /** Holds the index of the next firework slot to use. */
-    unsigned nextFirework;
-
-    /** And the number of rules. */
-    const static unsigned ruleCount = 9;
-
-    /** Holds the set of rules. */
-    FireworkRule rules[ruleCount];
+    /** Holds the fireworks and their rules. */
+    cyclone::ParticleEmitter emitter;
 
-    /** Dispatches a firework from the origin. */
-    void create(unsigned type, const Firework *parent=NULL);
-
-    /** Dispatches the given number of fireworks from the given parent. */
-    void create(unsigned type, unsigned number, const Firework *parent);
+    /** Dispatches the given number of fireworks from the ground. */
+    void create(unsigned type, unsigned number);
 
     /** Creates the rules. */
     void initFireworkRules();
@@ -230,15 +62,10 @@ public:
 // Method definitions
 FireworksDemo::FireworksDemo()
 :
-nextFirework(0)
+emitter(maxFireworks)
 {
-    // Make all shots unused
-    for (Firework *firework = fireworks;
-         firework < fireworks+maxFireworks;
-         firework++)
-    {
-        firework->type = 0;
-    }
+    // Fireworks that hit the ground go off there.
+    emitter.setKillHeight(0);
 
     // Create the firework types
     initFireworkRules();
@@ -250,92 +77,96 @@ FireworksDemo::~FireworksDemo()
 
 void FireworksDemo::initFireworkRules()
 {
-    // Go through the firework types and create their rules.
-    rules[0].init(2);
-    rules[0].setParameters(
-        1, // type
+    // Go through the firework types and create their rules. Types
+    // are numbered from one on the keyboard, and from zero in the
+    // emitter.
+    cyclone::ParticleEmitterRule rule;
+
+    rule.setParameters(
         0.5f, 1.4f, // age range
         cyclone::Vector3(-5, 25, -5), // min velocity
         cyclone::Vector3(5, 28, 5), // max velocity
         0.1 // damping
         );
-    rules[0].payloads[0].set(3, 5);
-    rules[0].payloads[1].set(5, 5);
+    rule.payloads.clear();
+    rule.addPayload(2, 5);
+    rule.addPayload(4, 5);
+    emitter.addRule(rule);
 
-    rules[1].init(1);
-    rules[1].setParameters(
-        2, // type
+    rule.setParameters(
         0.5f, 1.0f, // age range
         cyclone::Vector3(-5, 10, -5), // min velocity
         cyclone::Vector3(5, 20, 5), // max velocity
         0.8 // damping
         );
-    rules[1].payloads[0].set(4, 2);
+    rule.payloads.clear();
+    rule.addPayload(3, 2);
+    emitter.addRule(rule);
 
-    rules[2].init(0);
-    rules[2].setParameters(
-        3, // type
+    rule.setParameters(
         0.5f, 1.5f, // age range
         cyclone::Vector3(-5, -5, -5), // min velocity
         cyclone::Vector3(5, 5, 5), // max velocity
         0.1 // damping
         );
+    rule.payloads.clear();
+    emitter.addRule(rule);
 
-    rules[3].init(0);
-    rules[3].setParameters(
-        4, // type
+    rule.setParameters(
         0.25f, 0.5f, // age range
         cyclone::Vector3(-20, 5, -5), // min velocity
         cyclone::Vector3(20, 5, 5), // max velocity
         0.2 // damping
         );
+    rule.payloads.clear();
+    emitter.addRule(rule);
 
-    rules[4].init(1);
-    rules[4].setParameters(
-        5, // type
+    rule.setParameters(
         0.5f, 1.0f, // age range
         cyclone::Vector3(-20, 2, -5), // min velocity
         cyclone::Vector3(20, 18, 5), // max velocity
         0.01 // damping
         );
-    rules[4].payloads[0].set(3, 5);
+    rule.payloads.clear();
+    rule.addPayload(2, 5);
+    emitter.addRule(rule);
 
-    rules[5].init(0);
-    rules[5].setParameters(
-        6, // type
+    rule.setParameters(
         3, 5, // age range
         cyclone::Vector3(-5, 5, -5), // min velocity
         cyclone::Vector3(5, 10, 5), // max velocity
         0.95 // damping
         );
+    rule.payloads.clear();
+    emitter.addRule(rule);
 
-    rules[6].init(1);
-    rules[6].setParameters(
-        7, // type
+    rule.setParameters(
         4, 5, // age range
         cyclone::Vector3(-5, 50, -5), // min velocity
         cyclone::Vector3(5, 60, 5), // max velocity
         0.01 // damping
         );
-    rules[6].payloads[0].set(8, 10);
+    rule.payloads.clear();
+    rule.addPayload(7, 10);
+    emitter.addRule(rule);
 
-    rules[7].init(0);
-    rules[7].setParameters(
-        8, // type
+    rule.setParameters(
         0.25f, 0.5f, // age range
         cyclone::Vector3(-1, -1, -1), // min velocity
         cyclone::Vector3(1, 1, 1), // max velocity
         0.01 // damping
         );
+    rule.payloads.clear();
+    emitter.addRule(rule);
 
-    rules[8].init(0);
-    rules[8].setParameters(
-        9, // type
+    rule.setParameters(
         3, 5, // age range
         cyclone::Vector3(-15, 10, -5), // min velocity
         cyclone::Vector3(15, 15, 5), // max velocity
         0.95 // damping
         );
+    rule.payloads.clear();
+    emitter.addRule(rule);
     // ... and so on for other firework types ...
 }
 
@@ -353,23 +184,17 @@ const char* FireworksDemo::getTitle()
     return "Cyclone > Fireworks Demo";
 }
 
-void FireworksDemo::create(unsigned type, const Firework *parent)
-{
-    // Get the rule needed to create this firework
-    FireworkRule *rule = rules + (type - 1);
-
-    // Create the firework
-    rule->create(fireworks+nextFirework, parent);
-
-    // Increment the index for the next firework
-    nextFirework = (nextFirework + 1) % maxFireworks;
-}
-
-void FireworksDemo::create(unsigned type, unsigned number, const Firework *parent)
+void FireworksDemo::create(unsigned type, unsigned number)
 {
+    // Each firework launches from its own choice of three points
+    // along the ground.
     for (unsigned i = 0; i < number; i++)
     {
-        create(type, parent);
+        cyclone::Vector3 start;
+        int x = (int)crandom.randomInt(3) - 1;
+        start.x = 5.0f * cyclone::real(x);
+
+        emitter.emit(type - 1, 1, start);
     }
 }
 
@@ -379,34 +204,9 @@ void FireworksDemo::update()
     float duration = (float)TimingData::get().lastFrameDuration * 0.001f;
     if (duration <= 0.0f) return;
 
-    for (Firework *firework = fireworks;
-         firework < fireworks+maxFireworks;
-         firework++)
-    {
-        // Check if we need to process this firework.
-        if (firework->type > 0)
-        {
-            // Does it need removing?
-            if (firework->update(duration))
-            {
-                // Find the appropriate rule
-                FireworkRule *rule = rules + (firework->type-1);
-
-                // Delete the current firework (this doesn't affect its
-                // position and velocity for passing to the create function,
-                // just whether or not it is processed for rendering or
-                // physics.
-                firework->type = 0;
-
-                // Add the payload
-                for (unsigned i = 0; i < rule->payloadCount; i++)
-                {
-                    FireworkRule::Payload * payload = rule->payloads + i;
-                    create(payload->type, payload->count, firework);
-                }
-            }
-        }
-    }
+    // Move and age the fireworks, and let off the payloads of the
+    // ones that are done.
+    emitter.update(duration);
 
     Application::update();
 }
@@ -421,39 +221,34 @@ void FireworksDemo::display()
     gluLookAt(0.0, 4.0, 10.0,  0.0, 4.0, 0.0,  0.0, 1.0, 0.0);
 
     // Render each firework in turn
+    const cyclone::Vector3* positions = emitter.getStore().getPositions();
     glBegin(GL_QUADS);
-    for (Firework *firework = fireworks;
-        firework < fireworks+maxFireworks;
-        firework++)
+    for (unsigned i = 0; i < emitter.getLiveCount(); i++)
     {
-        // Check if we need to process this firework.
-        if (firework->type > 0)
+        switch (emitter.getType(i) + 1)
         {
-            switch (firework->type)
-            {
-            case 1: glColor3f(1,0,0); break;
-            case 2: glColor3f(1,0.5f,0); break;
-            case 3: glColor3f(1,1,0); break;
-            case 4: glColor3f(0,1,0); break;
-            case 5: glColor3f(0,1,1); break;
-            case 6: glColor3f(0.4f,0.4f,1); break;
-            case 7: glColor3f(1,0,1); break;
-            case 8: glColor3f(1,1,1); break;
-            case 9: glColor3f(1,0.5f,0.5f); break;
-            };
-
-            const cyclone::Vector3 &pos = firework->getPosition();
-            glVertex3f(pos.x-size, pos.y-size, pos.z);
-            glVertex3f(pos.x+size, pos.y-size, pos.z);
-            glVertex3f(pos.x+size, pos.y+size, pos.z);
-            glVertex3f(pos.x-size, pos.y+size, pos.z);
-
-            // Render the firework's reflection
-            glVertex3f(pos.x-size, -pos.y-size, pos.z);
-            glVertex3f(pos.x+size, -pos.y-size, pos.z);
-            glVertex3f(pos.x+size, -pos.y+size, pos.z);
-            glVertex3f(pos.x-size, -pos.y+size, pos.z);
-        }
+        case 1: glColor3f(1,0,0); break;
+        case 2: glColor3f(1,0.5f,0); break;
+        case 3: glColor3f(1,1,0); break;
+        case 4: glColor3f(0,1,0); break;
+        case 5: glColor3f(0,1,1); break;
+        case 6: glColor3f(0.4f,0.4f,1); break;
+        case 7: glColor3f(1,0,1); break;
+        case 8: glColor3f(1,1,1); break;
+        case 9: glColor3f(1,0.5f,0.5f); break;
+        };
+
+        const cyclone::Vector3 &pos = positions[i];
+        glVertex3f(pos.x-size, pos.y-size, pos.z);
+        glVertex3f(pos.x+size, pos.y-size, pos.z);
+        glVertex3f(pos.x+size, pos.y+size, pos.z);
+        glVertex3f(pos.x-size, pos.y+size, pos.z);
+
+        // Render the firework's reflection
+        glVertex3f(pos.x-size, -pos.y-size, pos.z);
+        glVertex3f(pos.x+size, -pos.y-size, pos.z);
+        glVertex3f(pos.x+size, -pos.y+size, pos.z);
+        glVertex3f(pos.x-size, -pos.y+size, pos.z);
     }
     glEnd();
 }
@@ -462,15 +257,15 @@ void FireworksDemo::key(unsigned char key)
 {
     switch (key)
     {
-    case '1': create(1, 1, NULL); break;
-    case '2': create(2, 1, NULL); break;
-    case '3': create(3, 1, NULL); break;
-    case '4': create(4, 1, NULL); break;
-    case '5': create(5, 1, NULL); break;
-    case '6': create(6, 1, NULL); break;
-    case '7': create(7, 1, NULL); break;
-    case '8': create(8, 1, NULL); break;
-    case '9': create(9, 1, NULL); break;
+    case '1': create(1, 1); break;
+    case '2': create(2, 1); break;
+    case '3': create(3, 1); break;
+    case '4': create(4, 1); break;
+    case '5': create(5, 1); break;
+    case '6': create(6, 1); break;
+    case '7': create(7, 1); break;
+    case '8': create(8, 1); break;
+    case '9': create(9, 1); break;
     }
 }
 
@@ -13,6 +13,7 @@
 #include <cyclone/cyclone.h>
 #include "../ogl_headers.h"
 #include "../app.h"
+#include "../render.h"
 #include "../timing.h"
 
 #include <stdio.h>
@@ -32,6 +33,9 @@ class LighterDemo : public Application
     cyclone::ParticleGravity particleGravity;
     cyclone::ParticleLighterThanAir particleLighterThanAir;
 
+    /** Draws the particles. */
+    ParticleRenderer renderer;
+
 public:
     /** Creates a ne
      * w demo object. */
@@ -40,6 +44,12 @@ public:
     /** Returns the window title for the demo. */
     virtual const char* getTitle();
 
+    /** Sets up the renderer. */
+    virtual void initGraphics();
+
+    /** Releases the renderer. */
+    virtual void deinit();
+
     /** Update the particle positions. */
     virtual void update();
 
@@ -59,6 +69,7 @@ public:
 
 // Method definitions
 LighterDemo::LighterDemo()
+: renderer(particleCount, 0.3f, 5, 4)
 {
     // Reset the position of the boxes
     reset();
@@ -75,6 +86,10 @@ void LighterDemo::reset()
     // Initialize particle force generator registry
     registry = cyclone::ParticleForceRegistry();
 
+    // Every particle shares the same two generators, so let the
+    // registry call each generator once for all its particles.
+    registry.setBatched(true);
+
     // Init gravity force generator
     particleGravity = cyclone::ParticleGravity(cyclone::Vector3(0, -10.0f, 0));
 
@@ -262,6 +277,17 @@ void LighterDemo::reset()
 }
 
 
+void LighterDemo::initGraphics()
+{
+    Application::initGraphics();
+    renderer.init();
+}
+
+void LighterDemo::deinit()
+{
+    renderer.deinit();
+}
+
 void LighterDemo::update()
 {
     // Find the duration of the last frame in seconds
@@ -291,21 +317,8 @@ void LighterDemo::display()
 
     glColor3f(0, 0, 0);
 
-    cyclone::Vector3 position;
-
-    // Particle iterator
-    cyclone::Particle *particle = particles;
-
     // Render all particles
-    for (; particle < particles+particleCount; particle++)
-    {
-        particle->getPosition(&position);
-    
-        glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
-        glutSolidSphere(0.3f, 5, 4);
-        glPopMatrix();
-    }
+    renderer.draw(cyclone::TrajectoryView::of(particles, particleCount));
 }
 
 void LighterDemo::mouse(int button, int state, int x, int y)
@@ -0,0 +1,396 @@
+/*
+ * The definition file for the instanced particle renderer.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "ogl_headers.h"
+#include <GL/glext.h>
+#ifdef __gnu_linux__
+    #include <GL/freeglut_ext.h>
+#endif
+#include "render.h"
+
+namespace {
+    /**
+     * Holds the GL entry points the instanced path needs, which have
+     * to be looked up at run time.
+     */
+    struct GLFunctions
+    {
+        PFNGLGENBUFFERSPROC genBuffers;
+        PFNGLDELETEBUFFERSPROC deleteBuffers;
+        PFNGLBINDBUFFERPROC bindBuffer;
+        PFNGLBUFFERDATAPROC bufferData;
+        PFNGLBUFFERSTORAGEPROC bufferStorage;
+        PFNGLMAPBUFFERRANGEPROC mapBufferRange;
+        PFNGLUNMAPBUFFERPROC unmapBuffer;
+        PFNGLCREATESHADERPROC createShader;
+        PFNGLDELETESHADERPROC deleteShader;
+        PFNGLSHADERSOURCEPROC shaderSource;
+        PFNGLCOMPILESHADERPROC compileShader;
+        PFNGLGETSHADERIVPROC getShaderiv;
+        PFNGLCREATEPROGRAMPROC createProgram;
+        PFNGLDELETEPROGRAMPROC deleteProgram;
+        PFNGLATTACHSHADERPROC attachShader;
+        PFNGLBINDATTRIBLOCATIONPROC bindAttribLocation;
+        PFNGLLINKPROGRAMPROC linkProgram;
+        PFNGLGETPROGRAMIVPROC getProgramiv;
+        PFNGLUSEPROGRAMPROC useProgram;
+        PFNGLGETUNIFORMLOCATIONPROC getUniformLocation;
+        PFNGLUNIFORM1FPROC uniform1f;
+        PFNGLENABLEVERTEXATTRIBARRAYPROC enableVertexAttribArray;
+        PFNGLDISABLEVERTEXATTRIBARRAYPROC disableVertexAttribArray;
+        PFNGLVERTEXATTRIBPOINTERPROC vertexAttribPointer;
+        PFNGLVERTEXATTRIBDIVISORPROC vertexAttribDivisor;
+        PFNGLDRAWARRAYSINSTANCEDPROC drawArraysInstanced;
+        PFNGLFENCESYNCPROC fenceSync;
+        PFNGLCLIENTWAITSYNCPROC clientWaitSync;
+        PFNGLDELETESYNCPROC deleteSync;
+    };
+
+    GLFunctions gl;
+
+    void* lookup(const char* name)
+    {
+#ifdef __gnu_linux__
+        return (void*)glutGetProcAddress(name);
+#else
+        return (void*)wglGetProcAddress(name);
+#endif
+    }
+
+    /**
+     * Looks up every entry point. Returns false if any is missing.
+     */
+    bool loadFunctions()
+    {
+        #define CYCLONE_DEMO_LOAD(member, name) \
+            if (!(gl.member = (decltype(gl.member))lookup(name))) return false
+
+        CYCLONE_DEMO_LOAD(genBuffers, "glGenBuffers");
+        CYCLONE_DEMO_LOAD(deleteBuffers, "glDeleteBuffers");
+        CYCLONE_DEMO_LOAD(bindBuffer, "glBindBuffer");
+        CYCLONE_DEMO_LOAD(bufferData, "glBufferData");
+        CYCLONE_DEMO_LOAD(bufferStorage, "glBufferStorage");
+        CYCLONE_DEMO_LOAD(mapBufferRange, "glMapBufferRange");
+        CYCLONE_DEMO_LOAD(unmapBuffer, "glUnmapBuffer");
+        CYCLONE_DEMO_LOAD(createShader, "glCreateShader");
+        CYCLONE_DEMO_LOAD(deleteShader, "glDeleteShader");
+        CYCLONE_DEMO_LOAD(shaderSource, "glShaderSource");
+        CYCLONE_DEMO_LOAD(compileShader, "glCompileShader");
+        CYCLONE_DEMO_LOAD(getShaderiv, "glGetShaderiv");
+        CYCLONE_DEMO_LOAD(createProgram, "glCreateProgram");
+        CYCLONE_DEMO_LOAD(deleteProgram, "glDeleteProgram");
+        CYCLONE_DEMO_LOAD(attachShader, "glAttachShader");
+        CYCLONE_DEMO_LOAD(bindAttribLocation, "glBindAttribLocation");
+        CYCLONE_DEMO_LOAD(linkProgram, "glLinkProgram");
+        CYCLONE_DEMO_LOAD(getProgramiv, "glGetProgramiv");
+        CYCLONE_DEMO_LOAD(useProgram, "glUseProgram");
+        CYCLONE_DEMO_LOAD(getUniformLocation, "glGetUniformLocation");
+        CYCLONE_DEMO_LOAD(uniform1f, "glUniform1f");
+        CYCLONE_DEMO_LOAD(enableVertexAttribArray, "glEnableVertexAttribArray");
+        CYCLONE_DEMO_LOAD(disableVertexAttribArray, "glDisableVertexAttribArray");
+        CYCLONE_DEMO_LOAD(vertexAttribPointer, "glVertexAttribPointer");
+        CYCLONE_DEMO_LOAD(vertexAttribDivisor, "glVertexAttribDivisor");
+        CYCLONE_DEMO_LOAD(drawArraysInstanced, "glDrawArraysInstanced");
+        CYCLONE_DEMO_LOAD(fenceSync, "glFenceSync");
+        CYCLONE_DEMO_LOAD(clientWaitSync, "glClientWaitSync");
+        CYCLONE_DEMO_LOAD(deleteSync, "glDeleteSync");
+
+        #undef CYCLONE_DEMO_LOAD
+        return true;
+    }
+
+    /**
+     * Returns true if the context is at least the given GL version.
+     */
+    bool hasVersion(int major, int minor)
+    {
+        const char* version = (const char*)glGetString(GL_VERSION);
+        if (!version) return false;
+
+        int haveMajor = 0, haveMinor = 0;
+        const char* c = version;
+        while (*c >= '0' && *c <= '9') haveMajor = haveMajor * 10 + (*c++ - '0');
+        if (*c == '.') c++;
+        while (*c >= '0' && *c <= '9') haveMinor = haveMinor * 10 + (*c++ - '0');
+        return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+    }
+
+    /**
+     * The vertex shader places a unit sphere vertex around the
+     * particle's position. It runs in a compatibility context, so
+     * picks up the modelview, projection and colour from GL's state.
+     * The vertex of a unit sphere is also its normal, which lights it
+     * from a fixed direction above and behind the viewer, with some
+     * ambient light so the far side isn't lost.
+     */
+    const char* vertexShader =
+        "#version 120\n"
+        "attribute vec3 vertex;\n"
+        "attribute vec3 offset;\n"
+        "uniform float radius;\n"
+        "const vec3 lightDirection = vec3(0.27, 0.8, 0.53);\n"
+        "void main()\n"
+        "{\n"
+        "    vec3 normal = normalize(gl_NormalMatrix * vertex);\n"
+        "    float diffuse = max(dot(normal, lightDirection), 0.0);\n"
+        "    gl_FrontColor = vec4(gl_Color.rgb * (0.3 + 0.7 * diffuse), gl_Color.a);\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * vec4(vertex * radius + offset, 1.0);\n"
+        "}\n";
+
+    const char* fragmentShader =
+        "#version 120\n"
+        "void main()\n"
+        "{\n"
+        "    gl_FragColor = gl_Color;\n"
+        "}\n";
+
+    enum { VERTEX_ATTRIBUTE = 0, OFFSET_ATTRIBUTE = 1 };
+
+    unsigned compile(GLenum type, const char* source)
+    {
+        GLuint shader = gl.createShader(type);
+        gl.shaderSource(shader, 1, &source, NULL);
+        gl.compileShader(shader);
+
+        GLint compiled = 0;
+        gl.getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled)
+        {
+            gl.deleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+
+    /**
+     * Adds the vertices of a unit sphere, as triangles, to the given
+     * array.
+     */
+    void buildSphere(std::vector<float> &vertices, unsigned slices, unsigned stacks)
+    {
+        const float pi = 3.14159265f;
+        for (unsigned j = 0; j < stacks; j++)
+        {
+            float theta0 = pi * j / stacks;
+            float theta1 = pi * (j + 1) / stacks;
+            for (unsigned i = 0; i < slices; i++)
+            {
+                float phi0 = 2 * pi * i / slices;
+                float phi1 = 2 * pi * (i + 1) / slices;
+
+                float corner[4][3] = {
+                    { sinf(theta0)*cosf(phi0), cosf(theta0), sinf(theta0)*sinf(phi0) },
+                    { sinf(theta1)*cosf(phi0), cosf(theta1), sinf(theta1)*sinf(phi0) },
+                    { sinf(theta1)*cosf(phi1), cosf(theta1), sinf(theta1)*sinf(phi1) },
+                    { sinf(theta0)*cosf(phi1), cosf(theta0), sinf(theta0)*sinf(phi1) }
+                };
+                const unsigned order[6] = { 0, 1, 2, 0, 2, 3 };
+                for (unsigned k = 0; k < 6; k++)
+                {
+                    vertices.insert(vertices.end(), corner[order[k]], corner[order[k]] + 3);
+                }
+            }
+        }
+    }
+}
+
+ParticleRenderer::ParticleRenderer(unsigned maxParticles, float radius,
+    unsigned slices, unsigned stacks)
+: maxParticles(maxParticles), radius(radius), slices(slices), stacks(stacks),
+  meshVertices(0), instanced(false), meshBuffer(0), positionBuffer(0),
+  program(0), radiusLocation(-1), mapped(0), region(0)
+{
+    fences[0] = fences[1] = fences[2] = 0;
+}
+
+bool ParticleRenderer::init()
+{
+    deinit();
+    instanced = initInstanced();
+    if (!instanced) deinit();
+    return instanced;
+}
+
+bool ParticleRenderer::initInstanced()
+{
+    if (maxParticles == 0 || !hasVersion(4, 4) || !loadFunctions()) return false;
+
+    // Clear any error left by earlier calls, so the check at the end
+    // only sees errors made here.
+    while (glGetError() != GL_NO_ERROR) {}
+
+    // The program.
+    GLuint vertex = compile(GL_VERTEX_SHADER, vertexShader);
+    GLuint fragment = compile(GL_FRAGMENT_SHADER, fragmentShader);
+    if (vertex && fragment)
+    {
+        program = gl.createProgram();
+        gl.attachShader(program, vertex);
+        gl.attachShader(program, fragment);
+        gl.bindAttribLocation(program, VERTEX_ATTRIBUTE, "vertex");
+        gl.bindAttribLocation(program, OFFSET_ATTRIBUTE, "offset");
+        gl.linkProgram(program);
+    }
+    if (vertex) gl.deleteShader(vertex);
+    if (fragment) gl.deleteShader(fragment);
+    if (!program) return false;
+
+    GLint linked = 0;
+    gl.getProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) return false;
+    radiusLocation = gl.getUniformLocation(program, "radius");
+
+    // The sphere mesh, which never changes.
+    std::vector<float> vertices;
+    buildSphere(vertices, slices, stacks);
+    meshVertices = (unsigned)(vertices.size() / 3);
+
+    GLuint buffer;
+    gl.genBuffers(1, &buffer);
+    meshBuffer = buffer;
+    gl.bindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+    gl.bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+
+    // The positions: three frames' worth, mapped once for good.
+    GLsizeiptr size = (GLsizeiptr)maxParticles * 3 * sizeof(float) * 3;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    gl.genBuffers(1, &buffer);
+    positionBuffer = buffer;
+    gl.bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+    gl.bufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    mapped = (float*)gl.mapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return mapped != 0 && glGetError() == GL_NO_ERROR;
+}
+
+void ParticleRenderer::deinit()
+{
+    if (!instanced && !program && !meshBuffer && !positionBuffer) return;
+
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (fences[i]) gl.deleteSync((GLsync)fences[i]);
+        fences[i] = 0;
+    }
+    if (mapped)
+    {
+        gl.bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        gl.unmapBuffer(GL_ARRAY_BUFFER);
+        gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+        mapped = 0;
+    }
+
+    GLuint buffers[2] = { meshBuffer, positionBuffer };
+    if (meshBuffer || positionBuffer) gl.deleteBuffers(2, buffers);
+    if (program) gl.deleteProgram(program);
+
+    meshBuffer = positionBuffer = program = 0;
+    instanced = false;
+}
+
+bool ParticleRenderer::isInstanced() const
+{
+    return instanced;
+}
+
+void ParticleRenderer::setRadius(float radius)
+{
+    ParticleRenderer::radius = radius;
+}
+
+void ParticleRenderer::drawImmediate(const cyclone::TrajectoryView &view)
+{
+    const char* position = (const char*)view.position;
+    for (unsigned i = 0; i < view.count; i++, position += view.stride)
+    {
+        const cyclone::Vector3 &p = *(const cyclone::Vector3*)position;
+        glPushMatrix();
+        glTranslatef((float)p.x, (float)p.y, (float)p.z);
+        glutSolidSphere(radius, slices, stacks);
+        glPopMatrix();
+    }
+}
+
+void ParticleRenderer::draw(const cyclone::TrajectoryView &view)
+{
+    unsigned count = view.count < maxParticles ? view.count : maxParticles;
+    if (count == 0) return;
+
+    if (!instanced)
+    {
+        cyclone::TrajectoryView limited = view;
+        limited.count = count;
+        drawImmediate(limited);
+        return;
+    }
+
+    // Wait until the GPU has finished with this third of the buffer,
+    // three frames ago.
+    if (fences[region])
+    {
+        gl.clientWaitSync((GLsync)fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        gl.deleteSync((GLsync)fences[region]);
+        fences[region] = 0;
+    }
+
+    // Write the positions straight into the mapped buffer.
+    unsigned first = region * maxParticles;
+    float* out = mapped + first * 3;
+    const char* position = (const char*)view.position;
+    for (unsigned i = 0; i < count; i++, position += view.stride, out += 3)
+    {
+        const cyclone::Vector3 &p = *(const cyclone::Vector3*)position;
+        out[0] = (float)p.x;
+        out[1] = (float)p.y;
+        out[2] = (float)p.z;
+    }
+
+    drawInstances(positionBuffer, first * 3 * sizeof(float), 0, count);
+
+    fences[region] = gl.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % 3;
+}
+
+bool ParticleRenderer::drawBuffer(unsigned buffer, unsigned count)
+{
+    if (!instanced) return false;
+    if (count > 0) drawInstances(buffer, 0, 4 * sizeof(float), count);
+    return true;
+}
+
+void ParticleRenderer::drawInstances(unsigned buffer, unsigned offset,
+    unsigned stride, unsigned count)
+{
+    gl.useProgram(program);
+    gl.uniform1f(radiusLocation, radius);
+
+    gl.bindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+    gl.enableVertexAttribArray(VERTEX_ATTRIBUTE);
+    gl.vertexAttribPointer(VERTEX_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    gl.bindBuffer(GL_ARRAY_BUFFER, buffer);
+    gl.enableVertexAttribArray(OFFSET_ATTRIBUTE);
+    gl.vertexAttribPointer(OFFSET_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, stride,
+        (const void*)(size_t)offset);
+    gl.vertexAttribDivisor(OFFSET_ATTRIBUTE, 1);
+
+    gl.drawArraysInstanced(GL_TRIANGLES, 0, meshVertices, count);
+
+    gl.vertexAttribDivisor(OFFSET_ATTRIBUTE, 0);
+    gl.disableVertexAttribArray(OFFSET_ATTRIBUTE);
+    gl.disableVertexAttribArray(VERTEX_ATTRIBUTE);
+    gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+    gl.useProgram(0);
+}
@@ -0,0 +1,132 @@
+/*
+ * The instanced particle renderer used by the demos.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a renderer that draws every particle of a demo as a small
+ * sphere with a single instanced draw call.
+ */
+#ifndef CYCLONE_DEMO_RENDER_H
+#define CYCLONE_DEMO_RENDER_H
+
+#include <cyclone/cyclone.h>
+
+/**
+ * Draws a set of particles as spheres of one size and colour.
+ *
+ * Positions are read straight from where they are held, through a
+ * trajectory view, so the particles of a store or of an array of
+ * particles are drawn without a call per particle. They are
+ * converted to floats as they are written into a vertex buffer that
+ * stays mapped for the life of the renderer, and every sphere is
+ * then drawn with one instanced call, lit from a fixed direction.
+ * The buffer has room for three frames, used in turn, and a fence
+ * for each, so a frame's positions are never written while the GPU
+ * may still be drawing from them.
+ *
+ * This needs OpenGL 4.4 (or the buffer storage, instanced arrays and
+ * sync extensions). Where they aren't available the renderer draws
+ * each sphere in immediate mode, as the demos otherwise do.
+ */
+class ParticleRenderer
+{
+protected:
+    /** Holds the most particles drawn in a frame. */
+    unsigned maxParticles;
+
+    /** Holds the radius of the spheres. */
+    float radius;
+
+    /** Holds the detail of the sphere mesh. */
+    unsigned slices, stacks;
+
+    /** Holds the number of vertices in the sphere mesh. */
+    unsigned meshVertices;
+
+    /** True if the instanced path is set up. */
+    bool instanced;
+
+    /** Holds the GL objects of the instanced path. */
+    unsigned meshBuffer;
+    unsigned positionBuffer;
+    unsigned program;
+    int radiusLocation;
+
+    /** Holds the mapped position buffer. */
+    float* mapped;
+
+    /** Holds the fence for each third of the position buffer. */
+    void* fences[3];
+
+    /** Holds the third of the position buffer to use next. */
+    unsigned region;
+
+    /** Sets up the buffers and shaders. Returns false if it can't. */
+    bool initInstanced();
+
+    /** Draws the given particles one at a time. */
+    void drawImmediate(const cyclone::TrajectoryView &view);
+
+    /**
+     * Draws a sphere at each of the given number of positions, read
+     * from the given buffer starting at the given byte offset.
+     */
+    void drawInstances(unsigned buffer, unsigned offset, unsigned stride, unsigned count);
+
+public:
+    /**
+     * Creates a renderer for up to the given number of particles,
+     * drawn as spheres of the given radius and detail.
+     */
+    ParticleRenderer(unsigned maxParticles, float radius = 0.3f,
+        unsigned slices = 6, unsigned stacks = 4);
+
+    /**
+     * Sets up the renderer's GL objects. It must be called once GL is
+     * set up, for example from initGraphics. Returns true if the
+     * instanced path can be used.
+     */
+    bool init();
+
+    /**
+     * Releases the renderer's GL objects.
+     */
+    void deinit();
+
+    /**
+     * Returns true if the renderer draws with instancing.
+     */
+    bool isInstanced() const;
+
+    /**
+     * Sets the radius of the spheres.
+     */
+    void setRadius(float radius);
+
+    /**
+     * Draws the particles in the given view in the current colour
+     * and modelview matrix. Only the first maxParticles are drawn.
+     */
+    void draw(const cyclone::TrajectoryView &view);
+
+    /**
+     * Draws the given number of particles whose positions are held
+     * in the given GL buffer, four floats to each, such as the
+     * position buffer of a ParticleComputeBackend. The positions
+     * never pass through the CPU. Returns false, drawing nothing, if
+     * the renderer isn't instanced.
+     */
+    bool drawBuffer(unsigned buffer, unsigned count);
+};
+
+#endif // CYCLONE_DEMO_RENDER_H
@@ -0,0 +1,233 @@
+/*
+ * Implementation file for the job system.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <cyclone/jobs.h>
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Records which job system and queue the current thread works
+     * for, so nested calls and scratch lookups use the right queue.
+     */
+    thread_local const JobSystem* currentSystem = 0;
+    thread_local unsigned currentQueueIndex = 0;
+
+    /**
+     * Holds the number of jobs a deterministic job system splits a
+     * loop into when it picks the grain size.
+     */
+    const unsigned deterministicJobCount = 64;
+}
+
+JobSystem::JobSystem(unsigned workerCount)
+    : workerCount(workerCount), queuedJobs(0), stopping(false), deterministic(false)
+{
+    if (JobSystem::workerCount == 0)
+    {
+        JobSystem::workerCount = std::thread::hardware_concurrency();
+        if (JobSystem::workerCount == 0) JobSystem::workerCount = 1;
+    }
+
+    for (unsigned i = 0; i < JobSystem::workerCount; i++)
+    {
+        queues.push_back(new WorkQueue());
+    }
+
+    // Queue zero belongs to the caller, so start one thread fewer
+    // than there are workers.
+    for (unsigned i = 1; i < JobSystem::workerCount; i++)
+    {
+        threads.push_back(std::thread(&JobSystem::workerMain, this, i));
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (unsigned i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+
+    for (unsigned i = 0; i < queues.size(); i++)
+    {
+        delete queues[i];
+    }
+}
+
+unsigned JobSystem::getWorkerCount() const
+{
+    return workerCount;
+}
+
+unsigned JobSystem::getCurrentWorker() const
+{
+    return currentQueue();
+}
+
+void JobSystem::setDeterministic(bool deterministic)
+{
+    JobSystem::deterministic = deterministic;
+}
+
+bool JobSystem::isDeterministic() const
+{
+    return deterministic;
+}
+
+unsigned JobSystem::currentQueue() const
+{
+    if (currentSystem == this) return currentQueueIndex;
+    return 0;
+}
+
+bool JobSystem::push(unsigned queue, const Job &job)
+{
+    WorkQueue &q = *queues[queue];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.bottom - q.top == queueCapacity) return false;
+        q.jobs[q.bottom % queueCapacity] = job;
+        q.bottom++;
+    }
+    queuedJobs++;
+    return true;
+}
+
+bool JobSystem::pop(unsigned queue, Job *job)
+{
+    WorkQueue &q = *queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.bottom == q.top) return false;
+    q.bottom--;
+    *job = q.jobs[q.bottom % queueCapacity];
+    queuedJobs--;
+    return true;
+}
+
+bool JobSystem::steal(unsigned queue, Job *job)
+{
+    WorkQueue &q = *queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.bottom == q.top) return false;
+    *job = q.jobs[q.top % queueCapacity];
+    q.top++;
+    queuedJobs--;
+    return true;
+}
+
+bool JobSystem::findJob(unsigned queue, Job *job)
+{
+    if (pop(queue, job)) return true;
+
+    for (unsigned i = 1; i < workerCount; i++)
+    {
+        if (steal((queue + i) % workerCount, job)) return true;
+    }
+    return false;
+}
+
+void JobSystem::run(const Job &job)
+{
+    job.function(job.data, job.begin, job.end);
+    job.pending->fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::workerMain(unsigned queue)
+{
+    currentSystem = this;
+    currentQueueIndex = queue;
+
+    for (;;)
+    {
+        Job job;
+        if (findJob(queue, &job))
+        {
+            run(job);
+            continue;
+        }
+
+        // Nothing to do: sleep until more work is queued.
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        while (!stopping && queuedJobs.load() == 0)
+        {
+            wake.wait(lock);
+        }
+        if (stopping && queuedJobs.load() == 0) return;
+    }
+}
+
+void JobSystem::parallelFor(unsigned count, unsigned grainSize, JobFunction function, void* data)
+{
+    if (count == 0) return;
+
+    if (grainSize == 0)
+    {
+        if (deterministic) grainSize = (count + deterministicJobCount - 1) / deterministicJobCount;
+        else grainSize = count / (workerCount * 4);
+        if (grainSize == 0) grainSize = 1;
+    }
+
+    // Small loops aren't worth handing out.
+    if (count <= grainSize || (workerCount == 1 && !deterministic))
+    {
+        function(data, 0, count);
+        return;
+    }
+
+    // A single deterministic worker still runs the loop in jobs.
+    if (workerCount == 1)
+    {
+        for (unsigned begin = 0; begin < count; begin += grainSize)
+        {
+            unsigned end = begin + grainSize;
+            if (end > count) end = count;
+            function(data, begin, end);
+        }
+        return;
+    }
+
+    unsigned jobCount = (count + grainSize - 1) / grainSize;
+    std::atomic<unsigned> pending(jobCount);
+    unsigned self = currentQueue();
+
+    // Deal the jobs out across all the queues, starting with our own.
+    for (unsigned j = 0; j < jobCount; j++)
+    {
+        Job job;
+        job.function = function;
+        job.data = data;
+        job.begin = j * grainSize;
+        job.end = job.begin + grainSize;
+        if (job.end > count) job.end = count;
+        job.pending = &pending;
+
+        if (!push((self + j) % workerCount, job)) run(job);
+    }
+
+    // Taking the lock before notifying makes sure no worker misses
+    // the wakeup between checking for work and going to sleep.
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+
+    // Help out until all our jobs are done. We may end up running
+    // jobs from other parallel loops, which is fine.
+    while (pending.load(std::memory_order_acquire) > 0)
+    {
+        Job job;
+        if (findJob(self, &job)) run(job);
+        else std::this_thread::yield();
+    }
+}
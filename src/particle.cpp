@@ -12,148 +12,184 @@
 
 #include <assert.h>
 #include <iostream>
+#include <cmath>
 #include <cyclone/particle.h>
+#include <cyclone/jobs.h>
 
 using namespace cyclone;
 
 
-void Particle::integrate(real duration)
+template <typename T>
+BasicDampingCache<T>::BasicDampingCache()
+    : duration(0), used(0), next(0)
 {
-    // We don't integrate things with zero mass.
-    if (inverseMass <= 0.0f) return;
-
-    assert(duration > 0.0);
-
-    // Work out the acceleration from the force
-    Vector3 resultingAcc = acceleration;
-    resultingAcc.addScaledVector(forceAccum, inverseMass);
-
-    // Update linear velocity from the acceleration.
-    velocity.addScaledVector(resultingAcc, duration);
-
-    // Impose drag.
-    velocity *= real_pow(damping, duration);
-
-    // Update linear position.
-    position.addScaledVector(velocity, duration);
-
-    // Clear the forces.
-    clearAccumulator();
 }
 
-
-void Particle::setMass(const real mass)
+template <typename T>
+void BasicDampingCache<T>::clear()
 {
-    assert(mass != 0);
-    Particle::inverseMass = ((real)1.0)/mass;
+    used = 0;
+    next = 0;
 }
 
-real Particle::getMass() const
+template <typename T>
+T BasicDampingCache<T>::addFactor(T damping, T duration)
 {
-    if (inverseMass == 0) {
-        return REAL_MAX;
-    } else {
-        return ((real)1.0)/inverseMass;
+    // A new duration invalidates every factor.
+    if (duration != BasicDampingCache::duration)
+    {
+        clear();
+        BasicDampingCache::duration = duration;
     }
-}
 
-void Particle::setInverseMass(const real inverseMass)
-{
-    Particle::inverseMass = inverseMass;
-}
+    T result = std::pow(damping, duration);
 
-real Particle::getInverseMass() const
-{
-    return inverseMass;
+    unsigned entry;
+    if (used < CacheSize) entry = used++;
+    else
+    {
+        entry = next;
+        next = (next + 1) % CacheSize;
+    }
+    BasicDampingCache::damping[entry] = damping;
+    factor[entry] = result;
+    return result;
 }
 
-bool Particle::hasFiniteMass() const
+template <typename T>
+BasicParticle<T>::BasicParticle()
+    : inverseMass(1), damping(1), motion(sleepEpsilon*2.0f),
+    isAwake(true), canSleep(false)
 {
-    return inverseMass >= 0.0f;
 }
 
-void Particle::setDamping(const real damping)
+template <typename T>
+void BasicParticle<T>::integrate(T duration)
 {
-    Particle::damping = damping;
+    // An empty cache works each factor out afresh with std::pow.
+    BasicDampingCache<T> cache;
+    integrate(duration, cache);
 }
 
-real Particle::getDamping() const
+template <typename T>
+void BasicParticle<T>::integrate(T duration, BasicDampingCache<T> &cache)
 {
-    return damping;
-}
+    // We don't integrate things with zero mass.
+    if (inverseMass <= 0.0f) return;
 
-void Particle::setPosition(const Vector3 &position)
-{
-    Particle::position = position;
-}
+    // Or things that are asleep.
+    if (!isAwake)
+    {
+        clearAccumulator();
+        return;
+    }
 
-void Particle::setPosition(const real x, const real y, const real z)
-{
-    position.x = x;
-    position.y = y;
-    position.z = z;
-}
+    assert(duration > 0.0);
 
-void Particle::getPosition(Vector3 *position) const
-{
-    *position = Particle::position;
-}
+    // Work out the acceleration from the force
+    BasicVector3<T> resultingAcc = acceleration;
+    resultingAcc.addScaledVector(forceAccum, inverseMass);
 
-Vector3 Particle::getPosition() const
-{
-    return position;
-}
+    // Update linear velocity from the acceleration.
+    velocity.addScaledVector(resultingAcc, duration);
 
-void Particle::setVelocity(const Vector3 &velocity)
-{
-    Particle::velocity = velocity;
-}
+    // Impose drag.
+    velocity *= cache.getFactor(damping, duration);
 
-void Particle::setVelocity(const real x, const real y, const real z)
-{
-    velocity.x = x;
-    velocity.y = y;
-    velocity.z = z;
-}
+    // Update linear position.
+    position.addScaledVector(velocity, duration);
 
-void Particle::getVelocity(Vector3 *velocity) const
-{
-    *velocity = Particle::velocity;
+    // Clear the forces.
+    clearAccumulator();
+
+    // Update the kinetic energy store, and possibly put the particle
+    // to sleep. The bias is looked up like the drag factor.
+    if (canSleep) updateMotion(cache.getFactor(0.5f, duration));
 }
 
-Vector3 Particle::getVelocity() const
+template <typename T>
+void BasicParticle<T>::updateMotion(T bias)
 {
-    return velocity;
+    T currentMotion = velocity.squareMagnitude();
+    motion = bias*motion + (1-bias)*currentMotion;
+
+    if (motion < sleepEpsilon) setAwake(false);
+    else if (motion > 10 * sleepEpsilon) motion = 10 * sleepEpsilon;
 }
 
-void Particle::setAcceleration(const Vector3 &acceleration)
+template <typename T>
+void BasicParticle<T>::setAwake(const bool awake)
 {
-    Particle::acceleration = acceleration;
+    if (awake) {
+        isAwake = true;
+
+        // Add a bit of motion to avoid it falling asleep immediately.
+        motion = sleepEpsilon*2.0f;
+    } else {
+        isAwake = false;
+        velocity.clear();
+    }
 }
 
-void Particle::setAcceleration(const real x, const real y, const real z)
+template <typename T>
+void BasicParticle<T>::setCanSleep(const bool canSleep)
 {
-    acceleration.x = x;
-    acceleration.y = y;
-    acceleration.z = z;
+    BasicParticle::canSleep = canSleep;
+
+    if (!canSleep && !isAwake) setAwake();
 }
 
-void Particle::getAcceleration(Vector3 *acceleration) const
-{
-    *acceleration = Particle::acceleration;
+namespace {
+    /**
+     * Holds what the integration jobs need to know.
+     */
+    template <typename T>
+    struct IntegrateJobData
+    {
+        BasicParticle<T>* particles;
+        T duration;
+    };
+
+    template <typename T>
+    void integrateJob(void* data, unsigned begin, unsigned end)
+    {
+        IntegrateJobData<T> &job = *static_cast<IntegrateJobData<T>*>(data);
+        BasicDampingCache<T> cache;
+        for (unsigned i = begin; i < end; i++)
+        {
+            job.particles[i].integrate(job.duration, cache);
+        }
+    }
+
+    /**
+     * Integrates a block of particles of either precision, on the
+     * job system if there is one.
+     */
+    template <typename T>
+    void integrateAll(BasicParticle<T>* particles, unsigned count, T duration, JobSystem* jobs)
+    {
+        IntegrateJobData<T> data;
+        data.particles = particles;
+        data.duration = duration;
+
+        if (jobs) jobs->parallelFor(count, 0, integrateJob<T>, &data);
+        else integrateJob<T>(&data, 0, count);
+    }
 }
 
-Vector3 Particle::getAcceleration() const
+void cyclone::integrateParticles(Particlef* particles, unsigned count, float duration, JobSystem* jobs)
 {
-    return acceleration;
+    integrateAll(particles, count, duration, jobs);
 }
 
-void Particle::addForce(const Vector3 &force)
+void cyclone::integrateParticles(Particled* particles, unsigned count, double duration, JobSystem* jobs)
 {
-    forceAccum += force;
+    integrateAll(particles, count, duration, jobs);
 }
 
-void Particle::clearAccumulator()
-{
-    forceAccum.clear();
+namespace cyclone {
+    template class BasicDampingCache<float>;
+    template class BasicDampingCache<double>;
+    template class BasicParticle<float>;
+    template class BasicParticle<double>;
 }
@@ -0,0 +1,110 @@
+/*
+ * Implementation file for the particle contact cache.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <cyclone/pcache.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+
+ParticleContactCache::ParticleContactCache(real warmStartFactor)
+    : warmStartFactor(warmStartFactor), matched(0)
+{
+}
+
+bool ParticleContactCache::entryLess(const Entry &a, const Entry &b)
+{
+    std::less<const void*> less;
+    if (a.particle[0] != b.particle[0]) return less(a.particle[0], b.particle[0]);
+    if (a.particle[1] != b.particle[1]) return less(a.particle[1], b.particle[1]);
+    return less(a.source, b.source);
+}
+
+void ParticleContactCache::setWarmStartFactor(real warmStartFactor)
+{
+    ParticleContactCache::warmStartFactor = warmStartFactor;
+}
+
+void ParticleContactCache::warmStart(ParticleContact* contacts, unsigned numContacts)
+{
+    matched = 0;
+
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        ParticleContact &contact = contacts[i];
+        contact.accumulatedImpulse = 0;
+        if (entries.empty()) continue;
+
+        Entry key;
+        key.particle[0] = contact.particle[0];
+        key.particle[1] = contact.particle[1];
+        key.source = contact.source;
+
+        std::vector<Entry>::const_iterator found =
+            std::lower_bound(entries.begin(), entries.end(), key, entryLess);
+        if (found == entries.end() || entryLess(key, *found)) continue;
+        matched++;
+
+        // Only push the particles apart: a contact can't pull.
+        real impulse = found->impulse * warmStartFactor;
+        if (impulse <= 0) continue;
+        contact.accumulatedImpulse = impulse;
+
+        Vector3 impulsePerIMass = contact.contactNormal * impulse;
+        Particle* first = contact.particle[0];
+        first->setVelocity(first->getVelocity() +
+            impulsePerIMass * first->getInverseMass());
+        if (contact.particle[1])
+        {
+            Particle* second = contact.particle[1];
+            second->setVelocity(second->getVelocity() +
+                impulsePerIMass * -second->getInverseMass());
+        }
+    }
+}
+
+void ParticleContactCache::store(const ParticleContact* contacts, unsigned numContacts)
+{
+    entries.resize(numContacts);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        Entry &entry = entries[i];
+        entry.particle[0] = contacts[i].particle[0];
+        entry.particle[1] = contacts[i].particle[1];
+        entry.source = contacts[i].source;
+        entry.impulse = contacts[i].accumulatedImpulse;
+    }
+    std::sort(entries.begin(), entries.end(), entryLess);
+}
+
+void ParticleContactCache::clear()
+{
+    entries.clear();
+    matched = 0;
+}
+
+void ParticleContactCache::remapParticles(const ParticleRemap &remap)
+{
+    for (unsigned i = 0; i < entries.size(); i++)
+    {
+        entries[i].particle[0] = remap.remap(entries[i].particle[0]);
+        entries[i].particle[1] = remap.remap(entries[i].particle[1]);
+    }
+    std::sort(entries.begin(), entries.end(), entryLess);
+}
+
+unsigned ParticleContactCache::getMatchedCount() const
+{
+    return matched;
+}
+
+unsigned ParticleContactCache::size() const
+{
+    return (unsigned)entries.size();
+}
@@ -0,0 +1,606 @@
+/*
+ * Implementation file for particle-particle collision detection.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/pcollide.h>
+#include <cyclone/preorder.h>
+#include <cyclone/jobs.h>
+
+using namespace cyclone;
+
+
+ParticleSpatialHash::ParticleSpatialHash(real cellSize)
+    : cellSize(cellSize), bucketCount(0), particles(0), particleCount(0)
+{
+    assert(cellSize > 0);
+}
+
+void ParticleSpatialHash::setCellSize(real cellSize)
+{
+    assert(cellSize > 0);
+    ParticleSpatialHash::cellSize = cellSize;
+}
+
+real ParticleSpatialHash::getCellSize() const
+{
+    return cellSize;
+}
+
+void ParticleSpatialHash::getCell(const Vector3 &position, int *cell) const
+{
+    real inverseCellSize = ((real)1.0) / cellSize;
+    cell[0] = (int)floor(position.x * inverseCellSize);
+    cell[1] = (int)floor(position.y * inverseCellSize);
+    cell[2] = (int)floor(position.z * inverseCellSize);
+}
+
+unsigned ParticleSpatialHash::getBucket(int x, int y, int z) const
+{
+    // Large primes spread neighbouring cells over the table.
+    unsigned h = ((unsigned)x * 73856093u) ^
+        ((unsigned)y * 19349663u) ^
+        ((unsigned)z * 83492791u);
+    return h & (bucketCount - 1);
+}
+
+void ParticleSpatialHash::build(Particle* const* particles, unsigned count)
+{
+    ParticleSpatialHash::particles = particles;
+    particleCount = count;
+
+    // Keep at least two buckets per particle.
+    unsigned wanted = 64;
+    while (wanted < count * 2) wanted <<= 1;
+    if (wanted > bucketCount) bucketCount = wanted;
+
+    bucketStart.assign(bucketCount + 1, 0);
+    particleBucket.resize(count);
+    sortedParticles.resize(count);
+
+    // Count the particles in each bucket.
+    int cell[3];
+    for (unsigned i = 0; i < count; i++)
+    {
+        getCell(particles[i]->getPosition(), cell);
+        unsigned bucket = getBucket(cell[0], cell[1], cell[2]);
+        particleBucket[i] = bucket;
+        bucketStart[bucket + 1]++;
+    }
+
+    // Turn the counts into start positions.
+    for (unsigned b = 0; b < bucketCount; b++)
+    {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+
+    // Place each particle, using the start positions as cursors and
+    // then shifting them back.
+    for (unsigned i = 0; i < count; i++)
+    {
+        sortedParticles[bucketStart[particleBucket[i]]++] = i;
+    }
+    for (unsigned b = bucketCount; b > 0; b--)
+    {
+        bucketStart[b] = bucketStart[b - 1];
+    }
+    bucketStart[0] = 0;
+}
+
+unsigned ParticleSpatialHash::getBucketCount() const
+{
+    return bucketCount;
+}
+
+unsigned ParticleSpatialHash::getBucketBegin(unsigned bucket) const
+{
+    return bucketStart[bucket];
+}
+
+unsigned ParticleSpatialHash::getBucketEnd(unsigned bucket) const
+{
+    return bucketStart[bucket + 1];
+}
+
+unsigned ParticleSpatialHash::getSortedParticle(unsigned position) const
+{
+    return sortedParticles[position];
+}
+
+Particle* ParticleSpatialHash::getParticle(unsigned index) const
+{
+    return particles[index];
+}
+
+unsigned ParticleSpatialHash::getParticleCount() const
+{
+    return particleCount;
+}
+
+unsigned ParticleSpatialHash::query(const Vector3 &min, const Vector3 &max,
+    std::vector<unsigned> &found) const
+{
+    size_t before = found.size();
+    if (particleCount == 0) return 0;
+
+    int low[3], high[3];
+    getCell(min, low);
+    getCell(max, high);
+
+    // A box covering more cells than there are buckets is cheaper to
+    // answer by testing every particle.
+    double cells = 1;
+    for (unsigned a = 0; a < 3; a++) cells *= (double)high[a] - low[a] + 1;
+
+    if (cells >= bucketCount)
+    {
+        for (unsigned i = 0; i < particleCount; i++)
+        {
+            const Vector3 &p = particles[i]->getPosition();
+            if (p.x >= min.x && p.y >= min.y && p.z >= min.z &&
+                p.x <= max.x && p.y <= max.y && p.z <= max.z)
+            {
+                found.push_back(i);
+            }
+        }
+        return (unsigned)(found.size() - before);
+    }
+
+    // Different cells can share a bucket, so search each bucket once.
+    queryBuckets.clear();
+    for (int x = low[0]; x <= high[0]; x++)
+    for (int y = low[1]; y <= high[1]; y++)
+    for (int z = low[2]; z <= high[2]; z++)
+    {
+        queryBuckets.push_back(getBucket(x, y, z));
+    }
+    std::sort(queryBuckets.begin(), queryBuckets.end());
+    queryBuckets.erase(std::unique(queryBuckets.begin(), queryBuckets.end()), queryBuckets.end());
+
+    for (unsigned b = 0; b < queryBuckets.size(); b++)
+    {
+        unsigned bucket = queryBuckets[b];
+        for (unsigned s = bucketStart[bucket]; s < bucketStart[bucket + 1]; s++)
+        {
+            unsigned i = sortedParticles[s];
+            const Vector3 &p = particles[i]->getPosition();
+            if (p.x >= min.x && p.y >= min.y && p.z >= min.z &&
+                p.x <= max.x && p.y <= max.y && p.z <= max.z)
+            {
+                found.push_back(i);
+            }
+        }
+    }
+    return (unsigned)(found.size() - before);
+}
+
+
+ParticleCollisionGenerator::ParticleCollisionGenerator(real radius, real restitution)
+    :
+    radius(radius),
+    restitution(restitution),
+    hash(radius * 2),
+    continuous(false),
+    sweepThreshold(radius),
+    swept(0),
+    jobs(0)
+{
+}
+
+void ParticleCollisionGenerator::addParticle(Particle* particle)
+{
+    particles.push_back(particle);
+}
+
+void ParticleCollisionGenerator::addParticles(Particle* particles, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        ParticleCollisionGenerator::particles.push_back(particles + i);
+    }
+}
+
+void ParticleCollisionGenerator::removeParticle(Particle* particle)
+{
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        if (particles[i] != particle) continue;
+
+        particles[i] = particles.back();
+        particles.pop_back();
+        return;
+    }
+}
+
+void ParticleCollisionGenerator::remapParticles(const ParticleRemap &remap)
+{
+    remap.remap(particles);
+}
+
+void ParticleCollisionGenerator::clearParticles()
+{
+    particles.clear();
+}
+
+void ParticleCollisionGenerator::setRadius(real radius)
+{
+    ParticleCollisionGenerator::radius = radius;
+    hash.setCellSize(radius * 2);
+}
+
+real ParticleCollisionGenerator::getRadius() const
+{
+    return radius;
+}
+
+void ParticleCollisionGenerator::setCellSize(real cellSize)
+{
+    hash.setCellSize(cellSize);
+}
+
+void ParticleCollisionGenerator::setRestitution(real restitution)
+{
+    ParticleCollisionGenerator::restitution = restitution;
+}
+
+const ParticleSpatialHash& ParticleCollisionGenerator::getSpatialHash() const
+{
+    return hash;
+}
+
+void ParticleCollisionGenerator::setContinuous(bool continuous)
+{
+    ParticleCollisionGenerator::continuous = continuous;
+    if (!continuous) startPositions.clear();
+}
+
+bool ParticleCollisionGenerator::isContinuous() const
+{
+    return continuous;
+}
+
+void ParticleCollisionGenerator::setSweepThreshold(real sweepThreshold)
+{
+    assert(sweepThreshold > 0);
+    ParticleCollisionGenerator::sweepThreshold = sweepThreshold;
+}
+
+unsigned ParticleCollisionGenerator::getSweptCount() const
+{
+    return swept;
+}
+
+void ParticleCollisionGenerator::setJobSystem(JobSystem* jobs)
+{
+    ParticleCollisionGenerator::jobs = jobs;
+}
+
+JobSystem* ParticleCollisionGenerator::getJobSystem() const
+{
+    return jobs;
+}
+
+void ParticleCollisionGenerator::beginStep()
+{
+    if (!continuous) return;
+
+    startPositions.resize(particles.size());
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        startPositions[i] = particles[i]->getPosition();
+    }
+}
+
+namespace {
+    /**
+     * Gets the box around the path between the given points, grown
+     * by the given margin.
+     */
+    void pathBounds(const Vector3 &start, const Vector3 &end, real margin,
+        Vector3* min, Vector3* max)
+    {
+        *min = Vector3(
+            start.x < end.x ? start.x : end.x,
+            start.y < end.y ? start.y : end.y,
+            start.z < end.z ? start.z : end.z) - Vector3(margin, margin, margin);
+        *max = Vector3(
+            start.x > end.x ? start.x : end.x,
+            start.y > end.y ? start.y : end.y,
+            start.z > end.z ? start.z : end.z) + Vector3(margin, margin, margin);
+    }
+
+    bool insideBounds(const Vector3 &point, const Vector3 &min, const Vector3 &max)
+    {
+        return point.x >= min.x && point.y >= min.y && point.z >= min.z &&
+            point.x <= max.x && point.y <= max.y && point.z <= max.z;
+    }
+}
+
+unsigned ParticleCollisionGenerator::addSweptContacts(unsigned i,
+    ParticleContact* contact, unsigned limit) const
+{
+    Particle* first = particles[i];
+    const Vector3 &start = startPositions[i];
+    const Vector3 end = first->getPosition();
+
+    // Slow particles near the path may have moved by up to the
+    // threshold since the start of the step.
+    const real diameter = radius * 2;
+    const real diameterSquared = diameter * diameter;
+    const real margin = diameter + sweepThreshold;
+    Vector3 min, max;
+    pathBounds(start, end, margin, &min, &max);
+
+    sweepFound.clear();
+    hash.query(min, max, sweepFound);
+
+    unsigned used = 0;
+    for (unsigned n = 0; n < sweepFound.size() && used < limit; n++)
+    {
+        unsigned j = sweepFound[n];
+        if (j == i) continue;
+
+        Particle* second = particles[j];
+        const Vector3 &otherStart = startPositions[j];
+        const Vector3 otherEnd = second->getPosition();
+
+        // A pair of fast particles is swept from the lower index, if
+        // that one's search finds the other.
+        if (j < i && sweeping[j])
+        {
+            Vector3 otherMin, otherMax;
+            pathBounds(otherStart, otherEnd, margin, &otherMin, &otherMax);
+            if (insideBounds(end, otherMin, otherMax)) continue;
+        }
+
+        // Find the first time in the step at which the particles are
+        // one diameter apart, following the relative motion.
+        Vector3 separation = start - otherStart;
+        Vector3 motion = (end - start) - (otherEnd - otherStart);
+        real c = separation.squareMagnitude() - diameterSquared;
+        real t = 1;
+        Vector3 normal;
+        if (c > 0)
+        {
+            real b = separation * motion;
+            if (b >= 0) continue;
+            real a = motion.squareMagnitude();
+            real discriminant = b * b - a * c;
+            if (discriminant < 0) continue;
+            t = (-b - real_sqrt(discriminant)) / a;
+            if (t > 1) continue;
+
+            // The normal is the one at the moment of impact, pointing
+            // from the second particle to the first.
+            normal = separation + motion * t;
+            normal.normalise();
+        }
+        else
+        {
+            // Particles that started the step touching are treated as
+            // they would be without the sweep.
+            normal = end - otherEnd;
+            if (normal.squareMagnitude() >= diameterSquared) continue;
+            if (normal.squareMagnitude() > 0) normal.normalise();
+            else normal = Vector3::UP;
+        }
+
+        contact->particle[0] = first;
+        contact->particle[1] = second;
+        contact->contactNormal = normal;
+        contact->penetration = diameter - (separation + motion) * normal;
+        contact->restitution = restitution;
+        contact->timeOfImpact = t;
+        contact++;
+        used++;
+    }
+    return used;
+}
+
+unsigned ParticleCollisionGenerator::addParticleContacts(unsigned i, bool sweep,
+    ParticleContact* contact, unsigned limit) const
+{
+    // Particles that can't be moving (immovable or asleep) only
+    // need contacts with particles that can, and those are found
+    // from the moving particle's side.
+    Particle* first = particles[i];
+    if (!first->getAwake() || first->getInverseMass() <= 0) return 0;
+    if (sweep && sweeping[i]) return 0;
+    Vector3 position = first->getPosition();
+
+    int cell[3];
+    hash.getCell(position, cell);
+
+    // Gather the distinct buckets of the neighbouring cells. Two
+    // cells can hash to the same bucket, and we mustn't visit a
+    // bucket twice or we'd report the same pair twice.
+    unsigned buckets[27];
+    unsigned bucketsFound = 0;
+    for (int dx = -1; dx <= 1; dx++)
+    for (int dy = -1; dy <= 1; dy++)
+    for (int dz = -1; dz <= 1; dz++)
+    {
+        unsigned bucket = hash.getBucket(cell[0]+dx, cell[1]+dy, cell[2]+dz);
+        unsigned b = 0;
+        while (b < bucketsFound && buckets[b] != bucket) b++;
+        if (b == bucketsFound) buckets[bucketsFound++] = bucket;
+    }
+
+    const real diameter = radius * 2;
+    const real diameterSquared = diameter * diameter;
+    unsigned used = 0;
+
+    for (unsigned b = 0; b < bucketsFound; b++)
+    {
+        unsigned end = hash.getBucketEnd(buckets[b]);
+        for (unsigned s = hash.getBucketBegin(buckets[b]); s < end; s++)
+        {
+            // A pair of moving particles is tested from its lower
+            // index only.
+            unsigned j = hash.getSortedParticle(s);
+            if (j == i) continue;
+            if (sweep && sweeping[j]) continue;
+
+            Particle* second = particles[j];
+            bool secondStill = !second->getAwake() || second->getInverseMass() <= 0;
+            if (j < i && !secondStill) continue;
+
+            Vector3 separation = position - second->getPosition();
+            real distanceSquared = separation.squareMagnitude();
+            if (distanceSquared >= diameterSquared) continue;
+
+            // The normal points from the second particle to the
+            // first. Coincident particles are pushed apart
+            // vertically.
+            real distance = real_sqrt(distanceSquared);
+            if (distance > 0)
+            {
+                contact->contactNormal = separation * (((real)1.0) / distance);
+            }
+            else
+            {
+                contact->contactNormal = Vector3::UP;
+            }
+
+            contact->particle[0] = first;
+            contact->particle[1] = second;
+            contact->penetration = diameter - distance;
+            contact->restitution = restitution;
+
+            contact++;
+            used++;
+            if (used == limit) return used;
+        }
+    }
+    return used;
+}
+
+namespace {
+    /**
+     * Holds what the range jobs need to know.
+     */
+    struct RangeJobData
+    {
+        const ParticleCollisionGenerator* generator;
+        unsigned count;
+        unsigned grain;
+        bool sweep;
+    };
+}
+
+void ParticleCollisionGenerator::rangeJob(void* data, unsigned begin, unsigned end)
+{
+    const RangeJobData &job = *static_cast<RangeJobData*>(data);
+    const ParticleCollisionGenerator &generator = *job.generator;
+
+    for (unsigned r = begin; r < end; r++)
+    {
+        std::vector<ParticleContact> &buffer = generator.rangeContacts[r];
+        unsigned used = 0;
+
+        unsigned last = (r + 1) * job.grain;
+        if (last > job.count) last = job.count;
+        for (unsigned i = r * job.grain; i < last; i++)
+        {
+            // Grow the buffer until the particle's contacts fit.
+            unsigned added;
+            for (;;)
+            {
+                if (used == buffer.size()) buffer.resize(buffer.size() * 2);
+                unsigned room = (unsigned)buffer.size() - used;
+                added = generator.addParticleContacts(i, job.sweep, &buffer[used], room);
+                if (added < room) break;
+                buffer.resize(buffer.size() * 2);
+            }
+            used += added;
+        }
+        generator.rangeUsed[r] = used;
+    }
+}
+
+unsigned ParticleCollisionGenerator::addContact(ParticleContact* contact, unsigned limit) const
+{
+    unsigned count = (unsigned)particles.size();
+    if (count < 2 || limit == 0) return 0;
+
+    hash.build(&particles[0], count);
+
+    // Particles moving fast enough to be swept have all their
+    // contacts found by the sweep, if their start positions were
+    // recorded for the particles there are now.
+    swept = 0;
+    bool sweep = continuous && startPositions.size() == count;
+    if (sweep)
+    {
+        const real thresholdSquared = sweepThreshold * sweepThreshold;
+        sweeping.resize(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            Particle* particle = particles[i];
+            sweeping[i] = particle->getAwake() && particle->getInverseMass() > 0 &&
+                (particle->getPosition() - startPositions[i]).squareMagnitude() > thresholdSquared;
+            swept += sweeping[i];
+        }
+    }
+
+    unsigned used = 0;
+
+    if (jobs && jobs->getWorkerCount() > 1)
+    {
+        // Each range of the particles finds its contacts into its own
+        // buffer, and the buffers are copied out in order, so the
+        // contacts are the ones the serial loop below finds.
+        unsigned ranges = jobs->getWorkerCount() * 4;
+        if (ranges > count) ranges = count;
+        RangeJobData data;
+        data.generator = this;
+        data.count = count;
+        data.grain = (count + ranges - 1) / ranges;
+        data.sweep = sweep;
+        ranges = (count + data.grain - 1) / data.grain;
+
+        if (rangeContacts.size() < ranges)
+        {
+            rangeContacts.resize(ranges, std::vector<ParticleContact>(64));
+        }
+        rangeUsed.resize(ranges);
+        jobs->parallelFor(ranges, 1, &ParticleCollisionGenerator::rangeJob, &data);
+
+        for (unsigned r = 0; r < ranges && used < limit; r++)
+        {
+            unsigned copied = rangeUsed[r];
+            if (copied > limit - used) copied = limit - used;
+            std::copy(rangeContacts[r].begin(), rangeContacts[r].begin() + copied, contact);
+            contact += copied;
+            used += copied;
+        }
+        if (used == limit) return used;
+    }
+    else
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned added = addParticleContacts(i, sweep, contact, limit - used);
+            contact += added;
+            used += added;
+            if (used == limit) return used;
+        }
+    }
+
+    // Then sweep the fast particles along their paths.
+    if (!sweep) return used;
+
+    for (unsigned i = 0; i < count && used < limit; i++)
+    {
+        if (!sweeping[i]) continue;
+
+        unsigned added = addSweptContacts(i, contact, limit - used);
+        contact += added;
+        used += added;
+    }
+
+    return used;
+}
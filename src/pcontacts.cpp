@@ -5,29 +5,82 @@
  */
 
 #include <assert.h>
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <cyclone/pcontacts.h>
+#include <cyclone/preorder.h>
 
 using namespace cyclone;
 
 
-void ParticleContact::resolve(real duration)
+template <typename T>
+void BasicParticleContactGenerator<T>::remapParticles(const BasicParticleRemap<T> &)
+{
+}
+
+template <typename T>
+void BasicParticleContactGenerator<T>::beginStep()
+{
+}
+
+template <typename T>
+BasicParticleContact<T>::BasicParticleContact()
+    :
+    restitution(0),
+    penetration(0),
+    source(0),
+    accumulatedImpulse(0),
+    timeOfImpact(1)
+{
+    particle[0] = particle[1] = 0;
+}
+
+template <typename T>
+void BasicParticleContact<T>::matchAwakeState()
+{
+    // Collisions with the world never cause a particle to wake up.
+    if (!particle[1]) return;
+
+    bool moving0 = particle[0]->getAwake() && particle[0]->hasFiniteMass();
+    bool moving1 = particle[1]->getAwake() && particle[1]->hasFiniteMass();
+
+    // Wake up only the sleeping one, if it can move.
+    if (moving0 && !particle[1]->getAwake() && particle[1]->hasFiniteMass()) particle[1]->setAwake();
+    else if (moving1 && !particle[0]->getAwake() && particle[0]->hasFiniteMass()) particle[0]->setAwake();
+}
+
+template <typename T>
+bool BasicParticleContact<T>::isStill() const
+{
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if (particle[i] && particle[i]->getAwake() && particle[i]->hasFiniteMass()) return false;
+    }
+    return true;
+}
+
+template <typename T>
+void BasicParticleContact<T>::resolve(T duration)
 {
     resolveVelocity(duration);
     resolveInterpenetration(duration);
 }
 
-real ParticleContact::calculateSeparatingVelocity() const
+template <typename T>
+T BasicParticleContact<T>::calculateSeparatingVelocity() const
 {
-    Vector3 relativeVelocity = particle[0]->getVelocity();
+    BasicVector3<T> relativeVelocity = particle[0]->getVelocity();
     if (particle[1]) relativeVelocity -= particle[1]->getVelocity();
     return relativeVelocity * contactNormal;
 }
 
-void ParticleContact::resolveVelocity(real duration)
+template <typename T>
+void BasicParticleContact<T>::resolveVelocity(T duration)
 {
     // Find velocity in the direction of this contact.
-    real separatingVelocity = calculateSeparatingVelocity();
+    T separatingVelocity = calculateSeparatingVelocity();
 
     // Check if it needs to be resolved.
     if (separatingVelocity > 0)
@@ -38,12 +91,12 @@ void ParticleContact::resolveVelocity(real duration)
     }
 
     // Calculate the new separating velocity.
-    real newSepVelocity = -separatingVelocity * restitution;
+    T newSepVelocity = -separatingVelocity * restitution;
 
     // Check the velocity buildup de to acceleration only.
-    Vector3 accelCausedVelocity = particle[0]->getAcceleration();
+    BasicVector3<T> accelCausedVelocity = particle[0]->getAcceleration();
     if (particle[1]) accelCausedVelocity -= particle[1]->getAcceleration();
-    real accelCausedSepVelocity = accelCausedVelocity * contactNormal * duration;
+    T accelCausedSepVelocity = accelCausedVelocity * contactNormal * duration;
 
     // If we've got a closing velocity due to acceleration buildup,
     // remove it from the new separating velocity.
@@ -57,44 +110,55 @@ void ParticleContact::resolveVelocity(real duration)
     }
 
     // Calculate the change in velocity post-contact.
-    real deltaVelocity = newSepVelocity - separatingVelocity;
+    T deltaVelocity = newSepVelocity - separatingVelocity;
 
     // We apply the change in velocity to each object in 
     // proportion to their inverse mass (i.e. those with
     // lower inverse mass [higher actual mass] experience 
     // less change in velocity).
-    real totalInverseMass = particle[0]->getInverseMass();
+    T totalInverseMass = particle[0]->getInverseMass();
     if (particle[1]) totalInverseMass += particle[1]->getInverseMass();
 
     // If all particles have infinite mass, then impulses have no effect.
     if (totalInverseMass <= 0) return;
 
     // Calculate the impulse to apply.
-    real impulse = deltaVelocity / totalInverseMass;
+    T impulse = deltaVelocity / totalInverseMass;
+    accumulatedImpulse += impulse;
 
     // Calculate amount of impluse per unit of impulse mass
-    Vector3 impulsePerIMass = contactNormal * impulse;
+    BasicVector3<T> impulsePerIMass = contactNormal * impulse;
 
     // Apply impulses: they are applied in the direction of the contact,
-    // and are proportional to the inverse mass.
-    particle[0]->setVelocity(particle[0]->getVelocity() +
-                            impulsePerIMass * particle[0]->getInverseMass());
-    if (particle[1])
+    // and are proportional to the inverse mass. A particle of infinite
+    // mass is shared between islands resolved at once, so it must not
+    // be written to even though its change would be zero.
+    if (particle[0]->getInverseMass() > 0)
+    {
+        particle[0]->setVelocity(particle[0]->getVelocity() +
+                                impulsePerIMass * particle[0]->getInverseMass());
+    }
+    if (particle[1] && particle[1]->getInverseMass() > 0)
     {
         // Particle 1 goes in the opposite direction.
         particle[1]->setVelocity(particle[1]->getVelocity() +
-                                impulsePerIMass * -particle[0]->getInverseMass());
+                                impulsePerIMass * -particle[1]->getInverseMass());
     }
 }
 
-void ParticleContact::resolveInterpenetration(real duration)
+template <typename T>
+void BasicParticleContact<T>::resolveInterpenetration(T duration)
 {
+    // Nothing is moved unless we find otherwise.
+    particleMovement[0].clear();
+    particleMovement[1].clear();
+
     // If we don't have any penetration, skip this step.
     if (penetration <= 0) return;
 
     // The movement of each object is based on its inverse mass,
     // so we total that.
-    real totalInverseMass = particle[0]->getInverseMass();
+    T totalInverseMass = particle[0]->getInverseMass();
     if (particle[1]) totalInverseMass += particle[1]->getInverseMass();
 
     // If all particles have infinite mass, then we do nothing.
@@ -102,39 +166,182 @@ void ParticleContact::resolveInterpenetration(real duration)
 
     // Calculate the amount of penetration resolution per unit
     // of inverse mass.
-    Vector3 movePerIMass = contactNormal * (penetration / totalInverseMass);
+    BasicVector3<T> movePerIMass = contactNormal * (penetration / totalInverseMass);
 
     // Calculate the movement amounts.
     particleMovement[0] = movePerIMass * particle[0]->getInverseMass();
     if (particle[1])
     {
-        particleMovement[1] = movePerIMass * particle[1]->getInverseMass();
+        // Particle 1 moves in the opposite direction.
+        particleMovement[1] = movePerIMass * -particle[1]->getInverseMass();
+    }
+
+    // Apply the penetration resolution, again leaving particles of
+    // infinite mass untouched.
+    if (particle[0]->getInverseMass() > 0)
+    {
+        particle[0]->setPosition(particle[0]->getPosition() + particleMovement[0]);
+    }
+    if (particle[1] && particle[1]->getInverseMass() > 0)
+    {
+        particle[1]->setPosition(particle[1]->getPosition() + particleMovement[1]);
+    }
+}
+
+template <typename T>
+BasicParticleContactResolver<T>::BasicParticleContactResolver(unsigned iterations)
+    : iterations(iterations), iterationsUsed(0),
+    velocityTolerance(0), penetrationTolerance(0),
+    velocityResidual(0), penetrationResidual(0), converged(true),
+    mode(RESOLVE_LINEAR_SCAN)
+{
+}
+
+template <typename T>
+BasicParticleContactResolver<T>::BasicParticleContactResolver()
+    : iterations(0), iterationsUsed(0),
+    velocityTolerance(0), penetrationTolerance(0),
+    velocityResidual(0), penetrationResidual(0), converged(true),
+    mode(RESOLVE_LINEAR_SCAN)
+{
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::setIterations(unsigned iterations)
+{
+    BasicParticleContactResolver::iterations = iterations;
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::setMode(ResolveMode mode)
+{
+    BasicParticleContactResolver::mode = mode;
+}
+
+template <typename T>
+typename BasicParticleContactResolver<T>::ResolveMode BasicParticleContactResolver<T>::getMode() const
+{
+    return mode;
+}
+
+template <typename T>
+unsigned BasicParticleContactResolver<T>::getIterationsUsed() const
+{
+    return iterationsUsed;
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::setTolerances(T velocityTolerance, T penetrationTolerance)
+{
+    assert(velocityTolerance >= 0 && penetrationTolerance >= 0);
+    BasicParticleContactResolver::velocityTolerance = velocityTolerance;
+    BasicParticleContactResolver::penetrationTolerance = penetrationTolerance;
+}
+
+template <typename T>
+bool BasicParticleContactResolver<T>::hasConverged() const
+{
+    return converged;
+}
+
+template <typename T>
+T BasicParticleContactResolver<T>::getVelocityResidual() const
+{
+    return velocityResidual;
+}
+
+template <typename T>
+T BasicParticleContactResolver<T>::getPenetrationResidual() const
+{
+    return penetrationResidual;
+}
+
+template <typename T>
+bool BasicParticleContactResolver<T>::hasTolerances() const
+{
+    return velocityTolerance > 0 || penetrationTolerance > 0;
+}
+
+template <typename T>
+bool BasicParticleContactResolver<T>::needsResolving(T separatingVelocity, T penetration) const
+{
+    return separatingVelocity < -velocityTolerance || penetration > penetrationTolerance;
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::measureResiduals(BasicParticleContact<T>* contactArray, unsigned numContacts)
+{
+    velocityResidual = 0;
+    penetrationResidual = 0;
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        T sepVel = contactArray[i].calculateSeparatingVelocity();
+        if (-sepVel > velocityResidual) velocityResidual = -sepVel;
+        if (contactArray[i].penetration > penetrationResidual)
+        {
+            penetrationResidual = contactArray[i].penetration;
+        }
+    }
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::resolveContacts(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration)
+{
+    if (mode == RESOLVE_PRIORITY)
+    {
+        resolvePriority(contactArray, numContacts, duration);
     }
     else
     {
-        particleMovement[1].clear();
+        resolveLinear(contactArray, numContacts, duration);
     }
 
-    // Apply the penetration resolution.
-    particle[0]->setPosition(particle[0]->getPosition() + particleMovement[0]);
-    if (particle[1])
+    velocityResidual = 0;
+    penetrationResidual = 0;
+    if (hasTolerances()) measureResiduals(contactArray, numContacts);
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::updatePenetration(BasicParticleContact<T> &contact, const BasicParticleContact<T> &resolved)
+{
+    const BasicVector3<T> *move = resolved.particleMovement;
+
+    if (contact.particle[0] == resolved.particle[0])
     {
-        particle[1]->setPosition(particle[1]->getPosition() + particleMovement[1]);
+        contact.penetration -= move[0] * contact.contactNormal;
+    }
+    else if (contact.particle[0] == resolved.particle[1])
+    {
+        contact.penetration -= move[1] * contact.contactNormal;
+    }
+
+    if (contact.particle[1])
+    {
+        if (contact.particle[1] == resolved.particle[0])
+        {
+            contact.penetration += move[0] * contact.contactNormal;
+        }
+        else if (contact.particle[1] == resolved.particle[1])
+        {
+            contact.penetration += move[1] * contact.contactNormal;
+        }
     }
 }
 
-void ParticleContactResolver::resolveContacts(ParticleContact* contactArray, unsigned numContacts, real duration)
+template <typename T>
+void BasicParticleContactResolver<T>::resolveLinear(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration)
 {
     iterationsUsed = 0;
+    converged = (numContacts == 0);
     while (iterationsUsed < iterations)
     {
         // Find contact with the larges closing velocity.
-        real max = REAL_MAX;
+        T max = std::numeric_limits<T>::max();
         unsigned maxIndex = numContacts;
         for (unsigned i = 0; i < numContacts; i++)
         {
-            real sepVel = contactArray[i].calculateSeparatingVelocity();
-            if (sepVel < max && (sepVel < 0 || contactArray[i].penetration > 0))
+            T sepVel = contactArray[i].calculateSeparatingVelocity();
+            if (sepVel < max && needsResolving(sepVel, contactArray[i].penetration))
             {
                 max = sepVel;
                 maxIndex = i;
@@ -142,10 +349,224 @@ void ParticleContactResolver::resolveContacts(ParticleContact* contactArray, uns
         }
 
         // Did we find a particle worth resolving?
-        if (maxIndex == numContacts) break;
+        if (maxIndex == numContacts)
+        {
+            converged = true;
+            break;
+        }
 
         // Resolve this contact.
         contactArray[maxIndex].resolve(duration);
+
+        // Update the interpenetrations for all particles.
+        BasicParticleContact<T> resolved = contactArray[maxIndex];
+        for (unsigned i = 0; i < numContacts; i++)
+        {
+            updatePenetration(contactArray[i], resolved);
+        }
+
         iterationsUsed++;
     }
 }
+
+template <typename T>
+bool BasicParticleContactResolver<T>::heapLess(unsigned a, unsigned b) const
+{
+    // Ties go to the lower index, as they do in the linear scan.
+    if (heapKey[a] != heapKey[b]) return heapKey[a] < heapKey[b];
+    return a < b;
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::heapSwap(unsigned a, unsigned b)
+{
+    unsigned contact = heap[a];
+    heap[a] = heap[b];
+    heap[b] = contact;
+    heapPosition[heap[a]] = a;
+    heapPosition[heap[b]] = b;
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::siftUp(unsigned position)
+{
+    while (position > 0)
+    {
+        unsigned parent = (position - 1) / 2;
+        if (!heapLess(heap[position], heap[parent])) break;
+        heapSwap(position, parent);
+        position = parent;
+    }
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::siftDown(unsigned position)
+{
+    unsigned size = (unsigned)heap.size();
+    for (;;)
+    {
+        unsigned smallest = position;
+        unsigned left = position * 2 + 1;
+        unsigned right = left + 1;
+        if (left < size && heapLess(heap[left], heap[smallest])) smallest = left;
+        if (right < size && heapLess(heap[right], heap[smallest])) smallest = right;
+        if (smallest == position) break;
+        heapSwap(position, smallest);
+        position = smallest;
+    }
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::heapRemove(unsigned position)
+{
+    unsigned last = (unsigned)heap.size() - 1;
+    heapPosition[heap[position]] = ~0u;
+    if (position != last)
+    {
+        heap[position] = heap[last];
+        heapPosition[heap[position]] = position;
+    }
+    heap.pop_back();
+
+    // The moved contact may need to go either way.
+    if (position < heap.size())
+    {
+        unsigned moved = heap[position];
+        siftUp(position);
+        siftDown(heapPosition[moved]);
+    }
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::updateHeap(BasicParticleContact<T>* contactArray, unsigned index)
+{
+    T sepVel = contactArray[index].calculateSeparatingVelocity();
+    bool outside = needsResolving(sepVel, contactArray[index].penetration);
+    unsigned position = heapPosition[index];
+
+    if (position == ~0u)
+    {
+        if (!outside) return;
+        heapKey[index] = sepVel;
+        heapPosition[index] = (unsigned)heap.size();
+        heap.push_back(index);
+        siftUp(heapPosition[index]);
+    }
+    else if (!outside)
+    {
+        heapRemove(position);
+    }
+    else
+    {
+        heapKey[index] = sepVel;
+        siftUp(position);
+        siftDown(heapPosition[index]);
+    }
+}
+
+namespace {
+    /**
+     * Orders particle-contact entries by particle.
+     */
+    template <typename T>
+    struct EntryOrder
+    {
+        template <class Entry>
+        bool operator()(const Entry &a, const Entry &b) const
+        {
+            std::less<BasicParticle<T>*> less;
+            if (a.particle != b.particle) return less(a.particle, b.particle);
+            return a.contact < b.contact;
+        }
+    };
+}
+
+template <typename T>
+void BasicParticleContactResolver<T>::resolvePriority(BasicParticleContact<T>* contactArray, unsigned numContacts, T duration)
+{
+    iterationsUsed = 0;
+    converged = true;
+    if (numContacts == 0) return;
+
+    // List the contacts each particle takes part in. The scratch
+    // arrays keep their storage between calls.
+    particleContacts.clear();
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        for (unsigned j = 0; j < 2; j++)
+        {
+            if (!contactArray[i].particle[j]) continue;
+            ParticleContactEntry entry;
+            entry.particle = contactArray[i].particle[j];
+            entry.contact = i;
+            particleContacts.push_back(entry);
+        }
+    }
+    std::sort(particleContacts.begin(), particleContacts.end(), EntryOrder<T>());
+
+    // Record where each contact's particles start in the list.
+    contactEntry.assign(numContacts * 2, ~0u);
+    unsigned entries = (unsigned)particleContacts.size();
+    unsigned groupStart = 0;
+    for (unsigned e = 0; e < entries; e++)
+    {
+        if (e > 0 && particleContacts[e].particle != particleContacts[e-1].particle)
+        {
+            groupStart = e;
+        }
+        const BasicParticleContact<T> &contact = contactArray[particleContacts[e].contact];
+        unsigned slot = (contact.particle[0] == particleContacts[e].particle) ? 0 : 1;
+        contactEntry[particleContacts[e].contact * 2 + slot] = groupStart;
+    }
+
+    // Build the heap of contacts that need resolving.
+    heap.clear();
+    heapPosition.assign(numContacts, ~0u);
+    heapKey.resize(numContacts);
+    updateStamp.assign(numContacts, ~0u);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        updateHeap(contactArray, i);
+    }
+
+    while (iterationsUsed < iterations && !heap.empty())
+    {
+        // The top of the heap has the largest closing velocity.
+        unsigned index = heap[0];
+        contactArray[index].resolve(duration);
+        BasicParticleContact<T> resolved = contactArray[index];
+
+        // Only contacts sharing a particle with the one we resolved
+        // can have changed.
+        for (unsigned j = 0; j < 2; j++)
+        {
+            BasicParticle<T>* particle = resolved.particle[j];
+            if (!particle) continue;
+
+            for (unsigned e = contactEntry[index * 2 + j];
+                 e < entries && particleContacts[e].particle == particle; e++)
+            {
+                unsigned other = particleContacts[e].contact;
+                if (updateStamp[other] == iterationsUsed) continue;
+                updateStamp[other] = iterationsUsed;
+
+                updatePenetration(contactArray[other], resolved);
+                updateHeap(contactArray, other);
+            }
+        }
+
+        iterationsUsed++;
+    }
+
+    // The heap holds every contact outside the tolerances.
+    converged = heap.empty();
+}
+
+namespace cyclone {
+    template class BasicParticleContactGenerator<float>;
+    template class BasicParticleContactGenerator<double>;
+    template class BasicParticleContact<float>;
+    template class BasicParticleContact<double>;
+    template class BasicParticleContactResolver<float>;
+    template class BasicParticleContactResolver<double>;
+}
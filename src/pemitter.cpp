@@ -0,0 +1,264 @@
+/*
+ * Implementation file for the particle emitter.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <cyclone/pemitter.h>
+
+using namespace cyclone;
+
+
+ParticleEmitterRule::ParticleEmitterRule()
+    : minAge(1), maxAge(1), damping(1), acceleration(Vector3::GRAVITY)
+{
+}
+
+void ParticleEmitterRule::setParameters(real minAge, real maxAge,
+    const Vector3 &minVelocity, const Vector3 &maxVelocity, real damping)
+{
+    ParticleEmitterRule::minAge = minAge;
+    ParticleEmitterRule::maxAge = maxAge;
+    ParticleEmitterRule::minVelocity = minVelocity;
+    ParticleEmitterRule::maxVelocity = maxVelocity;
+    ParticleEmitterRule::damping = damping;
+}
+
+void ParticleEmitterRule::addPayload(unsigned type, unsigned count)
+{
+    Payload payload;
+    payload.type = type;
+    payload.count = count;
+    payloads.push_back(payload);
+}
+
+ParticleEmitter::ParticleEmitter(unsigned capacity, unsigned seed)
+    :
+    store(capacity),
+    age(capacity, 0),
+    type(capacity, 0),
+    random(seed),
+    killHeight(-REAL_MAX),
+    liveCount(0),
+    spawned(0),
+    died(0),
+    dropped(0)
+{
+    for (unsigned i = 0; i < capacity; i++)
+    {
+        store.add().setInverseMass(0);
+    }
+
+    // A spawn pass never fills more slots than there are, so the
+    // random numbers never need more room than this.
+    randoms.reserve(capacity * 4);
+}
+
+unsigned ParticleEmitter::addRule(const ParticleEmitterRule &rule)
+{
+    rules.push_back(rule);
+    return (unsigned)rules.size() - 1;
+}
+
+ParticleEmitterRule& ParticleEmitter::getRule(unsigned type)
+{
+    return rules[type];
+}
+
+unsigned ParticleEmitter::getRuleCount() const
+{
+    return (unsigned)rules.size();
+}
+
+void ParticleEmitter::setKillHeight(real killHeight)
+{
+    ParticleEmitter::killHeight = killHeight;
+}
+
+void ParticleEmitter::emit(unsigned type, unsigned count, const Vector3 &position,
+    const Vector3 &velocity)
+{
+    assert(type < rules.size());
+    if (count == 0) return;
+
+    SpawnRequest request;
+    request.type = type;
+    request.count = count;
+    request.position = position;
+    request.velocity = velocity;
+    requests.push_back(request);
+}
+
+void ParticleEmitter::expire(real duration)
+{
+    Vector3* position = store.getPositions();
+    Vector3* velocity = store.getVelocities();
+    Vector3* acceleration = store.getAccelerations();
+    Vector3* forceAccum = store.getForceAccumulators();
+    real* inverseMass = store.getInverseMasses();
+    real* damping = store.getDampings();
+
+    unsigned i = 0;
+    while (i < liveCount)
+    {
+        age[i] -= duration;
+        if (age[i] >= 0 && position[i].y >= killHeight)
+        {
+            i++;
+            continue;
+        }
+
+        // The particle dies where it is. Its payload starts from its
+        // position and velocity.
+        const ParticleEmitterRule &rule = rules[type[i]];
+        for (unsigned p = 0; p < rule.payloads.size(); p++)
+        {
+            emit(rule.payloads[p].type, rule.payloads[p].count, position[i], velocity[i]);
+        }
+
+        // The last live particle takes its slot, so the live ones
+        // stay at the front. It hasn't been aged yet, so the slot is
+        // looked at again.
+        unsigned last = --liveCount;
+        position[i] = position[last];
+        velocity[i] = velocity[last];
+        acceleration[i] = acceleration[last];
+        forceAccum[i] = forceAccum[last];
+        inverseMass[i] = inverseMass[last];
+        damping[i] = damping[last];
+        age[i] = age[last];
+        type[i] = type[last];
+
+        inverseMass[last] = 0;
+        died++;
+    }
+}
+
+void ParticleEmitter::spawn()
+{
+    unsigned wanted = 0;
+    for (unsigned r = 0; r < requests.size(); r++) wanted += requests[r].count;
+
+    unsigned space = getCapacity() - liveCount;
+    unsigned count = wanted < space ? wanted : space;
+    dropped += wanted - count;
+    if (count == 0)
+    {
+        requests.clear();
+        return;
+    }
+
+    // Draw the lifetime and launch velocity of every new particle in
+    // one go.
+    randoms.resize(count * 4);
+    random.fillReal(&randoms[0], count * 4);
+
+    Vector3* position = store.getPositions();
+    Vector3* velocity = store.getVelocities();
+    Vector3* acceleration = store.getAccelerations();
+    Vector3* forceAccum = store.getForceAccumulators();
+    real* inverseMass = store.getInverseMasses();
+    real* damping = store.getDampings();
+
+    const real* r = &randoms[0];
+    unsigned i = liveCount;
+    unsigned made = 0;
+    for (unsigned q = 0; q < requests.size() && made < count; q++)
+    {
+        const SpawnRequest &request = requests[q];
+        const ParticleEmitterRule &rule = rules[request.type];
+        Vector3 range = rule.maxVelocity - rule.minVelocity;
+
+        for (unsigned k = 0; k < request.count && made < count; k++, made++, r += 4, i++)
+        {
+            position[i] = request.position;
+            velocity[i] = request.velocity + Vector3(
+                rule.minVelocity.x + r[1] * range.x,
+                rule.minVelocity.y + r[2] * range.y,
+                rule.minVelocity.z + r[3] * range.z);
+            acceleration[i] = rule.acceleration;
+            forceAccum[i].clear();
+            inverseMass[i] = 1;
+            damping[i] = rule.damping;
+
+            age[i] = rule.minAge + r[0] * (rule.maxAge - rule.minAge);
+            type[i] = request.type;
+        }
+    }
+
+    liveCount += count;
+    spawned += count;
+    requests.clear();
+}
+
+void ParticleEmitter::update(real duration)
+{
+    spawned = died = dropped = 0;
+
+    if (duration > 0)
+    {
+        store.integrateRange(0, liveCount, duration);
+        expire(duration);
+    }
+    spawn();
+}
+
+void ParticleEmitter::clear()
+{
+    real* inverseMass = store.getInverseMasses();
+    for (unsigned i = 0; i < liveCount; i++) inverseMass[i] = 0;
+
+    requests.clear();
+    liveCount = 0;
+}
+
+ParticleStore& ParticleEmitter::getStore()
+{
+    return store;
+}
+
+const ParticleStore& ParticleEmitter::getStore() const
+{
+    return store;
+}
+
+bool ParticleEmitter::isAlive(unsigned index) const
+{
+    return index < liveCount;
+}
+
+unsigned ParticleEmitter::getType(unsigned index) const
+{
+    return type[index];
+}
+
+real ParticleEmitter::getAge(unsigned index) const
+{
+    return age[index];
+}
+
+unsigned ParticleEmitter::getCapacity() const
+{
+    return store.size();
+}
+
+unsigned ParticleEmitter::getLiveCount() const
+{
+    return liveCount;
+}
+
+unsigned ParticleEmitter::getSpawnedCount() const
+{
+    return spawned;
+}
+
+unsigned ParticleEmitter::getDiedCount() const
+{
+    return died;
+}
+
+unsigned ParticleEmitter::getDroppedCount() const
+{
+    return dropped;
+}
@@ -5,56 +5,523 @@
  */
 
 #include <assert.h>
-#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <cyclone/pfgen.h>
+#include <cyclone/jobs.h>
+#include <cyclone/preorder.h>
 
 using namespace cyclone;
 
-void ParticleForceRegistry::add(Particle* particle, ParticleForceGenerator* fg)
+template <typename T>
+void BasicParticleForceGenerator<T>::updateForces(BasicParticle<T>* const* particles, size_t count, T duration)
 {
-    ParticleForceRegistry::ParticleForceRegistration newRegistration;
+    for (size_t i = 0; i < count; i++)
+    {
+        updateForce(particles[i], duration);
+    }
+}
+
+template <typename T>
+void BasicParticleForceGenerator<T>::prepareForces(T)
+{
+}
+
+template <typename T>
+void BasicParticleForceGenerator<T>::remapParticles(const BasicParticleRemap<T> &)
+{
+}
+
+template <typename T>
+BasicParticleForceRegistry<T>::BasicParticleForceRegistry() :
+    batchCount(0),
+    batched(false),
+    batchesDirty(true),
+    particleGroupsDirty(true)
+{
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::setBatched(bool batched)
+{
+    BasicParticleForceRegistry::batched = batched;
+    batchesDirty = true;
+}
+
+template <typename T>
+bool BasicParticleForceRegistry<T>::isBatched() const
+{
+    return batched;
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::reserve(unsigned capacity)
+{
+    registrations.reserve(capacity);
+    slots.reserve(capacity);
+    freeSlots.reserve(capacity);
+    batchOrder.reserve(capacity);
+    particleOrder.reserve(capacity);
+    particleStarts.reserve(capacity + 1);
+    awakeParticles.reserve(capacity);
+    remapGenerators.reserve(capacity);
+}
+
+template <typename T>
+typename BasicParticleForceRegistry<T>::Handle BasicParticleForceRegistry<T>::add(BasicParticle<T>* particle, BasicParticleForceGenerator<T>* fg)
+{
+    // Find a slot for the handle, reusing a released one if we can.
+    unsigned slot;
+    if (freeSlots.empty())
+    {
+        slot = (unsigned)slots.size();
+        Slot newSlot;
+        newSlot.generation = 0;
+        slots.push_back(newSlot);
+    }
+    else
+    {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    slots[slot].index = (unsigned)registrations.size();
+
+    BasicParticleForceRegistry::ParticleForceRegistration newRegistration;
     newRegistration.particle = particle;
     newRegistration.fg = fg;
+    newRegistration.slot = slot;
 
     registrations.push_back(newRegistration);
+    batchesDirty = true;
+    particleGroupsDirty = true;
+
+    Handle handle;
+    handle.slot = slot;
+    handle.generation = slots[slot].generation;
+    return handle;
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::removeAt(unsigned index)
+{
+    // Release the slot, invalidating any handles to it.
+    unsigned slot = registrations[index].slot;
+    slots[slot].generation++;
+    freeSlots.push_back(slot);
+
+    // Fill the gap with the last registration.
+    unsigned last = (unsigned)registrations.size() - 1;
+    if (index != last)
+    {
+        registrations[index] = registrations[last];
+        slots[registrations[index].slot].index = index;
+    }
+    registrations.pop_back();
+    batchesDirty = true;
+    particleGroupsDirty = true;
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::remove(Handle handle)
+{
+    if (!isRegistered(handle)) return;
+    removeAt(slots[handle.slot].index);
 }
 
-void ParticleForceRegistry::remove(Particle* particle, ParticleForceGenerator* fg)
+template <typename T>
+void BasicParticleForceRegistry<T>::remove(BasicParticle<T>* particle, BasicParticleForceGenerator<T>* fg)
 {
-    Registry::iterator i = registrations.begin();
-    while (i != registrations.end())
+    for (unsigned i = 0; i < registrations.size(); i++)
     {
-        if ((i->particle == particle) && (i->fg == fg))
+        if ((registrations[i].particle == particle) && (registrations[i].fg == fg))
         {
-            registrations.erase(i);
+            removeAt(i);
             break;
         }
+    }
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::removeAllFor(BasicParticle<T>* particle)
+{
+    unsigned i = 0;
+    while (i < registrations.size())
+    {
+        // A removal moves a new registration into this position,
+        // so only advance when we keep the current one.
+        if (registrations[i].particle == particle) removeAt(i);
+        else i++;
+    }
+}
+
+template <typename T>
+bool BasicParticleForceRegistry<T>::isRegistered(Handle handle) const
+{
+    return handle.slot < slots.size() &&
+        slots[handle.slot].generation == handle.generation &&
+        slots[handle.slot].index < registrations.size() &&
+        registrations[slots[handle.slot].index].slot == handle.slot;
+}
 
-        i++;
+template <typename T>
+unsigned BasicParticleForceRegistry<T>::size() const
+{
+    return (unsigned)registrations.size();
+}
+
+template <typename T>
+bool BasicParticleForceRegistry<T>::registrationLess(const ParticleForceRegistration &a,
+    const ParticleForceRegistration &b)
+{
+    return std::less<const BasicParticle<T>*>()(a.particle, b.particle);
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::remapParticles(const BasicParticleRemap<T> &remap)
+{
+    for (unsigned i = 0; i < registrations.size(); i++)
+    {
+        registrations[i].particle = remap.remap(registrations[i].particle);
+    }
+
+    // Walking the registry then walks the particles in order. The
+    // sort is stable, so each particle's generators keep their order.
+    std::stable_sort(registrations.begin(), registrations.end(), registrationLess);
+    for (unsigned i = 0; i < registrations.size(); i++)
+    {
+        slots[registrations[i].slot].index = i;
+    }
+    batchesDirty = true;
+    particleGroupsDirty = true;
+
+    // Generators registered many times must only move their own
+    // particles once. The list keeps its storage between calls.
+    remapGenerators.clear();
+    for (unsigned i = 0; i < registrations.size(); i++)
+    {
+        remapGenerators.push_back(registrations[i].fg);
+    }
+    std::sort(remapGenerators.begin(), remapGenerators.end());
+    remapGenerators.erase(std::unique(remapGenerators.begin(), remapGenerators.end()),
+        remapGenerators.end());
+    for (unsigned i = 0; i < remapGenerators.size(); i++)
+    {
+        remapGenerators[i]->remapParticles(remap);
     }
 }
 
-void ParticleForceRegistry::clear()
+template <typename T>
+void BasicParticleForceRegistry<T>::clear()
 {
+    // Release every slot so outstanding handles become invalid.
+    for (unsigned i = 0; i < registrations.size(); i++)
+    {
+        unsigned slot = registrations[i].slot;
+        slots[slot].generation++;
+        freeSlots.push_back(slot);
+    }
+
     registrations.clear();
+    batchesDirty = true;
+    particleGroupsDirty = true;
+}
+
+/**
+ * Orders registration indices by generator, keeping the original
+ * order for registrations that share a generator.
+ */
+template <typename T>
+struct BasicParticleForceRegistry<T>::GeneratorOrder
+{
+    const Registry* registrations;
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        std::less<BasicParticleForceGenerator<T>*> less;
+        return less((*registrations)[a].fg, (*registrations)[b].fg);
+    }
+};
+
+namespace {
+    /**
+     * Orders the starts of generator groups by the position of each
+     * group's first registration.
+     */
+    struct FirstRegistrationOrder
+    {
+        const std::vector<unsigned>* order;
+
+        bool operator()(unsigned a, unsigned b) const
+        {
+            return (*order)[a] < (*order)[b];
+        }
+    };
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::buildBatches()
+{
+    // Empty the batches, keeping their storage.
+    for (unsigned b = 0; b < batchCount; b++)
+    {
+        batches[b].particles.clear();
+    }
+    batchCount = 0;
+
+    // Group the registrations by generator. A stable sort keeps each
+    // generator's particles in registration order.
+    unsigned count = (unsigned)registrations.size();
+    batchOrder.resize(count);
+    for (unsigned i = 0; i < count; i++) batchOrder[i] = i;
+
+    GeneratorOrder byGenerator;
+    byGenerator.registrations = &registrations;
+    std::stable_sort(batchOrder.begin(), batchOrder.end(), byGenerator);
+
+    // Find where each group starts, then order the groups by the
+    // first time their generator was registered.
+    batchStarts.clear();
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (i == 0 || registrations[batchOrder[i]].fg != registrations[batchOrder[i-1]].fg)
+        {
+            batchStarts.push_back(i);
+        }
+    }
+
+    FirstRegistrationOrder byFirst;
+    byFirst.order = &batchOrder;
+    std::sort(batchStarts.begin(), batchStarts.end(), byFirst);
+
+    // Fill one batch per group.
+    for (unsigned g = 0; g < batchStarts.size(); g++)
+    {
+        if (batchCount == batches.size()) batches.push_back(ParticleForceBatch());
+        ParticleForceBatch &batch = batches[batchCount++];
+
+        unsigned i = batchStarts[g];
+        batch.fg = registrations[batchOrder[i]].fg;
+        for (; i < count && registrations[batchOrder[i]].fg == batch.fg; i++)
+        {
+            batch.particles.push_back(registrations[batchOrder[i]].particle);
+        }
+
+        // A particle registered twice with the same generator would
+        // be written by two workers at once if the batch were split.
+        batchSorted.assign(batch.particles.begin(), batch.particles.end());
+        std::sort(batchSorted.begin(), batchSorted.end(), std::less<BasicParticle<T>*>());
+        batch.repeats = std::adjacent_find(batchSorted.begin(), batchSorted.end()) != batchSorted.end();
+    }
+
+    batchesDirty = false;
+}
+
+/**
+ * Orders registration indices by particle, keeping the original
+ * order for registrations that share a particle.
+ */
+template <typename T>
+struct BasicParticleForceRegistry<T>::ParticleOrder
+{
+    const Registry* registrations;
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        std::less<BasicParticle<T>*> less;
+        return less((*registrations)[a].particle, (*registrations)[b].particle);
+    }
+};
+
+template <typename T>
+struct BasicParticleForceRegistry<T>::ForceJobData
+{
+    const Registry* registrations;
+    const std::vector<unsigned>* order;
+    const std::vector<unsigned>* starts;
+    T duration;
+};
+
+namespace {
+    /**
+     * Holds what the batch update jobs need to know.
+     */
+    template <typename T>
+    struct BatchJobData
+    {
+        BasicParticleForceGenerator<T>* fg;
+        BasicParticle<T>* const* particles;
+        T duration;
+    };
+
+    /**
+     * Gives a range of a batch's particles to its generator.
+     */
+    template <typename T>
+    void updateBatchJob(void* data, unsigned begin, unsigned end)
+    {
+        const BatchJobData<T> &job = *static_cast<BatchJobData<T>*>(data);
+        job.fg->updateForces(job.particles + begin, end - begin, job.duration);
+    }
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::buildParticleGroups()
+{
+    unsigned count = (unsigned)registrations.size();
+    particleOrder.resize(count);
+    for (unsigned i = 0; i < count; i++) particleOrder[i] = i;
+
+    ParticleOrder byParticle;
+    byParticle.registrations = &registrations;
+    std::stable_sort(particleOrder.begin(), particleOrder.end(), byParticle);
+
+    particleStarts.clear();
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (i == 0 || registrations[particleOrder[i]].particle != registrations[particleOrder[i-1]].particle)
+        {
+            particleStarts.push_back(i);
+        }
+    }
+    particleStarts.push_back(count);
+
+    particleGroupsDirty = false;
 }
 
-void ParticleForceRegistry::updateForces(real duration)
+template <typename T>
+void BasicParticleForceRegistry<T>::updateForcesJob(void* data, unsigned begin, unsigned end)
 {
-    Registry::iterator i = registrations.begin();
+    const ForceJobData &job = *static_cast<ForceJobData*>(data);
+    const Registry &registrations = *job.registrations;
+    const std::vector<unsigned> &order = *job.order;
+    const std::vector<unsigned> &starts = *job.starts;
+
+    for (unsigned g = begin; g < end; g++)
+    {
+        if (!registrations[order[starts[g]]].particle->getAwake()) continue;
+
+        for (unsigned i = starts[g]; i < starts[g+1]; i++)
+        {
+            const ParticleForceRegistration &reg = registrations[order[i]];
+            reg.fg->updateForce(reg.particle, job.duration);
+        }
+    }
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::updateForces(T duration, JobSystem &jobs)
+{
+    if (jobs.getWorkerCount() == 1)
+    {
+        updateForces(duration);
+        return;
+    }
+
+    if (!batched)
+    {
+        updateForcesInOrder(duration, &jobs);
+        return;
+    }
+
+    prepareGenerators(duration);
+
+    for (unsigned b = 0; b < batchCount; b++)
+    {
+        ParticleForceBatch &batch = batches[b];
+
+        // Pass on only the particles that are awake.
+        awakeParticles.clear();
+        for (unsigned i = 0; i < batch.particles.size(); i++)
+        {
+            if (batch.particles[i]->getAwake()) awakeParticles.push_back(batch.particles[i]);
+        }
+        if (awakeParticles.empty()) continue;
+
+        if (batch.repeats)
+        {
+            batch.fg->updateForces(&awakeParticles[0], awakeParticles.size(), duration);
+            continue;
+        }
+
+        BatchJobData<T> data;
+        data.fg = batch.fg;
+        data.particles = &awakeParticles[0];
+        data.duration = duration;
+        jobs.parallelFor((unsigned)awakeParticles.size(), 0, updateBatchJob<T>, &data);
+    }
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::prepareGenerators(T duration)
+{
+    // The batches list each generator once, whatever the mode.
+    if (batchesDirty) buildBatches();
+    for (unsigned b = 0; b < batchCount; b++)
+    {
+        batches[b].fg->prepareForces(duration);
+    }
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::updateForcesInOrder(T duration, JobSystem* jobs)
+{
+    prepareGenerators(duration);
+    if (particleGroupsDirty) buildParticleGroups();
+
+    ForceJobData data;
+    data.registrations = &registrations;
+    data.order = &particleOrder;
+    data.starts = &particleStarts;
+    data.duration = duration;
+
+    unsigned groups = (unsigned)particleStarts.size() - 1;
+    if (jobs) jobs->parallelFor(groups, 0, &BasicParticleForceRegistry::updateForcesJob, &data);
+    else updateForcesJob(&data, 0, groups);
+}
+
+template <typename T>
+void BasicParticleForceRegistry<T>::updateForces(T duration)
+{
+    prepareGenerators(duration);
+
+    if (batched)
+    {
+        for (unsigned b = 0; b < batchCount; b++)
+        {
+            ParticleForceBatch &batch = batches[b];
+
+            // Pass on only the particles that are awake.
+            awakeParticles.clear();
+            for (unsigned i = 0; i < batch.particles.size(); i++)
+            {
+                if (batch.particles[i]->getAwake()) awakeParticles.push_back(batch.particles[i]);
+            }
+            if (awakeParticles.empty()) continue;
+
+            batch.fg->updateForces(&awakeParticles[0], awakeParticles.size(), duration);
+        }
+        return;
+    }
+
+    typename Registry::iterator i = registrations.begin();
     for (; i != registrations.end(); i++)
     {
+        if (!i->particle->getAwake()) continue;
         i->fg->updateForce(i->particle, duration);
     }
 }
 
-ParticleGravity::ParticleGravity(const Vector3& gravity) : gravity(gravity)
+template <typename T>
+BasicParticleGravity<T>::BasicParticleGravity(const BasicVector3<T>& gravity) : gravity(gravity)
 {
 }
 
-ParticleGravity::ParticleGravity(){}
+template <typename T>
+BasicParticleGravity<T>::BasicParticleGravity(){}
 
-void ParticleGravity::updateForce(Particle* particle, real duration)
+template <typename T>
+void BasicParticleGravity<T>::updateForce(BasicParticle<T>* particle, T duration)
 {
     // Ensure particle does not have infiinite mass.
     if (!particle->hasFiniteMass()) return;
@@ -63,28 +530,58 @@ void ParticleGravity::updateForce(Particle* particle, real duration)
     particle->addForce(gravity * particle->getMass());
 }
 
-ParticlePointGravity::ParticlePointGravity(){}
+template <typename T>
+void BasicParticleGravity<T>::updateForces(BasicParticle<T>* const* particles, size_t count, T duration)
+{
+    // Copy the gravity vector so the compiler can keep it in
+    // registers for the whole loop.
+    const BasicVector3<T> g = gravity;
 
-ParticlePointGravity::ParticlePointGravity(const real& gravityScalar, const Vector3& gravityPoint)
+    for (size_t i = 0; i < count; i++)
+    {
+        BasicParticle<T>* particle = particles[i];
+        if (!particle->hasFiniteMass()) continue;
+        particle->addForce(g * particle->getMass());
+    }
+}
+
+template <typename T>
+BasicParticlePointGravity<T>::BasicParticlePointGravity(){}
+
+template <typename T>
+BasicParticlePointGravity<T>::BasicParticlePointGravity(const T& gravityScalar, const BasicVector3<T>& gravityPoint)
+{
+    BasicParticlePointGravity::gravityScalar = gravityScalar;
+    BasicParticlePointGravity::gravityPoint = gravityPoint;
+}
+
+template <typename T>
+T BasicParticlePointGravity<T>::getGravityScalar() const
 {
-    ParticlePointGravity::gravityScalar = gravityScalar;
-    ParticlePointGravity::gravityPoint = gravityPoint;
+    return gravityScalar;
 }
 
-void ParticlePointGravity::updateForce(Particle* particle, real duration)
+template <typename T>
+BasicVector3<T> BasicParticlePointGravity<T>::getGravityPoint() const
+{
+    return gravityPoint;
+}
+
+template <typename T>
+void BasicParticlePointGravity<T>::updateForce(BasicParticle<T>* particle, T duration)
 {
     // Ensure particle does not have infiinite mass.
     if (!particle->hasFiniteMass()) return;
 
     // Get position vector from particle to gravity point
-    Vector3 particleToPoint = gravityPoint - particle->getPosition();
+    BasicVector3<T> particleToPoint = gravityPoint - particle->getPosition();
 
     // Get distance from particle to grav point
-    real particleToPointDist = particleToPoint.magnitude();
+    T particleToPointDist = particleToPoint.magnitude();
 
     if (particleToPointDist < 0.5)
     {
-        particle->setVelocity(cyclone::Vector3(0,0,0));
+        particle->setVelocity(cyclone::BasicVector3<T>(0,0,0));
         return;
     }
 
@@ -92,14 +589,15 @@ void ParticlePointGravity::updateForce(Particle* particle, real duration)
     particleToPoint.normalise();
 
     // Get force vector of gravity on particle, scaled by particle's distance from gravity point
-    Vector3 scaledPointGravity = (particleToPoint * (gravityScalar * particle->getMass())) * ((real)1.0 / real_pow(particleToPointDist, 1.5));
+    BasicVector3<T> scaledPointGravity = (particleToPoint * (gravityScalar * particle->getMass())) * ((T)1.0 / std::pow(particleToPointDist, 1.5));
     // Vector3 scaledPointGravity = (particleToPoint * (gravityScalar * particle->getMass())) * ((real)1.0 / particleToPointDist);
 
     // Apply distance- and mass-scaled gravity to particle toward gravity point
     particle->addForce(scaledPointGravity);
 }
 
-ParticleUplift::ParticleUplift(const Vector3& upliftForce, const Vector3& upliftPoint, const real& upliftRadius, const real& maxUpliftHeight, const ParticleGravity& gravity) : 
+template <typename T>
+BasicParticleUplift<T>::BasicParticleUplift(const BasicVector3<T>& upliftForce, const BasicVector3<T>& upliftPoint, const T& upliftRadius, const T& maxUpliftHeight, const BasicParticleGravity<T>& gravity) : 
     upliftForce(upliftForce), 
     upliftPoint(upliftPoint),
     upliftRadius(upliftRadius),
@@ -108,28 +606,65 @@ ParticleUplift::ParticleUplift(const Vector3& upliftForce, const Vector3& uplift
 {
 }
 
-ParticleUplift::ParticleUplift(){}
+template <typename T>
+BasicParticleUplift<T>::BasicParticleUplift(){}
 
-Vector3 ParticleGravity::getGravity() const
+template <typename T>
+BasicVector3<T> BasicParticleGravity<T>::getGravity() const
 {
     return gravity;
 }
 
-void ParticleUplift::updateForce(Particle* particle, real duration)
+template <typename T>
+BasicParticleDrag<T>::BasicParticleDrag(T k1, T k2) : k1(k1), k2(k2)
+{
+}
+
+template <typename T>
+BasicParticleDrag<T>::BasicParticleDrag() : k1(0), k2(0) {}
+
+template <typename T>
+void BasicParticleDrag<T>::updateForce(BasicParticle<T>* particle, T duration)
+{
+    BasicVector3<T> force;
+    if (accumulateForce(particle->getPosition(), particle->getVelocity(),
+        particle->getInverseMass(), &force))
+    {
+        particle->addForce(force);
+    }
+}
+
+template <typename T>
+void BasicParticleDrag<T>::updateForces(BasicParticle<T>* const* particles, size_t count, T duration)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        BasicParticle<T>* particle = particles[i];
+        BasicVector3<T> force;
+        if (accumulateForce(particle->getPosition(), particle->getVelocity(),
+            particle->getInverseMass(), &force))
+        {
+            particle->addForce(force);
+        }
+    }
+}
+
+template <typename T>
+void BasicParticleUplift<T>::updateForce(BasicParticle<T>* particle, T duration)
 {
     // Ensure particle does not have infiinite mass.
     if (!particle->hasFiniteMass()) return;
 
-    Vector3 particlePosition = particle->getPosition();
+    BasicVector3<T> particlePosition = particle->getPosition();
 
     // Ensure particle is in uplift radius of effect
-    Vector3 particleToPoint = upliftPoint - particlePosition;
+    BasicVector3<T> particleToPoint = upliftPoint - particlePosition;
     if (particleToPoint.magnitude() > upliftRadius) return; 
 
     if (particlePosition.y >= maxUpliftHeight)
     {
         // If particle is at max height, stop its motion
-        particle->setVelocity(cyclone::Vector3(0,0,0));
+        particle->setVelocity(cyclone::BasicVector3<T>(0,0,0));
 
         // Apply negative of gravitational force to given particle.
         particle->addForce(gravity.getGravity() * (-1.0 *particle->getMass()));
@@ -141,25 +676,75 @@ void ParticleUplift::updateForce(Particle* particle, real duration)
     }
 }
 
-ParticleSpring::ParticleSpring(Particle* other, real& springConstant, real& restLength) : 
+template <typename T>
+void BasicParticleUplift<T>::getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const
+{
+    BasicVector3<T> extent(upliftRadius, upliftRadius, upliftRadius);
+    *min = upliftPoint - extent;
+    *max = upliftPoint + extent;
+}
+
+template <typename T>
+BasicParticleBlast<T>::BasicParticleBlast(const BasicVector3<T> &centre, T radius, T peakForce) :
+    centre(centre),
+    radius(radius),
+    peakForce(peakForce)
+{
+    assert(radius > 0);
+}
+
+template <typename T>
+void BasicParticleBlast<T>::set(const BasicVector3<T> &centre, T peakForce)
+{
+    BasicParticleBlast::centre = centre;
+    BasicParticleBlast::peakForce = peakForce;
+}
+
+template <typename T>
+void BasicParticleBlast<T>::updateForce(BasicParticle<T>* particle, T duration)
+{
+    if (peakForce == 0 || !particle->hasFiniteMass()) return;
+
+    BasicVector3<T> direction = particle->getPosition() - centre;
+    T distance = direction.magnitude();
+
+    // Particles at the very centre have no direction to go in.
+    if (distance >= radius || distance <= 0) return;
+
+    direction *= ((T)1.0) / distance;
+    particle->addForce(direction * (peakForce * (1 - distance / radius)));
+}
+
+template <typename T>
+void BasicParticleBlast<T>::getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const
+{
+    BasicVector3<T> extent(radius, radius, radius);
+    *min = centre - extent;
+    *max = centre + extent;
+}
+
+template <typename T>
+BasicParticleSpring<T>::BasicParticleSpring(BasicParticle<T>* other, T& springConstant, T& restLength) : 
     other(other), 
     springConstant(springConstant),
     restLength(restLength)
 {
 }
 
-ParticleSpring::ParticleSpring(){}
+template <typename T>
+BasicParticleSpring<T>::BasicParticleSpring(){}
 
-void ParticleSpring::updateForce(Particle* particle, real duration) 
+template <typename T>
+void BasicParticleSpring<T>::updateForce(BasicParticle<T>* particle, T duration) 
 {
     // Calculate the vector of the spring.
-    Vector3 force;
+    BasicVector3<T> force;
     particle->getPosition(&force);
     force -= other->getPosition();
 
     // Calculate the magnituge of the spring force.
-    real magnitude = force.magnitude();
-    magnitude = real_abs(magnitude - restLength);
+    T magnitude = force.magnitude();
+    magnitude = std::abs(magnitude - restLength);
     magnitude *= springConstant;
 
     // Calculate final force and apply it.
@@ -168,24 +753,33 @@ void ParticleSpring::updateForce(Particle* particle, real duration)
     particle->addForce(force);
 }
 
-ParticleAnchoredSpring::ParticleAnchoredSpring(Vector3* anchorPoint, real& springConstant, real& restLength) : 
+template <typename T>
+void BasicParticleSpring<T>::remapParticles(const BasicParticleRemap<T> &remap)
+{
+    other = remap.remap(other);
+}
+
+template <typename T>
+BasicParticleAnchoredSpring<T>::BasicParticleAnchoredSpring(BasicVector3<T>* anchorPoint, T& springConstant, T& restLength) : 
     anchorPoint(anchorPoint), 
     springConstant(springConstant),
     restLength(restLength)
 {
 }
 
-ParticleAnchoredSpring::ParticleAnchoredSpring(){}
+template <typename T>
+BasicParticleAnchoredSpring<T>::BasicParticleAnchoredSpring(){}
 
-void ParticleAnchoredSpring::updateForce(Particle* particle, real duration)
+template <typename T>
+void BasicParticleAnchoredSpring<T>::updateForce(BasicParticle<T>* particle, T duration)
 {
     // Calculate the vector of the spring.
-    Vector3 force;
+    BasicVector3<T> force;
     particle->getPosition(&force);
     force -= *anchorPoint;
 
     // Calculate the magnituge of the spring force.
-    real magnitude = force.magnitude();
+    T magnitude = force.magnitude();
     magnitude = (magnitude - restLength) * springConstant;
 
     // Calculate final force and apply it.
@@ -195,24 +789,33 @@ void ParticleAnchoredSpring::updateForce(Particle* particle, real duration)
 }
 
 
-ParticleBungee::ParticleBungee(Particle* other, real& springConstant, real& restLength) : 
+template <typename T>
+BasicParticleBungee<T>::BasicParticleBungee(BasicParticle<T>* other, T& springConstant, T& restLength) : 
     other(other), 
     springConstant(springConstant),
     restLength(restLength)
 {
 }
 
-ParticleBungee::ParticleBungee(){}
+template <typename T>
+BasicParticleBungee<T>::BasicParticleBungee(){}
+
+template <typename T>
+void BasicParticleBungee<T>::remapParticles(const BasicParticleRemap<T> &remap)
+{
+    other = remap.remap(other);
+}
 
-void ParticleBungee::updateForce(Particle* particle, real duration) 
+template <typename T>
+void BasicParticleBungee<T>::updateForce(BasicParticle<T>* particle, T duration) 
 {
     // Calculate the vector of the spring.
-    Vector3 force;
+    BasicVector3<T> force;
     particle->getPosition(&force);
     force -= other->getPosition();
 
     // Check if bungee is compressed; if so, return.
-    real magnitude = force.magnitude();
+    T magnitude = force.magnitude();
     if (magnitude <= restLength) return;
 
     // Calculate the magnitude of the force.
@@ -224,7 +827,8 @@ void ParticleBungee::updateForce(Particle* particle, real duration)
     particle->addForce(force);
 }
 
-ParticleBuoyancy::ParticleBuoyancy(real maxDepth, real volume, real waterHeight, real liquidDensity) : 
+template <typename T>
+BasicParticleBuoyancy<T>::BasicParticleBuoyancy(T maxDepth, T volume, T waterHeight, T liquidDensity) : 
     maxDepth(maxDepth), 
     volume(volume),
     waterHeight(waterHeight),
@@ -232,16 +836,18 @@ ParticleBuoyancy::ParticleBuoyancy(real maxDepth, real volume, real waterHeight,
 {
 }
 
-ParticleBuoyancy::ParticleBuoyancy(){}
+template <typename T>
+BasicParticleBuoyancy<T>::BasicParticleBuoyancy(){}
 
-void ParticleBuoyancy::updateForce(Particle* particle, real duration) 
+template <typename T>
+void BasicParticleBuoyancy<T>::updateForce(BasicParticle<T>* particle, T duration) 
 {
     // Get submersion depth.
-    real depth = particle->getPosition().y;
+    T depth = particle->getPosition().y;
 
     // Check if particle is out of the water.
     if (depth >= waterHeight + maxDepth) return;
-    Vector3 force(0,0,0);
+    BasicVector3<T> force(0,0,0);
 
     // Check if at maximum depth (i.e. fully submerged)
     if (depth <= waterHeight - maxDepth)
@@ -262,7 +868,67 @@ void ParticleBuoyancy::updateForce(Particle* particle, real duration)
     particle->addForce(force);
 }
 
-ParticleLighterThanAir::ParticleLighterThanAir(real particleDensity, real particleVolume, real airDensityAtGround, real densityAltitudeSlope, ParticleGravity gravity) : 
+template <typename T>
+void BasicParticleBuoyancy<T>::updateForces(BasicParticle<T>* const* particles, size_t count, T duration)
+{
+    const T surface = waterHeight + maxDepth;
+    const T floor = waterHeight - maxDepth;
+    const T fullForce = liquidDensity * volume;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        BasicParticle<T>* particle = particles[i];
+        T depth = particle->getPosition().y;
+
+        // Skip particles out of the water.
+        if (depth >= surface) continue;
+
+        // Fully submerged particles get the maximum force, the rest
+        // are partially submerged (see updateForce).
+        BasicVector3<T> force(0,0,0);
+        if (depth <= floor)
+        {
+            force.y = fullForce;
+        }
+        else
+        {
+            force.y = liquidDensity * volume * (depth - maxDepth - waterHeight) / (2 * maxDepth);
+        }
+        particle->addForce(force);
+    }
+}
+
+template <typename T>
+BasicParticleBuoyancyZone<T>::BasicParticleBuoyancyZone(const BasicVector3<T> &min, const BasicVector3<T> &max,
+    T maxDepth, T volume, T liquidDensity) :
+    min(min),
+    max(max),
+    buoyancy(maxDepth, volume, max.y, liquidDensity),
+    maxDepth(maxDepth)
+{
+}
+
+template <typename T>
+void BasicParticleBuoyancyZone<T>::updateForce(BasicParticle<T>* particle, T duration)
+{
+    BasicVector3<T> position = particle->getPosition();
+    if (position.x < min.x || position.x > max.x ||
+        position.z < min.z || position.z > max.z ||
+        position.y < min.y) return;
+
+    buoyancy.updateForce(particle, duration);
+}
+
+template <typename T>
+void BasicParticleBuoyancyZone<T>::getBounds(BasicVector3<T>* min, BasicVector3<T>* max) const
+{
+    *min = BasicParticleBuoyancyZone::min;
+    *max = BasicParticleBuoyancyZone::max;
+    max->y += maxDepth;
+}
+
+template <typename T>
+BasicParticleLighterThanAir<T>::BasicParticleLighterThanAir(T particleDensity, T particleVolume, T airDensityAtGround, T densityAltitudeSlope, BasicParticleGravity<T> gravity) : 
     particleDensity(particleDensity), 
     particleVolume(particleVolume),
     airDensityAtGround(airDensityAtGround),
@@ -275,17 +941,19 @@ ParticleLighterThanAir::ParticleLighterThanAir(real particleDensity, real partic
     assert(densityAltitudeSlope < 0);
 }
 
-ParticleLighterThanAir::ParticleLighterThanAir(){}
+template <typename T>
+BasicParticleLighterThanAir<T>::BasicParticleLighterThanAir(){}
 
-void ParticleLighterThanAir::updateForce(Particle* particle, real duration) 
+template <typename T>
+void BasicParticleLighterThanAir<T>::updateForce(BasicParticle<T>* particle, T duration) 
 {
-    particle->setVelocity(cyclone::Vector3(0,0,0));
+    particle->setVelocity(cyclone::BasicVector3<T>(0,0,0));
     
     // Base buoyancy force countering gravity
-    Vector3 force = gravity.getGravity() * -1.0f * particle->getMass();
+    BasicVector3<T> force = gravity.getGravity() * -1.0f * particle->getMass();
 
     // Calculate air density at the altitude of the particle
-    real currentAirDensity = densityAltitudeSlope * particle->getPosition().y + airDensityAtGround;
+    T currentAirDensity = densityAltitudeSlope * particle->getPosition().y + airDensityAtGround;
    
     /**
      * If air is less dense than particle, particle is no
@@ -299,11 +967,39 @@ void ParticleLighterThanAir::updateForce(Particle* particle, real duration)
     }
 
     // Calculate y-component of the buoyancy force.
-    real buoyancyComponentY = (currentAirDensity - particleDensity) * particleVolume;
-
-    if (buoyancyComponentY > 0.5)
-        std::cout << buoyancyComponentY << " " << particle->getVelocity().y << std::endl;
+    T buoyancyComponentY = (currentAirDensity - particleDensity) * particleVolume;
 
     // Apply counter-gravity plus buoyancy force.
-    particle->addForce(force + cyclone::Vector3(0, buoyancyComponentY, 0));
+    particle->addForce(force + cyclone::BasicVector3<T>(0, buoyancyComponentY, 0));
+}
+
+namespace cyclone {
+    template class BasicParticleForceGenerator<float>;
+    template class BasicParticleForceGenerator<double>;
+    template class BasicParticleRegionForceGenerator<float>;
+    template class BasicParticleRegionForceGenerator<double>;
+    template class BasicParticleForceRegistry<float>;
+    template class BasicParticleForceRegistry<double>;
+    template class BasicParticleGravity<float>;
+    template class BasicParticleGravity<double>;
+    template class BasicParticleDrag<float>;
+    template class BasicParticleDrag<double>;
+    template class BasicParticlePointGravity<float>;
+    template class BasicParticlePointGravity<double>;
+    template class BasicParticleUplift<float>;
+    template class BasicParticleUplift<double>;
+    template class BasicParticleBlast<float>;
+    template class BasicParticleBlast<double>;
+    template class BasicParticleSpring<float>;
+    template class BasicParticleSpring<double>;
+    template class BasicParticleAnchoredSpring<float>;
+    template class BasicParticleAnchoredSpring<double>;
+    template class BasicParticleBungee<float>;
+    template class BasicParticleBungee<double>;
+    template class BasicParticleBuoyancy<float>;
+    template class BasicParticleBuoyancy<double>;
+    template class BasicParticleBuoyancyZone<float>;
+    template class BasicParticleBuoyancyZone<double>;
+    template class BasicParticleLighterThanAir<float>;
+    template class BasicParticleLighterThanAir<double>;
 }
@@ -0,0 +1,297 @@
+/*
+ * Implementation file for mutual gravitation between particles.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <cyclone/pgravity.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Holds the most bodies kept in a leaf.
+     */
+    const unsigned leafSize = 8;
+
+    /**
+     * Holds the deepest the tree can go. Coincident bodies can't be
+     * separated, so they end up together in a leaf at this depth.
+     */
+    const unsigned maxDepth = 32;
+}
+
+ParticleMutualGravity::ParticleMutualGravity(real gravityScalar,
+    real openingAngle, real softening)
+    :
+    gravityScalar(gravityScalar),
+    openingAngle(openingAngle),
+    softening(softening)
+{
+}
+
+void ParticleMutualGravity::addParticle(Particle* particle)
+{
+    particles.push_back(particle);
+}
+
+void ParticleMutualGravity::addParticles(Particle* particles, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        ParticleMutualGravity::particles.push_back(particles + i);
+    }
+}
+
+void ParticleMutualGravity::remapParticles(const ParticleRemap &remap)
+{
+    remap.remap(particles);
+}
+
+void ParticleMutualGravity::clearParticles()
+{
+    particles.clear();
+    nodes.clear();
+    bodies.clear();
+}
+
+void ParticleMutualGravity::setOpeningAngle(real openingAngle)
+{
+    assert(openingAngle >= 0);
+    ParticleMutualGravity::openingAngle = openingAngle;
+}
+
+void ParticleMutualGravity::setSoftening(real softening)
+{
+    assert(softening >= 0);
+    ParticleMutualGravity::softening = softening;
+}
+
+real ParticleMutualGravity::getGravityScalar() const
+{
+    return gravityScalar;
+}
+
+real ParticleMutualGravity::getSoftening() const
+{
+    return softening;
+}
+
+void ParticleMutualGravity::buildTree()
+{
+    nodes.clear();
+    bodies.clear();
+
+    // Copy out the bodies, and find the cube that holds them.
+    Vector3 low, high;
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        Particle* particle = particles[i];
+        if (!particle->hasFiniteMass()) continue;
+
+        Body body;
+        body.position = particle->getPosition();
+        body.mass = particle->getMass();
+        body.particle = particle;
+
+        if (bodies.empty())
+        {
+            low = high = body.position;
+        }
+        else
+        {
+            if (body.position.x < low.x) low.x = body.position.x;
+            if (body.position.y < low.y) low.y = body.position.y;
+            if (body.position.z < low.z) low.z = body.position.z;
+            if (body.position.x > high.x) high.x = body.position.x;
+            if (body.position.y > high.y) high.y = body.position.y;
+            if (body.position.z > high.z) high.z = body.position.z;
+        }
+        bodies.push_back(body);
+    }
+    if (bodies.empty()) return;
+
+    Vector3 extent = high - low;
+    real halfSize = extent.x;
+    if (extent.y > halfSize) halfSize = extent.y;
+    if (extent.z > halfSize) halfSize = extent.z;
+    halfSize = halfSize * (real)0.5 + (real)1e-3;
+
+    scratch.resize(bodies.size());
+    nodes.resize(1);
+    buildNode(0, 0, (unsigned)bodies.size(), (low + high) * (real)0.5, halfSize, 0);
+}
+
+void ParticleMutualGravity::buildNode(unsigned node, unsigned begin, unsigned end,
+    const Vector3 &centre, real halfSize, unsigned depth)
+{
+    nodes[node].size = halfSize * 2;
+
+    if (end - begin <= leafSize || depth == maxDepth)
+    {
+        Vector3 weighted;
+        real mass = 0;
+        for (unsigned i = begin; i < end; i++)
+        {
+            weighted.addScaledVector(bodies[i].position, bodies[i].mass);
+            mass += bodies[i].mass;
+        }
+
+        Node &leaf = nodes[node];
+        leaf.leaf = true;
+        leaf.first = begin;
+        leaf.count = end - begin;
+        leaf.mass = mass;
+        leaf.centreOfMass = weighted * (((real)1.0) / mass);
+        return;
+    }
+
+    // Sort the bodies into octants, keeping their order within each.
+    unsigned octantCount[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (unsigned i = begin; i < end; i++)
+    {
+        const Vector3 &p = bodies[i].position;
+        unsigned octant = (p.x >= centre.x ? 1 : 0) |
+            (p.y >= centre.y ? 2 : 0) | (p.z >= centre.z ? 4 : 0);
+        octantCount[octant]++;
+    }
+
+    unsigned octantStart[9];
+    octantStart[0] = begin;
+    for (unsigned o = 0; o < 8; o++)
+    {
+        octantStart[o + 1] = octantStart[o] + octantCount[o];
+    }
+
+    unsigned cursor[8];
+    for (unsigned o = 0; o < 8; o++) cursor[o] = octantStart[o];
+    for (unsigned i = begin; i < end; i++)
+    {
+        const Vector3 &p = bodies[i].position;
+        unsigned octant = (p.x >= centre.x ? 1 : 0) |
+            (p.y >= centre.y ? 2 : 0) | (p.z >= centre.z ? 4 : 0);
+        scratch[cursor[octant]++] = bodies[i];
+    }
+    for (unsigned i = begin; i < end; i++) bodies[i] = scratch[i];
+
+    // Give the non-empty octants a block of nodes of their own, then
+    // fill each in. The nodes array may grow as we recurse, so only
+    // hold indices into it.
+    unsigned children = 0;
+    for (unsigned o = 0; o < 8; o++) if (octantCount[o]) children++;
+
+    unsigned firstChild = (unsigned)nodes.size();
+    nodes.resize(firstChild + children);
+    nodes[node].leaf = false;
+    nodes[node].first = firstChild;
+    nodes[node].count = children;
+
+    real quarter = halfSize * (real)0.5;
+    unsigned child = firstChild;
+    for (unsigned o = 0; o < 8; o++)
+    {
+        if (!octantCount[o]) continue;
+
+        Vector3 childCentre(
+            centre.x + ((o & 1) ? quarter : -quarter),
+            centre.y + ((o & 2) ? quarter : -quarter),
+            centre.z + ((o & 4) ? quarter : -quarter)
+            );
+        buildNode(child, octantStart[o], octantStart[o + 1], childCentre, quarter, depth + 1);
+        child++;
+    }
+
+    Vector3 weighted;
+    real mass = 0;
+    for (unsigned c = firstChild; c < firstChild + children; c++)
+    {
+        weighted.addScaledVector(nodes[c].centreOfMass, nodes[c].mass);
+        mass += nodes[c].mass;
+    }
+    nodes[node].mass = mass;
+    nodes[node].centreOfMass = weighted * (((real)1.0) / mass);
+}
+
+Vector3 ParticleMutualGravity::getAcceleration(const Vector3 &position, const Particle* self) const
+{
+    Vector3 acceleration;
+    if (nodes.empty()) return acceleration;
+
+    const real softeningSquared = softening * softening;
+    const real openingSquared = openingAngle * openingAngle;
+
+    // Walk the tree with an explicit stack. Each node pushes at most
+    // eight children, so this is enough for the deepest tree.
+    unsigned stack[maxDepth * 8 + 1];
+    unsigned stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node &node = nodes[stack[--stackSize]];
+
+        Vector3 separation = node.centreOfMass - position;
+        real distanceSquared = separation.squareMagnitude();
+
+        if (node.leaf)
+        {
+            for (unsigned i = node.first; i < node.first + node.count; i++)
+            {
+                const Body &body = bodies[i];
+                if (body.particle == self) continue;
+
+                // The acceleration is along the unit vector, divided
+                // by distance^1.5, i.e. the separation divided by
+                // distance^2.5.
+                Vector3 d = body.position - position;
+                real s = d.squareMagnitude() + softeningSquared;
+                if (s <= 0) continue;
+                real scale = gravityScalar * body.mass / (s * real_sqrt(real_sqrt(s)));
+                acceleration.addScaledVector(d, scale);
+            }
+        }
+        else if (node.size * node.size < openingSquared * distanceSquared)
+        {
+            real s = distanceSquared + softeningSquared;
+            real scale = gravityScalar * node.mass / (s * real_sqrt(real_sqrt(s)));
+            acceleration.addScaledVector(separation, scale);
+        }
+        else
+        {
+            for (unsigned c = node.first; c < node.first + node.count; c++)
+            {
+                stack[stackSize++] = c;
+            }
+        }
+    }
+
+    return acceleration;
+}
+
+void ParticleMutualGravity::prepareForces(real duration)
+{
+    buildTree();
+}
+
+void ParticleMutualGravity::updateForce(Particle* particle, real duration)
+{
+    // Ensure particle does not have infinite mass.
+    if (!particle->hasFiniteMass()) return;
+
+    Vector3 acceleration = getAcceleration(particle->getPosition(), particle);
+    particle->addForce(acceleration * particle->getMass());
+}
+
+void ParticleMutualGravity::updateForces(Particle* const* particles, size_t count, real duration)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        Particle* particle = particles[i];
+        if (!particle->hasFiniteMass()) continue;
+
+        Vector3 acceleration = getAcceleration(particle->getPosition(), particle);
+        particle->addForce(acceleration * particle->getMass());
+    }
+}
@@ -0,0 +1,434 @@
+/*
+ * Implementation file for the implicit spring network integrator.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/pimplicit.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Returns the dot product of two per-particle vectors.
+     */
+    real dot(const std::vector<Vector3> &a, const std::vector<Vector3> &b)
+    {
+        real result = 0;
+        for (unsigned i = 0; i < a.size(); i++) result += a[i] * b[i];
+        return result;
+    }
+
+    /**
+     * Adds scale times the given 3x3 block to the target block.
+     */
+    void addBlock(real* target, const real* block, real scale)
+    {
+        for (unsigned i = 0; i < 9; i++) target[i] += block[i] * scale;
+    }
+
+    /**
+     * Multiplies a 3x3 block by a vector.
+     */
+    Vector3 transform(const real* block, const Vector3 &v)
+    {
+        return Vector3(
+            block[0]*v.x + block[1]*v.y + block[2]*v.z,
+            block[3]*v.x + block[4]*v.y + block[5]*v.z,
+            block[6]*v.x + block[7]*v.y + block[8]*v.z
+            );
+    }
+}
+
+ParticleSpringNetwork::ParticleSpringNetwork(unsigned maxIterations, real tolerance)
+    :
+    topologyDirty(true),
+    maxIterations(maxIterations),
+    iterationsUsed(0),
+    tolerance(tolerance)
+{
+}
+
+unsigned ParticleSpringNetwork::addParticle(Particle* particle)
+{
+    std::map<Particle*, unsigned>::iterator found = particleIndex.find(particle);
+    if (found != particleIndex.end()) return found->second;
+
+    unsigned index = (unsigned)particles.size();
+    particles.push_back(particle);
+    particleIndex[particle] = index;
+    topologyDirty = true;
+    return index;
+}
+
+void ParticleSpringNetwork::addSpring(SpringType type, unsigned a, unsigned b,
+    const Vector3* anchor, real springConstant, real restLength)
+{
+    assert(a < particles.size());
+    assert(type == ANCHORED_SPRING || (b < particles.size() && b != a));
+
+    Spring spring;
+    spring.type = type;
+    spring.particle[0] = a;
+    spring.particle[1] = b;
+    spring.anchor = anchor;
+    spring.springConstant = springConstant;
+    spring.restLength = restLength;
+    springs.push_back(spring);
+    topologyDirty = true;
+}
+
+void ParticleSpringNetwork::addSpring(unsigned a, unsigned b, real springConstant, real restLength)
+{
+    addSpring(SPRING, a, b, 0, springConstant, restLength);
+}
+
+void ParticleSpringNetwork::addSpring(Particle* a, Particle* b, real springConstant, real restLength)
+{
+    unsigned ia = addParticle(a);
+    unsigned ib = addParticle(b);
+    addSpring(SPRING, ia, ib, 0, springConstant, restLength);
+}
+
+void ParticleSpringNetwork::addAnchoredSpring(Particle* particle, const Vector3* anchor,
+    real springConstant, real restLength)
+{
+    assert(anchor);
+    addSpring(ANCHORED_SPRING, addParticle(particle), 0, anchor, springConstant, restLength);
+}
+
+void ParticleSpringNetwork::addBungee(Particle* a, Particle* b, real springConstant, real restLength)
+{
+    unsigned ia = addParticle(a);
+    unsigned ib = addParticle(b);
+    addSpring(BUNGEE, ia, ib, 0, springConstant, restLength);
+}
+
+void ParticleSpringNetwork::clear()
+{
+    particles.clear();
+    particleIndex.clear();
+    springs.clear();
+    topologyDirty = true;
+}
+
+void ParticleSpringNetwork::remapParticles(const ParticleRemap &remap)
+{
+    particleIndex.clear();
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        particles[i] = remap.remap(particles[i]);
+        particleIndex[particles[i]] = i;
+    }
+}
+
+unsigned ParticleSpringNetwork::getParticleCount() const
+{
+    return (unsigned)particles.size();
+}
+
+unsigned ParticleSpringNetwork::getSpringCount() const
+{
+    return (unsigned)springs.size();
+}
+
+void ParticleSpringNetwork::setMaxIterations(unsigned maxIterations)
+{
+    ParticleSpringNetwork::maxIterations = maxIterations;
+}
+
+void ParticleSpringNetwork::setTolerance(real tolerance)
+{
+    ParticleSpringNetwork::tolerance = tolerance;
+}
+
+unsigned ParticleSpringNetwork::getIterationsUsed() const
+{
+    return iterationsUsed;
+}
+
+void ParticleSpringNetwork::buildTopology()
+{
+    unsigned count = (unsigned)particles.size();
+
+    // Each row has a block for the particle itself and one for each
+    // particle it shares a spring with.
+    std::vector< std::vector<unsigned> > columns(count);
+    for (unsigned i = 0; i < count; i++) columns[i].push_back(i);
+    for (unsigned s = 0; s < springs.size(); s++)
+    {
+        const Spring &spring = springs[s];
+        if (spring.type == ANCHORED_SPRING) continue;
+        columns[spring.particle[0]].push_back(spring.particle[1]);
+        columns[spring.particle[1]].push_back(spring.particle[0]);
+    }
+
+    rowStart.resize(count + 1);
+    blockColumn.clear();
+    diagonalBlock.resize(count);
+    rowStart[0] = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        std::vector<unsigned> &row = columns[i];
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+
+        for (unsigned c = 0; c < row.size(); c++)
+        {
+            if (row[c] == i) diagonalBlock[i] = (unsigned)blockColumn.size();
+            blockColumn.push_back(row[c]);
+        }
+        rowStart[i + 1] = (unsigned)blockColumn.size();
+    }
+    blocks.resize(blockColumn.size());
+
+    // Record where each spring's blocks are, so assembly doesn't need
+    // to search for them.
+    for (unsigned s = 0; s < springs.size(); s++)
+    {
+        Spring &spring = springs[s];
+        unsigned a = spring.particle[0];
+        spring.block[0] = diagonalBlock[a];
+        if (spring.type == ANCHORED_SPRING) continue;
+
+        unsigned b = spring.particle[1];
+        spring.block[1] = (unsigned)(std::lower_bound(
+            blockColumn.begin() + rowStart[a], blockColumn.begin() + rowStart[a + 1], b) -
+            blockColumn.begin());
+        spring.block[2] = (unsigned)(std::lower_bound(
+            blockColumn.begin() + rowStart[b], blockColumn.begin() + rowStart[b + 1], a) -
+            blockColumn.begin());
+        spring.block[3] = diagonalBlock[b];
+    }
+
+    force.resize(count);
+    stiffnessVelocity.resize(count);
+    rhs.resize(count);
+    deltaVelocity.assign(count, Vector3());
+    residual.resize(count);
+    direction.resize(count);
+    product.resize(count);
+    preconditioned.resize(count);
+    inverseDiagonal.resize(count);
+    movable.resize(count);
+
+    topologyDirty = false;
+}
+
+void ParticleSpringNetwork::assemble(real duration)
+{
+    unsigned count = (unsigned)particles.size();
+    real h2 = duration * duration;
+
+    for (unsigned b = 0; b < blocks.size(); b++)
+    {
+        for (unsigned i = 0; i < 9; i++) blocks[b].data[i] = 0;
+    }
+
+    // Start with the forces that aren't from the springs.
+    for (unsigned i = 0; i < count; i++)
+    {
+        Particle* particle = particles[i];
+        movable[i] = particle->hasFiniteMass();
+        stiffnessVelocity[i].clear();
+
+        if (movable[i])
+        {
+            Vector3 external;
+            particle->getAcceleration(&external);
+            external *= particle->getMass();
+            external += particle->getForceAccumulator();
+            force[i] = external;
+        }
+        else
+        {
+            force[i].clear();
+        }
+    }
+
+    for (unsigned s = 0; s < springs.size(); s++)
+    {
+        const Spring &spring = springs[s];
+        unsigned a = spring.particle[0];
+        bool anchored = spring.type == ANCHORED_SPRING;
+
+        Vector3 other = anchored ?
+            *spring.anchor : particles[spring.particle[1]]->getPosition();
+        Vector3 d = particles[a]->getPosition() - other;
+        real length = d.magnitude();
+        if (length <= 0) continue;
+
+        // Bungees go slack when they're shorter than their rest
+        // length.
+        if (spring.type == BUNGEE && length <= spring.restLength) continue;
+
+        Vector3 u = d * (((real)1.0) / length);
+        real k = spring.springConstant;
+
+        Vector3 f = u * (-k * (length - spring.restLength));
+        force[a] += f;
+        if (!anchored) force[spring.particle[1]] -= f;
+
+        // The Jacobian of the force on the first particle with
+        // respect to its position. The transverse term is dropped
+        // when the spring is compressed, which keeps the matrix
+        // positive definite.
+        real transverse = ((real)1.0) - spring.restLength / length;
+        if (transverse < 0) transverse = 0;
+        real axial = ((real)1.0) - transverse;
+        real jacobian[9];
+        const real uv[3] = {u.x, u.y, u.z};
+        for (unsigned r = 0; r < 3; r++)
+        for (unsigned c = 0; c < 3; c++)
+        {
+            jacobian[r*3 + c] = -k * (axial * uv[r] * uv[c] + (r == c ? transverse : 0));
+        }
+
+        Vector3 va = particles[a]->getVelocity();
+        if (anchored)
+        {
+            stiffnessVelocity[a] += transform(jacobian, va);
+            addBlock(blocks[spring.block[0]].data, jacobian, -h2);
+        }
+        else
+        {
+            unsigned b = spring.particle[1];
+            Vector3 kv = transform(jacobian, va - particles[b]->getVelocity());
+            stiffnessVelocity[a] += kv;
+            stiffnessVelocity[b] -= kv;
+
+            addBlock(blocks[spring.block[0]].data, jacobian, -h2);
+            addBlock(blocks[spring.block[1]].data, jacobian, h2);
+            addBlock(blocks[spring.block[2]].data, jacobian, h2);
+            addBlock(blocks[spring.block[3]].data, jacobian, -h2);
+        }
+    }
+
+    // Add the masses to the diagonal, and work out the right hand
+    // side and the Jacobi preconditioner.
+    for (unsigned i = 0; i < count; i++)
+    {
+        real* diagonal = blocks[diagonalBlock[i]].data;
+
+        if (!movable[i])
+        {
+            rhs[i].clear();
+            deltaVelocity[i].clear();
+            inverseDiagonal[i].clear();
+            continue;
+        }
+
+        real mass = particles[i]->getMass();
+        diagonal[0] += mass;
+        diagonal[4] += mass;
+        diagonal[8] += mass;
+
+        rhs[i] = (force[i] + stiffnessVelocity[i] * duration) * duration;
+        inverseDiagonal[i] = Vector3(
+            ((real)1.0) / diagonal[0],
+            ((real)1.0) / diagonal[4],
+            ((real)1.0) / diagonal[8]
+            );
+    }
+}
+
+void ParticleSpringNetwork::multiply(const std::vector<Vector3> &in, std::vector<Vector3> &out) const
+{
+    unsigned count = (unsigned)particles.size();
+    for (unsigned i = 0; i < count; i++)
+    {
+        Vector3 sum;
+        if (movable[i])
+        {
+            for (unsigned b = rowStart[i]; b < rowStart[i + 1]; b++)
+            {
+                sum += transform(blocks[b].data, in[blockColumn[b]]);
+            }
+        }
+        out[i] = sum;
+    }
+}
+
+void ParticleSpringNetwork::solve()
+{
+    unsigned count = (unsigned)particles.size();
+    iterationsUsed = 0;
+
+    real rhsSquared = dot(rhs, rhs);
+    if (rhsSquared <= 0)
+    {
+        for (unsigned i = 0; i < count; i++) deltaVelocity[i].clear();
+        return;
+    }
+    real stopSquared = tolerance * tolerance * rhsSquared;
+
+    // Preconditioned conjugate gradients, starting from the last
+    // step's answer.
+    multiply(deltaVelocity, product);
+    for (unsigned i = 0; i < count; i++)
+    {
+        residual[i] = rhs[i] - product[i];
+        preconditioned[i] = residual[i].componentProduct(inverseDiagonal[i]);
+        direction[i] = preconditioned[i];
+    }
+    real rz = dot(residual, preconditioned);
+
+    while (iterationsUsed < maxIterations && dot(residual, residual) > stopSquared)
+    {
+        multiply(direction, product);
+        real curvature = dot(direction, product);
+        if (curvature <= 0) break;
+
+        real alpha = rz / curvature;
+        for (unsigned i = 0; i < count; i++)
+        {
+            deltaVelocity[i].addScaledVector(direction[i], alpha);
+            residual[i].addScaledVector(product[i], -alpha);
+            preconditioned[i] = residual[i].componentProduct(inverseDiagonal[i]);
+        }
+
+        real rzNext = dot(residual, preconditioned);
+        real beta = rzNext / rz;
+        rz = rzNext;
+        for (unsigned i = 0; i < count; i++)
+        {
+            direction[i] = preconditioned[i] + direction[i] * beta;
+        }
+        iterationsUsed++;
+    }
+}
+
+void ParticleSpringNetwork::integrate(real duration)
+{
+    assert(duration > 0.0);
+
+    if (topologyDirty) buildTopology();
+    if (particles.empty()) return;
+
+    assemble(duration);
+    solve();
+
+    DampingCache cache;
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        Particle* particle = particles[i];
+        if (movable[i])
+        {
+            // Update linear velocity from the solve, impose drag,
+            // then update linear position with the new velocity.
+            Vector3 velocity = particle->getVelocity() + deltaVelocity[i];
+            velocity *= cache.getFactor(particle->getDamping(), duration);
+            particle->setVelocity(velocity);
+
+            Vector3 position = particle->getPosition();
+            position.addScaledVector(velocity, duration);
+            particle->setPosition(position);
+        }
+
+        // Clear the forces.
+        particle->clearAccumulator();
+    }
+}
@@ -0,0 +1,519 @@
+/*
+ * Implementation file for resolving contacts in independent islands.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/pislands.h>
+#include <cyclone/jobs.h>
+#include <cyclone/pool.h>
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Marks a contact end that doesn't move.
+     */
+    const unsigned noNode = ~0u;
+
+    /**
+     * Holds the number of colours tracked per particle. Contacts that
+     * can't be given one of these go into a final colour that is
+     * always resolved on one thread.
+     */
+    const unsigned maxColours = 64;
+
+    /**
+     * Holds what the island and colour jobs need to know.
+     */
+    struct ResolveJobData
+    {
+        ParticleIslandResolver* resolver;
+        ParticleContact* contacts;
+        unsigned offset;
+        real duration;
+        JobSystem* jobs;
+    };
+}
+
+ParticleIslandResolver::ParticleIslandResolver(unsigned colourThreshold, unsigned colourSweeps)
+    :
+    contactScratch(0),
+    arena(0),
+    iterations(0),
+    mode(ParticleContactResolver::RESOLVE_LINEAR_SCAN),
+    velocityTolerance(0),
+    penetrationTolerance(0),
+    velocityResidual(0),
+    penetrationResidual(0),
+    converged(true),
+    colourThreshold(colourThreshold),
+    colourSweeps(colourSweeps)
+{
+}
+
+void ParticleIslandResolver::setIterations(unsigned iterations)
+{
+    ParticleIslandResolver::iterations = iterations;
+}
+
+void ParticleIslandResolver::setMode(ParticleContactResolver::ResolveMode mode)
+{
+    ParticleIslandResolver::mode = mode;
+}
+
+void ParticleIslandResolver::setTolerances(real velocityTolerance, real penetrationTolerance)
+{
+    assert(velocityTolerance >= 0 && penetrationTolerance >= 0);
+    ParticleIslandResolver::velocityTolerance = velocityTolerance;
+    ParticleIslandResolver::penetrationTolerance = penetrationTolerance;
+}
+
+void ParticleIslandResolver::setColouring(unsigned colourThreshold, unsigned colourSweeps)
+{
+    ParticleIslandResolver::colourThreshold = colourThreshold;
+    ParticleIslandResolver::colourSweeps = colourSweeps;
+}
+
+void ParticleIslandResolver::setFrameArena(FrameArena* arena)
+{
+    ParticleIslandResolver::arena = arena;
+}
+
+unsigned ParticleIslandResolver::findNode(const Particle* particle) const
+{
+    if (!particle || particle->getInverseMass() <= 0) return noNode;
+
+    std::vector<Particle*>::const_iterator found = std::lower_bound(
+        nodeParticle.begin(), nodeParticle.end(), particle);
+    return (unsigned)(found - nodeParticle.begin());
+}
+
+unsigned ParticleIslandResolver::findRoot(unsigned node)
+{
+    // Path halving: point every other node on the way at its
+    // grandparent.
+    while (parent[node] != node)
+    {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+void ParticleIslandResolver::join(unsigned a, unsigned b)
+{
+    a = findRoot(a);
+    b = findRoot(b);
+    if (a == b) return;
+
+    if (treeSize[a] < treeSize[b]) std::swap(a, b);
+    parent[b] = a;
+    treeSize[a] += treeSize[b];
+}
+
+void ParticleIslandResolver::partition(ParticleContact* contacts, unsigned numContacts)
+{
+    // Make room for the most islands and particles these contacts
+    // could have, so the arrays only grow when the number of
+    // contacts reaches a new high rather than the number of islands.
+    nodeParticle.reserve(numContacts * 2);
+    parent.reserve(numContacts * 2);
+    treeSize.reserve(numContacts * 2);
+    colourMask.reserve(numContacts * 2);
+    islandStart.reserve(numContacts + 1);
+    islandColour.reserve(numContacts + 1);
+    colourStart.reserve(numContacts * 2 + 1);
+    sortCursor.reserve(numContacts);
+
+    // Find the distinct moving particles.
+    nodeParticle.clear();
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        for (unsigned k = 0; k < 2; k++)
+        {
+            Particle* particle = contacts[i].particle[k];
+            if (particle && particle->getInverseMass() > 0) nodeParticle.push_back(particle);
+        }
+    }
+    std::sort(nodeParticle.begin(), nodeParticle.end());
+    nodeParticle.erase(std::unique(nodeParticle.begin(), nodeParticle.end()), nodeParticle.end());
+
+    unsigned nodeCount = (unsigned)nodeParticle.size();
+    parent.resize(nodeCount);
+    treeSize.assign(nodeCount, 1);
+    for (unsigned n = 0; n < nodeCount; n++) parent[n] = n;
+
+    // Join the particles of each contact.
+    info.resize(numContacts);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        ContactInfo &contactInfo = info[i];
+        contactInfo.node[0] = findNode(contacts[i].particle[0]);
+        contactInfo.node[1] = findNode(contacts[i].particle[1]);
+        contactInfo.colour = 0;
+        if (contactInfo.node[0] != noNode && contactInfo.node[1] != noNode)
+        {
+            join(contactInfo.node[0], contactInfo.node[1]);
+        }
+    }
+
+    // Number the islands in the order their first contact appears.
+    // Contacts with nothing that moves all go in one island. The tree
+    // sizes aren't needed any more, so their space is reused.
+    std::vector<unsigned> &rootIsland = treeSize;
+    rootIsland.assign(nodeCount, noNode);
+    unsigned islandCount = 0;
+    unsigned inertIsland = noNode;
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        ContactInfo &contactInfo = info[i];
+        unsigned node = contactInfo.node[0] != noNode ? contactInfo.node[0] : contactInfo.node[1];
+
+        if (node == noNode)
+        {
+            if (inertIsland == noNode) inertIsland = islandCount++;
+            contactInfo.island = inertIsland;
+            continue;
+        }
+
+        unsigned root = findRoot(node);
+        if (rootIsland[root] == noNode) rootIsland[root] = islandCount++;
+        contactInfo.island = rootIsland[root];
+    }
+
+    // Sort the contacts by island, keeping their order within each.
+    islandStart.assign(islandCount + 1, 0);
+    for (unsigned i = 0; i < numContacts; i++) islandStart[info[i].island + 1]++;
+    for (unsigned k = 0; k < islandCount; k++) islandStart[k + 1] += islandStart[k];
+
+    if (arena)
+    {
+        contactScratch = arena->allocateArray<ParticleContact>(numContacts);
+    }
+    else
+    {
+        contactStorage.resize(numContacts);
+        contactScratch = numContacts ? &contactStorage[0] : 0;
+    }
+    infoScratch.resize(numContacts);
+    sortCursor.assign(islandStart.begin(), islandStart.end() - 1);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        unsigned position = sortCursor[info[i].island]++;
+        contactScratch[position] = contacts[i];
+        infoScratch[position] = info[i];
+    }
+    std::copy(contactScratch, contactScratch + numContacts, contacts);
+    info.swap(infoScratch);
+
+    // Colour the large islands. Each island's colour boundaries go in
+    // colourStart, ending with the end of the island.
+    colourStart.clear();
+    colourMask.assign(nodeCount, 0);
+    islandColour.resize(islandCount + 1);
+    colouredIslands.clear();
+    for (unsigned k = 0; k < islandCount; k++)
+    {
+        islandColour[k] = (unsigned)colourStart.size();
+        if (islandStart[k + 1] - islandStart[k] >= colourThreshold)
+        {
+            colourIsland(contacts, k);
+            colouredIslands.push_back(k);
+        }
+        else
+        {
+            colourStart.push_back(islandStart[k]);
+            colourStart.push_back(islandStart[k + 1]);
+        }
+    }
+    islandColour[islandCount] = (unsigned)colourStart.size();
+}
+
+void ParticleIslandResolver::colourIsland(ParticleContact* contacts, unsigned island)
+{
+    unsigned begin = islandStart[island];
+    unsigned end = islandStart[island + 1];
+
+    // Greedily give each contact the lowest colour none of its
+    // moving particles has been given yet. Islands share no
+    // particles, so the masks never need clearing between islands.
+    std::vector<unsigned long long> &used = colourMask;
+    unsigned colourCount = 0;
+    for (unsigned i = begin; i < end; i++)
+    {
+        ContactInfo &contactInfo = info[i];
+        unsigned long long taken = 0;
+        for (unsigned n = 0; n < 2; n++)
+        {
+            if (contactInfo.node[n] != noNode) taken |= used[contactInfo.node[n]];
+        }
+
+        unsigned colour = 0;
+        while (colour < maxColours && (taken & (1ull << colour))) colour++;
+        if (colour < maxColours)
+        {
+            for (unsigned n = 0; n < 2; n++)
+            {
+                if (contactInfo.node[n] != noNode) used[contactInfo.node[n]] |= 1ull << colour;
+            }
+        }
+
+        contactInfo.colour = colour;
+        if (colour + 1 > colourCount) colourCount = colour + 1;
+    }
+
+    // Sort the island's contacts by colour.
+    std::vector<unsigned> &start = sortStart;
+    start.assign(colourCount + 1, 0);
+    for (unsigned i = begin; i < end; i++) start[info[i].colour + 1]++;
+    start[0] = begin;
+    for (unsigned c = 0; c < colourCount; c++) start[c + 1] += start[c];
+
+    sortCursor.assign(start.begin(), start.end() - 1);
+    for (unsigned i = begin; i < end; i++)
+    {
+        unsigned position = sortCursor[info[i].colour]++;
+        contactScratch[position] = contacts[i];
+        infoScratch[position] = info[i];
+    }
+    for (unsigned i = begin; i < end; i++)
+    {
+        contacts[i] = contactScratch[i];
+        info[i] = infoScratch[i];
+    }
+
+    colourStart.insert(colourStart.end(), start.begin(), start.end());
+}
+
+unsigned ParticleIslandResolver::getIslandCount() const
+{
+    return (unsigned)islandStart.size() - 1;
+}
+
+unsigned ParticleIslandResolver::getIslandBegin(unsigned island) const
+{
+    return islandStart[island];
+}
+
+unsigned ParticleIslandResolver::getIslandEnd(unsigned island) const
+{
+    return islandStart[island + 1];
+}
+
+unsigned ParticleIslandResolver::getColourCount(unsigned island) const
+{
+    return islandColour[island + 1] - islandColour[island] - 1;
+}
+
+void ParticleIslandResolver::resolveIslands(ParticleContact* contacts,
+    unsigned begin, unsigned end, real duration, unsigned worker)
+{
+    ParticleContactResolver &resolver = resolvers[worker];
+
+    for (unsigned k = begin; k < end; k++)
+    {
+        unsigned first = islandStart[k];
+        unsigned count = islandStart[k + 1] - first;
+
+        // The big islands are done by sweeping their colours.
+        if (count >= colourThreshold) continue;
+
+        resolver.setIterations(iterations ? iterations : count * 2);
+        resolver.resolveContacts(contacts + first, count, duration);
+        workerIterations[worker] += resolver.getIterationsUsed();
+
+        WorkerResiduals &residuals = workerResiduals[worker];
+        if (!resolver.hasConverged()) residuals.converged = false;
+        if (resolver.getVelocityResidual() > residuals.velocity)
+        {
+            residuals.velocity = resolver.getVelocityResidual();
+        }
+        if (resolver.getPenetrationResidual() > residuals.penetration)
+        {
+            residuals.penetration = resolver.getPenetrationResidual();
+        }
+    }
+}
+
+void ParticleIslandResolver::resolveColour(ParticleContact* contacts,
+    unsigned begin, unsigned end, real duration, unsigned worker)
+{
+    for (unsigned i = begin; i < end; i++)
+    {
+        ParticleContact &contact = contacts[i];
+        const ContactInfo &contactInfo = info[i];
+
+        // Bring the penetration up to date with the moves made so
+        // far. No other contact of this colour moves these particles.
+        Vector3 moved;
+        if (contactInfo.node[0] != noNode) moved += displacement[contactInfo.node[0]];
+        if (contactInfo.node[1] != noNode) moved -= displacement[contactInfo.node[1]];
+        contact.penetration = penetration[i] - moved * contact.contactNormal;
+
+        // Contacts within the tolerances are left alone.
+        if (contact.calculateSeparatingVelocity() >= -velocityTolerance &&
+            contact.penetration <= penetrationTolerance) continue;
+
+        contact.resolve(duration);
+        workerIterations[worker]++;
+
+        if (contactInfo.node[0] != noNode) displacement[contactInfo.node[0]] += contact.particleMovement[0];
+        if (contactInfo.node[1] != noNode) displacement[contactInfo.node[1]] += contact.particleMovement[1];
+    }
+}
+
+void ParticleIslandResolver::islandJob(void* data, unsigned begin, unsigned end)
+{
+    const ResolveJobData &job = *static_cast<ResolveJobData*>(data);
+    job.resolver->resolveIslands(job.contacts, begin, end, job.duration,
+        job.jobs ? job.jobs->getCurrentWorker() : 0);
+}
+
+void ParticleIslandResolver::colourJob(void* data, unsigned begin, unsigned end)
+{
+    const ResolveJobData &job = *static_cast<ResolveJobData*>(data);
+    job.resolver->resolveColour(job.contacts, job.offset + begin, job.offset + end,
+        job.duration, job.jobs ? job.jobs->getCurrentWorker() : 0);
+}
+
+void ParticleIslandResolver::resolveContacts(ParticleContact* contacts, unsigned numContacts,
+    real duration, JobSystem* jobs)
+{
+    workerIterations.assign(workerIterations.size(), 0);
+    velocityResidual = 0;
+    penetrationResidual = 0;
+    converged = true;
+    if (numContacts == 0) return;
+
+    partition(contacts, numContacts);
+
+    unsigned workers = jobs ? jobs->getWorkerCount() : 1;
+    if (resolvers.size() < workers) resolvers.resize(workers, ParticleContactResolver(0));
+    if (workerIterations.size() < workers) workerIterations.resize(workers, 0);
+    WorkerResiduals none = { 0, 0, true };
+    workerResiduals.assign(resolvers.size(), none);
+    for (unsigned w = 0; w < resolvers.size(); w++)
+    {
+        resolvers[w].setMode(mode);
+        resolvers[w].setTolerances(velocityTolerance, penetrationTolerance);
+    }
+
+    ResolveJobData data;
+    data.resolver = this;
+    data.contacts = contacts;
+    data.offset = 0;
+    data.duration = duration;
+    data.jobs = jobs;
+
+    // The small islands first, as many at once as there are workers.
+    unsigned islandCount = getIslandCount();
+    if (jobs) jobs->parallelFor(islandCount, 0, &ParticleIslandResolver::islandJob, &data);
+    else islandJob(&data, 0, islandCount);
+
+    for (unsigned w = 0; w < workerResiduals.size(); w++)
+    {
+        const WorkerResiduals &residuals = workerResiduals[w];
+        if (!residuals.converged) converged = false;
+        if (residuals.velocity > velocityResidual) velocityResidual = residuals.velocity;
+        if (residuals.penetration > penetrationResidual) penetrationResidual = residuals.penetration;
+    }
+    if (colouredIslands.empty()) return;
+
+    // Then the big ones, sweeping each colour in turn.
+    displacement.assign(nodeParticle.size(), Vector3());
+    penetration.resize(numContacts);
+    for (unsigned i = 0; i < numContacts; i++) penetration[i] = contacts[i].penetration;
+
+    for (unsigned c = 0; c < colouredIslands.size(); c++)
+    {
+        unsigned island = colouredIslands[c];
+        unsigned firstColour = islandColour[island];
+        unsigned colourCount = getColourCount(island);
+
+        bool settled = false;
+        for (unsigned sweep = 0; sweep < colourSweeps && !settled; sweep++)
+        {
+            unsigned before = countIterations();
+
+            for (unsigned k = 0; k < colourCount; k++)
+            {
+                unsigned begin = colourStart[firstColour + k];
+                unsigned end = colourStart[firstColour + k + 1];
+
+                // The overflow colour may share particles, so it
+                // always runs on this thread.
+                data.offset = begin;
+                if (jobs && k < maxColours)
+                {
+                    jobs->parallelFor(end - begin, 0, &ParticleIslandResolver::colourJob, &data);
+                }
+                else
+                {
+                    colourJob(&data, 0, end - begin);
+                }
+            }
+
+            // Stop once a sweep finds nothing outside the tolerances.
+            settled = (countIterations() == before);
+        }
+        if (!settled) converged = false;
+    }
+
+    finishColouredIslands(contacts);
+}
+
+void ParticleIslandResolver::finishColouredIslands(ParticleContact* contacts)
+{
+    bool measure = velocityTolerance > 0 || penetrationTolerance > 0;
+
+    for (unsigned c = 0; c < colouredIslands.size(); c++)
+    {
+        unsigned island = colouredIslands[c];
+        for (unsigned i = islandStart[island]; i < islandStart[island + 1]; i++)
+        {
+            // A contact's penetration was last updated when it was
+            // visited, so later sweeps may have moved its particles.
+            ParticleContact &contact = contacts[i];
+            const ContactInfo &contactInfo = info[i];
+            Vector3 moved;
+            if (contactInfo.node[0] != noNode) moved += displacement[contactInfo.node[0]];
+            if (contactInfo.node[1] != noNode) moved -= displacement[contactInfo.node[1]];
+            contact.penetration = penetration[i] - moved * contact.contactNormal;
+
+            if (!measure) continue;
+            real sepVel = contact.calculateSeparatingVelocity();
+            if (-sepVel > velocityResidual) velocityResidual = -sepVel;
+            if (contact.penetration > penetrationResidual) penetrationResidual = contact.penetration;
+        }
+    }
+}
+
+unsigned ParticleIslandResolver::countIterations() const
+{
+    unsigned used = 0;
+    for (unsigned w = 0; w < workerIterations.size(); w++) used += workerIterations[w];
+    return used;
+}
+
+unsigned ParticleIslandResolver::getIterationsUsed() const
+{
+    return countIterations();
+}
+
+bool ParticleIslandResolver::hasConverged() const
+{
+    return converged;
+}
+
+real ParticleIslandResolver::getVelocityResidual() const
+{
+    return velocityResidual;
+}
+
+real ParticleIslandResolver::getPenetrationResidual() const
+{
+    return penetrationResidual;
+}
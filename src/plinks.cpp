@@ -7,6 +7,8 @@
 #include <assert.h>
 #include <iostream>
 #include <cyclone/plinks.h>
+#include <cyclone/pstore.h>
+#include <cyclone/preorder.h>
 
 using namespace cyclone;
 
@@ -17,8 +19,46 @@ real ParticleLink::currentLength() const
     return relativePos.magnitude();
 }
 
+void ParticleLink::remapParticles(const ParticleRemap &remap)
+{
+    particle[0] = remap.remap(particle[0]);
+    particle[1] = remap.remap(particle[1]);
+}
+
+bool ParticleLink::isStill() const
+{
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if (particle[i]->getAwake() && particle[i]->hasFiniteMass()) return false;
+    }
+    return true;
+}
+
+bool ParticleLink::getLengthLimits(real* minLength, real* maxLength) const
+{
+    return false;
+}
+
+bool ParticleCable::getLengthLimits(real* minLength, real* maxLength) const
+{
+    *minLength = 0;
+    *maxLength = ParticleCable::maxLength;
+    return true;
+}
+
+bool ParticleRod::getLengthLimits(real* minLength, real* maxLength) const
+{
+    *minLength = length;
+    *maxLength = length;
+    return true;
+}
+
 unsigned ParticleCable::addContact(ParticleContact* contact, unsigned limit) const
 {
+    // Links between particles that are asleep (or immovable) can't
+    // have changed length.
+    if (isStill()) return 0;
+
     // Find the length of the cable.
     real length = currentLength();
 
@@ -42,11 +82,14 @@ unsigned ParticleCable::addContact(ParticleContact* contact, unsigned limit) con
 
 unsigned ParticleRod::addContact(ParticleContact* contact, unsigned limit) const
 {
+    // As with cables, a still rod needs no contact.
+    if (isStill()) return 0;
+
     // Find the length of the rod.
     real currentLen = currentLength();
 
     // If rod is nominal length, return.
-    if (currentLen = length) return 0;
+    if (currentLen == length) return 0;
 
     // Otherwise, return the contact.
     contact->particle[0] = particle[0];
@@ -75,3 +118,244 @@ unsigned ParticleRod::addContact(ParticleContact* contact, unsigned limit) const
     
     return 1;
 }
+
+ParticleLinkSet::ParticleLinkSet(Particle* particles)
+    : particles(particles), store(0)
+{
+}
+
+void ParticleLinkSet::setParticles(Particle* particles)
+{
+    ParticleLinkSet::particles = particles;
+}
+
+Particle* ParticleLinkSet::getParticles() const
+{
+    return particles;
+}
+
+void ParticleLinkSet::setStore(ParticleStore* store)
+{
+    ParticleLinkSet::store = store;
+    if (store) particles = 0;
+}
+
+ParticleStore* ParticleLinkSet::getStore() const
+{
+    return store;
+}
+
+unsigned ParticleLinkSet::addLink(unsigned a, unsigned b, real minLength,
+    real maxLength, real restitution)
+{
+    assert(a != b && minLength <= maxLength);
+
+    first.push_back(a);
+    second.push_back(b);
+    ParticleLinkSet::minLength.push_back(minLength);
+    ParticleLinkSet::maxLength.push_back(maxLength);
+    minLengthSquared.push_back(minLength * minLength);
+    maxLengthSquared.push_back(maxLength * maxLength);
+    ParticleLinkSet::restitution.push_back(restitution);
+    return (unsigned)first.size() - 1;
+}
+
+unsigned ParticleLinkSet::addRod(unsigned a, unsigned b, real length)
+{
+    return addLink(a, b, length, length, 0);
+}
+
+unsigned ParticleLinkSet::addCable(unsigned a, unsigned b, real maxLength, real restitution)
+{
+    return addLink(a, b, 0, maxLength, restitution);
+}
+
+void ParticleLinkSet::remapParticles(const ParticleRemap &remap)
+{
+    if (remap.getParticles() != particles) return;
+
+    for (unsigned i = 0; i < first.size(); i++)
+    {
+        first[i] = remap.remap(first[i]);
+        second[i] = remap.remap(second[i]);
+    }
+}
+
+void ParticleLinkSet::clear()
+{
+    first.clear();
+    second.clear();
+    minLength.clear();
+    maxLength.clear();
+    minLengthSquared.clear();
+    maxLengthSquared.clear();
+    restitution.clear();
+}
+
+unsigned ParticleLinkSet::size() const
+{
+    return (unsigned)first.size();
+}
+
+unsigned ParticleLinkSet::getFirst(unsigned link) const
+{
+    return first[link];
+}
+
+unsigned ParticleLinkSet::getSecond(unsigned link) const
+{
+    return second[link];
+}
+
+void ParticleLinkSet::getLengthLimits(unsigned link, real* minLength, real* maxLength) const
+{
+    *minLength = ParticleLinkSet::minLength[link];
+    *maxLength = ParticleLinkSet::maxLength[link];
+}
+
+void ParticleLinkSet::measureLengths() const
+{
+    // Work out every link's squared length in one pass, with no
+    // branches or square roots.
+    const unsigned count = size();
+    offset.resize(count);
+    lengthSquared.resize(count);
+    Vector3* d = &offset[0];
+    real* lengths = &lengthSquared[0];
+    const unsigned* a = &first[0];
+    const unsigned* b = &second[0];
+    if (store)
+    {
+        const Vector3* position = store->getPositions();
+        for (unsigned i = 0; i < count; i++) d[i] = position[b[i]] - position[a[i]];
+    }
+    else
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            d[i] = particles[b[i]].getPosition() - particles[a[i]].getPosition();
+        }
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        lengths[i] = d[i].x*d[i].x + d[i].y*d[i].y + d[i].z*d[i].z;
+    }
+}
+
+unsigned ParticleLinkSet::addContact(ParticleContact* contact, unsigned limit) const
+{
+    const unsigned count = size();
+    if (count == 0 || limit == 0) return 0;
+
+    // Links in a store can't make contacts; see resolve.
+    assert(particles && !store);
+    if (!particles) return 0;
+
+    measureLengths();
+    const Vector3* d = &offset[0];
+    const real* lengths = &lengthSquared[0];
+    const unsigned* a = &first[0];
+    const unsigned* b = &second[0];
+
+    // Then write contacts for the links that are out of range.
+    const real* minSquared = &minLengthSquared[0];
+    const real* maxSquared = &maxLengthSquared[0];
+    unsigned used = 0;
+    for (unsigned i = 0; i < count && used < limit; i++)
+    {
+        bool extended = lengths[i] > maxSquared[i];
+        bool compressed = lengths[i] < minSquared[i];
+        if (!extended && !compressed) continue;
+
+        Particle* p0 = particles + a[i];
+        Particle* p1 = particles + b[i];
+
+        // Links between particles that are asleep (or immovable)
+        // can't have changed length.
+        if (!(p0->getAwake() && p0->hasFiniteMass()) &&
+            !(p1->getAwake() && p1->hasFiniteMass())) continue;
+
+        real length = real_sqrt(lengths[i]);
+        Vector3 normal = length > 0 ? d[i] * (((real)1.0) / length) : Vector3::UP;
+
+        ParticleContact &c = contact[used++];
+        c.particle[0] = p0;
+        c.particle[1] = p1;
+        if (extended)
+        {
+            c.contactNormal = normal;
+            c.penetration = length - maxLength[i];
+            c.restitution = restitution[i];
+        }
+        else
+        {
+            // Only rods can be compressed, and they don't bounce.
+            c.contactNormal = normal * -1.0;
+            c.penetration = minLength[i] - length;
+            c.restitution = 0;
+        }
+    }
+
+    return used;
+}
+
+unsigned ParticleLinkSet::resolve(real duration)
+{
+    const unsigned count = size();
+    if (count == 0) return 0;
+    assert(store);
+    assert(duration > 0.0);
+    if (!store) return 0;
+
+    Vector3* position = store->getPositions();
+    Vector3* velocity = store->getVelocities();
+    const real* inverseMass = store->getInverseMasses();
+    real inverseDuration = ((real)1.0) / duration;
+
+    unsigned corrected = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned a = first[i];
+        unsigned b = second[i];
+        real totalInverseMass = inverseMass[a] + inverseMass[b];
+        if (totalInverseMass <= 0) continue;
+
+        // Earlier corrections may have moved the ends, so the length
+        // is worked out from the store as it is now.
+        Vector3 d = position[b] - position[a];
+        real length = d.magnitude();
+
+        real error;
+        if (length > maxLength[i]) error = length - maxLength[i];
+        else if (length < minLength[i]) error = length - minLength[i];
+        else continue;
+
+        Vector3 normal = length > 0 ? d * (((real)1.0) / length) : Vector3::UP;
+
+        // As a contact would, first remove the velocity taking the
+        // link further out of range: a stretched cable bounces back
+        // by its restitution, and a compressed rod stops.
+        real separating = (velocity[b] - velocity[a]) * normal;
+        real target;
+        if (error > 0 && separating > 0) target = -separating * restitution[i];
+        else if (error < 0 && separating < 0) target = 0;
+        else target = separating;
+
+        real change = (target - separating) / totalInverseMass;
+        velocity[a].addScaledVector(normal, -change * inverseMass[a]);
+        velocity[b].addScaledVector(normal, change * inverseMass[b]);
+
+        // Then move the ends back to the limit, and change their
+        // velocities to match, so the particles don't carry on out
+        // of range over the next step.
+        Vector3 moveA = normal * (error * inverseMass[a] / totalInverseMass);
+        Vector3 moveB = normal * (-error * inverseMass[b] / totalInverseMass);
+        position[a] += moveA;
+        position[b] += moveB;
+        velocity[a].addScaledVector(moveA, inverseDuration);
+        velocity[b].addScaledVector(moveB, inverseDuration);
+        corrected++;
+    }
+
+    return corrected;
+}
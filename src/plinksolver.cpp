@@ -0,0 +1,379 @@
+/*
+ * Implementation file for the position based link solver.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <map>
+#include <cyclone/plinksolver.h>
+#include <cyclone/jobs.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Holds the number of colours tracked per particle. Constraints
+     * that can't be given one of these go into a final colour that is
+     * always solved on one thread.
+     */
+    const unsigned maxColours = 64;
+
+    /**
+     * Holds what the solve jobs need to know.
+     */
+    struct SolveJobData
+    {
+        const void* constraints;
+        real inverseDuration;
+    };
+
+    /**
+     * Holds what the Jacobi jobs need to know.
+     */
+    struct JacobiJobData
+    {
+        const void* constraints;
+        void* corrections;
+        Particle* const* ends;
+        const unsigned* endStart;
+        const unsigned* endLinks;
+        real inverseDuration;
+    };
+}
+
+ParticleLinkSolver::ParticleLinkSolver(unsigned iterations)
+    : colourDirty(true), endsDirty(true), iterations(iterations), mode(SOLVE_GAUSS_SEIDEL)
+{
+}
+
+bool ParticleLinkSolver::addLink(const ParticleLink* link)
+{
+    real minLength, maxLength;
+    if (!link->getLengthLimits(&minLength, &maxLength)) return false;
+
+    addConstraint(link->particle[0], link->particle[1], minLength, maxLength);
+    return true;
+}
+
+void ParticleLinkSolver::addConstraint(Particle* a, Particle* b, real minLength, real maxLength)
+{
+    assert(minLength <= maxLength);
+
+    Constraint constraint;
+    constraint.particle[0] = a;
+    constraint.particle[1] = b;
+    constraint.minLength = minLength;
+    constraint.maxLength = maxLength;
+    constraints.push_back(constraint);
+    colourDirty = true;
+    endsDirty = true;
+}
+
+void ParticleLinkSolver::addLinks(const ParticleLinkSet &links)
+{
+    Particle* particles = links.getParticles();
+    assert(particles || links.size() == 0);
+    for (unsigned i = 0; i < links.size(); i++)
+    {
+        real minLength, maxLength;
+        links.getLengthLimits(i, &minLength, &maxLength);
+        addConstraint(particles + links.getFirst(i), particles + links.getSecond(i),
+            minLength, maxLength);
+    }
+}
+
+void ParticleLinkSolver::remapParticles(const ParticleRemap &remap)
+{
+    for (unsigned i = 0; i < constraints.size(); i++)
+    {
+        constraints[i].particle[0] = remap.remap(constraints[i].particle[0]);
+        constraints[i].particle[1] = remap.remap(constraints[i].particle[1]);
+    }
+    colourDirty = true;
+    endsDirty = true;
+}
+
+void ParticleLinkSolver::clear()
+{
+    constraints.clear();
+    colourDirty = true;
+    endsDirty = true;
+}
+
+unsigned ParticleLinkSolver::getConstraintCount() const
+{
+    return (unsigned)constraints.size();
+}
+
+unsigned ParticleLinkSolver::getColourCount()
+{
+    if (colourDirty) colourConstraints();
+    return (unsigned)colourStart.size() - 1;
+}
+
+void ParticleLinkSolver::setIterations(unsigned iterations)
+{
+    ParticleLinkSolver::iterations = iterations;
+}
+
+void ParticleLinkSolver::setMode(SolveMode mode)
+{
+    ParticleLinkSolver::mode = mode;
+}
+
+ParticleLinkSolver::SolveMode ParticleLinkSolver::getMode() const
+{
+    return mode;
+}
+
+void ParticleLinkSolver::colourConstraints()
+{
+    // Greedily give each constraint the lowest colour neither of its
+    // particles has been given yet.
+    std::map<const Particle*, unsigned long long> used;
+    std::vector<unsigned> colour(constraints.size());
+    unsigned colourCount = 0;
+
+    for (unsigned c = 0; c < constraints.size(); c++)
+    {
+        unsigned long long &usedA = used[constraints[c].particle[0]];
+        unsigned long long &usedB = used[constraints[c].particle[1]];
+        unsigned long long taken = usedA | usedB;
+
+        unsigned k = 0;
+        while (k < maxColours && (taken & (1ull << k))) k++;
+        if (k < maxColours)
+        {
+            usedA |= 1ull << k;
+            usedB |= 1ull << k;
+        }
+
+        colour[c] = k;
+        if (k + 1 > colourCount) colourCount = k + 1;
+    }
+
+    // Counting sort by colour, keeping the order within each colour.
+    colourStart.assign(colourCount + 1, 0);
+    for (unsigned c = 0; c < constraints.size(); c++) colourStart[colour[c] + 1]++;
+    for (unsigned k = 0; k < colourCount; k++) colourStart[k + 1] += colourStart[k];
+
+    std::vector<unsigned> cursor(colourStart.begin(), colourStart.end() - 1);
+    coloured.resize(constraints.size());
+    for (unsigned c = 0; c < constraints.size(); c++)
+    {
+        coloured[cursor[colour[c]]++] = constraints[c];
+    }
+
+    colourDirty = false;
+}
+
+void ParticleLinkSolver::buildEnds()
+{
+    // Number each particle in the order the constraints first use it,
+    // and count the constraint ends that move it.
+    std::map<const Particle*, unsigned> row;
+    std::vector<unsigned> endRow(constraints.size() * 2);
+    ends.clear();
+    endStart.assign(1, 0);
+
+    for (unsigned e = 0; e < endRow.size(); e++)
+    {
+        Particle* particle = constraints[e / 2].particle[e % 2];
+        std::map<const Particle*, unsigned>::iterator found = row.find(particle);
+        if (found == row.end())
+        {
+            found = row.insert(std::make_pair(particle, (unsigned)ends.size())).first;
+            ends.push_back(particle);
+            endStart.push_back(0);
+        }
+        endRow[e] = found->second;
+        endStart[found->second + 1]++;
+    }
+    for (unsigned r = 0; r < ends.size(); r++) endStart[r + 1] += endStart[r];
+
+    // Then list each particle's ends, keeping them in constraint
+    // order so the sums are made in the same order every time.
+    std::vector<unsigned> cursor(endStart.begin(), endStart.end() - 1);
+    endLinks.resize(endRow.size());
+    for (unsigned e = 0; e < endRow.size(); e++)
+    {
+        endLinks[cursor[endRow[e]]++] = e;
+    }
+
+    corrections.resize(constraints.size());
+    endsDirty = false;
+}
+
+bool ParticleLinkSolver::measureConstraint(const Constraint &constraint, Vector3 *correction)
+{
+    const Particle* a = constraint.particle[0];
+    const Particle* b = constraint.particle[1];
+
+    real totalInverseMass = a->getInverseMass() + b->getInverseMass();
+    if (totalInverseMass <= 0) return false;
+
+    // A constraint between particles that can't be moving (asleep or
+    // immovable) is left alone.
+    bool movingA = a->getAwake() && a->hasFiniteMass();
+    bool movingB = b->getAwake() && b->hasFiniteMass();
+    if (!movingA && !movingB) return false;
+
+    Vector3 separation = a->getPosition() - b->getPosition();
+    real length = separation.magnitude();
+    if (length <= 0) return false;
+
+    // Work out how far outside its limits the link is.
+    real error;
+    if (length > constraint.maxLength) error = length - constraint.maxLength;
+    else if (length < constraint.minLength) error = length - constraint.minLength;
+    else return false;
+
+    *correction = separation * (error / (length * totalInverseMass));
+    return true;
+}
+
+void ParticleLinkSolver::solveConstraint(const Constraint &constraint, real inverseDuration)
+{
+    Vector3 correction;
+    if (!measureConstraint(constraint, &correction)) return;
+
+    Particle* a = constraint.particle[0];
+    Particle* b = constraint.particle[1];
+
+    // Correcting the link moves both ends, so wake a sleeping one.
+    if (!a->getAwake()) a->setAwake();
+    if (!b->getAwake()) b->setAwake();
+
+    // Share the correction out in proportion to inverse mass, and
+    // change the velocities to match.
+    Vector3 moveA = correction * -a->getInverseMass();
+    a->setPosition(a->getPosition() + moveA);
+    a->setVelocity(a->getVelocity() + moveA * inverseDuration);
+
+    Vector3 moveB = correction * b->getInverseMass();
+    b->setPosition(b->getPosition() + moveB);
+    b->setVelocity(b->getVelocity() + moveB * inverseDuration);
+}
+
+void ParticleLinkSolver::solveJob(void* data, unsigned begin, unsigned end)
+{
+    const SolveJobData &job = *static_cast<SolveJobData*>(data);
+    const Constraint* constraints = static_cast<const Constraint*>(job.constraints);
+    for (unsigned c = begin; c < end; c++)
+    {
+        solveConstraint(constraints[c], job.inverseDuration);
+    }
+}
+
+void ParticleLinkSolver::measureJob(void* data, unsigned begin, unsigned end)
+{
+    const JacobiJobData &job = *static_cast<JacobiJobData*>(data);
+    const Constraint* constraints = static_cast<const Constraint*>(job.constraints);
+    Correction* corrections = static_cast<Correction*>(job.corrections);
+    for (unsigned c = begin; c < end; c++)
+    {
+        corrections[c].active = measureConstraint(constraints[c], &corrections[c].correction);
+    }
+}
+
+void ParticleLinkSolver::applyJob(void* data, unsigned begin, unsigned end)
+{
+    const JacobiJobData &job = *static_cast<JacobiJobData*>(data);
+    const Correction* corrections = static_cast<const Correction*>(job.corrections);
+    for (unsigned r = begin; r < end; r++)
+    {
+        // Sum the corrections of the constraints moving this
+        // particle; the first end of a constraint moves against it.
+        Vector3 total;
+        unsigned count = 0;
+        for (unsigned i = job.endStart[r]; i < job.endStart[r + 1]; i++)
+        {
+            const Correction &correction = corrections[job.endLinks[i] / 2];
+            if (!correction.active) continue;
+            if (job.endLinks[i] % 2) total += correction.correction;
+            else total -= correction.correction;
+            count++;
+        }
+        if (count == 0) continue;
+
+        // Correcting a link moves both ends, so wake a sleeping one.
+        Particle* particle = job.ends[r];
+        if (!particle->getAwake()) particle->setAwake();
+
+        Vector3 move = total * (particle->getInverseMass() / (real)count);
+        particle->setPosition(particle->getPosition() + move);
+        particle->setVelocity(particle->getVelocity() + move * job.inverseDuration);
+    }
+}
+
+void ParticleLinkSolver::solve(real duration, JobSystem* jobs)
+{
+    assert(duration > 0.0);
+    if (constraints.empty()) return;
+
+    real inverseDuration = ((real)1.0) / duration;
+
+    if (mode == SOLVE_GAUSS_SEIDEL)
+    {
+        for (unsigned i = 0; i < iterations; i++)
+        {
+            for (unsigned c = 0; c < constraints.size(); c++)
+            {
+                solveConstraint(constraints[c], inverseDuration);
+            }
+        }
+        return;
+    }
+
+    if (mode == SOLVE_JACOBI)
+    {
+        if (endsDirty) buildEnds();
+
+        JacobiJobData data;
+        data.constraints = &constraints[0];
+        data.corrections = &corrections[0];
+        data.ends = &ends[0];
+        data.endStart = &endStart[0];
+        data.endLinks = &endLinks[0];
+        data.inverseDuration = inverseDuration;
+
+        // Every constraint is measured before any particle moves.
+        unsigned constraintCount = (unsigned)constraints.size();
+        unsigned endCount = (unsigned)ends.size();
+        for (unsigned i = 0; i < iterations; i++)
+        {
+            if (jobs)
+            {
+                jobs->parallelFor(constraintCount, 0, &ParticleLinkSolver::measureJob, &data);
+                jobs->parallelFor(endCount, 0, &ParticleLinkSolver::applyJob, &data);
+            }
+            else
+            {
+                measureJob(&data, 0, constraintCount);
+                applyJob(&data, 0, endCount);
+            }
+        }
+        return;
+    }
+
+    if (colourDirty) colourConstraints();
+
+    unsigned colourCount = (unsigned)colourStart.size() - 1;
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        for (unsigned k = 0; k < colourCount; k++)
+        {
+            SolveJobData data;
+            data.constraints = &coloured[colourStart[k]];
+            data.inverseDuration = inverseDuration;
+            unsigned count = colourStart[k + 1] - colourStart[k];
+
+            // The overflow colour may share particles, so it always
+            // runs on this thread.
+            if (jobs && k < maxColours) jobs->parallelFor(count, 0, &ParticleLinkSolver::solveJob, &data);
+            else solveJob(&data, 0, count);
+        }
+    }
+}
@@ -0,0 +1,355 @@
+/*
+ * Implementation file for multi-rate particle integration.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/pmultirate.h>
+#include <cyclone/jobs.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+
+namespace {
+    /**
+     * Holds what the integration jobs for one level need to know.
+     */
+    struct LevelJobData
+    {
+        Particle* particles;
+        const unsigned* indices;
+        unsigned char* level;
+
+        /** Holds the state each particle is left in by its step. */
+        Vector3* lastVelocity;
+        unsigned char* lastAwake;
+
+        /** Holds the duration of one step at level zero. */
+        real duration;
+
+        /** Holds the number of steps this level's step spans. */
+        unsigned span;
+
+        /** Holds the highest level the particles can move to. */
+        unsigned topLevel;
+
+        real maxDisplacement;
+    };
+
+    /**
+     * Orders particle indices by their level, then by index.
+     */
+    struct LevelOrder
+    {
+        const unsigned char* level;
+
+        LevelOrder(const unsigned char* level) : level(level) {}
+
+        bool operator()(unsigned a, unsigned b) const
+        {
+            if (level[a] != level[b]) return level[a] < level[b];
+            return a < b;
+        }
+    };
+
+    void levelJob(void* data, unsigned begin, unsigned end)
+    {
+        LevelJobData &job = *static_cast<LevelJobData*>(data);
+        const real stepDuration = job.duration * (real)job.span;
+        const real average = (real)1 / (real)job.span;
+        DampingCache cache;
+
+        for (unsigned n = begin; n < end; n++)
+        {
+            unsigned i = job.indices[n];
+            Particle &particle = job.particles[i];
+
+            // Particles that can't move may as well wait as long as
+            // they can.
+            if (particle.getInverseMass() <= 0 || !particle.getAwake())
+            {
+                particle.clearAccumulator();
+                job.level[i] = (unsigned char)job.topLevel;
+                job.lastVelocity[i] = particle.getVelocity();
+                job.lastAwake[i] = particle.getAwake();
+                continue;
+            }
+
+            // Forces have been building up since the particle's last
+            // step: use their average over this one.
+            Vector3 force = particle.getForceAccumulator();
+            if (job.span > 1)
+            {
+                force *= average;
+                particle.clearAccumulator();
+                particle.addForce(force);
+            }
+            Vector3 acceleration = particle.getAcceleration();
+            acceleration.addScaledVector(force, particle.getInverseMass());
+
+            particle.integrate(stepDuration, cache);
+
+            // Find the longest step that keeps the particle within
+            // the displacement limit.
+            real speed = particle.getVelocity().magnitude();
+            real halfAcceleration = acceleration.magnitude() * (real)0.5;
+            unsigned l = job.topLevel;
+            while (l > 0)
+            {
+                real dt = job.duration * (real)(1u << l);
+                if (speed * dt + halfAcceleration * dt * dt <= job.maxDisplacement) break;
+                l--;
+            }
+            job.level[i] = (unsigned char)l;
+            job.lastVelocity[i] = particle.getVelocity();
+            job.lastAwake[i] = 1;
+        }
+    }
+}
+
+ParticleMultiRateIntegrator::ParticleMultiRateIntegrator(unsigned maxLevel, real maxDisplacement)
+    :
+    maxDisplacement(maxDisplacement),
+    stepCount(0),
+    integrated(0),
+    dirty(false)
+{
+    setMaxLevel(maxLevel);
+}
+
+void ParticleMultiRateIntegrator::setMaxLevel(unsigned maxLevel)
+{
+    assert(maxLevel < MaxLevels);
+    ParticleMultiRateIntegrator::maxLevel = maxLevel;
+}
+
+void ParticleMultiRateIntegrator::setMaxDisplacement(real maxDisplacement)
+{
+    assert(maxDisplacement > 0);
+    ParticleMultiRateIntegrator::maxDisplacement = maxDisplacement;
+}
+
+void ParticleMultiRateIntegrator::reset()
+{
+    for (unsigned l = 0; l < MaxLevels; l++) levels[l].clear();
+    level.clear();
+    lastVelocity.clear();
+    lastAwake.clear();
+    marked.clear();
+    pending.clear();
+    sleepers.clear();
+    stepCount = 0;
+    dirty = false;
+}
+
+void ParticleMultiRateIntegrator::resetParticle(unsigned index)
+{
+    // Particles not seen yet start at level zero anyway.
+    if (index >= level.size() || level[index] == 0) return;
+
+    level[index] = 0;
+    dirty = true;
+}
+
+void ParticleMultiRateIntegrator::remapParticles(const ParticleRemap &remap)
+{
+    // Particles not seen yet are still at level zero wherever they
+    // end up, and will be picked up by the next step.
+    if (level.empty()) return;
+    assert(level.size() <= remap.getCount());
+
+    std::vector<unsigned char> moved(remap.getCount(), 0);
+    std::vector<unsigned char> movedAwake(remap.getCount(), 0);
+    std::vector<Vector3> movedVelocity(remap.getCount());
+    for (unsigned i = 0; i < level.size(); i++)
+    {
+        unsigned to = remap.remap(i);
+        moved[to] = level[i];
+        movedAwake[to] = lastAwake[i];
+        movedVelocity[to] = lastVelocity[i];
+    }
+    level.swap(moved);
+    lastAwake.swap(movedAwake);
+    lastVelocity.swap(movedVelocity);
+    marked.assign(level.size(), 0);
+    for (unsigned n = 0; n < pending.size(); n++) pending[n] = remap.remap(pending[n]);
+    for (unsigned n = 0; n < sleepers.size(); n++) sleepers[n] = remap.remap(sleepers[n]);
+    rebuildLevels();
+}
+
+void ParticleMultiRateIntegrator::disturbParticle(unsigned index)
+{
+    // Particles at level zero are integrated at every step anyway.
+    if (index < level.size() && level[index] > 0) pending.push_back(index);
+}
+
+void ParticleMultiRateIntegrator::checkDisturbed(const Particle* particles,
+    const std::vector<unsigned> &candidates, unsigned dueLevel)
+{
+    for (unsigned n = 0; n < candidates.size(); n++)
+    {
+        unsigned i = candidates[n];
+        if (level[i] <= dueLevel || marked[i]) continue;
+
+        const Particle &particle = particles[i];
+        if (particle.getAwake() != (lastAwake[i] != 0) ||
+            particle.getVelocity() != lastVelocity[i])
+        {
+            marked[i] = 1;
+            disturbed.push_back(i);
+        }
+    }
+}
+
+void ParticleMultiRateIntegrator::rebuildLevels()
+{
+    for (unsigned l = 0; l < MaxLevels; l++) levels[l].clear();
+    for (unsigned i = 0; i < level.size(); i++)
+    {
+        levels[level[i]].push_back(i);
+    }
+    dirty = false;
+}
+
+void ParticleMultiRateIntegrator::integrate(Particle* particles, unsigned count,
+    real duration, JobSystem* jobs)
+{
+    assert(duration > 0);
+
+    if (dirty) rebuildLevels();
+
+    // New particles start at level zero.
+    if (count > level.size())
+    {
+        for (unsigned i = (unsigned)level.size(); i < count; i++)
+        {
+            levels[0].push_back(i);
+        }
+        level.resize(count, 0);
+        lastVelocity.resize(count);
+        lastAwake.resize(count, 0);
+        marked.resize(count, 0);
+    }
+
+    // The steps of every level up to the number of times two divides
+    // the step count end here.
+    stepCount++;
+    unsigned dueLevel = 0;
+    while (dueLevel + 1 < MaxLevels && (stepCount & (1u << dueLevel)) == 0) dueLevel++;
+
+    // Particles can only climb to a level whose next step starts now.
+    unsigned topLevel = dueLevel < maxLevel ? dueLevel : maxLevel;
+
+    LevelJobData data;
+    data.particles = particles;
+    data.level = &level[0];
+    data.lastVelocity = &lastVelocity[0];
+    data.lastAwake = &lastAwake[0];
+    data.duration = duration;
+    data.topLevel = topLevel;
+    data.maxDisplacement = maxDisplacement;
+
+    due.clear();
+
+    // Particles in the middle of a longer step that have been woken,
+    // or had their velocity changed by a contact, since their last
+    // step can't wait for it to end. Only particles touched by a
+    // contact, and sleepers, can have been.
+    disturbed.clear();
+    checkDisturbed(particles, pending, dueLevel);
+    checkDisturbed(particles, sleepers, dueLevel);
+    pending.clear();
+
+    if (!disturbed.empty())
+    {
+        // Take them out of their levels, then integrate each level's
+        // over the time since its last step, dropping them to level
+        // zero.
+        std::sort(disturbed.begin(), disturbed.end(), LevelOrder(&level[0]));
+        for (unsigned l = dueLevel + 1; l < MaxLevels; l++)
+        {
+            std::vector<unsigned> &list = levels[l];
+            unsigned kept = 0;
+            for (unsigned n = 0; n < list.size(); n++)
+            {
+                if (!marked[list[n]]) list[kept++] = list[n];
+            }
+            list.resize(kept);
+        }
+
+        unsigned first = 0;
+        while (first < disturbed.size())
+        {
+            unsigned l = level[disturbed[first]];
+            unsigned last = first;
+            while (last < disturbed.size() && level[disturbed[last]] == l) last++;
+
+            data.indices = &disturbed[first];
+            data.span = stepCount & ((1u << l) - 1);
+            if (jobs) jobs->parallelFor(last - first, 0, levelJob, &data);
+            else levelJob(&data, 0, last - first);
+            first = last;
+        }
+
+        for (unsigned n = 0; n < disturbed.size(); n++)
+        {
+            level[disturbed[n]] = 0;
+            marked[disturbed[n]] = 0;
+        }
+        due.insert(due.end(), disturbed.begin(), disturbed.end());
+    }
+
+    for (unsigned l = 0; l <= dueLevel; l++)
+    {
+        std::vector<unsigned> &list = levels[l];
+        if (list.empty()) continue;
+
+        data.indices = &list[0];
+        data.span = 1u << l;
+        if (jobs) jobs->parallelFor((unsigned)list.size(), 0, levelJob, &data);
+        else levelJob(&data, 0, (unsigned)list.size());
+
+        due.insert(due.end(), list.begin(), list.end());
+        list.clear();
+    }
+    integrated = (unsigned)due.size();
+
+    // Sort the particles just integrated into their new levels. All
+    // of them are at or below the due level, whose lists were just
+    // emptied.
+    for (unsigned n = 0; n < due.size(); n++)
+    {
+        levels[level[due[n]]].push_back(due[n]);
+    }
+
+    // Keep the sleepers that weren't integrated, and add those just
+    // put to sleep.
+    unsigned kept = 0;
+    for (unsigned n = 0; n < sleepers.size(); n++)
+    {
+        if (level[sleepers[n]] > dueLevel) sleepers[kept++] = sleepers[n];
+    }
+    sleepers.resize(kept);
+    for (unsigned n = 0; n < due.size(); n++)
+    {
+        if (!lastAwake[due[n]]) sleepers.push_back(due[n]);
+    }
+
+    // Once every level has finished a step together, start counting
+    // again so the count doesn't overflow.
+    if (stepCount == (1u << (MaxLevels - 1))) stepCount = 0;
+}
+
+unsigned ParticleMultiRateIntegrator::getLevelCount(unsigned level) const
+{
+    assert(level < MaxLevels);
+    return (unsigned)levels[level].size();
+}
+
+unsigned ParticleMultiRateIntegrator::getIntegratedCount() const
+{
+    return integrated;
+}
@@ -0,0 +1,88 @@
+/*
+ * Implementation file for the per-frame arena.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <cyclone/pool.h>
+
+using namespace cyclone;
+
+
+FrameArena::FrameArena(size_t capacity)
+    : buffer(0), capacity(capacity), used(0), overflowUsed(0), peak(0)
+{
+    if (capacity > 0) buffer = new unsigned char[capacity];
+}
+
+FrameArena::~FrameArena()
+{
+    for (unsigned i = 0; i < overflow.size(); i++) delete[] overflow[i];
+    delete[] buffer;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    // Try the main buffer first.
+    uintptr_t base = (uintptr_t)buffer;
+    uintptr_t start = (base + used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t end = (size_t)(start - base) + bytes;
+    if (buffer && end <= capacity)
+    {
+        used = end;
+        if (used + overflowUsed > peak) peak = used + overflowUsed;
+        return (void*)start;
+    }
+
+    // Otherwise this frame has outgrown the buffer: take the memory
+    // from the heap, allowing for the alignment.
+    size_t size = bytes + alignment;
+    unsigned char* block = new unsigned char[size];
+    overflow.push_back(block);
+    overflowUsed += size;
+    if (used + overflowUsed > peak) peak = used + overflowUsed;
+
+    uintptr_t aligned = ((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return (void*)aligned;
+}
+
+void FrameArena::reset()
+{
+    if (!overflow.empty())
+    {
+        for (unsigned i = 0; i < overflow.size(); i++) delete[] overflow[i];
+        overflow.clear();
+        overflowUsed = 0;
+
+        // Make the buffer big enough for the largest frame so far.
+        delete[] buffer;
+        capacity = peak;
+        buffer = new unsigned char[capacity];
+    }
+    used = 0;
+}
+
+size_t FrameArena::getUsed() const
+{
+    return used + overflowUsed;
+}
+
+size_t FrameArena::getCapacity() const
+{
+    return capacity;
+}
+
+size_t FrameArena::getPeak() const
+{
+    return peak;
+}
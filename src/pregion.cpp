@@ -0,0 +1,118 @@
+/*
+ * Implementation file for force generators limited to regions of space.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <cyclone/pregion.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+
+ParticleRegionForces::ParticleRegionForces(real cellSize)
+    : hash(cellSize), evaluations(0)
+{
+}
+
+void ParticleRegionForces::addParticle(Particle* particle)
+{
+    particles.push_back(particle);
+}
+
+void ParticleRegionForces::addParticles(Particle* particles, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        ParticleRegionForces::particles.push_back(particles + i);
+    }
+}
+
+void ParticleRegionForces::removeParticle(Particle* particle)
+{
+    for (unsigned i = 0; i < particles.size(); i++)
+    {
+        if (particles[i] != particle) continue;
+
+        particles[i] = particles.back();
+        particles.pop_back();
+        return;
+    }
+}
+
+void ParticleRegionForces::remapParticles(const ParticleRemap &remap)
+{
+    remap.remap(particles);
+}
+
+void ParticleRegionForces::clearParticles()
+{
+    particles.clear();
+}
+
+void ParticleRegionForces::addGenerator(ParticleRegionForceGenerator* generator)
+{
+    generators.push_back(generator);
+}
+
+void ParticleRegionForces::removeGenerator(ParticleRegionForceGenerator* generator)
+{
+    for (unsigned i = 0; i < generators.size(); i++)
+    {
+        if (generators[i] != generator) continue;
+
+        generators.erase(generators.begin() + i);
+        return;
+    }
+}
+
+void ParticleRegionForces::clearGenerators()
+{
+    generators.clear();
+}
+
+void ParticleRegionForces::setCellSize(real cellSize)
+{
+    hash.setCellSize(cellSize);
+}
+
+const ParticleSpatialHash& ParticleRegionForces::getSpatialHash() const
+{
+    return hash;
+}
+
+unsigned ParticleRegionForces::getEvaluationCount() const
+{
+    return evaluations;
+}
+
+void ParticleRegionForces::updateForces(real duration)
+{
+    evaluations = 0;
+    if (particles.empty() || generators.empty()) return;
+
+    hash.build(&particles[0], (unsigned)particles.size());
+
+    for (unsigned g = 0; g < generators.size(); g++)
+    {
+        ParticleRegionForceGenerator* generator = generators[g];
+
+        Vector3 min, max;
+        generator->getBounds(&min, &max);
+
+        found.clear();
+        hash.query(min, max, found);
+
+        // Pass on sleeping particles too: a region force is what
+        // disturbs a resting scene, and adding it wakes them.
+        affected.clear();
+        for (unsigned i = 0; i < found.size(); i++)
+        {
+            affected.push_back(particles[found[i]]);
+        }
+        if (affected.empty()) continue;
+
+        generator->updateForces(&affected[0], affected.size(), duration);
+        evaluations += (unsigned)affected.size();
+    }
+}
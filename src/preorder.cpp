@@ -0,0 +1,106 @@
+/*
+ * Implementation file for reordering particles in memory.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+
+namespace {
+    /**
+     * Spreads the low ten bits of the given value out so there are
+     * two zero bits between each.
+     */
+    unsigned spreadBits(unsigned v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    /**
+     * Orders particles from a remap's array before all others, and
+     * by address among themselves.
+     */
+    template <typename T>
+    struct RemapOrder
+    {
+        const BasicParticleRemap<T>* remap;
+
+        bool operator()(const BasicParticle<T>* a, const BasicParticle<T>* b) const
+        {
+            bool inA = remap->contains(a), inB = remap->contains(b);
+            if (inA != inB) return inA;
+            return inA && a < b;
+        }
+    };
+}
+
+unsigned cyclone::mortonCode(unsigned x, unsigned y, unsigned z)
+{
+    if (x > 0x3ff) x = 0x3ff;
+    if (y > 0x3ff) y = 0x3ff;
+    if (z > 0x3ff) z = 0x3ff;
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+template <typename T>
+BasicParticleRemap<T>::BasicParticleRemap(BasicParticle<T>* particles, unsigned count, const unsigned* newIndex)
+    : particles(particles), count(count), newIndex(newIndex)
+{
+}
+
+template <typename T>
+BasicParticle<T>* BasicParticleRemap<T>::getParticles() const
+{
+    return particles;
+}
+
+template <typename T>
+unsigned BasicParticleRemap<T>::getCount() const
+{
+    return count;
+}
+
+template <typename T>
+bool BasicParticleRemap<T>::contains(const BasicParticle<T>* particle) const
+{
+    return particle >= particles && particle < particles + count;
+}
+
+template <typename T>
+unsigned BasicParticleRemap<T>::remap(unsigned index) const
+{
+    assert(index < count);
+    return newIndex[index];
+}
+
+template <typename T>
+BasicParticle<T>* BasicParticleRemap<T>::remap(BasicParticle<T>* particle) const
+{
+    if (!contains(particle)) return particle;
+    return particles + newIndex[particle - particles];
+}
+
+template <typename T>
+void BasicParticleRemap<T>::remap(std::vector<BasicParticle<T>*> &list) const
+{
+    for (unsigned i = 0; i < list.size(); i++) list[i] = remap(list[i]);
+
+    RemapOrder<T> order;
+    order.remap = this;
+    std::stable_sort(list.begin(), list.end(), order);
+}
+
+namespace cyclone {
+    template class BasicParticleRemap<float>;
+    template class BasicParticleRemap<double>;
+}
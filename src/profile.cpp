@@ -0,0 +1,147 @@
+/*
+ * Implementation file for the frame profiler.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <chrono>
+#include <cyclone/profile.h>
+
+using namespace cyclone;
+
+
+Profiler::Profiler(unsigned capacity)
+    : frames(capacity > 0 ? capacity : 1), first(0), count(0), nextIndex(0)
+{
+    origin = 0;
+    origin = now();
+    beginFrame();
+}
+
+unsigned long long Profiler::now()
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::beginFrame()
+{
+    current.index = nextIndex;
+    for (unsigned p = 0; p < PROFILE_PHASE_COUNT; p++)
+    {
+        current.start[p] = 0;
+        current.duration[p] = 0;
+    }
+    for (unsigned c = 0; c < PROFILE_COUNTER_COUNT; c++) current.counter[c] = 0;
+}
+
+void Profiler::endFrame()
+{
+    unsigned capacity = (unsigned)frames.size();
+    if (count < capacity)
+    {
+        frames[(first + count) % capacity] = current;
+        count++;
+    }
+    else
+    {
+        frames[first] = current;
+        first = (first + 1) % capacity;
+    }
+
+    nextIndex++;
+    beginFrame();
+}
+
+void Profiler::addTime(ProfilePhase phase, unsigned long long start, unsigned long long end)
+{
+    if (current.duration[phase] == 0) current.start[phase] = start - origin;
+    current.duration[phase] += end - start;
+}
+
+void Profiler::setCounter(ProfileCounter counter, unsigned value)
+{
+    current.counter[counter] = value;
+}
+
+unsigned Profiler::getFrameCount() const
+{
+    return count;
+}
+
+const ProfileFrame& Profiler::getFrame(unsigned frame) const
+{
+    assert(frame < count);
+    return frames[(first + frame) % frames.size()];
+}
+
+double Profiler::getMeanDuration(ProfilePhase phase) const
+{
+    if (count == 0) return 0;
+
+    double total = 0;
+    for (unsigned f = 0; f < count; f++) total += (double)getFrame(f).duration[phase];
+    return total / count;
+}
+
+void Profiler::clear()
+{
+    first = 0;
+    count = 0;
+}
+
+const char* Profiler::getPhaseName(ProfilePhase phase)
+{
+    static const char* names[PROFILE_PHASE_COUNT] = {
+        "step", "forces", "integration", "links",
+        "contact_generation", "resolution"
+    };
+    return names[phase];
+}
+
+const char* Profiler::getCounterName(ProfileCounter counter)
+{
+    static const char* names[PROFILE_COUNTER_COUNT] = {
+        "contacts", "iterations", "cached_contacts", "awake_particles"
+    };
+    return names[counter];
+}
+
+bool Profiler::writeChromeTrace(const char* filename) const
+{
+    FILE* file = fopen(filename, "w");
+    if (!file) return false;
+
+    // Trace times are in microseconds.
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool firstEvent = true;
+    for (unsigned f = 0; f < count; f++)
+    {
+        const ProfileFrame &frame = getFrame(f);
+        for (unsigned p = 0; p < PROFILE_PHASE_COUNT; p++)
+        {
+            if (frame.duration[p] == 0) continue;
+
+            fprintf(file, "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %llu}}",
+                firstEvent ? "" : ",\n", getPhaseName((ProfilePhase)p),
+                frame.start[p] * 1e-3, frame.duration[p] * 1e-3, frame.index);
+            firstEvent = false;
+        }
+        for (unsigned c = 0; c < PROFILE_COUNTER_COUNT; c++)
+        {
+            fprintf(file, "%s  {\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, "
+                "\"ts\": %.3f, \"args\": {\"value\": %u}}",
+                firstEvent ? "" : ",\n", getCounterName((ProfileCounter)c),
+                frame.start[PROFILE_STEP] * 1e-3, frame.counter[c]);
+            firstEvent = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
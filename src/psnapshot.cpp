@@ -0,0 +1,669 @@
+/*
+ * Implementation file for particle world snapshots.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <cyclone/psnapshot.h>
+#include <cyclone/pcache.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #define CYCLONE_SNAPSHOT_MMAP
+#endif
+
+using namespace cyclone;
+
+
+namespace {
+    const char snapshotMagic[8] = { 'C', 'Y', 'C', 'S', 'N', 'A', 'P', 0 };
+    const unsigned snapshotByteOrder = 0x01020304;
+    const unsigned long long sectionAlignment = 64;
+
+    const unsigned recordSizes[SNAPSHOT_SECTION_COUNT] = {
+        sizeof(SnapshotParticle),
+        sizeof(unsigned),
+        sizeof(SnapshotRegistration),
+        sizeof(SnapshotContactGenerator),
+        sizeof(SnapshotLink),
+        sizeof(SnapshotCacheEntry)
+    };
+
+    unsigned long long alignOffset(unsigned long long offset)
+    {
+        return (offset + sectionAlignment - 1) & ~(sectionAlignment - 1);
+    }
+
+    /**
+     * Maps generator pointers back to their position in a list, by
+     * binary search of the pointers sorted.
+     */
+    struct PointerIndex
+    {
+        std::vector<std::pair<const void*, unsigned> > entries;
+
+        template <class T>
+        void build(const std::vector<T*> &pointers)
+        {
+            entries.resize(pointers.size());
+            for (unsigned i = 0; i < pointers.size(); i++)
+            {
+                entries[i] = std::make_pair((const void*)pointers[i], i);
+            }
+            std::sort(entries.begin(), entries.end(), entryLess);
+        }
+
+        unsigned find(const void* pointer) const
+        {
+            std::pair<const void*, unsigned> key(pointer, 0);
+            std::vector<std::pair<const void*, unsigned> >::const_iterator found =
+                std::lower_bound(entries.begin(), entries.end(), key, entryLess);
+            if (found == entries.end() || found->first != pointer) return SNAPSHOT_NONE;
+            return found->second;
+        }
+
+        static bool entryLess(const std::pair<const void*, unsigned> &a,
+            const std::pair<const void*, unsigned> &b)
+        {
+            std::less<const void*> less;
+            if (a.first != b.first) return less(a.first, b.first);
+            return a.second < b.second;
+        }
+    };
+
+    void copyVector(real* out, const Vector3 &vector)
+    {
+        out[0] = vector.x;
+        out[1] = vector.y;
+        out[2] = vector.z;
+    }
+
+    Vector3 readVector(const real* in)
+    {
+        return Vector3(in[0], in[1], in[2]);
+    }
+
+    /**
+     * Writes a section's records at the given offset, padding the
+     * file up to it first.
+     */
+    bool writeSection(FILE* file, unsigned long long &position,
+        const SnapshotSection &section, const void* records)
+    {
+        static const unsigned char zeros[sectionAlignment] = { 0 };
+
+        assert(section.offset >= position && section.offset - position < sectionAlignment);
+        size_t padding = (size_t)(section.offset - position);
+        if (padding && fwrite(zeros, 1, padding, file) != padding) return false;
+        position = section.offset;
+
+        size_t bytes = (size_t)(section.count * section.recordSize);
+        if (bytes && fwrite(records, 1, bytes, file) != bytes) return false;
+        position += bytes;
+        return true;
+    }
+}
+
+unsigned SnapshotBindings::addForceGenerator(ParticleForceGenerator* generator)
+{
+    forceGenerators.push_back(generator);
+    return (unsigned)forceGenerators.size() - 1;
+}
+
+unsigned SnapshotBindings::addContactGenerator(ParticleContactGenerator* generator)
+{
+    contactGenerators.push_back(generator);
+    return (unsigned)contactGenerators.size() - 1;
+}
+
+ParticleForceGenerator* SnapshotBindings::getForceGenerator(unsigned id) const
+{
+    if (id >= forceGenerators.size()) return 0;
+    return forceGenerators[id];
+}
+
+ParticleContactGenerator* SnapshotBindings::getContactGenerator(unsigned id) const
+{
+    if (id >= contactGenerators.size()) return 0;
+    return contactGenerators[id];
+}
+
+void SnapshotBindings::clear()
+{
+    forceGenerators.clear();
+    contactGenerators.clear();
+    cables.clear();
+    rods.clear();
+}
+
+ParticleSnapshot::ParticleSnapshot()
+    : data(0), size(0), mapped(false), error("")
+{
+}
+
+ParticleSnapshot::~ParticleSnapshot()
+{
+    close();
+}
+
+bool ParticleSnapshot::fail(const char* error)
+{
+    ParticleSnapshot::error = error;
+    return false;
+}
+
+const char* ParticleSnapshot::getError() const
+{
+    return error;
+}
+
+bool ParticleSnapshot::write(const char* filename, const ParticleWorld &world,
+    const SnapshotBindings &bindings, const ParticleContactCache* cache)
+{
+    const Particle* particles = world.particles;
+    const unsigned particleCount = world.particleCount;
+
+    // Particles are stored by their index in the world.
+    struct ParticleIndex
+    {
+        const Particle* particles;
+        unsigned count;
+
+        bool find(const Particle* particle, unsigned* index) const
+        {
+            if (!particle)
+            {
+                *index = SNAPSHOT_NONE;
+                return true;
+            }
+            std::less<const Particle*> less;
+            if (less(particle, particles) || !less(particle, particles + count)) return false;
+            *index = (unsigned)(particle - particles);
+            return true;
+        }
+    } particleIndex = { particles, particleCount };
+
+    std::vector<SnapshotParticle> particleRecords(particleCount);
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        const Particle &particle = particles[i];
+        SnapshotParticle &record = particleRecords[i];
+        memset(&record, 0, sizeof(record));
+        copyVector(record.position, particle.position);
+        copyVector(record.velocity, particle.velocity);
+        copyVector(record.acceleration, particle.acceleration);
+        copyVector(record.forceAccum, particle.forceAccum);
+        record.inverseMass = particle.inverseMass;
+        record.damping = particle.damping;
+        record.motion = particle.motion;
+        record.flags = (particle.isAwake ? SnapshotParticle::AWAKE : 0) |
+            (particle.canSleep ? SnapshotParticle::CAN_SLEEP : 0);
+    }
+
+    // Force registrations, in the registry's order.
+    PointerIndex forceIds;
+    forceIds.build(bindings.forceGenerators);
+
+    const ParticleForceRegistry::Registry &registrations = world.registry.registrations;
+    std::vector<SnapshotRegistration> registrationRecords(registrations.size());
+    for (unsigned i = 0; i < registrations.size(); i++)
+    {
+        SnapshotRegistration &record = registrationRecords[i];
+        if (!particleIndex.find(registrations[i].particle, &record.particle) ||
+            record.particle == SNAPSHOT_NONE)
+        {
+            return fail("a force registration refers to a particle outside the world");
+        }
+        record.generator = forceIds.find(registrations[i].fg);
+        if (record.generator == SNAPSHOT_NONE)
+        {
+            return fail("a registered force generator hasn't been bound");
+        }
+    }
+
+    // Contact generators, with the cables and rods among them stored
+    // as links.
+    PointerIndex contactIds;
+    contactIds.build(bindings.contactGenerators);
+
+    const ParticleWorld::ContactGenerators &generators = world.contactGenerators;
+    std::vector<SnapshotContactGenerator> generatorRecords(generators.size());
+    std::vector<SnapshotLink> linkRecords;
+    for (unsigned i = 0; i < generators.size(); i++)
+    {
+        SnapshotContactGenerator &record = generatorRecords[i];
+        const ParticleLink* link = 0;
+        SnapshotLink linkRecord;
+        memset(&linkRecord, 0, sizeof(linkRecord));
+
+        if (const ParticleCable* cable = dynamic_cast<const ParticleCable*>(generators[i]))
+        {
+            link = cable;
+            linkRecord.type = SnapshotLink::CABLE;
+            linkRecord.length = cable->maxLength;
+            linkRecord.restitution = cable->restitution;
+        }
+        else if (const ParticleRod* rod = dynamic_cast<const ParticleRod*>(generators[i]))
+        {
+            link = rod;
+            linkRecord.type = SnapshotLink::ROD;
+            linkRecord.length = rod->length;
+        }
+
+        if (link)
+        {
+            if (!link->particle[0] || !link->particle[1])
+            {
+                return fail("a link is missing a particle");
+            }
+            if (!particleIndex.find(link->particle[0], &linkRecord.particle[0]) ||
+                !particleIndex.find(link->particle[1], &linkRecord.particle[1]))
+            {
+                return fail("a link refers to a particle outside the world");
+            }
+            record.kind = SnapshotContactGenerator::LINK;
+            record.index = (unsigned)linkRecords.size();
+            linkRecords.push_back(linkRecord);
+        }
+        else
+        {
+            record.kind = SnapshotContactGenerator::BOUND;
+            record.index = contactIds.find(generators[i]);
+            if (record.index == SNAPSHOT_NONE)
+            {
+                return fail("a contact generator hasn't been bound");
+            }
+        }
+    }
+
+    // The cache refers to its contacts' generators by their place in
+    // the world's list. Entries from generators no longer in it can
+    // never match again, so are dropped.
+    std::vector<SnapshotCacheEntry> cacheRecords;
+    if (cache)
+    {
+        PointerIndex sources;
+        sources.build(generators);
+
+        cacheRecords.reserve(cache->entries.size());
+        for (unsigned i = 0; i < cache->entries.size(); i++)
+        {
+            const ParticleContactCache::Entry &entry = cache->entries[i];
+            SnapshotCacheEntry record;
+            record.source = sources.find(entry.source);
+            if (record.source == SNAPSHOT_NONE) continue;
+            if (!particleIndex.find(entry.particle[0], &record.particle[0]) ||
+                !particleIndex.find(entry.particle[1], &record.particle[1]))
+            {
+                return fail("a cached contact refers to a particle outside the world");
+            }
+            record.impulse = entry.impulse;
+            cacheRecords.push_back(record);
+        }
+    }
+
+    // Lay out the file.
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = snapshotByteOrder;
+    header.realSize = sizeof(real);
+    header.headerSize = sizeof(SnapshotHeader);
+    header.timestep = world.timestep;
+    header.accumulator = world.accumulator;
+    header.maxSteps = world.maxSteps;
+
+    const void* records[SNAPSHOT_SECTION_COUNT] = {
+        particleRecords.empty() ? 0 : &particleRecords[0],
+        world.freeParticles.empty() ? 0 : &world.freeParticles[0],
+        registrationRecords.empty() ? 0 : &registrationRecords[0],
+        generatorRecords.empty() ? 0 : &generatorRecords[0],
+        linkRecords.empty() ? 0 : &linkRecords[0],
+        cacheRecords.empty() ? 0 : &cacheRecords[0]
+    };
+    const size_t counts[SNAPSHOT_SECTION_COUNT] = {
+        particleRecords.size(),
+        world.freeParticles.size(),
+        registrationRecords.size(),
+        generatorRecords.size(),
+        linkRecords.size(),
+        cacheRecords.size()
+    };
+
+    unsigned long long offset = sizeof(SnapshotHeader);
+    for (unsigned s = 0; s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        SnapshotSection &section = header.sections[s];
+        section.offset = alignOffset(offset);
+        section.count = counts[s];
+        section.recordSize = recordSizes[s];
+        offset = section.offset + section.count * section.recordSize;
+    }
+    header.fileSize = offset;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) return fail("the snapshot file couldn't be created");
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    unsigned long long position = sizeof(header);
+    for (unsigned s = 0; ok && s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        ok = writeSection(file, position, header.sections[s], records[s]);
+    }
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok)
+    {
+        ::remove(filename);
+        return fail("the snapshot file couldn't be written");
+    }
+    return true;
+}
+
+bool ParticleSnapshot::open(const char* filename)
+{
+    close();
+
+#if defined(CYCLONE_SNAPSHOT_MMAP)
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return fail("the snapshot file couldn't be opened");
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size <= 0)
+    {
+        ::close(fd);
+        return fail("the snapshot file is empty");
+    }
+
+    void* mapping = mmap(0, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) return fail("the snapshot file couldn't be mapped");
+
+    data = static_cast<const unsigned char*>(mapping);
+    size = (size_t)status.st_size;
+    mapped = true;
+#else
+    FILE* file = fopen(filename, "rb");
+    if (!file) return fail("the snapshot file couldn't be opened");
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0)
+    {
+        fclose(file);
+        return fail("the snapshot file is empty");
+    }
+
+    // Doubles keep the sections aligned.
+    double* buffer = new double[(length + sizeof(double) - 1) / sizeof(double)];
+    bool read = fread(buffer, 1, (size_t)length, file) == (size_t)length;
+    fclose(file);
+
+    data = reinterpret_cast<const unsigned char*>(buffer);
+    size = (size_t)length;
+    mapped = false;
+    if (!read)
+    {
+        close();
+        return fail("the snapshot file couldn't be read");
+    }
+#endif
+
+    if (!validate())
+    {
+        // Keep the reason validation failed.
+        const char* reason = error;
+        close();
+        return fail(reason);
+    }
+    return true;
+}
+
+bool ParticleSnapshot::validate()
+{
+    if (size < sizeof(SnapshotHeader)) return fail("the file is too short to be a snapshot");
+
+    const SnapshotHeader &header = getHeader();
+    if (memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0)
+    {
+        return fail("the file isn't a snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) return fail("the snapshot has an unsupported version");
+    if (header.byteOrder != snapshotByteOrder) return fail("the snapshot has the wrong byte order");
+    if (header.realSize != sizeof(real)) return fail("the snapshot has a different precision");
+    if (header.headerSize != sizeof(SnapshotHeader) || header.fileSize > size)
+    {
+        return fail("the snapshot is damaged or truncated");
+    }
+
+    for (unsigned s = 0; s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        const SnapshotSection &section = header.sections[s];
+        if (section.recordSize != recordSizes[s] ||
+            section.offset % sectionAlignment != 0 ||
+            section.offset > header.fileSize ||
+            section.count > (header.fileSize - section.offset) / section.recordSize ||
+            section.count > SNAPSHOT_NONE)
+        {
+            return fail("the snapshot is damaged or truncated");
+        }
+    }
+    return true;
+}
+
+void ParticleSnapshot::close()
+{
+    if (!data) return;
+
+#if defined(CYCLONE_SNAPSHOT_MMAP)
+    munmap(const_cast<unsigned char*>(data), size);
+#else
+    delete[] reinterpret_cast<const double*>(data);
+#endif
+    data = 0;
+    size = 0;
+    mapped = false;
+}
+
+bool ParticleSnapshot::isOpen() const
+{
+    return data != 0;
+}
+
+const SnapshotHeader& ParticleSnapshot::getHeader() const
+{
+    assert(data);
+    return *reinterpret_cast<const SnapshotHeader*>(data);
+}
+
+const void* ParticleSnapshot::getSection(SnapshotSectionType type, unsigned* count) const
+{
+    assert(data);
+    const SnapshotSection &section = getHeader().sections[type];
+    *count = (unsigned)section.count;
+    return data + section.offset;
+}
+
+const SnapshotParticle* ParticleSnapshot::getParticles(unsigned* count) const
+{
+    return static_cast<const SnapshotParticle*>(getSection(SNAPSHOT_PARTICLES, count));
+}
+
+const SnapshotRegistration* ParticleSnapshot::getRegistrations(unsigned* count) const
+{
+    return static_cast<const SnapshotRegistration*>(getSection(SNAPSHOT_REGISTRATIONS, count));
+}
+
+const SnapshotLink* ParticleSnapshot::getLinks(unsigned* count) const
+{
+    return static_cast<const SnapshotLink*>(getSection(SNAPSHOT_LINKS, count));
+}
+
+bool ParticleSnapshot::restore(ParticleWorld &world, SnapshotBindings &bindings,
+    ParticleContactCache* cache)
+{
+    if (!data) return fail("no snapshot is open");
+    const SnapshotHeader &header = getHeader();
+
+    unsigned particleCount, freeCount, registrationCount, generatorCount, linkCount, cacheCount;
+    const SnapshotParticle* particleRecords = getParticles(&particleCount);
+    const unsigned* freeRecords = static_cast<const unsigned*>(
+        getSection(SNAPSHOT_FREE_PARTICLES, &freeCount));
+    const SnapshotRegistration* registrationRecords = getRegistrations(&registrationCount);
+    const SnapshotContactGenerator* generatorRecords =
+        static_cast<const SnapshotContactGenerator*>(
+            getSection(SNAPSHOT_CONTACT_GENERATORS, &generatorCount));
+    const SnapshotLink* linkRecords = getLinks(&linkCount);
+    const SnapshotCacheEntry* cacheRecords = static_cast<const SnapshotCacheEntry*>(
+        getSection(SNAPSHOT_CACHE, &cacheCount));
+
+    // Check every reference before anything is changed, so a bad
+    // snapshot leaves the world as it was.
+    if (particleCount > world.maxParticles) return fail("the world is too small for the snapshot");
+    if (freeCount > particleCount) return fail("the snapshot is damaged");
+    for (unsigned i = 0; i < freeCount; i++)
+    {
+        if (freeRecords[i] >= particleCount) return fail("the snapshot is damaged");
+    }
+    for (unsigned i = 0; i < registrationCount; i++)
+    {
+        if (registrationRecords[i].particle >= particleCount) return fail("the snapshot is damaged");
+        if (!bindings.getForceGenerator(registrationRecords[i].generator))
+        {
+            return fail("a force generator in the snapshot hasn't been bound");
+        }
+    }
+    for (unsigned i = 0; i < linkCount; i++)
+    {
+        const SnapshotLink &link = linkRecords[i];
+        if (link.type != SnapshotLink::CABLE && link.type != SnapshotLink::ROD) return fail("the snapshot is damaged");
+        for (unsigned j = 0; j < 2; j++)
+        {
+            // Links always join two particles of the world.
+            if (link.particle[j] >= particleCount) return fail("the snapshot is damaged");
+        }
+    }
+    for (unsigned i = 0; i < generatorCount; i++)
+    {
+        const SnapshotContactGenerator &generator = generatorRecords[i];
+        if (generator.kind == SnapshotContactGenerator::LINK)
+        {
+            if (generator.index >= linkCount) return fail("the snapshot is damaged");
+        }
+        else if (generator.kind != SnapshotContactGenerator::BOUND ||
+            !bindings.getContactGenerator(generator.index))
+        {
+            return fail("a contact generator in the snapshot hasn't been bound");
+        }
+    }
+    for (unsigned i = 0; cache && i < cacheCount; i++)
+    {
+        const SnapshotCacheEntry &entry = cacheRecords[i];
+        if (entry.particle[0] >= particleCount || entry.source >= generatorCount ||
+            (entry.particle[1] != SNAPSHOT_NONE && entry.particle[1] >= particleCount))
+        {
+            return fail("the snapshot is damaged");
+        }
+    }
+
+    // The world.
+    world.clear();
+    Particle* particles = world.particles;
+    world.particleCount = particleCount;
+    world.timestep = (real)header.timestep;
+    world.accumulator = (real)header.accumulator;
+    world.maxSteps = header.maxSteps;
+
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        const SnapshotParticle &record = particleRecords[i];
+        Particle &particle = particles[i];
+        particle.position = readVector(record.position);
+        particle.velocity = readVector(record.velocity);
+        particle.acceleration = readVector(record.acceleration);
+        particle.forceAccum = readVector(record.forceAccum);
+        particle.inverseMass = record.inverseMass;
+        particle.damping = record.damping;
+        particle.motion = record.motion;
+        particle.isAwake = (record.flags & SnapshotParticle::AWAKE) != 0;
+        particle.canSleep = (record.flags & SnapshotParticle::CAN_SLEEP) != 0;
+    }
+    world.freeParticles.assign(freeRecords, freeRecords + freeCount);
+    world.removed.assign(world.maxParticles, false);
+    for (unsigned i = 0; i < freeCount; i++) world.removed[freeRecords[i]] = true;
+
+    ParticleForceRegistry &registry = world.registry;
+    registry.reserve(registrationCount);
+    for (unsigned i = 0; i < registrationCount; i++)
+    {
+        registry.add(particles + registrationRecords[i].particle,
+            bindings.getForceGenerator(registrationRecords[i].generator));
+    }
+
+    // The links, then the contact generator list that uses them.
+    bindings.cables.clear();
+    bindings.rods.clear();
+    std::vector<ParticleLink*> links(linkCount);
+    for (unsigned i = 0; i < linkCount; i++)
+    {
+        const SnapshotLink &record = linkRecords[i];
+        ParticleLink* link;
+        if (record.type == SnapshotLink::CABLE)
+        {
+            ParticleCable* cable = bindings.cables.allocate();
+            cable->maxLength = record.length;
+            cable->restitution = record.restitution;
+            link = cable;
+        }
+        else
+        {
+            ParticleRod* rod = bindings.rods.allocate();
+            rod->length = record.length;
+            link = rod;
+        }
+        for (unsigned j = 0; j < 2; j++)
+        {
+            link->particle[j] = particles + record.particle[j];
+        }
+        links[i] = link;
+    }
+
+    ParticleWorld::ContactGenerators &generators = world.contactGenerators;
+    generators.resize(generatorCount);
+    for (unsigned i = 0; i < generatorCount; i++)
+    {
+        const SnapshotContactGenerator &record = generatorRecords[i];
+        if (record.kind == SnapshotContactGenerator::LINK) generators[i] = links[record.index];
+        else generators[i] = bindings.getContactGenerator(record.index);
+    }
+
+    // The cache, which keeps its entries sorted on their pointers.
+    if (cache)
+    {
+        std::vector<ParticleContactCache::Entry> &entries = cache->entries;
+        entries.resize(cacheCount);
+        for (unsigned i = 0; i < cacheCount; i++)
+        {
+            const SnapshotCacheEntry &record = cacheRecords[i];
+            ParticleContactCache::Entry &entry = entries[i];
+            entry.particle[0] = particles + record.particle[0];
+            entry.particle[1] = record.particle[1] == SNAPSHOT_NONE ? 0 : particles + record.particle[1];
+            entry.source = generators[record.source];
+            entry.impulse = record.impulse;
+        }
+        std::sort(entries.begin(), entries.end(), ParticleContactCache::entryLess);
+        cache->matched = 0;
+    }
+
+    return true;
+}
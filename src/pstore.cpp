@@ -0,0 +1,204 @@
+/*
+ * Implementation file for the structure-of-arrays particle store.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <cyclone/pstore.h>
+#include <cyclone/jobs.h>
+
+using namespace cyclone;
+
+
+ParticleStore::ParticleStore()
+{
+}
+
+ParticleStore::ParticleStore(unsigned capacity)
+{
+    reserve(capacity);
+}
+
+void ParticleStore::reserve(unsigned capacity)
+{
+    position.reserve(capacity);
+    velocity.reserve(capacity);
+    acceleration.reserve(capacity);
+    forceAccum.reserve(capacity);
+    inverseMass.reserve(capacity);
+    damping.reserve(capacity);
+}
+
+ParticleHandle ParticleStore::add()
+{
+    unsigned index = size();
+
+    position.push_back(Vector3());
+    velocity.push_back(Vector3());
+    acceleration.push_back(Vector3());
+    forceAccum.push_back(Vector3());
+    inverseMass.push_back(1);
+    damping.push_back(1);
+
+    return ParticleHandle(this, index);
+}
+
+ParticleHandle ParticleStore::get(unsigned index)
+{
+    assert(index < size());
+    return ParticleHandle(this, index);
+}
+
+unsigned ParticleStore::size() const
+{
+    return (unsigned)position.size();
+}
+
+void ParticleStore::clear()
+{
+    position.clear();
+    velocity.clear();
+    acceleration.clear();
+    forceAccum.clear();
+    inverseMass.clear();
+    damping.clear();
+}
+
+void ParticleStore::clearAccumulators()
+{
+    unsigned count = size();
+    Vector3* f = getForceAccumulators();
+    for (unsigned i = 0; i < count; i++)
+    {
+        f[i].clear();
+    }
+}
+
+void ParticleStore::integrateAll(real duration)
+{
+    integrateRange(0, size(), duration);
+}
+
+namespace {
+    /**
+     * Holds what the integration jobs need to know.
+     */
+    struct IntegrateJobData
+    {
+        ParticleStore* store;
+        real duration;
+    };
+}
+
+void ParticleStore::integrateJob(void* data, unsigned begin, unsigned end)
+{
+    IntegrateJobData &job = *static_cast<IntegrateJobData*>(data);
+    job.store->integrateRange(begin, end, job.duration);
+}
+
+void ParticleStore::integrateAll(real duration, JobSystem &jobs)
+{
+    IntegrateJobData data;
+    data.store = this;
+    data.duration = duration;
+    jobs.parallelFor(size(), 0, &ParticleStore::integrateJob, &data);
+}
+
+void ParticleStore::integrateRange(unsigned begin, unsigned end, real duration)
+{
+    assert(duration > 0.0);
+    if (begin >= end) return;
+
+    // Work on the raw arrays so the loop body is plain pointer
+    // arithmetic.
+    Vector3* p = getPositions();
+    Vector3* v = getVelocities();
+    const Vector3* a = getAccelerations();
+    Vector3* f = getForceAccumulators();
+    const real* im = getInverseMasses();
+    const real* d = getDampings();
+    DampingCache cache;
+
+    for (unsigned i = begin; i < end; i++)
+    {
+        // We don't integrate things with zero mass.
+        if (im[i] <= 0.0f) continue;
+
+        // Work out the acceleration from the force
+        Vector3 resultingAcc = a[i];
+        resultingAcc.addScaledVector(f[i], im[i]);
+
+        // Update linear velocity from the acceleration.
+        v[i].addScaledVector(resultingAcc, duration);
+
+        // Impose drag.
+        v[i] *= cache.getFactor(d[i], duration);
+
+        // Update linear position.
+        p[i].addScaledVector(v[i], duration);
+
+        // Clear the forces.
+        f[i].clear();
+    }
+}
+
+Vector3* ParticleStore::getPositions()
+{
+    return position.empty() ? 0 : &position[0];
+}
+
+const Vector3* ParticleStore::getPositions() const
+{
+    return position.empty() ? 0 : &position[0];
+}
+
+Vector3* ParticleStore::getVelocities()
+{
+    return velocity.empty() ? 0 : &velocity[0];
+}
+
+const Vector3* ParticleStore::getVelocities() const
+{
+    return velocity.empty() ? 0 : &velocity[0];
+}
+
+Vector3* ParticleStore::getAccelerations()
+{
+    return acceleration.empty() ? 0 : &acceleration[0];
+}
+
+const Vector3* ParticleStore::getAccelerations() const
+{
+    return acceleration.empty() ? 0 : &acceleration[0];
+}
+
+Vector3* ParticleStore::getForceAccumulators()
+{
+    return forceAccum.empty() ? 0 : &forceAccum[0];
+}
+
+const Vector3* ParticleStore::getForceAccumulators() const
+{
+    return forceAccum.empty() ? 0 : &forceAccum[0];
+}
+
+real* ParticleStore::getInverseMasses()
+{
+    return inverseMass.empty() ? 0 : &inverseMass[0];
+}
+
+const real* ParticleStore::getInverseMasses() const
+{
+    return inverseMass.empty() ? 0 : &inverseMass[0];
+}
+
+real* ParticleStore::getDampings()
+{
+    return damping.empty() ? 0 : &damping[0];
+}
+
+const real* ParticleStore::getDampings() const
+{
+    return damping.empty() ? 0 : &damping[0];
+}
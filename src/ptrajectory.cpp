@@ -0,0 +1,491 @@
+/*
+ * Implementation file for the particle trajectory recorder.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <cyclone/ptrajectory.h>
+#include <cyclone/particle.h>
+#include <cyclone/pstore.h>
+#include <cyclone/pworld.h>
+
+using namespace cyclone;
+
+
+namespace {
+    const char trajectoryMagic[8] = { 'C', 'Y', 'C', 'T', 'R', 'A', 'J', 0 };
+    const unsigned trajectoryVersion = 1;
+    const unsigned chunkMagic = 0x4d415246; // "FRAM"
+    const unsigned fileVelocities = 1;
+
+    /**
+     * Writes a signed value as a variable length integer: zigzag
+     * encoded so small negative values are short too, then seven
+     * bits to a byte, lowest first. Takes at most ten bytes.
+     */
+    unsigned char* putValue(unsigned char* out, long long value)
+    {
+        unsigned long long bits = ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+        while (bits >= 0x80)
+        {
+            *out++ = (unsigned char)(bits | 0x80);
+            bits >>= 7;
+        }
+        *out++ = (unsigned char)bits;
+        return out;
+    }
+
+    /**
+     * Holds the furthest from zero a quantized value can be, small
+     * enough that the difference of any two fits in a long long.
+     */
+    const double quantizeLimit = 2305843009213693952.0; // 2^61
+
+    /**
+     * Rounds to the nearest integer, halves away from zero. Values
+     * past the limit are clamped to it, and values that aren't
+     * numbers give zero.
+     */
+    long long quantize(double value)
+    {
+        if (!(value == value)) return 0;
+        if (value > quantizeLimit) value = quantizeLimit;
+        else if (value < -quantizeLimit) value = -quantizeLimit;
+        return value >= 0 ? (long long)(value + 0.5) : -(long long)(0.5 - value);
+    }
+
+    /**
+     * Reads a value written by putValue, returning false if it runs
+     * past the end of the data.
+     */
+    bool getValue(const unsigned char* &data, const unsigned char* end, long long* value)
+    {
+        unsigned long long bits = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (data == end) return false;
+            unsigned char byte = *data++;
+            bits |= (unsigned long long)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                *value = (long long)(bits >> 1) ^ -(long long)(bits & 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Copies vectors from a view into a contiguous array.
+     */
+    void gather(Vector3* out, const Vector3* in, size_t stride, unsigned count)
+    {
+        if (stride == sizeof(Vector3))
+        {
+            memcpy(out, in, count * sizeof(Vector3));
+            return;
+        }
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+        for (unsigned i = 0; i < count; i++)
+        {
+            out[i] = *reinterpret_cast<const Vector3*>(bytes + i * stride);
+        }
+    }
+
+    /**
+     * Copies the vectors in the given slots of a strided array,
+     * leaving zero for any slot past the end of the array.
+     */
+    void gather(Vector3* out, const Vector3* in, size_t stride,
+        const unsigned* slots, unsigned count, unsigned limit)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (slots[i] < limit) out[i] = *reinterpret_cast<const Vector3*>(bytes + slots[i] * stride);
+            else out[i].clear();
+        }
+    }
+}
+
+TrajectoryView TrajectoryView::of(const ParticleStore &store)
+{
+    TrajectoryView view;
+    view.position = store.getPositions();
+    view.velocity = store.getVelocities();
+    view.stride = sizeof(Vector3);
+    view.count = store.size();
+    return view;
+}
+
+TrajectoryView TrajectoryView::of(const Particle* particles, unsigned count)
+{
+    TrajectoryView view;
+    view.position = &particles->position;
+    view.velocity = &particles->velocity;
+    view.stride = sizeof(Particle);
+    view.count = count;
+    return view;
+}
+
+TrajectoryRecorder::TrajectoryRecorder(unsigned maxParticles, unsigned ringFrames)
+    :
+    ring(ringFrames > 0 ? ringFrames : 1),
+    recorded(0),
+    written(0),
+    maxParticles(maxParticles),
+    reorderCount(0),
+    positionQuantum((real)0.0001),
+    velocityQuantum((real)0.001),
+    keyFrameInterval(60),
+    velocities(true),
+    file(0),
+    closing(false),
+    bytesWritten(0),
+    stalls(0),
+    failed(false)
+{
+    for (unsigned i = 0; i < ring.size(); i++)
+    {
+        ring[i].position.resize(maxParticles);
+        ring[i].velocity.resize(maxParticles);
+        ring[i].count = 0;
+        ring[i].time = 0;
+    }
+    previous.reserve(maxParticles * 6);
+
+    // The most a chunk can take: ten bytes for each value.
+    buffer.resize(sizeof(TrajectoryChunkHeader) + maxParticles * 6 * 10);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    close();
+}
+
+void TrajectoryRecorder::setQuantization(real positionQuantum, real velocityQuantum)
+{
+    assert(!file && positionQuantum > 0 && velocityQuantum > 0);
+    TrajectoryRecorder::positionQuantum = positionQuantum;
+    TrajectoryRecorder::velocityQuantum = velocityQuantum;
+}
+
+void TrajectoryRecorder::setKeyFrameInterval(unsigned keyFrameInterval)
+{
+    assert(!file);
+    TrajectoryRecorder::keyFrameInterval = keyFrameInterval > 0 ? keyFrameInterval : 1;
+}
+
+bool TrajectoryRecorder::open(const char* filename, bool velocities)
+{
+    close();
+
+    file = fopen(filename, "wb");
+    if (!file) return false;
+
+    TrajectoryRecorder::velocities = velocities;
+    recorded = 0;
+    written = 0;
+    bytesWritten = 0;
+    stalls = 0;
+    failed = false;
+    closing = false;
+    previous.clear();
+    slots.clear();
+
+    TrajectoryFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, trajectoryMagic, sizeof(trajectoryMagic));
+    header.version = trajectoryVersion;
+    header.flags = velocities ? fileVelocities : 0;
+    header.positionQuantum = positionQuantum;
+    header.velocityQuantum = velocityQuantum;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) failed = true;
+    bytesWritten = sizeof(header);
+
+    writer = std::thread(&TrajectoryRecorder::writeFrames, this);
+    return true;
+}
+
+void TrajectoryRecorder::recordFrame(const TrajectoryView &view, double time)
+{
+    if (!file) return;
+
+    // Wait for the writer to free a frame of the ring.
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (recorded - written == ring.size())
+        {
+            stalls++;
+            spaceReady.wait(lock, [this] { return recorded - written < ring.size(); });
+        }
+    }
+
+    // The frame is ours until it is counted as recorded.
+    Frame &frame = ring[recorded % ring.size()];
+    frame.count = view.count < maxParticles ? view.count : maxParticles;
+    frame.time = time;
+    if (frame.count > 0 && slots.empty())
+    {
+        gather(&frame.position[0], view.position, view.stride, frame.count);
+        if (velocities) gather(&frame.velocity[0], view.velocity, view.stride, frame.count);
+    }
+    else if (frame.count > 0)
+    {
+        gather(&frame.position[0], view.position, view.stride, &slots[0], frame.count, view.count);
+        if (velocities)
+        {
+            gather(&frame.velocity[0], view.velocity, view.stride, &slots[0], frame.count, view.count);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        recorded++;
+    }
+    frameReady.notify_one();
+}
+
+void TrajectoryRecorder::recordFrame(ParticleWorld &world, double time)
+{
+    // The first frame takes the particles as they are.
+    unsigned count = world.getReorderCount();
+    if (recorded > 0 && count == reorderCount + 1) remapParticles(world.getLastReorder());
+    reorderCount = count;
+
+    recordFrame(TrajectoryView::of(world.getParticles(), world.getParticleCount()), time);
+}
+
+void TrajectoryRecorder::remapParticles(const ParticleRemap &remap)
+{
+    // Start each particle off in its own slot.
+    unsigned size = (unsigned)slots.size();
+    unsigned needed = maxParticles > remap.getCount() ? maxParticles : remap.getCount();
+    if (size < needed)
+    {
+        slots.resize(needed);
+        for (unsigned i = size; i < needed; i++) slots[i] = i;
+    }
+
+    for (unsigned i = 0; i < slots.size(); i++)
+    {
+        if (slots[i] < remap.getCount()) slots[i] = remap.remap(slots[i]);
+    }
+}
+
+void TrajectoryRecorder::writeFrames()
+{
+    for (;;)
+    {
+        unsigned long long index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameReady.wait(lock, [this] { return written < recorded || closing; });
+            if (written == recorded) return;
+            index = written;
+        }
+
+        size_t size = writeFrame(ring[index % ring.size()], index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (size == 0) failed = true;
+            bytesWritten += size;
+            written++;
+        }
+        spaceReady.notify_one();
+    }
+}
+
+size_t TrajectoryRecorder::writeFrame(const Frame &frame, unsigned long long index)
+{
+    const unsigned components = velocities ? 6 : 3;
+    const unsigned values = frame.count * components;
+
+    // A frame is a key frame at the interval, or if the particles
+    // have changed.
+    bool keyFrame = index % keyFrameInterval == 0 || previous.size() != values;
+    if (keyFrame) previous.assign(values, 0);
+
+    TrajectoryChunkHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = chunkMagic;
+    header.flags = (keyFrame ? TrajectoryChunkHeader::KEY_FRAME : 0) |
+        (velocities ? TrajectoryChunkHeader::VELOCITIES : 0);
+    header.frame = index;
+    header.time = frame.time;
+    header.particleCount = frame.count;
+
+    unsigned char* out = &buffer[sizeof(header)];
+    const double positionScale = 1.0 / positionQuantum;
+    const double velocityScale = 1.0 / velocityQuantum;
+    for (unsigned i = 0; i < frame.count; i++)
+    {
+        long long* last = &previous[i * components];
+        const Vector3 &position = frame.position[i];
+        long long quantized[6] = {
+            quantize(position.x * positionScale),
+            quantize(position.y * positionScale),
+            quantize(position.z * positionScale)
+        };
+        if (velocities)
+        {
+            const Vector3 &velocity = frame.velocity[i];
+            quantized[3] = quantize(velocity.x * velocityScale);
+            quantized[4] = quantize(velocity.y * velocityScale);
+            quantized[5] = quantize(velocity.z * velocityScale);
+        }
+
+        for (unsigned c = 0; c < components; c++)
+        {
+            out = putValue(out, quantized[c] - last[c]);
+            last[c] = quantized[c];
+        }
+    }
+
+    size_t size = out - &buffer[0];
+    header.payloadSize = (unsigned)(size - sizeof(header));
+    memcpy(&buffer[0], &header, sizeof(header));
+    return fwrite(&buffer[0], 1, size, file) == size ? size : 0;
+}
+
+void TrajectoryRecorder::close()
+{
+    if (!file) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    frameReady.notify_one();
+    writer.join();
+
+    if (fclose(file) != 0) failed = true;
+    file = 0;
+}
+
+bool TrajectoryRecorder::isOpen() const
+{
+    return file != 0;
+}
+
+unsigned long long TrajectoryRecorder::getFrameCount() const
+{
+    return recorded;
+}
+
+unsigned long long TrajectoryRecorder::getBytesWritten()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesWritten;
+}
+
+unsigned TrajectoryRecorder::getStallCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stalls;
+}
+
+bool TrajectoryRecorder::hasFailed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+TrajectoryReader::TrajectoryReader()
+    : file(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close();
+}
+
+bool TrajectoryReader::open(const char* filename)
+{
+    close();
+
+    file = fopen(filename, "rb");
+    if (!file) return false;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, trajectoryMagic, sizeof(trajectoryMagic)) != 0 ||
+        header.version != trajectoryVersion ||
+        header.positionQuantum <= 0 || header.velocityQuantum <= 0)
+    {
+        close();
+        return false;
+    }
+
+    previous.clear();
+    return true;
+}
+
+void TrajectoryReader::close()
+{
+    if (file) fclose(file);
+    file = 0;
+}
+
+const TrajectoryFileHeader& TrajectoryReader::getHeader() const
+{
+    return header;
+}
+
+bool TrajectoryReader::readFrame(std::vector<Vector3>* positions, std::vector<Vector3>* velocities,
+    double* time, unsigned long long* frame)
+{
+    if (!file) return false;
+
+    TrajectoryChunkHeader chunk;
+    if (fread(&chunk, sizeof(chunk), 1, file) != 1 || chunk.magic != chunkMagic) return false;
+
+    buffer.resize(chunk.payloadSize);
+    if (chunk.payloadSize && fread(&buffer[0], 1, chunk.payloadSize, file) != chunk.payloadSize)
+    {
+        return false;
+    }
+
+    const bool hasVelocities = (chunk.flags & TrajectoryChunkHeader::VELOCITIES) != 0;
+    const unsigned components = hasVelocities ? 6 : 3;
+    const unsigned values = chunk.particleCount * components;
+    if (chunk.flags & TrajectoryChunkHeader::KEY_FRAME) previous.assign(values, 0);
+    else if (previous.size() != values) return false;
+
+    const unsigned char* data = buffer.empty() ? 0 : &buffer[0];
+    const unsigned char* end = data + buffer.size();
+    for (unsigned v = 0; v < values; v++)
+    {
+        long long delta;
+        if (!getValue(data, end, &delta)) return false;
+        previous[v] += delta;
+    }
+
+    positions->resize(chunk.particleCount);
+    if (velocities) velocities->resize(hasVelocities ? chunk.particleCount : 0);
+    for (unsigned i = 0; i < chunk.particleCount; i++)
+    {
+        const long long* value = &previous[i * components];
+        (*positions)[i] = Vector3(
+            (real)(value[0] * header.positionQuantum),
+            (real)(value[1] * header.positionQuantum),
+            (real)(value[2] * header.positionQuantum));
+        if (velocities && hasVelocities)
+        {
+            (*velocities)[i] = Vector3(
+                (real)(value[3] * header.velocityQuantum),
+                (real)(value[4] * header.velocityQuantum),
+                (real)(value[5] * header.velocityQuantum));
+        }
+    }
+
+    if (time) *time = chunk.time;
+    if (frame) *frame = chunk.frame;
+    return true;
+}
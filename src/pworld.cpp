@@ -0,0 +1,838 @@
+/*
+ * Implementation file for the particle world.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/pworld.h>
+#include <cyclone/jobs.h>
+#include <cyclone/plinksolver.h>
+#include <cyclone/pislands.h>
+#include <cyclone/pcache.h>
+#include <cyclone/pregion.h>
+#include <cyclone/pmultirate.h>
+#include <cyclone/pintegrator.h>
+#include <cyclone/profile.h>
+#include <cyclone/preorder.h>
+
+using namespace cyclone;
+
+
+namespace {
+    /**
+     * Holds what the contact generation jobs need to know.
+     */
+    struct GenerateJobData
+    {
+        ParticleContactGenerator* const* generators;
+        std::vector<ParticleContact>* buffers;
+        unsigned* bufferUsed;
+        unsigned* worker;
+        unsigned* begin;
+        unsigned* count;
+        JobSystem* jobs;
+    };
+
+    /**
+     * Runs a range of the generators into the calling worker's
+     * buffer, growing it whenever a generator fills it.
+     */
+    void generateJob(void* data, unsigned begin, unsigned end)
+    {
+        GenerateJobData &job = *static_cast<GenerateJobData*>(data);
+        unsigned w = job.jobs ? job.jobs->getCurrentWorker() : 0;
+        std::vector<ParticleContact> &buffer = job.buffers[w];
+        unsigned used = job.bufferUsed[w];
+
+        for (unsigned g = begin; g < end; g++)
+        {
+            unsigned generated;
+            for (;;)
+            {
+                if (used == buffer.size()) buffer.resize(buffer.size() * 2);
+                unsigned room = (unsigned)buffer.size() - used;
+                generated = job.generators[g]->addContact(&buffer[used], room);
+                if (generated < room) break;
+
+                // The generator may have had more to give.
+                buffer.resize(buffer.size() * 2);
+            }
+
+            job.worker[g] = w;
+            job.begin[g] = used;
+            job.count[g] = generated;
+            used += generated;
+        }
+        job.bufferUsed[w] = used;
+    }
+
+    /**
+     * Holds what the merge jobs need to know.
+     */
+    struct MergeJobData
+    {
+        std::vector<ParticleContact>* buffers;
+        const unsigned* worker;
+        const unsigned* begin;
+        const unsigned* count;
+        const unsigned* offset;
+        ParticleContact* contacts;
+        unsigned maxContacts;
+    };
+
+    /**
+     * Copies a range of the generators' kept contacts to their place
+     * in the contact array, dropping those beyond its end.
+     */
+    void mergeJob(void* data, unsigned begin, unsigned end)
+    {
+        MergeJobData &job = *static_cast<MergeJobData*>(data);
+        for (unsigned g = begin; g < end; g++)
+        {
+            unsigned offset = job.offset[g];
+            if (offset >= job.maxContacts) break;
+
+            unsigned count = job.count[g];
+            if (count > job.maxContacts - offset) count = job.maxContacts - offset;
+            const ParticleContact* source = &job.buffers[job.worker[g]][job.begin[g]];
+            std::copy(source, source + count, job.contacts + offset);
+        }
+    }
+}
+
+
+ParticleWorld::ParticleWorld(unsigned maxParticles, unsigned maxContacts, unsigned iterations)
+    :
+    particleCount(0),
+    maxParticles(maxParticles),
+    resolver(iterations),
+    maxContacts(maxContacts),
+    contactsUsed(0),
+    timestep((real)1.0/(real)60.0),
+    accumulator(0),
+    maxSteps(8),
+    jobs(0),
+    linkSolver(0),
+    islandResolver(0),
+    contactCache(0),
+    regionForces(0),
+    multiRate(0),
+    integrator(0),
+    profiler(0),
+    reorderInterval(0),
+    stepsSinceReorder(0),
+    reorderCount(0),
+    parallelContacts(false),
+    deterministic(false),
+    contactsDropped(0),
+    contactOverflow(false),
+    sweptContacts(false)
+{
+    particles = new Particle[maxParticles];
+    contacts = new ParticleContact[maxContacts];
+    calculateIterations = (iterations == 0);
+    freeParticles.reserve(maxParticles);
+    removed.assign(maxParticles, false);
+}
+
+ParticleWorld::~ParticleWorld()
+{
+    delete[] contacts;
+    delete[] particles;
+}
+
+Particle* ParticleWorld::addParticle()
+{
+    // Reuse the slot of a removed particle if there is one.
+    Particle* particle;
+    if (!freeParticles.empty())
+    {
+        particle = particles + freeParticles.back();
+        freeParticles.pop_back();
+    }
+    else if (particleCount < maxParticles)
+    {
+        particle = particles + particleCount++;
+    }
+    else return 0;
+
+    removed[particle - particles] = false;
+    particle->setPosition(0, 0, 0);
+    particle->setVelocity(0, 0, 0);
+    particle->setAcceleration(0, 0, 0);
+    particle->setInverseMass(1);
+    particle->setDamping(1);
+    particle->clearAccumulator();
+    particle->setCanSleep(false);
+    particle->setAwake();
+    if (multiRate) multiRate->resetParticle((unsigned)(particle - particles));
+    return particle;
+}
+
+void ParticleWorld::removeParticle(Particle* particle)
+{
+    assert(particle >= particles && particle < particles + particleCount);
+
+    unsigned index = (unsigned)(particle - particles);
+    if (removed[index]) return;
+    removed[index] = true;
+
+    registry.removeAllFor(particle);
+
+    // Leave the slot where nothing will move it.
+    particle->setVelocity(0, 0, 0);
+    particle->setAcceleration(0, 0, 0);
+    particle->setInverseMass(0);
+    particle->clearAccumulator();
+    particle->setAwake(false);
+
+    freeParticles.push_back(index);
+}
+
+void ParticleWorld::clear()
+{
+    particleCount = 0;
+    freeParticles.clear();
+    removed.assign(maxParticles, false);
+    for (unsigned i = 0; i < contactsUsed; i++) contacts[i].timeOfImpact = 1;
+    contactsUsed = 0;
+    accumulator = 0;
+    registry.clear();
+    contactGenerators.clear();
+    if (multiRate) multiRate->reset();
+}
+
+Particle* ParticleWorld::getParticles()
+{
+    return particles;
+}
+
+unsigned ParticleWorld::getParticleCount() const
+{
+    return particleCount;
+}
+
+unsigned ParticleWorld::getLiveParticleCount() const
+{
+    return particleCount - (unsigned)freeParticles.size();
+}
+
+unsigned ParticleWorld::getAwakeCount() const
+{
+    unsigned awake = 0;
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        if (particles[i].getAwake()) awake++;
+    }
+    return awake;
+}
+
+unsigned ParticleWorld::getMaxParticles() const
+{
+    return maxParticles;
+}
+
+ParticleForceRegistry& ParticleWorld::getForceRegistry()
+{
+    return registry;
+}
+
+ParticleWorld::ContactGenerators& ParticleWorld::getContactGenerators()
+{
+    return contactGenerators;
+}
+
+ParticleContactResolver& ParticleWorld::getContactResolver()
+{
+    return resolver;
+}
+
+ParticleContact* ParticleWorld::getContacts()
+{
+    return contacts;
+}
+
+unsigned ParticleWorld::getContactCount() const
+{
+    return contactsUsed;
+}
+
+bool ParticleWorld::getContactOverflow() const
+{
+    return contactOverflow;
+}
+
+unsigned ParticleWorld::getContactsDropped() const
+{
+    return contactsDropped;
+}
+
+unsigned ParticleWorld::getIterationsUsed() const
+{
+    if (contactsUsed == 0) return 0;
+    if (islandResolver) return islandResolver->getIterationsUsed();
+    return resolver.getIterationsUsed();
+}
+
+FrameArena& ParticleWorld::getFrameArena()
+{
+    return frameArena;
+}
+
+void ParticleWorld::setTimestep(real timestep)
+{
+    assert(timestep > 0);
+    ParticleWorld::timestep = timestep;
+}
+
+real ParticleWorld::getTimestep() const
+{
+    return timestep;
+}
+
+void ParticleWorld::setMaxSteps(unsigned maxSteps)
+{
+    assert(maxSteps > 0);
+    ParticleWorld::maxSteps = maxSteps;
+}
+
+unsigned ParticleWorld::getMaxSteps() const
+{
+    return maxSteps;
+}
+
+real ParticleWorld::getInterpolationAlpha() const
+{
+    return accumulator / timestep;
+}
+
+void ParticleWorld::setJobSystem(JobSystem* jobs)
+{
+    ParticleWorld::jobs = jobs;
+}
+
+JobSystem* ParticleWorld::getJobSystem() const
+{
+    return jobs;
+}
+
+void ParticleWorld::setParallelContactGeneration(bool parallel)
+{
+    parallelContacts = parallel;
+}
+
+void ParticleWorld::setDeterministic(bool deterministic)
+{
+    ParticleWorld::deterministic = deterministic;
+}
+
+bool ParticleWorld::isDeterministic() const
+{
+    return deterministic;
+}
+
+void ParticleWorld::setLinkSolver(ParticleLinkSolver* linkSolver)
+{
+    ParticleWorld::linkSolver = linkSolver;
+}
+
+void ParticleWorld::setIslandResolver(ParticleIslandResolver* islandResolver)
+{
+    if (ParticleWorld::islandResolver) ParticleWorld::islandResolver->setFrameArena(0);
+    ParticleWorld::islandResolver = islandResolver;
+    if (islandResolver) islandResolver->setFrameArena(&frameArena);
+}
+
+void ParticleWorld::setContactCache(ParticleContactCache* contactCache)
+{
+    ParticleWorld::contactCache = contactCache;
+}
+
+void ParticleWorld::setRegionForces(ParticleRegionForces* regionForces)
+{
+    ParticleWorld::regionForces = regionForces;
+}
+
+void ParticleWorld::setMultiRateIntegrator(ParticleMultiRateIntegrator* multiRate)
+{
+    ParticleWorld::multiRate = multiRate;
+    if (multiRate) multiRate->reset();
+}
+
+void ParticleWorld::setIntegrator(ParticleIntegrator* integrator)
+{
+    ParticleWorld::integrator = integrator;
+}
+
+void ParticleWorld::setProfiler(Profiler* profiler)
+{
+    ParticleWorld::profiler = profiler;
+}
+
+void ParticleWorld::setReorderInterval(unsigned steps)
+{
+    reorderInterval = steps;
+    stepsSinceReorder = 0;
+}
+
+unsigned ParticleWorld::getReorderInterval() const
+{
+    return reorderInterval;
+}
+
+void ParticleWorld::reorderParticles(std::vector<unsigned>* newIndex)
+{
+    stepsSinceReorder = 0;
+    if (particleCount == 0) return;
+
+    // Removed particles sort after every live one.
+    const unsigned last = ~0u;
+    std::pair<unsigned, unsigned>* reorderKeys =
+        frameArena.allocateArray<std::pair<unsigned, unsigned> >(particleCount);
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        reorderKeys[i].first = removed[i] ? last : 0;
+    }
+
+    // Quantise positions within the bounds of the live particles,
+    // the same scale on every axis so cells stay cubes.
+    Vector3 min, max;
+    bool first = true;
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        if (removed[i]) continue;
+
+        Vector3 position = particles[i].getPosition();
+        if (first)
+        {
+            min = max = position;
+            first = false;
+            continue;
+        }
+        if (position.x < min.x) min.x = position.x;
+        if (position.y < min.y) min.y = position.y;
+        if (position.z < min.z) min.z = position.z;
+        if (position.x > max.x) max.x = position.x;
+        if (position.y > max.y) max.y = position.y;
+        if (position.z > max.z) max.z = position.z;
+    }
+    real extent = max.x - min.x;
+    if (max.y - min.y > extent) extent = max.y - min.y;
+    if (max.z - min.z > extent) extent = max.z - min.z;
+    real scale = extent > 0 ? (real)1023 / extent : 0;
+
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        reorderKeys[i].second = i;
+        if (removed[i]) continue;
+
+        Vector3 q = particles[i].getPosition() - min;
+        reorderKeys[i].first = mortonCode(
+            (unsigned)(q.x * scale), (unsigned)(q.y * scale), (unsigned)(q.z * scale));
+    }
+    std::sort(reorderKeys, reorderKeys + particleCount);
+
+    // Move the particles.
+    reorderCount++;
+    reorderIndex.resize(particleCount);
+    Particle* reorderCopy = frameArena.allocateArray<Particle>(particleCount);
+    std::copy(particles, particles + particleCount, reorderCopy);
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        unsigned old = reorderKeys[i].second;
+        particles[i] = reorderCopy[old];
+        reorderIndex[old] = i;
+    }
+
+    // The removed slots are now the last ones.
+    unsigned live = particleCount - (unsigned)freeParticles.size();
+    freeParticles.clear();
+    for (unsigned i = particleCount; i > live; i--) freeParticles.push_back(i - 1);
+    for (unsigned i = 0; i < particleCount; i++) removed[i] = (i >= live);
+
+    // Tell everything that holds particles where they have gone.
+    ParticleRemap remap(particles, particleCount, &reorderIndex[0]);
+    registry.remapParticles(remap);
+    if (regionForces) regionForces->remapParticles(remap);
+    if (linkSolver) linkSolver->remapParticles(remap);
+    if (contactCache) contactCache->remapParticles(remap);
+    if (multiRate) multiRate->remapParticles(remap);
+    for (unsigned i = 0; i < contactsUsed; i++)
+    {
+        contacts[i].particle[0] = remap.remap(contacts[i].particle[0]);
+        contacts[i].particle[1] = remap.remap(contacts[i].particle[1]);
+    }
+
+    reorderGenerators = contactGenerators;
+    std::sort(reorderGenerators.begin(), reorderGenerators.end());
+    reorderGenerators.erase(
+        std::unique(reorderGenerators.begin(), reorderGenerators.end()),
+        reorderGenerators.end());
+    for (unsigned i = 0; i < reorderGenerators.size(); i++)
+    {
+        reorderGenerators[i]->remapParticles(remap);
+    }
+
+    if (newIndex) newIndex->assign(reorderIndex.begin(), reorderIndex.end());
+}
+
+unsigned ParticleWorld::getReorderCount() const
+{
+    return reorderCount;
+}
+
+ParticleRemap ParticleWorld::getLastReorder() const
+{
+    if (reorderIndex.empty()) return ParticleRemap(particles, 0, 0);
+    return ParticleRemap(particles, (unsigned)reorderIndex.size(), &reorderIndex[0]);
+}
+
+void ParticleWorld::startFrame()
+{
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        // Remove all forces from the accumulator
+        particles[i].clearAccumulator();
+    }
+}
+
+unsigned ParticleWorld::generateContacts()
+{
+    contactsDropped = 0;
+    contactOverflow = false;
+    sweptContacts = false;
+    if (parallelContacts) return generateBufferedContacts();
+
+    unsigned limit = maxContacts;
+    ParticleContact *nextContact = contacts;
+
+    // Generators that don't test for impacts during the step leave
+    // the time of impact alone, so every slot they might be given
+    // must be at the end of the step. Slots beyond last step's
+    // contacts already are.
+    for (unsigned i = 0; i < contactsUsed; i++) contacts[i].timeOfImpact = 1;
+
+    for (ContactGenerators::iterator g = contactGenerators.begin();
+        g != contactGenerators.end();
+        g++)
+    {
+        // We've run out of contacts to fill. This means we're
+        // missing contacts.
+        if (limit == 0)
+        {
+            contactOverflow = true;
+            break;
+        }
+
+        unsigned generated = (*g)->addContact(nextContact, limit);
+        if (generated == limit) contactOverflow = true;
+
+        // Moving particles wake the sleeping particles they touch.
+        // Contacts left with nothing that can move are dropped.
+        unsigned used = 0;
+        for (unsigned i = 0; i < generated; i++)
+        {
+            ParticleContact &contact = nextContact[i];
+            contact.matchAwakeState();
+            if (contact.isStill()) continue;
+
+            contact.source = *g;
+            contact.accumulatedImpulse = 0;
+            if (contact.timeOfImpact < 1) sweptContacts = true;
+            if (used != i) nextContact[used] = contact;
+            used++;
+        }
+
+        // Slots given up go back to the end of the step too.
+        for (unsigned i = used; i < generated; i++)
+        {
+            nextContact[i].timeOfImpact = 1;
+        }
+        limit -= used;
+        nextContact += used;
+    }
+
+    // Return the number of contacts used.
+    return maxContacts - limit;
+}
+
+unsigned ParticleWorld::generateBufferedContacts()
+{
+    const unsigned generatorCount = (unsigned)contactGenerators.size();
+    if (generatorCount == 0) return 0;
+
+    // Give each worker a buffer, and put last step's slots back at
+    // the end of the step for generators that don't set the time of
+    // impact.
+    unsigned workers = jobs ? jobs->getWorkerCount() : 1;
+    if (contactBuffers.size() < workers)
+    {
+        unsigned size = maxContacts / workers;
+        if (size < 64) size = 64;
+        contactBuffers.resize(workers, std::vector<ParticleContact>(size));
+        contactBufferUsed.resize(workers, 0);
+    }
+    for (unsigned w = 0; w < contactBuffers.size(); w++)
+    {
+        for (unsigned i = 0; i < contactBufferUsed[w]; i++)
+        {
+            contactBuffers[w][i].timeOfImpact = 1;
+        }
+        contactBufferUsed[w] = 0;
+    }
+
+    // For each generator: the buffer its contacts went into, where
+    // they start, how many there are (and then how many were kept),
+    // and where they go in the contact array.
+    unsigned* generatedWorker = frameArena.allocateArray<unsigned>(generatorCount);
+    unsigned* generatedBegin = frameArena.allocateArray<unsigned>(generatorCount);
+    unsigned* generatedCount = frameArena.allocateArray<unsigned>(generatorCount);
+    unsigned* generatedOffset = frameArena.allocateArray<unsigned>(generatorCount);
+
+    GenerateJobData generate;
+    generate.generators = &contactGenerators[0];
+    generate.buffers = &contactBuffers[0];
+    generate.bufferUsed = &contactBufferUsed[0];
+    generate.worker = generatedWorker;
+    generate.begin = generatedBegin;
+    generate.count = generatedCount;
+    generate.jobs = jobs;
+    if (jobs) jobs->parallelFor(generatorCount, 0, generateJob, &generate);
+    else generateJob(&generate, 0, generatorCount);
+
+    // Waking particles must happen in the generators' order, so the
+    // contacts are filtered on this thread. Each generator's kept
+    // contacts are packed to the front of its range, and a running
+    // total gives where they go in the contact array.
+    unsigned total = 0;
+    for (unsigned g = 0; g < generatorCount; g++)
+    {
+        ParticleContact* generated = &contactBuffers[generatedWorker[g]][generatedBegin[g]];
+        unsigned used = 0;
+        for (unsigned i = 0; i < generatedCount[g]; i++)
+        {
+            ParticleContact &contact = generated[i];
+            contact.matchAwakeState();
+            if (contact.isStill()) continue;
+
+            contact.source = contactGenerators[g];
+            contact.accumulatedImpulse = 0;
+            if (contact.timeOfImpact < 1) sweptContacts = true;
+            if (used != i) generated[used] = contact;
+            used++;
+        }
+        generatedCount[g] = used;
+        generatedOffset[g] = total;
+        total += used;
+    }
+
+    if (total > maxContacts)
+    {
+        contactsDropped = total - maxContacts;
+        contactOverflow = true;
+        total = maxContacts;
+    }
+
+    // Then copy them into place.
+    MergeJobData merge;
+    merge.buffers = &contactBuffers[0];
+    merge.worker = generatedWorker;
+    merge.begin = generatedBegin;
+    merge.count = generatedCount;
+    merge.offset = generatedOffset;
+    merge.contacts = contacts;
+    merge.maxContacts = maxContacts;
+    if (jobs) jobs->parallelFor(generatorCount, 0, mergeJob, &merge);
+    else mergeJob(&merge, 0, generatorCount);
+
+    return total;
+}
+
+void ParticleWorld::rewindToImpact(real duration)
+{
+    // Find the earliest impact of each moving particle.
+    real* impact = frameArena.allocateArray<real>(particleCount);
+    for (unsigned i = 0; i < particleCount; i++) impact[i] = 1;
+    for (unsigned i = 0; i < contactsUsed; i++)
+    {
+        const ParticleContact &contact = contacts[i];
+        if (contact.timeOfImpact >= 1) continue;
+
+        for (unsigned j = 0; j < 2; j++)
+        {
+            Particle* particle = contact.particle[j];
+            if (!particle || particle < particles ||
+                particle >= particles + particleCount) continue;
+            if (particle->getInverseMass() <= 0) continue;
+
+            unsigned index = (unsigned)(particle - particles);
+            if (contact.timeOfImpact < impact[index]) impact[index] = contact.timeOfImpact;
+        }
+    }
+
+    // Move those particles back.
+    Vector3* moved = frameArena.allocateArray<Vector3>(particleCount);
+    for (unsigned i = 0; i < particleCount; i++)
+    {
+        if (impact[i] >= 1) continue;
+
+        moved[i] = particles[i].getVelocity() * (-(1 - impact[i]) * duration);
+        particles[i].setPosition(particles[i].getPosition() + moved[i]);
+    }
+
+    // Then correct the penetration of every contact they are in.
+    for (unsigned i = 0; i < contactsUsed; i++)
+    {
+        ParticleContact &contact = contacts[i];
+        for (unsigned j = 0; j < 2; j++)
+        {
+            Particle* particle = contact.particle[j];
+            if (!particle || particle < particles ||
+                particle >= particles + particleCount) continue;
+
+            const Vector3 &move = moved[particle - particles];
+            if (j == 0) contact.penetration -= move * contact.contactNormal;
+            else contact.penetration += move * contact.contactNormal;
+        }
+    }
+}
+
+void ParticleWorld::applyForces(real duration)
+{
+    if (jobs) registry.updateForces(duration, *jobs);
+    else registry.updateForces(duration);
+    if (regionForces) regionForces->updateForces(duration);
+}
+
+void ParticleWorld::integrate(real duration)
+{
+    assert(!(integrator && multiRate));
+    if (integrator) integrator->integrate(*this, duration);
+    else if (multiRate) multiRate->integrate(particles, particleCount, duration, jobs);
+    else integrateParticles(particles, particleCount, duration, jobs);
+}
+
+void ParticleWorld::step(real duration)
+{
+    CYCLONE_PROFILE_FRAME(profiler);
+
+    // Last step's scratch memory is no longer needed.
+    frameArena.reset();
+
+    // A deterministic world has its loops split the same way for
+    // any number of workers, for this step only.
+    bool fixedSplit = false;
+    if (jobs && deterministic)
+    {
+        fixedSplit = jobs->isDeterministic();
+        jobs->setDeterministic(true);
+    }
+
+    // Put the particles back into spatial order if it's time.
+    if (reorderInterval && ++stepsSinceReorder >= reorderInterval)
+    {
+        reorderParticles();
+    }
+
+    // Let the contact generators see where the particles start.
+    for (ContactGenerators::iterator g = contactGenerators.begin();
+        g != contactGenerators.end();
+        g++)
+    {
+        (*g)->beginStep();
+    }
+
+    // First apply the force generators
+    {
+        CYCLONE_PROFILE_SCOPE(profiler, PROFILE_FORCES);
+        applyForces(duration);
+    }
+
+    // Then integrate the objects
+    {
+        CYCLONE_PROFILE_SCOPE(profiler, PROFILE_INTEGRATION);
+        integrate(duration);
+    }
+
+    // Pull the links back into shape
+    if (linkSolver)
+    {
+        CYCLONE_PROFILE_SCOPE(profiler, PROFILE_LINKS);
+        linkSolver->solve(duration, jobs);
+    }
+
+    // Generate contacts
+    {
+        CYCLONE_PROFILE_SCOPE(profiler, PROFILE_CONTACT_GENERATION);
+        contactsUsed = generateContacts();
+        if (sweptContacts) rewindToImpact(duration);
+    }
+
+    {
+        CYCLONE_PROFILE_SCOPE(profiler, PROFILE_RESOLUTION);
+
+        // Start from last step's impulses
+        if (contactCache) contactCache->warmStart(contacts, contactsUsed);
+
+        // And process them
+        if (contactsUsed && islandResolver)
+        {
+            islandResolver->resolveContacts(contacts, contactsUsed, duration, jobs);
+        }
+        else if (contactsUsed)
+        {
+            if (calculateIterations) resolver.setIterations(contactsUsed * 2);
+            resolver.resolveContacts(contacts, contactsUsed, duration);
+        }
+
+        if (contactCache) contactCache->store(contacts, contactsUsed);
+
+        // Contacts may have woken slow particles or changed their
+        // velocity part way through their step.
+        if (multiRate)
+        {
+            for (unsigned i = 0; i < contactsUsed; i++)
+            {
+                for (unsigned j = 0; j < 2; j++)
+                {
+                    Particle* particle = contacts[i].particle[j];
+                    if (!particle || particle < particles ||
+                        particle >= particles + particleCount) continue;
+                    multiRate->disturbParticle((unsigned)(particle - particles));
+                }
+            }
+        }
+    }
+
+    CYCLONE_PROFILE_COUNTER(profiler, PROFILE_CONTACTS, contactsUsed);
+    CYCLONE_PROFILE_COUNTER(profiler, PROFILE_ITERATIONS, getIterationsUsed());
+    CYCLONE_PROFILE_COUNTER(profiler, PROFILE_CACHED_CONTACTS,
+        contactCache ? contactCache->getMatchedCount() : 0);
+    CYCLONE_PROFILE_COUNTER(profiler, PROFILE_AWAKE_PARTICLES, getAwakeCount());
+
+    if (jobs && deterministic) jobs->setDeterministic(fixedSplit);
+}
+
+unsigned ParticleWorld::runPhysics(real duration)
+{
+    accumulator += duration;
+
+    unsigned steps = 0;
+    while (accumulator >= timestep && steps < maxSteps)
+    {
+        step(timestep);
+        accumulator -= timestep;
+        steps++;
+    }
+
+    // If we couldn't keep up, drop the time we didn't simulate so
+    // the backlog doesn't keep growing.
+    if (accumulator >= timestep)
+    {
+        accumulator = real_fmod(accumulator, timestep);
+    }
+
+    return steps;
+}
@@ -0,0 +1,276 @@
+/*
+ * Implementation file for running a particle world on its own thread.
+ *
+ * Part of the Cyclone physics system.
+ */
+
+#include <chrono>
+#include <cyclone/pworldthread.h>
+#include <cyclone/pworld.h>
+
+using namespace cyclone;
+
+
+namespace {
+    unsigned long long clockNow()
+    {
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+ParticleStateBuffer::ParticleStateBuffer(unsigned maxParticles)
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        states[i].position.resize(maxParticles);
+        states[i].velocity.resize(maxParticles);
+        states[i].previousPosition.resize(maxParticles);
+    }
+    reset();
+}
+
+void ParticleStateBuffer::reset()
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        states[i].count = 0;
+        states[i].previousCount = 0;
+        states[i].step = 0;
+        states[i].reorderCount = 0;
+        states[i].time = 0;
+        states[i].previousTime = 0;
+    }
+
+    writing = 0;
+    reading = 1;
+    middle.store(2);
+}
+
+ParticleState& ParticleStateBuffer::getWriteState()
+{
+    return states[writing];
+}
+
+void ParticleStateBuffer::publish()
+{
+    // Hand over the finished state and take whichever one the reader
+    // left between us.
+    writing = middle.exchange(writing | FRESH, std::memory_order_acq_rel) & 3;
+}
+
+bool ParticleStateBuffer::update()
+{
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+
+    // Hand back the state we were reading and take the newest one.
+    reading = middle.exchange(reading, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+const ParticleState& ParticleStateBuffer::getLatest() const
+{
+    return states[reading];
+}
+
+ParticleWorldThread::ParticleWorldThread(ParticleWorld &world)
+: world(world), buffer(world.getMaxParticles()), timestep(0),
+  callback(0), callbackData(0), stopping(false),
+  startTime(0), steps(0), droppedSteps(0), previousReorderCount(0)
+{
+}
+
+ParticleWorldThread::~ParticleWorldThread()
+{
+    stop();
+}
+
+void ParticleWorldThread::setStepCallback(StepCallback callback, void* data)
+{
+    ParticleWorldThread::callback = callback;
+    callbackData = data;
+}
+
+void ParticleWorldThread::start()
+{
+    if (thread.joinable()) return;
+
+    stopping.store(false);
+    steps.store(0);
+    droppedSteps.store(0);
+    timestep = world.getTimestep();
+
+    buffer.reset();
+    recordPrevious(0);
+    publish(0, 0);
+
+    startTime = clockNow();
+    thread = std::thread(&ParticleWorldThread::run, this);
+}
+
+void ParticleWorldThread::stop()
+{
+    if (!thread.joinable()) return;
+
+    stopping.store(true);
+    thread.join();
+}
+
+bool ParticleWorldThread::isRunning() const
+{
+    return thread.joinable();
+}
+
+double ParticleWorldThread::getTime() const
+{
+    return (clockNow() - startTime) * 1e-9;
+}
+
+unsigned long long ParticleWorldThread::getStepCount() const
+{
+    return steps.load();
+}
+
+unsigned long long ParticleWorldThread::getDroppedStepCount() const
+{
+    return droppedSteps.load();
+}
+
+ParticleStateBuffer& ParticleWorldThread::getBuffer()
+{
+    return buffer;
+}
+
+void ParticleWorldThread::recordPrevious(double time)
+{
+    ParticleState &state = buffer.getWriteState();
+
+    const Particle* particles = world.getParticles();
+    unsigned count = world.getParticleCount();
+    for (unsigned i = 0; i < count; i++)
+    {
+        state.previousPosition[i] = particles[i].getPosition();
+    }
+    state.previousCount = count;
+    state.previousTime = time;
+    previousReorderCount = world.getReorderCount();
+}
+
+void ParticleWorldThread::publish(unsigned long long step, double time)
+{
+    ParticleState &state = buffer.getWriteState();
+
+    // A step reorders at most once, before it moves anything.
+    if (world.getReorderCount() != previousReorderCount)
+    {
+        ParticleRemap remap = world.getLastReorder();
+        unsigned moved = state.previousCount < remap.getCount() ?
+            state.previousCount : remap.getCount();
+        reorderScratch.assign(state.previousPosition.begin(),
+            state.previousPosition.begin() + moved);
+        for (unsigned i = 0; i < moved; i++)
+        {
+            state.previousPosition[remap.remap(i)] = reorderScratch[i];
+        }
+    }
+
+    const Particle* particles = world.getParticles();
+    unsigned count = world.getParticleCount();
+    for (unsigned i = 0; i < count; i++)
+    {
+        state.position[i] = particles[i].getPosition();
+        state.velocity[i] = particles[i].getVelocity();
+    }
+    state.count = count;
+    state.step = step;
+    state.reorderCount = world.getReorderCount();
+    state.time = time;
+
+    buffer.publish();
+}
+
+void ParticleWorldThread::run()
+{
+    const unsigned long long stepLength = (unsigned long long)(timestep * 1e9);
+    const unsigned maxSteps = world.getMaxSteps();
+
+    // Steps are due at fixed times from the start, whether or not
+    // they were simulated, so dropping steps doesn't make the clock
+    // drift.
+    unsigned long long taken = 0;
+    unsigned long long dropped = 0;
+    unsigned long long next = startTime + stepLength;
+
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        unsigned long long now = clockNow();
+        if (now < next)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+            continue;
+        }
+
+        unsigned long long due = (now - next) / stepLength + 1;
+        if (due > maxSteps)
+        {
+            dropped += due - maxSteps;
+            next += (due - maxSteps) * stepLength;
+            due = maxSteps;
+            droppedSteps.store(dropped);
+        }
+
+        for (unsigned long long i = 0; i < due; i++)
+        {
+            // Only the last two steps of a batch are published.
+            if (i + 1 == due)
+            {
+                recordPrevious((taken + dropped + i) * (double)timestep);
+            }
+
+            if (callback) callback(world, callbackData);
+            world.step(timestep);
+            next += stepLength;
+        }
+        taken += due;
+
+        publish(taken, (taken + dropped) * (double)timestep);
+        steps.store(taken);
+    }
+}
+
+unsigned ParticleWorldThread::interpolate(double time, Vector3* positions, unsigned max)
+{
+    buffer.update();
+
+    const ParticleState &state = buffer.getLatest();
+
+    unsigned count = state.count < max ? state.count : max;
+    unsigned blended = state.previousCount < count ? state.previousCount : count;
+
+    real alpha = 1;
+    if (state.time > state.previousTime)
+    {
+        double t = (time - state.previousTime) / (state.time - state.previousTime);
+        if (t < 0) t = 0;
+        else if (t > 1) t = 1;
+        alpha = (real)t;
+    }
+
+    for (unsigned i = 0; i < blended; i++)
+    {
+        const Vector3 &from = state.previousPosition[i];
+        positions[i] = from + (state.position[i] - from) * alpha;
+    }
+
+    // Particles added in the last step have nothing to blend from.
+    for (unsigned i = blended; i < count; i++)
+    {
+        positions[i] = state.position[i];
+    }
+    return count;
+}
+
+unsigned ParticleWorldThread::interpolate(Vector3* positions, unsigned max)
+{
+    return interpolate(getTime() - timestep, positions, max);
+}
@@ -12,10 +12,74 @@
 
 #include <cstdlib>
 #include <ctime>
+#include <cstring>
 #include <cyclone/random.h>
 
 using namespace cyclone;
 
+namespace {
+    /**
+     * The number of values the fill methods make at a time.
+     */
+    const unsigned batchSize = 256;
+
+    /**
+     * Turns a random bitstring into a floating point number between
+     * 0 and 1. This works by fixing the ieee sign and exponent bits
+     * (so that the size of the result is 1-2) and using the bits to
+     * create the fraction part of the float.
+     */
+#ifdef SINGLE_PRECISION
+    inline real bitsToReal(unsigned bits)
+    {
+        // Set up a reinterpret structure for manipulation
+        union {
+            real value;
+            unsigned word;
+        } convert;
+
+        convert.word = (bits >> 9) | 0x3f800000;
+        return convert.value - 1.0f;
+    }
+#else
+    inline real bitsToReal(unsigned bits)
+    {
+        // Set up a reinterpret structure for manipulation
+        union {
+            real value;
+            unsigned words[2];
+        } convert;
+
+        // Note that bits are used more than once in this process.
+        convert.words[0] =  bits << 20; // Fill in the top 16 bits
+        convert.words[1] = (bits >> 12) | 0x3FF00000; // And the bottom 20
+        return convert.value - 1.0;
+    }
+#endif
+
+    inline unsigned rotate(unsigned n, unsigned r)
+    {
+        return (n << r) | (n >> (32 - r));
+    }
+
+    /**
+     * Extends a run of the generator's output. The first 17 entries
+     * of the sequence hold the generator's last 17 values, oldest
+     * first; the next count entries are filled in. Without the wrap
+     * around of the buffer there are no branches, and as each value
+     * depends only on values at least ten places back, the processor
+     * can work on several at once.
+     */
+    void extendSequence(unsigned* sequence, unsigned count)
+    {
+        const unsigned end = 17 + count;
+        for (unsigned i = 17; i < end; i++)
+        {
+            sequence[i] = rotate(sequence[i - 10], 13) + rotate(sequence[i - 17], 9);
+        }
+    }
+}
+
 Random::Random()
 {
     seed(0);
@@ -26,6 +90,11 @@ Random::Random(unsigned seed)
     Random::seed(seed);
 }
 
+Random::Random(unsigned seed, unsigned stream)
+{
+    Random::seed(seed, stream);
+}
+
 void Random::seed(unsigned s)
 {
     if (s == 0) {
@@ -44,6 +113,44 @@ void Random::seed(unsigned s)
     p1 = 0;  p2 = 10;
 }
 
+void Random::seed(unsigned s, unsigned stream)
+{
+    if (stream == 0)
+    {
+        seed(s);
+        return;
+    }
+
+    if (s == 0) {
+        s = (unsigned)clock();
+    }
+    seedFromKey(((unsigned long long)s << 32) | stream);
+}
+
+void Random::seedFromKey(unsigned long long key)
+{
+    for (unsigned i = 0; i < 17; i++)
+    {
+        key += 0x9E3779B97F4A7C15ull;
+        unsigned long long z = key;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        buffer[i] = (unsigned)((z ^ (z >> 31)) >> 32);
+    }
+
+    p1 = 0;  p2 = 10;
+}
+
+Random Random::split()
+{
+    unsigned long long key = randomBits();
+    key = (key << 32) | randomBits();
+
+    Random stream(1);
+    stream.seedFromKey(key);
+    return stream;
+}
+
 unsigned Random::rotl(unsigned n, unsigned r)
 {
 	  return	(n << r) |
@@ -71,49 +178,10 @@ unsigned Random::randomBits()
     return result;
 }
 
-#ifdef SINGLE_PRECISION
 real Random::randomReal()
 {
-    // Get the random number
-    unsigned bits = randomBits();
-
-    // Set up a reinterpret structure for manipulation
-    union {
-        real value;
-        unsigned word;
-    } convert;
-
-    // Now assign the bits to the word. This works by fixing the ieee
-    // sign and exponent bits (so that the size of the result is 1-2)
-    // and using the bits to create the fraction part of the float.
-    convert.word = (bits >> 9) | 0x3f800000;
-
-    // And return the value
-    return convert.value - 1.0f;
+    return bitsToReal(randomBits());
 }
-#else
-real Random::randomReal()
-{
-    // Get the random number
-    unsigned bits = randomBits();
-
-    // Set up a reinterpret structure for manipulation
-    union {
-        real value;
-        unsigned words[2];
-    } convert;
-
-    // Now assign the bits to the words. This works by fixing the ieee
-    // sign and exponent bits (so that the size of the result is 1-2)
-    // and using the bits to create the fraction part of the float. Note
-    // that bits are used more than once in this process.
-    convert.words[0] =  bits << 20; // Fill in the top 16 bits
-    convert.words[1] = (bits >> 12) | 0x3FF00000; // And the bottom 20
-
-    // And return the value
-    return convert.value - 1.0;
-}
-#endif
 
 real Random::randomReal(real min, real max)
 {
@@ -135,18 +203,6 @@ real Random::randomBinomial(real scale)
     return (randomReal()-randomReal())*scale;
 }
 
-Quaternion Random::randomQuaternion()
-{
-    Quaternion q(
-        randomReal(),
-        randomReal(),
-        randomReal(),
-        randomReal()
-        );
-    q.normalise();
-    return q;
-}
-
 Vector3 Random::randomVector(real scale)
 {
     return Vector3(
@@ -182,3 +238,82 @@ Vector3 Random::randomVector(const Vector3 &min, const Vector3 &max)
         randomReal(min.z, max.z)
         );
 }
+
+void Random::fillBits(unsigned* out, unsigned count)
+{
+    // The generator makes x[n] = rotl(x[n-10], 13) + rotl(x[n-17], 9),
+    // with buffer[p1 + k] holding x[n-k]. Lay its state out as a
+    // sequence, oldest first, and extend that in batches.
+    unsigned sequence[17 + batchSize];
+    for (unsigned k = 0; k < 17; k++) sequence[k] = buffer[(p1 + 17 - k) % 17];
+
+    while (count > 0)
+    {
+        unsigned n = count < batchSize ? count : batchSize;
+        extendSequence(sequence, n);
+        memcpy(out, sequence + 17, n * sizeof(unsigned));
+        memmove(sequence, sequence + n, 17 * sizeof(unsigned));
+        out += n;
+        count -= n;
+    }
+
+    // Put the state back where the single value methods expect it.
+    for (unsigned k = 0; k < 17; k++) buffer[(p1 + 17 - k) % 17] = sequence[k];
+}
+
+void Random::fillReal(real* out, unsigned count)
+{
+    fillReal(out, count, 0, 1);
+}
+
+void Random::fillReal(real* out, unsigned count, real min, real max)
+{
+    unsigned bits[batchSize];
+    real scale = max - min;
+    while (count > 0)
+    {
+        unsigned n = count < batchSize ? count : batchSize;
+        fillBits(bits, n);
+        for (unsigned i = 0; i < n; i++) out[i] = bitsToReal(bits[i]) * scale + min;
+        out += n;
+        count -= n;
+    }
+}
+
+void Random::fillVectors(Vector3* out, unsigned count, real scale)
+{
+    // Six values for each vector: a difference of two per component.
+    const unsigned perBatch = batchSize / 6;
+    real values[perBatch * 6];
+    while (count > 0)
+    {
+        unsigned n = count < perBatch ? count : perBatch;
+        fillReal(values, n * 6);
+        for (unsigned i = 0; i < n; i++)
+        {
+            const real* v = values + i * 6;
+            out[i] = Vector3((v[0] - v[1]) * scale, (v[2] - v[3]) * scale, (v[4] - v[5]) * scale);
+        }
+        out += n;
+        count -= n;
+    }
+}
+
+void Random::fillVectors(Vector3* out, unsigned count, const Vector3 &min, const Vector3 &max)
+{
+    const unsigned perBatch = batchSize / 3;
+    real values[perBatch * 3];
+    Vector3 size = max - min;
+    while (count > 0)
+    {
+        unsigned n = count < perBatch ? count : perBatch;
+        fillReal(values, n * 3);
+        for (unsigned i = 0; i < n; i++)
+        {
+            const real* v = values + i * 3;
+            out[i] = Vector3(v[0] * size.x + min.x, v[1] * size.y + min.y, v[2] * size.z + min.z);
+        }
+        out += n;
+        count -= n;
+    }
+}